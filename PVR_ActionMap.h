@@ -0,0 +1,528 @@
+/************************************************************************************
+
+Filename    :   PVR_ActionMap.h
+Content     :   Declarative mapping of controller input to game actions.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_ActionMap_h
+#define PVR_ActionMap_h
+
+#include "PVR_API.h"
+#include "PVR_InputPoller.h"
+#include "PVR_Math.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** ActionCondition
+
+enum ActionHand
+{
+    ActionHand_Left  = pvrHand_Left,
+    ActionHand_Right = pvrHand_Right,
+    ActionHand_Any,
+};
+
+enum ActionConditionType
+{
+    ActionCondition_Button,     // Any bit of Mask pressed.
+    ActionCondition_Touch,      // Any bit of Mask touched.
+    ActionCondition_AxisAbove,  // Axis >= Threshold.
+    ActionCondition_AxisBelow,  // Axis <= Threshold.
+};
+
+struct ActionCondition
+{
+    ActionConditionType Type;
+    ActionHand          Hand;
+    uint32_t            Mask;
+    InputAxis           Axis;
+    float               Threshold;
+
+    static ActionCondition Button(ActionHand hand, uint32_t mask)   { return Make(ActionCondition_Button, hand, mask, InputAxis_Count, 0.0f); }
+    static ActionCondition Touch(ActionHand hand, uint32_t mask)    { return Make(ActionCondition_Touch, hand, mask, InputAxis_Count, 0.0f); }
+    static ActionCondition Above(ActionHand hand, InputAxis axis, float threshold) { return Make(ActionCondition_AxisAbove, hand, 0, axis, threshold); }
+    static ActionCondition Below(ActionHand hand, InputAxis axis, float threshold) { return Make(ActionCondition_AxisBelow, hand, 0, axis, threshold); }
+
+    bool operator==(const ActionCondition& other) const
+    {
+        return Type == other.Type && Hand == other.Hand && Mask == other.Mask && Axis == other.Axis &&
+               Threshold == other.Threshold;
+    }
+
+private:
+    static ActionCondition Make(ActionConditionType type, ActionHand hand, uint32_t mask, InputAxis axis, float threshold)
+    {
+        const ActionCondition result = { type, hand, mask, axis, threshold };
+        return result;
+    }
+};
+
+// Conditions that must all hold at once, e.g. a chord of grip and A. At most
+// MaxConditions per binding; ActionMap rejects longer ones.
+struct ActionBinding
+{
+    enum { MaxConditions = 4 };
+
+    std::vector<ActionCondition> Conditions;
+
+    ActionBinding() { }
+    ActionBinding(const ActionCondition& condition) { Conditions.push_back(condition); }
+
+    ActionBinding& And(const ActionCondition& condition)
+    {
+        Conditions.push_back(condition);
+        return *this;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** ActionState
+//
+// Result of ActionMap::Evaluate() for one snapshot, with edges relative to the previous
+// snapshot evaluated into the same state.
+
+class ActionState
+{
+public:
+    bool IsActive(int action) const     { return Test(Current, action); }
+    bool WasPressed(int action) const   { return Test(Current, action) && !Test(Previous, action); }
+    bool WasReleased(int action) const  { return !Test(Current, action) && Test(Previous, action); }
+
+    void Reset()
+    {
+        std::fill(Current.begin(), Current.end(), 0u);
+        std::fill(Previous.begin(), Previous.end(), 0u);
+    }
+
+private:
+    friend class ActionMap;
+
+    static bool Test(const std::vector<uint32_t>& bits, int action)
+    {
+        const size_t word = size_t(action) / 32;
+        return word < bits.size() && ((bits[word] >> (action & 31)) & 1u) != 0;
+    }
+
+    std::vector<uint32_t> Current;
+    std::vector<uint32_t> Previous;
+    std::vector<uint8_t>  Conditions;   // Scratch.
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** ActionMap
+//
+// Actions are ORs of bindings, and bindings ANDs of conditions on one pvrInputState.
+// They are declared in code or in a small text syntax, then compiled once into flat
+// tables: every distinct condition is evaluated exactly once per snapshot into a byte,
+// with button conditions as a mask test and axis conditions as one compare (sign folded
+// into the operands for "below"). Each binding becomes a term of four condition indices,
+// padded with an always true condition, whose AND sets its action's bit. The per
+// snapshot cost is a few loads per condition and term, with no branches on the kind of
+// input or the shape of the bindings.
+//
+// Text syntax, case insensitive:
+//     expression := binding ('|' binding)*
+//     binding    := condition ('&' condition)*
+//     condition  := hand '.' button ['.touch'] | hand '.' axis ('>' | '<') number
+//     hand       := left | right | any
+//     button     := system | menu | trigger | grip | touchpad | joystick | a | b | x | y |
+//                   index | middle | ring | pinky
+//     axis       := trigger | grip | touchpad.x | touchpad.y | joystick.x | joystick.y |
+//                   gripforce | touchpadforce | index | middle | ring | pinky
+// '>' means at or above and '<' at or below.
+//
+// Example usage:
+//     ActionMap actions;
+//     const int jump = actions.AddAction("jump", "right.a | right.trigger > 0.8");
+//     const int teleport = actions.AddAction("teleport", "any.joystick.y > 0.7 & any.joystick.touch");
+//     actions.Compile();
+//     ...
+//     actions.Evaluate(inputState, &state);
+//     if (state.WasPressed(jump))
+//         Jump();
+
+class ActionMap
+{
+public:
+    ActionMap() : Compiled(false) { }
+
+    // Adds an action without bindings. Returns its index.
+    int AddAction(const char* name)
+    {
+        Action action;
+        action.Name = name ? name : "";
+        Actions.push_back(action);
+        Compiled = false;
+        return int(Actions.size()) - 1;
+    }
+
+    // Adds an action from a text expression. Returns its index, or -1 on a syntax error.
+    int AddAction(const char* name, const char* expression)
+    {
+        std::vector<ActionBinding> bindings;
+        if (!Parse(expression, &bindings))
+            return -1;
+        const int index = AddAction(name);
+        Actions[index].Bindings = bindings;
+        return index;
+    }
+
+    // Returns false, adding nothing, if the binding has more than MaxConditions conditions.
+    bool AddBinding(int action, const ActionBinding& binding)
+    {
+        PVR_MATH_ASSERT(action >= 0 && action < int(Actions.size()));
+        if (binding.Conditions.size() > ActionBinding::MaxConditions)
+            return false;
+        Actions[action].Bindings.push_back(binding);
+        Compiled = false;
+        return true;
+    }
+
+    int FindAction(const char* name) const
+    {
+        for (size_t i = 0; i < Actions.size(); i++)
+            if (Actions[i].Name == name)
+                return int(i);
+        return -1;
+    }
+
+    int GetActionCount() const { return int(Actions.size()); }
+
+    const char* GetActionName(int action) const { return Actions[action].Name.c_str(); }
+
+    // Condition indices are 16 bits, one of which is the padding condition.
+    enum { MaxDistinctConditions = 65535 };
+
+    // Builds the evaluation tables. Must be called after adding actions or bindings.
+    // Returns false, leaving the map uncompiled, if the bindings use more than
+    // MaxDistinctConditions distinct conditions. Bindings with more than MaxConditions
+    // conditions are skipped.
+    bool Compile()
+    {
+        ButtonConditions.clear();
+        AxisConditions.clear();
+        Terms.clear();
+        Compiled = false;
+
+        // Distinct conditions; index 0 is always true and pads short bindings.
+        std::vector<ActionCondition> distinct(1, ActionCondition::Button(ActionHand_Any, 0));
+        for (size_t a = 0; a < Actions.size(); a++)
+        {
+            const std::vector<ActionBinding>& bindings = Actions[a].Bindings;
+            for (size_t b = 0; b < bindings.size(); b++)
+            {
+                const std::vector<ActionCondition>& conditions = bindings[b].Conditions;
+                if (conditions.empty() || conditions.size() > ActionBinding::MaxConditions)
+                    continue;
+                Term term = { { 0, 0, 0, 0 }, uint32_t(a) };
+                for (size_t c = 0; c < conditions.size(); c++)
+                {
+                    const size_t index = Intern(conditions[c], &distinct);
+                    if (index > MaxDistinctConditions)
+                    {
+                        Terms.clear();
+                        return false;
+                    }
+                    term.Conditions[c] = uint16_t(index);
+                }
+                Terms.push_back(term);
+            }
+        }
+
+        // Button conditions first, then axis ones, so indices match evaluation order.
+        std::vector<uint16_t> remap(distinct.size());
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t i = 0; i < distinct.size(); i++)
+            {
+                const ActionCondition& condition = distinct[i];
+                const bool isAxis = condition.Type == ActionCondition_AxisAbove || condition.Type == ActionCondition_AxisBelow;
+                if (isAxis != (pass == 1))
+                    continue;
+                remap[i] = uint16_t(ButtonConditions.size() + AxisConditions.size());
+                if (i == 0)
+                {
+                    const ButtonTest always = { AlwaysSource, 1 };
+                    ButtonConditions.push_back(always);
+                }
+                else if (!isAxis)
+                {
+                    const ButtonTest test = { uint32_t((condition.Type == ActionCondition_Touch ? 3 : 0) + condition.Hand),
+                                              condition.Mask };
+                    ButtonConditions.push_back(test);
+                }
+                else
+                {
+                    // Values are laid out as left, right, max, min per axis; "any" reads
+                    // the max for "above" and the min for "below".
+                    const bool below = condition.Type == ActionCondition_AxisBelow;
+                    uint32_t slot = condition.Hand;
+                    if (condition.Hand == ActionHand_Any)
+                        slot = below ? 3 : 2;
+                    const float sign = below ? -1.0f : 1.0f;
+                    const AxisTest test = { uint32_t(condition.Axis) * 4 + slot, sign, sign * condition.Threshold };
+                    AxisConditions.push_back(test);
+                }
+            }
+        }
+        for (size_t t = 0; t < Terms.size(); t++)
+            for (int c = 0; c < ActionBinding::MaxConditions; c++)
+                Terms[t].Conditions[c] = remap[Terms[t].Conditions[c]];
+        Compiled = true;
+        return true;
+    }
+
+    bool IsCompiled() const { return Compiled; }
+
+    void Evaluate(const pvrInputState& input, ActionState* state) const
+    {
+        PVR_MATH_ASSERT(Compiled);
+        const size_t words = (Actions.size() + 31) / 32;
+        state->Current.resize(words, 0u);
+        state->Previous.resize(words, 0u);
+        state->Current.swap(state->Previous);
+        std::vector<uint8_t>& conditions = state->Conditions;
+        conditions.resize(ButtonConditions.size() + AxisConditions.size());
+
+        const uint32_t masks[AlwaysSource + 1] =
+        {
+            input.HandButtons[0], input.HandButtons[1], input.HandButtons[0] | input.HandButtons[1],
+            input.HandTouches[0], input.HandTouches[1], input.HandTouches[0] | input.HandTouches[1],
+            1u,
+        };
+        float values[InputAxis_Count * 4];
+        for (int axis = 0; axis < InputAxis_Count; axis++)
+        {
+            const float left = GetInputAxis(input, 0, InputAxis(axis));
+            const float right = GetInputAxis(input, 1, InputAxis(axis));
+            values[axis * 4 + 0] = left;
+            values[axis * 4 + 1] = right;
+            values[axis * 4 + 2] = PVRMath_Max(left, right);
+            values[axis * 4 + 3] = PVRMath_Min(left, right);
+        }
+
+        const size_t buttonCount = ButtonConditions.size();
+        for (size_t i = 0; i < buttonCount; i++)
+            conditions[i] = uint8_t((masks[ButtonConditions[i].Source] & ButtonConditions[i].Mask) != 0);
+        for (size_t i = 0; i < AxisConditions.size(); i++)
+        {
+            const AxisTest& test = AxisConditions[i];
+            conditions[buttonCount + i] = uint8_t(values[test.Value] * test.Sign >= test.Threshold);
+        }
+
+        // One pass over the terms; each sets the bit of its action when all its
+        // conditions hold. Terms are sorted by action, so bits are gathered in a register
+        // and stored once per word.
+        std::fill(state->Current.begin(), state->Current.end(), 0u);
+        uint32_t* current = state->Current.data();
+        const uint8_t* results = conditions.data();
+        uint32_t word = 0, wordIndex = 0;
+        for (size_t t = 0; t < Terms.size(); t++)
+        {
+            const Term& term = Terms[t];
+            if (term.Action / 32 != wordIndex)
+            {
+                current[wordIndex] = word;
+                word = 0;
+                wordIndex = term.Action / 32;
+            }
+            const uint32_t all = results[term.Conditions[0]] & results[term.Conditions[1]] &
+                                 results[term.Conditions[2]] & results[term.Conditions[3]];
+            word |= all << (term.Action & 31);
+        }
+        if (!Terms.empty())
+            current[wordIndex] = word;
+    }
+
+private:
+    struct Action
+    {
+        std::string                Name;
+        std::vector<ActionBinding> Bindings;
+    };
+
+    enum { AlwaysSource = 6 };
+
+    struct ButtonTest
+    {
+        uint32_t Source;    // Index into the masks of Evaluate().
+        uint32_t Mask;
+    };
+
+    struct AxisTest
+    {
+        uint32_t Value;     // Index into the values of Evaluate().
+        float    Sign;
+        float    Threshold; // Premultiplied by Sign.
+    };
+
+    struct Term
+    {
+        uint16_t Conditions[ActionBinding::MaxConditions];
+        uint32_t Action;
+    };
+
+    static size_t Intern(const ActionCondition& condition, std::vector<ActionCondition>* distinct)
+    {
+        for (size_t i = 0; i < distinct->size(); i++)
+            if ((*distinct)[i] == condition)
+                return i;
+        distinct->push_back(condition);
+        return distinct->size() - 1;
+    }
+
+    // Parser for the text syntax.
+
+    static void SkipSpaces(const char** p)
+    {
+        while (isspace((unsigned char)**p))
+            (*p)++;
+    }
+
+    static std::string ReadName(const char** p)
+    {
+        std::string name;
+        while (isalnum((unsigned char)**p))
+            name += char(tolower((unsigned char)*(*p)++));
+        return name;
+    }
+
+    static uint32_t ButtonMask(const std::string& name)
+    {
+        static const struct { const char* Name; uint32_t Mask; } buttons[] =
+        {
+            { "system", pvrButton_System }, { "menu", pvrButton_ApplicationMenu }, { "trigger", pvrButton_Trigger },
+            { "grip", pvrButton_Grip }, { "touchpad", pvrButton_TouchPad }, { "joystick", pvrButton_JoyStick },
+            { "a", pvrButton_A }, { "b", pvrButton_B }, { "x", pvrButton_X }, { "y", pvrButton_Y },
+            { "index", pvrButton_FingerIndex }, { "middle", pvrButton_FingerMiddle },
+            { "ring", pvrButton_FingerRing }, { "pinky", pvrButton_FingerPinky },
+        };
+        for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++)
+            if (name == buttons[i].Name)
+                return buttons[i].Mask;
+        return 0;
+    }
+
+    static bool AxisIndex(const std::string& name, InputAxis* axis)
+    {
+        static const char* const axes[InputAxis_Count] =
+        {
+            "trigger", "grip", "touchpad.x", "touchpad.y", "joystick.x", "joystick.y",
+            "gripforce", "touchpadforce", "index", "middle", "ring", "pinky",
+        };
+        for (int i = 0; i < InputAxis_Count; i++)
+        {
+            if (name == axes[i])
+            {
+                *axis = InputAxis(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool ParseCondition(const char** p, ActionCondition* out)
+    {
+        SkipSpaces(p);
+        const std::string hand = ReadName(p);
+        ActionHand actionHand;
+        if (hand == "left")
+            actionHand = ActionHand_Left;
+        else if (hand == "right")
+            actionHand = ActionHand_Right;
+        else if (hand == "any")
+            actionHand = ActionHand_Any;
+        else
+            return false;
+        if (*(*p)++ != '.')
+            return false;
+
+        // Dotted input name, e.g. joystick.y or a.touch.
+        std::string input = ReadName(p);
+        bool touch = false;
+        while (**p == '.')
+        {
+            (*p)++;
+            const std::string part = ReadName(p);
+            if (part == "touch")
+                touch = true;
+            else
+                input += "." + part;
+        }
+
+        SkipSpaces(p);
+        if (**p == '>' || **p == '<')
+        {
+            const bool above = (**p == '>');
+            (*p)++;
+            char* end = nullptr;
+            const float threshold = float(strtod(*p, &end));
+            InputAxis axis;
+            if (end == *p || touch || !AxisIndex(input, &axis))
+                return false;
+            *p = end;
+            *out = above ? ActionCondition::Above(actionHand, axis, threshold)
+                         : ActionCondition::Below(actionHand, axis, threshold);
+            return true;
+        }
+
+        const uint32_t mask = ButtonMask(input);
+        if (!mask)
+            return false;
+        *out = touch ? ActionCondition::Touch(actionHand, mask) : ActionCondition::Button(actionHand, mask);
+        return true;
+    }
+
+    static bool Parse(const char* expression, std::vector<ActionBinding>* out)
+    {
+        if (!expression)
+            return false;
+        const char* p = expression;
+        ActionBinding binding;
+        for (;;)
+        {
+            ActionCondition condition;
+            if (!ParseCondition(&p, &condition))
+                return false;
+            if (binding.Conditions.size() == ActionBinding::MaxConditions)
+                return false;
+            binding.And(condition);
+            SkipSpaces(&p);
+            if (*p == '&')
+            {
+                p++;
+                continue;
+            }
+            out->push_back(binding);
+            binding.Conditions.clear();
+            if (*p == '|')
+            {
+                p++;
+                continue;
+            }
+            return *p == '\0';
+        }
+    }
+
+    std::vector<Action>     Actions;
+    std::vector<ButtonTest> ButtonConditions;
+    std::vector<AxisTest>   AxisConditions;
+    std::vector<Term>       Terms;              // Grouped by action.
+    bool                    Compiled;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,259 @@
+/************************************************************************************
+
+Filename    :   PVR_Culling.h
+Content     :   Batched frustum culling of bounding boxes and spheres.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Culling_h
+#define PVR_Culling_h
+
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** BoundsSoA / SpheresSoA
+//
+// Non-owning views of bounding volumes stored one component per array.
+// Keeping the arrays contiguous lets the kernels below test 8 (AVX) or 4 (SSE2)
+// volumes per iteration with plain loads.
+
+struct BoundsSoA
+{
+    const float* MinX;
+    const float* MinY;
+    const float* MinZ;
+    const float* MaxX;
+    const float* MaxY;
+    const float* MaxZ;
+};
+
+struct SpheresSoA
+{
+    const float* X;
+    const float* Y;
+    const float* Z;
+    const float* Radius;
+};
+
+
+namespace CullingDetail {
+
+inline int PopCount8(uint8_t v)
+{
+    v = uint8_t(v - ((v >> 1) & 0x55));
+    v = uint8_t((v & 0x33) + ((v >> 2) & 0x33));
+    return (v + (v >> 4)) & 0x0F;
+}
+
+// Plane coefficients with the box corner furthest along the normal selected up front, since
+// the choice only depends on the signs of the normal.
+struct BoxPlane
+{
+    float Nx, Ny, Nz, D;
+    const float* Px;
+    const float* Py;
+    const float* Pz;
+};
+
+inline void SetupBoxPlanes(const Frustumf& frustum, const BoundsSoA& b, BoxPlane planes[Frustumf::Plane_Count])
+{
+    for (int p = 0; p < Frustumf::Plane_Count; p++)
+    {
+        const Planef& src = frustum.Planes[p];
+        planes[p].Nx = src.N.x;
+        planes[p].Ny = src.N.y;
+        planes[p].Nz = src.N.z;
+        planes[p].D  = src.D;
+        planes[p].Px = (src.N.x >= 0.0f) ? b.MaxX : b.MinX;
+        planes[p].Py = (src.N.y >= 0.0f) ? b.MaxY : b.MinY;
+        planes[p].Pz = (src.N.z >= 0.0f) ? b.MaxZ : b.MinZ;
+    }
+}
+
+inline bool TestBoxScalar(const BoxPlane planes[Frustumf::Plane_Count], int i)
+{
+    for (int p = 0; p < Frustumf::Plane_Count; p++)
+    {
+        const BoxPlane& pl = planes[p];
+        if (pl.Nx * pl.Px[i] + pl.Ny * pl.Py[i] + pl.Nz * pl.Pz[i] + pl.D < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+inline bool TestSphereScalar(const Frustumf& frustum, const SpheresSoA& s, int i)
+{
+    for (int p = 0; p < Frustumf::Plane_Count; p++)
+    {
+        const Planef& pl = frustum.Planes[p];
+        if (pl.N.x * s.X[i] + pl.N.y * s.Y[i] + pl.N.z * s.Z[i] + pl.D < -s.Radius[i])
+            return false;
+    }
+    return true;
+}
+
+} // namespace CullingDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** CullBounds
+//
+// Tests count axis aligned boxes against the frustum and writes one bit per box to
+// visibleBits (bit i % 8 of byte i / 8, set when the box may be visible), which must hold
+// (count + 7) / 8 bytes. Returns the number of visible boxes.
+//
+// With AVX one output byte is produced per iteration; iteration stops testing further
+// planes as soon as all 8 boxes are rejected.
+
+inline int CullBounds(const Frustumf& frustum, const BoundsSoA& bounds, int count, uint8_t* visibleBits)
+{
+    using namespace CullingDetail;
+    BoxPlane planes[Frustumf::Plane_Count];
+    SetupBoxPlanes(frustum, bounds, planes);
+
+    int visible = 0;
+    int i = 0;
+
+#if PVR_SIMD_AVX
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < Frustumf::Plane_Count; p++)
+        {
+            const BoxPlane& pl = planes[p];
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pl.Nx), _mm256_loadu_ps(pl.Px + i)),
+                                                   _mm256_mul_ps(_mm256_set1_ps(pl.Ny), _mm256_loadu_ps(pl.Py + i))),
+                                     _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pl.Nz), _mm256_loadu_ps(pl.Pz + i)),
+                                                   _mm256_set1_ps(pl.D)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0)
+                break;
+        }
+        const uint8_t bits = uint8_t(_mm256_movemask_ps(inside));
+        visibleBits[i >> 3] = bits;
+        visible += PopCount8(bits);
+    }
+#elif PVR_SIMD_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        int bits = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            const int j = i + half * 4;
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < Frustumf::Plane_Count; p++)
+            {
+                const BoxPlane& pl = planes[p];
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.Nx), _mm_loadu_ps(pl.Px + j)),
+                                                 _mm_mul_ps(_mm_set1_ps(pl.Ny), _mm_loadu_ps(pl.Py + j))),
+                                      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.Nz), _mm_loadu_ps(pl.Pz + j)),
+                                                 _mm_set1_ps(pl.D)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+                if (_mm_movemask_ps(inside) == 0)
+                    break;
+            }
+            bits |= _mm_movemask_ps(inside) << (half * 4);
+        }
+        visibleBits[i >> 3] = uint8_t(bits);
+        visible += PopCount8(uint8_t(bits));
+    }
+#endif
+
+    // Remaining boxes, also the complete path without SIMD.
+    for (; i < count; i += 8)
+    {
+        uint8_t bits = 0;
+        for (int j = i; j < i + 8 && j < count; j++)
+        {
+            if (TestBoxScalar(planes, j))
+                bits |= uint8_t(1 << (j - i));
+        }
+        visibleBits[i >> 3] = bits;
+        visible += PopCount8(bits);
+    }
+    return visible;
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** CullSpheres
+//
+// Sphere counterpart of CullBounds with the same output format.
+
+inline int CullSpheres(const Frustumf& frustum, const SpheresSoA& spheres, int count, uint8_t* visibleBits)
+{
+    using namespace CullingDetail;
+    int visible = 0;
+    int i = 0;
+
+#if PVR_SIMD_AVX
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(spheres.X + i);
+        const __m256 y = _mm256_loadu_ps(spheres.Y + i);
+        const __m256 z = _mm256_loadu_ps(spheres.Z + i);
+        const __m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(spheres.Radius + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < Frustumf::Plane_Count; p++)
+        {
+            const Planef& pl = frustum.Planes[p];
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pl.N.x), x),
+                                                   _mm256_mul_ps(_mm256_set1_ps(pl.N.y), y)),
+                                     _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pl.N.z), z),
+                                                   _mm256_set1_ps(pl.D)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+        }
+        const uint8_t bits = uint8_t(_mm256_movemask_ps(inside));
+        visibleBits[i >> 3] = bits;
+        visible += PopCount8(bits);
+    }
+#elif PVR_SIMD_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        int bits = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            const int j = i + half * 4;
+            const __m128 x = _mm_loadu_ps(spheres.X + j);
+            const __m128 y = _mm_loadu_ps(spheres.Y + j);
+            const __m128 z = _mm_loadu_ps(spheres.Z + j);
+            const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(spheres.Radius + j));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < Frustumf::Plane_Count; p++)
+            {
+                const Planef& pl = frustum.Planes[p];
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.N.x), x),
+                                                 _mm_mul_ps(_mm_set1_ps(pl.N.y), y)),
+                                      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.N.z), z),
+                                                 _mm_set1_ps(pl.D)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+            }
+            bits |= _mm_movemask_ps(inside) << (half * 4);
+        }
+        visibleBits[i >> 3] = uint8_t(bits);
+        visible += PopCount8(uint8_t(bits));
+    }
+#endif
+
+    for (; i < count; i += 8)
+    {
+        uint8_t bits = 0;
+        for (int j = i; j < i + 8 && j < count; j++)
+        {
+            if (TestSphereScalar(frustum, spheres, j))
+                bits |= uint8_t(1 << (j - i));
+        }
+        visibleBits[i >> 3] = bits;
+        visible += PopCount8(bits);
+    }
+    return visible;
+}
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,327 @@
+/************************************************************************************
+
+Filename    :   PVR_DeviceWatcher.h
+Content     :   Device connection, HMD status and battery change events.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_DeviceWatcher_h
+#define PVR_DeviceWatcher_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Threading.h"
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** DeviceEvent
+
+enum DeviceEventType
+{
+    DeviceEvent_Connected,          // Device bit set in getConnectedDevices.
+    DeviceEvent_Disconnected,
+    DeviceEvent_HmdStatusChanged,   // One or more HmdStatusFlag bits changed.
+    DeviceEvent_BatteryChanged,     // Battery percent or level of a connected device changed.
+    DeviceEvent_Count
+};
+
+// pvrHmdStatus as bits.
+enum HmdStatusFlag
+{
+    HmdStatus_Visible       = 0x01,
+    HmdStatus_Present       = 0x02,
+    HmdStatus_Mounted       = 0x04,
+    HmdStatus_DisplayLost   = 0x08,
+    HmdStatus_ServiceReady  = 0x10,
+    HmdStatus_ShouldQuit    = 0x20,
+    HmdStatus_HasInputFocus = 0x40,
+};
+
+inline uint32_t GetHmdStatusFlags(const pvrHmdStatus& status)
+{
+    return (status.IsVisible ? HmdStatus_Visible : 0) |
+           (status.HmdPresent ? HmdStatus_Present : 0) |
+           (status.HmdMounted ? HmdStatus_Mounted : 0) |
+           (status.DisplayLost ? HmdStatus_DisplayLost : 0) |
+           (status.ServiceReady ? HmdStatus_ServiceReady : 0) |
+           (status.ShouldQuit ? HmdStatus_ShouldQuit : 0) |
+           (status.HasInputFocus ? HmdStatus_HasInputFocus : 0);
+}
+
+struct DeviceEvent
+{
+    DeviceEventType      Type;
+    pvrTrackedDeviceType Device;            // Connection and battery events only.
+    uint32_t             HmdStatus;         // HmdStatusFlag bits after the change.
+    uint32_t             HmdStatusChanged;  // HmdStatusFlag bits that changed; status events only.
+    int                  BatteryPercent;    // 0-100, -1 if not supported; battery events only.
+    int                  BatteryLevel;      // pvrTrackedDeviceProp_BatteryLevel_int; battery events only.
+    double               TimeInSeconds;     // Runtime time of the poll that saw the change.
+};
+
+typedef std::function<void(const DeviceEvent& event)> DeviceEventCallback;
+
+// Everything the watcher diffs, as of one poll.
+struct DeviceWatcherState
+{
+    enum { MaxDevices = 32 };
+
+    uint32_t Connected;                 // pvrTrackedDeviceType bits.
+    uint32_t HmdStatus;                 // HmdStatusFlag bits.
+    uint32_t BatteryValid;              // Devices whose battery was read.
+    int      BatteryPercent[MaxDevices];
+    int      BatteryLevel[MaxDevices];
+
+    DeviceWatcherState() : Connected(0), HmdStatus(0), BatteryValid(0)
+    {
+        for (int i = 0; i < MaxDevices; i++)
+            BatteryPercent[i] = BatteryLevel[i] = -1;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** DeviceWatcher
+//
+// Polls getConnectedDevices and getHmdStatus on a background thread at a low rate, and
+// the battery properties of each connected device at a lower one (and once as soon as
+// it connects), and publishes what changed as DeviceEvents. The render thread then
+// neither polls nor diffs: it reacts to events, or reads the cached GetState().
+//
+// Callbacks run on the watcher thread, outside of any lock, in subscription order. The
+// first poll compares against an empty state, so subscribers that are registered before
+// Start() see a Connected event for every device and the initial HMD status. A callback
+// may Unsubscribe() itself, but it still receives the remaining events of the same poll:
+// a poll dispatches from the Dispatch copy of the subscriber list taken before its first
+// event. The removal takes effect from the next poll.
+//
+// Example usage:
+//     DeviceWatcher devices;
+//     devices.Subscribe((1 << DeviceEvent_HmdStatusChanged), [&](const DeviceEvent& event) {
+//         if (event.HmdStatusChanged & HmdStatus_Mounted)
+//             SetPaused(!(event.HmdStatus & HmdStatus_Mounted));
+//     });
+//     devices.Start(session);
+
+class DeviceWatcher
+{
+public:
+    DeviceWatcher() : Session(nullptr), BatteryInterval(0.0), LastBatteryTime(0.0), HasPolled(false), NextId(0)
+    { }
+
+    ~DeviceWatcher() { Stop(); }
+
+    // Polls connections and HMD status at rateHz, battery properties every batteryInterval
+    // seconds.
+    bool Start(pvrSessionHandle session, double rateHz = 10.0, double batteryInterval = 5.0)
+    {
+        if (!session || rateHz <= 0.0)
+            return false;
+        Session = session;
+        BatteryInterval = batteryInterval;
+        return Thread.Start([this]() { Poll(); }, 1.0 / rateHz);
+    }
+
+    void Stop() { Thread.Stop(); }
+
+    bool IsRunning() const { return Thread.IsRunning(); }
+
+    // Registers callback for the event types set in typeMask (bit per DeviceEventType).
+    // Returns an id for Unsubscribe().
+    int Subscribe(uint32_t typeMask, const DeviceEventCallback& callback)
+    {
+        std::lock_guard<std::mutex> lock(SubscriberLock);
+        const Subscriber subscriber = { NextId++, typeMask, callback };
+        Subscribers.push_back(subscriber);
+        return subscriber.Id;
+    }
+
+    void Unsubscribe(int id)
+    {
+        std::lock_guard<std::mutex> lock(SubscriberLock);
+        for (size_t i = 0; i < Subscribers.size(); i++)
+        {
+            if (Subscribers[i].Id == id)
+            {
+                Subscribers.erase(Subscribers.begin() + i);
+                return;
+            }
+        }
+    }
+
+    // State as of the last poll.
+    DeviceWatcherState GetState() const
+    {
+        std::lock_guard<std::mutex> lock(StateLock);
+        return State;
+    }
+
+    bool IsConnected(pvrTrackedDeviceType device) const
+    {
+        std::lock_guard<std::mutex> lock(StateLock);
+        return (State.Connected & uint32_t(device)) != 0;
+    }
+
+    uint32_t GetHmdStatus() const
+    {
+        std::lock_guard<std::mutex> lock(StateLock);
+        return State.HmdStatus;
+    }
+
+    // Diffs a state against the previous one and publishes the events. Start() calls this
+    // from the watcher thread; call it directly only when not started (e.g. to replay
+    // recorded states). Battery values of devices missing from state.BatteryValid are
+    // carried over from the previous state.
+    void Process(const DeviceWatcherState& state, double time)
+    {
+        DeviceWatcherState previous;
+        DeviceWatcherState next = state;
+        {
+            std::lock_guard<std::mutex> lock(StateLock);
+            previous = State;
+            for (uint32_t i = 0; i < DeviceWatcherState::MaxDevices; i++)
+            {
+                const uint32_t bit = 1u << i;
+                if ((next.Connected & bit) && !(next.BatteryValid & bit) && (previous.BatteryValid & bit))
+                {
+                    next.BatteryPercent[i] = previous.BatteryPercent[i];
+                    next.BatteryLevel[i] = previous.BatteryLevel[i];
+                    next.BatteryValid |= bit;
+                }
+            }
+            next.BatteryValid &= next.Connected;
+            State = next;
+        }
+
+        Pending.clear();
+        DeviceEvent event = {};
+        event.HmdStatus = next.HmdStatus;
+        event.TimeInSeconds = time;
+
+        const uint32_t changed = previous.Connected ^ next.Connected;
+        for (uint32_t mask = changed; mask; mask &= mask - 1)
+        {
+            const uint32_t bit = mask & (0u - mask);
+            event.Type = (next.Connected & bit) ? DeviceEvent_Connected : DeviceEvent_Disconnected;
+            event.Device = pvrTrackedDeviceType(bit);
+            Pending.push_back(event);
+        }
+        event.Device = pvrTrackedDeviceType(0);
+
+        if (previous.HmdStatus != next.HmdStatus)
+        {
+            event.Type = DeviceEvent_HmdStatusChanged;
+            event.HmdStatusChanged = previous.HmdStatus ^ next.HmdStatus;
+            Pending.push_back(event);
+            event.HmdStatusChanged = 0;
+        }
+
+        for (uint32_t i = 0; i < DeviceWatcherState::MaxDevices; i++)
+        {
+            const uint32_t bit = 1u << i;
+            if (!(next.BatteryValid & bit))
+                continue;
+            if ((previous.BatteryValid & bit) && previous.BatteryPercent[i] == next.BatteryPercent[i] &&
+                previous.BatteryLevel[i] == next.BatteryLevel[i])
+            {
+                continue;
+            }
+            event.Type = DeviceEvent_BatteryChanged;
+            event.Device = pvrTrackedDeviceType(bit);
+            event.BatteryPercent = next.BatteryPercent[i];
+            event.BatteryLevel = next.BatteryLevel[i];
+            Pending.push_back(event);
+        }
+
+        Publish();
+    }
+
+private:
+    struct Subscriber
+    {
+        int                 Id;
+        uint32_t            TypeMask;
+        DeviceEventCallback Callback;
+    };
+
+    void Publish()
+    {
+        if (Pending.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(SubscriberLock);
+            Dispatch = Subscribers;
+        }
+        for (size_t e = 0; e < Pending.size(); e++)
+        {
+            for (size_t s = 0; s < Dispatch.size(); s++)
+            {
+                if (Dispatch[s].TypeMask & (1u << Pending[e].Type))
+                    Dispatch[s].Callback(Pending[e]);
+            }
+        }
+        Dispatch.clear();
+    }
+
+    void Poll()
+    {
+        DeviceWatcherState state;
+        if (pvr_getConnectedDevices(Session, &state.Connected) != pvr_success)
+            return;
+        pvrHmdStatus status;
+        if (pvr_getHmdStatus(Session, &status) != pvr_success)
+            return;
+        state.HmdStatus = GetHmdStatusFlags(status);
+
+        // All batteries every BatteryInterval, and those of new devices right away.
+        const double time = pvr_getTimeSeconds(Session->envh);
+        const bool batteryDue = !HasPolled || time - LastBatteryTime >= BatteryInterval;
+        uint32_t batteryMask = state.Connected;
+        if (!batteryDue)
+        {
+            std::lock_guard<std::mutex> lock(StateLock);
+            batteryMask &= ~State.BatteryValid;
+        }
+        for (uint32_t mask = batteryMask; mask; mask &= mask - 1)
+        {
+            const uint32_t bit = mask & (0u - mask);
+            uint32_t i = 0;
+            while (!(bit & (1u << i)))
+                i++;
+            const pvrTrackedDeviceType device = pvrTrackedDeviceType(bit);
+            state.BatteryPercent[i] = pvr_getTrackedDeviceIntProperty(Session, device, pvrTrackedDeviceProp_BatteryPercent_int, -1);
+            state.BatteryLevel[i] = pvr_getTrackedDeviceIntProperty(Session, device, pvrTrackedDeviceProp_BatteryLevel_int, -1);
+            state.BatteryValid |= bit;
+        }
+        if (batteryDue)
+            LastBatteryTime = time;
+        HasPolled = true;
+        Process(state, time);
+    }
+
+    pvrSessionHandle            Session;
+    double                      BatteryInterval;
+    double                      LastBatteryTime;
+    bool                        HasPolled;
+
+    mutable std::mutex          StateLock;
+    DeviceWatcherState          State;
+
+    mutable std::mutex          SubscriberLock;
+    std::vector<Subscriber>     Subscribers;
+    int                         NextId;
+
+    std::vector<DeviceEvent>    Pending;    // Watcher thread only.
+    std::vector<Subscriber>     Dispatch;   // Watcher thread only.
+    PollingThread               Thread;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,469 @@
+/************************************************************************************
+
+Filename    :   PVR_EyeTracking.h
+Content     :   Gaze filtering, saccade detection and landing point prediction for
+                pvrEyeTrackingInfo samples, and a polled eye tracking history.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_EyeTracking_h
+#define PVR_EyeTracking_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Filter.h"
+#include "PVR_Threading.h"
+#include "PVR_TimedRing.h"
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** GazeState
+
+enum GazeState
+{
+    GazeState_Fixation,     // Fixation or smooth pursuit; the output is filtered.
+    GazeState_Saccade,      // Fast eye movement; the output follows the predicted landing point.
+    GazeState_Blink,        // Both eyes closed (or reopening); the output holds the last fixation.
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** GazeFilterParams
+
+struct GazeFilterParams
+{
+    float MinCutoff;                // One-Euro cutoff at rest, in Hz.
+    float Beta;                     // One-Euro speed coefficient, per (rad/s).
+    float DerivativeCutoff;         // One-Euro derivative cutoff, in Hz.
+    float SaccadeOnsetVelocity;     // Angular velocity entering a saccade, in degrees per second.
+    float SaccadeOffsetVelocity;    // Angular velocity leaving a saccade, in degrees per second.
+    float MaxSaccadeDuration;       // Saccades longer than this are ended, in seconds.
+    float BlinkThreshold;           // An eye with blink[] above this is closed.
+    float BlinkRecoveryTime;        // Samples are ignored for this long after the eyes reopen, in seconds.
+
+    GazeFilterParams()
+        : MinCutoff(2.0f), Beta(0.8f), DerivativeCutoff(1.0f),
+          SaccadeOnsetVelocity(80.0f), SaccadeOffsetVelocity(30.0f), MaxSaccadeDuration(0.12f),
+          BlinkThreshold(0.5f), BlinkRecoveryTime(0.05f)
+    { }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** GazeSample
+//
+// Gaze directions are tangents, like pvrEyeTrackingInfo::GazeTan.
+
+struct GazeSample
+{
+    double    TimeInSeconds;
+    GazeState State;
+    bool      Valid;                    // False until the first sample with an open eye.
+    Vector2f  GazeTan;                  // Combined (cyclopean) gaze.
+    Vector2f  EyeGazeTan[pvrEye_Count];
+    float     ConvergenceDistance;
+    float     AngularVelocity;          // Unfiltered, in radians per second.
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** GazeProcessor
+//
+// Processes pvrEyeTrackingInfo samples in arrival order:
+//
+//  - Fixations are smoothed with a One-Euro filter per eye and for the combined gaze.
+//  - Saccades are detected with a velocity threshold with hysteresis. During a saccade
+//    the amplitude is estimated from the peak velocity with the main sequence relation
+//    (Baloh et al. 1975) and, once the peak has passed, from the symmetry of the velocity
+//    profile. PredictGazeTan() places the gaze along that trajectory at the display time
+//    of the frame, so foveation follows the eye instead of lagging a whole saccade.
+//  - Samples with both eyes closed, and the short recovery period after a blink, hold the
+//    last fixation. With one eye closed the other eye drives the combined gaze.
+//
+// Filtering happens in gaze angle space (atan of GazeTan) so velocities are in radians
+// per second regardless of eccentricity. Update() costs a few hundred nanoseconds.
+//
+// Example usage:
+//     pvrEyeTrackingInfo info;
+//     if (pvr_getEyeTrackingInfo(session, 0.0, &info) == pvr_success)
+//         gaze.Update(info);
+//     Vector2f foveaTan = gaze.PredictGazeTan(predictedDisplayTime);
+
+class GazeProcessor
+{
+public:
+    explicit GazeProcessor(const GazeFilterParams& params = GazeFilterParams())
+    {
+        SetParams(params);
+        Reset();
+    }
+
+    void SetParams(const GazeFilterParams& params)
+    {
+        Params = params;
+        for (int i = 0; i < FilterCount; i++)
+            AngleFilter[i].SetParams(params.MinCutoff, params.Beta, params.DerivativeCutoff);
+        ConvergenceFilter.SetParams(params.MinCutoff, 0.0f, params.DerivativeCutoff);
+    }
+
+    const GazeFilterParams& GetParams() const { return Params; }
+
+    void Reset()
+    {
+        for (int i = 0; i < FilterCount; i++)
+            AngleFilter[i].Reset();
+        ConvergenceFilter.Reset();
+        Sample = GazeSample();
+        Sample.State = GazeState_Fixation;
+        LastRawAngle = Vector2f();
+        LastRawTime = 0.0;
+        HasLastRaw = false;
+        BlinkEndTime = -1.0;
+        SaccadeStartTime = 0.0;
+        SaccadeStart = Vector2f();
+        SaccadeDirection = Vector2f();
+        SaccadeAmplitude = 0.0f;
+        SaccadePeakVelocity = 0.0f;
+        SaccadeDistanceAtPeak = 0.0f;
+        SaccadeDistance = 0.0f;
+    }
+
+    // Processes one sample and returns the updated output. Samples older than the previous
+    // one are ignored.
+    const GazeSample& Update(const pvrEyeTrackingInfo& info)
+    {
+        const double time = info.TimeInSeconds;
+        if (Sample.Valid && time <= Sample.TimeInSeconds)
+            return Sample;
+
+        const bool open[pvrEye_Count] = { info.blink[pvrEye_Left] <= Params.BlinkThreshold,
+                                          info.blink[pvrEye_Right] <= Params.BlinkThreshold };
+
+        // Blink gating.
+        if (!open[pvrEye_Left] && !open[pvrEye_Right])
+        {
+            Sample.TimeInSeconds = time;
+            Sample.State = GazeState_Blink;
+            Sample.AngularVelocity = 0.0f;
+            BlinkEndTime = -1.0;
+            HasLastRaw = false;
+            return Sample;
+        }
+        if (Sample.State == GazeState_Blink)
+        {
+            // Eyelid movement disturbs the first samples after a blink.
+            if (BlinkEndTime < 0.0)
+                BlinkEndTime = time;
+            if (time - BlinkEndTime < Params.BlinkRecoveryTime)
+            {
+                Sample.TimeInSeconds = time;
+                return Sample;
+            }
+            for (int i = 0; i < FilterCount; i++)
+                AngleFilter[i].Reset();
+            Sample.State = GazeState_Fixation;
+        }
+
+        Vector2f eyeAngle[pvrEye_Count];
+        for (int eye = 0; eye < pvrEye_Count; eye++)
+            eyeAngle[eye] = Vector2f(atanf(info.GazeTan[eye].x), atanf(info.GazeTan[eye].y));
+
+        Vector2f angle;
+        if (open[pvrEye_Left] && open[pvrEye_Right])
+            angle = (eyeAngle[pvrEye_Left] + eyeAngle[pvrEye_Right]) * 0.5f;
+        else
+            angle = open[pvrEye_Left] ? eyeAngle[pvrEye_Left] : eyeAngle[pvrEye_Right];
+
+        // Unfiltered angular velocity drives the classification.
+        float velocity = 0.0f;
+        if (HasLastRaw)
+            velocity = angle.Distance(LastRawAngle) / float(time - LastRawTime);
+        Sample.AngularVelocity = velocity;
+
+        const float onset  = DegreeToRad(Params.SaccadeOnsetVelocity);
+        const float offset = DegreeToRad(Params.SaccadeOffsetVelocity);
+
+        if (Sample.State == GazeState_Fixation && HasLastRaw && velocity > onset)
+        {
+            Sample.State = GazeState_Saccade;
+            SaccadeStartTime = LastRawTime;
+            SaccadeStart = LastRawAngle;
+            SaccadePeakVelocity = 0.0f;
+            SaccadeDistanceAtPeak = 0.0f;
+        }
+
+        if (Sample.State == GazeState_Saccade)
+        {
+            const bool ended = (velocity < offset) || (time - SaccadeStartTime > Params.MaxSaccadeDuration);
+            if (ended)
+            {
+                // Restart the filters at the landing point rather than dragging them across.
+                for (int i = 0; i < FilterCount; i++)
+                    AngleFilter[i].Reset();
+                Sample.State = GazeState_Fixation;
+            }
+            else
+            {
+                UpdateSaccade(angle, velocity);
+            }
+        }
+
+        LastRawAngle = angle;
+        LastRawTime = time;
+        HasLastRaw = true;
+
+        if (Sample.State == GazeState_Fixation)
+        {
+            const Vector2f filtered = AngleFilter[2].Filter(angle, time);
+            Sample.GazeTan = AngleToTan(filtered);
+        }
+        else
+        {
+            // Raw gaze during saccades; PredictGazeTan() extrapolates along the trajectory.
+            AngleFilter[2].Reset();
+            AngleFilter[2].Filter(angle, time);
+            Sample.GazeTan = AngleToTan(angle);
+        }
+
+        for (int eye = 0; eye < pvrEye_Count; eye++)
+        {
+            if (!open[eye])
+                continue;
+            if (Sample.State == GazeState_Saccade)
+                AngleFilter[eye].Reset();
+            Sample.EyeGazeTan[eye] = AngleToTan(AngleFilter[eye].Filter(eyeAngle[eye], time));
+        }
+
+        if (info.ConvergenceDistance > 0.0f)
+            Sample.ConvergenceDistance = ConvergenceFilter.Filter(info.ConvergenceDistance, time);
+
+        Sample.TimeInSeconds = time;
+        Sample.Valid = true;
+        return Sample;
+    }
+
+    const GazeSample& GetSample() const { return Sample; }
+
+    // Combined gaze expected at displayTime (e.g. the predicted display time of the frame).
+    // Outside of saccades this is the filtered gaze.
+    Vector2f PredictGazeTan(double displayTime) const
+    {
+        if (Sample.State != GazeState_Saccade)
+            return Sample.GazeTan;
+        return AngleToTan(SaccadeAngleAt(displayTime));
+    }
+
+    // Predicted end point and end time of the current saccade. Returns false outside of saccades.
+    bool GetSaccadeLanding(Vector2f* outLandingTan, double* outLandingTime) const
+    {
+        if (Sample.State != GazeState_Saccade)
+            return false;
+        if (outLandingTan)
+            *outLandingTan = AngleToTan(SaccadeStart + SaccadeDirection * SaccadeAmplitude);
+        if (outLandingTime)
+            *outLandingTime = SaccadeStartTime + SaccadeDuration(SaccadeAmplitude);
+        return true;
+    }
+
+private:
+    enum { FilterCount = 3 };   // Left eye, right eye, combined.
+
+    static Vector2f AngleToTan(const Vector2f& a)
+    {
+        return Vector2f(tanf(a.x), tanf(a.y));
+    }
+
+    // Main sequence duration: about 21 ms + 2.2 ms per degree.
+    static float SaccadeDuration(float amplitude)
+    {
+        return 0.021f + 0.0022f * RadToDegree(amplitude);
+    }
+
+    void UpdateSaccade(const Vector2f& angle, float velocity)
+    {
+        const Vector2f traveled = angle - SaccadeStart;
+        SaccadeDistance = traveled.Length();
+        if (SaccadeDistance > 0.0f)
+            SaccadeDirection = traveled * (1.0f / SaccadeDistance);
+
+        bool pastPeak = false;
+        if (velocity >= SaccadePeakVelocity)
+        {
+            SaccadePeakVelocity = velocity;
+            SaccadeDistanceAtPeak = SaccadeDistance;
+        }
+        else
+        {
+            pastPeak = velocity < 0.85f * SaccadePeakVelocity;
+        }
+
+        // Main sequence: Vpeak = Vmax * (1 - exp(-A / C)), Vmax ~ 500 deg/s, C ~ 14 deg.
+        const float vmax = DegreeToRad(500.0f);
+        const float ratio = PVRMath_Min(SaccadePeakVelocity / vmax, 0.95f);
+        float amplitude = -DegreeToRad(14.0f) * logf(1.0f - ratio);
+
+        // The velocity profile is roughly symmetric, so the peak marks half the amplitude.
+        if (pastPeak)
+            amplitude = 2.0f * SaccadeDistanceAtPeak;
+
+        SaccadeAmplitude = PVRMath_Max(amplitude, SaccadeDistance);
+    }
+
+    Vector2f SaccadeAngleAt(double time) const
+    {
+        if (SaccadeAmplitude <= 0.0f)
+            return LastRawAngle;
+
+        // Smoothstep position profile, never behind the latest measured position.
+        float t = float((time - SaccadeStartTime) / SaccadeDuration(SaccadeAmplitude));
+        t = PVRMath_Min(PVRMath_Max(t, 0.0f), 1.0f);
+        float progress = t * t * (3.0f - 2.0f * t);
+        progress = PVRMath_Max(progress, SaccadeDistance / SaccadeAmplitude);
+        return SaccadeStart + SaccadeDirection * (SaccadeAmplitude * progress);
+    }
+
+    GazeFilterParams        Params;
+    OneEuroFilter<Vector2f> AngleFilter[FilterCount];
+    OneEuroFilter<float>    ConvergenceFilter;
+    GazeSample              Sample;
+
+    Vector2f LastRawAngle;
+    double   LastRawTime;
+    bool     HasLastRaw;
+    double   BlinkEndTime;
+
+    double   SaccadeStartTime;
+    Vector2f SaccadeStart;
+    Vector2f SaccadeDirection;
+    float    SaccadeAmplitude;
+    float    SaccadePeakVelocity;
+    float    SaccadeDistanceAtPeak;
+    float    SaccadeDistance;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** EyeTrackingHistory
+//
+// Thread safe TimedRing of pvrEyeTrackingInfo samples. One thread adds samples (usually
+// EyeTrackingPoller) and any thread can query the gaze at an arbitrary recent time
+// without a call into the runtime.
+
+class EyeTrackingHistory
+{
+public:
+    explicit EyeTrackingHistory(int capacity = 512, float blinkThreshold = 0.5f)
+        : Ring(capacity), BlinkThreshold(blinkThreshold)
+    { }
+
+    void Clear() { Ring.Clear(); }
+
+    // Returns false if the sample is not newer than the newest stored sample (e.g. the
+    // same tracker sample polled twice).
+    bool Add(const pvrEyeTrackingInfo& info) { return Ring.Add(info); }
+
+    int GetCount() const { return Ring.GetCount(); }
+
+    bool GetLatest(pvrEyeTrackingInfo* outInfo) const { return Ring.GetLatest(outInfo); }
+
+    // Eye tracking state at absTime. Between two samples gaze, convergence and blink are
+    // interpolated, except that an eye closed in either sample takes the values of the
+    // nearer sample. Times after the newest sample return the newest sample. Returns false
+    // if the history is empty or absTime is older than the oldest sample.
+    bool Sample(double absTime, pvrEyeTrackingInfo* outInfo) const
+    {
+        return Ring.Sample(absTime, [&](const pvrEyeTrackingInfo& a, const pvrEyeTrackingInfo& b, float t)
+        {
+            if (&a == &b)
+            {
+                *outInfo = a;
+                return;
+            }
+            *outInfo = (t < 0.5f) ? a : b;
+            outInfo->TimeInSeconds = absTime;
+            for (int eye = 0; eye < pvrEye_Count; eye++)
+            {
+                if (a.blink[eye] > BlinkThreshold || b.blink[eye] > BlinkThreshold)
+                    continue;
+                outInfo->GazeTan[eye].x = a.GazeTan[eye].x + (b.GazeTan[eye].x - a.GazeTan[eye].x) * t;
+                outInfo->GazeTan[eye].y = a.GazeTan[eye].y + (b.GazeTan[eye].y - a.GazeTan[eye].y) * t;
+                outInfo->blink[eye] = a.blink[eye] + (b.blink[eye] - a.blink[eye]) * t;
+            }
+            if (a.ConvergenceDistance > 0.0f && b.ConvergenceDistance > 0.0f)
+                outInfo->ConvergenceDistance = a.ConvergenceDistance + (b.ConvergenceDistance - a.ConvergenceDistance) * t;
+        });
+    }
+
+private:
+    TimedRing<pvrEyeTrackingInfo> Ring;
+    float                         BlinkThreshold;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** EyeTrackingPoller
+//
+// Polls getEyeTrackingInfo on a background thread and feeds an EyeTrackingHistory, so
+// render, UI and analytics code share one runtime call per tracker sample. Poll at or
+// above the tracker rate; repeated samples are dropped by the history.
+//
+// Example usage:
+//     EyeTrackingPoller eyePoller;
+//     eyePoller.Start(session, 240.0);
+//     pvrEyeTrackingInfo info;
+//     if (eyePoller.Sample(predictedDisplayTime, &info))
+//         ...
+
+class EyeTrackingPoller
+{
+public:
+    explicit EyeTrackingPoller(int historyCapacity = 512)
+        : History(historyCapacity), Session(nullptr)
+    { }
+
+    ~EyeTrackingPoller() { Stop(); }
+
+    bool Start(pvrSessionHandle session, double rateHz = 240.0)
+    {
+        if (!session || rateHz <= 0.0)
+            return false;
+        Session = session;
+        return Thread.Start([this]() { Poll(); }, 1.0 / rateHz);
+    }
+
+    void Stop() { Thread.Stop(); }
+
+    bool IsRunning() const { return Thread.IsRunning(); }
+
+    const EyeTrackingHistory& GetHistory() const { return History; }
+
+    bool Sample(double absTime, pvrEyeTrackingInfo* outInfo) const
+    {
+        return History.Sample(absTime, outInfo);
+    }
+
+    bool GetLatest(pvrEyeTrackingInfo* outInfo) const
+    {
+        return History.GetLatest(outInfo);
+    }
+
+private:
+    void Poll()
+    {
+        pvrEyeTrackingInfo info;
+        if (pvr_getEyeTrackingInfo(Session, 0.0, &info) == pvr_success)
+            History.Add(info);
+    }
+
+    EyeTrackingHistory History;
+    pvrSessionHandle   Session;
+    PollingThread      Thread;
+};
+
+
+} // Namespace PVR
+
+#endif
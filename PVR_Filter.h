@@ -0,0 +1,219 @@
+/************************************************************************************
+
+Filename    :   PVR_Filter.h
+Content     :   Low latency signal filters for tracking data.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Filter_h
+#define PVR_Filter_h
+
+#include "PVR_Math.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** FilterMagnitude
+//
+// Scalar type and speed measure used by the adaptive filters below.
+
+template<class T> struct FilterScalar              { typedef T Type; };
+template<class T> struct FilterScalar<Vector2<T> > { typedef T Type; };
+template<class T> struct FilterScalar<Vector3<T> > { typedef T Type; };
+
+inline float  FilterMagnitude(float v)  { return fabsf(v); }
+inline double FilterMagnitude(double v) { return fabs(v); }
+
+template<class T>
+inline T FilterMagnitude(const Vector2<T>& v) { return v.Length(); }
+
+template<class T>
+inline T FilterMagnitude(const Vector3<T>& v) { return v.Length(); }
+
+
+namespace FilterDetail {
+
+template<class Scalar>
+inline Scalar OneEuroAlpha(Scalar cutoff, Scalar dt)
+{
+    const Scalar tau = Scalar(1) / (Scalar(2) * Math<Scalar>::Pi() * cutoff);
+    return Scalar(1) / (Scalar(1) + tau / dt);
+}
+
+} // namespace FilterDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** OneEuroFilter
+//
+// Speed adaptive low-pass filter (Casiez et al., "1 Euro Filter", CHI 2012).
+// The cutoff frequency rises with the speed of the signal: slow movements are smoothed
+// heavily (jitter removal) while fast movements pass with little lag.
+//
+//  - MinCutoff (Hz) sets the smoothing at rest; lower removes more jitter.
+//  - Beta sets how quickly the cutoff rises with speed; higher reduces lag.
+//  - DerivativeCutoff (Hz) smooths the speed estimate itself.
+//
+// T is float, double, Vector2<> or Vector3<>.
+
+template<class T>
+class OneEuroFilter
+{
+public:
+    typedef typename FilterScalar<T>::Type Scalar;
+
+    OneEuroFilter(Scalar minCutoff = Scalar(1), Scalar beta = Scalar(0), Scalar derivativeCutoff = Scalar(1))
+        : MinCutoff(minCutoff), Beta(beta), DerivativeCutoff(derivativeCutoff),
+          Value(), Derivative(), LastTime(0), Initialized(false)
+    { }
+
+    void SetParams(Scalar minCutoff, Scalar beta, Scalar derivativeCutoff = Scalar(1))
+    {
+        MinCutoff = minCutoff;
+        Beta = beta;
+        DerivativeCutoff = derivativeCutoff;
+    }
+
+    void Reset()                { Initialized = false; Derivative = T(); }
+    bool IsInitialized() const  { return Initialized; }
+
+    // Filters a new sample taken at time (seconds). Samples not newer than the previous
+    // one are ignored.
+    const T& Filter(const T& value, double time)
+    {
+        return Update(value, time, nullptr);
+    }
+
+    // Same, with the cutoff driven by a speed measured elsewhere (e.g. the velocity the
+    // tracker reports) instead of the filtered derivative, which lags and carries noise.
+    const T& Filter(const T& value, double time, Scalar speed)
+    {
+        return Update(value, time, &speed);
+    }
+
+    const T& GetValue() const       { return Value; }
+    const T& GetDerivative() const  { return Derivative; }
+    double   GetLastTime() const    { return LastTime; }
+
+private:
+    const T& Update(const T& value, double time, const Scalar* speed)
+    {
+        if (!Initialized)
+        {
+            Value = value;
+            Derivative = T();
+            LastTime = time;
+            Initialized = true;
+            return Value;
+        }
+
+        const Scalar dt = Scalar(time - LastTime);
+        if (dt <= Scalar(0))
+            return Value;
+        LastTime = time;
+
+        const T rawDerivative = (value - Value) * (Scalar(1) / dt);
+        Derivative = Derivative + (rawDerivative - Derivative) * FilterDetail::OneEuroAlpha(DerivativeCutoff, dt);
+
+        const Scalar cutoff = MinCutoff + Beta * (speed ? *speed : FilterMagnitude(Derivative));
+        Value = Value + (value - Value) * FilterDetail::OneEuroAlpha(cutoff, dt);
+        return Value;
+    }
+
+    Scalar MinCutoff;
+    Scalar Beta;
+    Scalar DerivativeCutoff;
+    T      Value;
+    T      Derivative;
+    double LastTime;
+    bool   Initialized;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** OneEuroRotationFilter
+//
+// OneEuroFilter for rotations. The derivative is the angular velocity (rad/s) from the
+// filtered to the new rotation, and the smoothing step is a slerp toward the new rotation,
+// so the result stays a unit quaternion and q and -q filter the same.
+//
+// T is float or double.
+
+template<class T>
+class OneEuroRotationFilter
+{
+public:
+    OneEuroRotationFilter(T minCutoff = T(1), T beta = T(0), T derivativeCutoff = T(1))
+        : MinCutoff(minCutoff), Beta(beta), DerivativeCutoff(derivativeCutoff),
+          Value(Quat<T>::Identity()), Derivative(), LastTime(0), Initialized(false)
+    { }
+
+    void SetParams(T minCutoff, T beta, T derivativeCutoff = T(1))
+    {
+        MinCutoff = minCutoff;
+        Beta = beta;
+        DerivativeCutoff = derivativeCutoff;
+    }
+
+    void Reset()                { Initialized = false; Derivative = Vector3<T>(); }
+    bool IsInitialized() const  { return Initialized; }
+
+    const Quat<T>& Filter(const Quat<T>& value, double time)
+    {
+        return Update(value, time, nullptr);
+    }
+
+    // Same, with the cutoff driven by an angular speed (rad/s) measured elsewhere.
+    const Quat<T>& Filter(const Quat<T>& value, double time, T speed)
+    {
+        return Update(value, time, &speed);
+    }
+
+    const Quat<T>&    GetValue() const      { return Value; }
+    const Vector3<T>& GetDerivative() const { return Derivative; }
+    double            GetLastTime() const   { return LastTime; }
+
+private:
+    const Quat<T>& Update(const Quat<T>& value, double time, const T* speed)
+    {
+        if (!Initialized)
+        {
+            Value = value.Normalized();
+            Derivative = Vector3<T>();
+            LastTime = time;
+            Initialized = true;
+            return Value;
+        }
+
+        const T dt = T(time - LastTime);
+        if (dt <= T(0))
+            return Value;
+        LastTime = time;
+
+        // Shortest rotation from the filtered value to the new sample, in world frame.
+        Quat<T> delta = value * Value.Inverted();
+        if (delta.w < T(0))
+            delta = delta * T(-1);
+        const Vector3<T> step = delta.FastToRotationVector();
+        Derivative = Derivative + (step * (T(1) / dt) - Derivative) * FilterDetail::OneEuroAlpha(DerivativeCutoff, dt);
+
+        const T cutoff = MinCutoff + Beta * (speed ? *speed : Derivative.Length());
+        const T alpha = FilterDetail::OneEuroAlpha(cutoff, dt);
+        Value = (Quat<T>::FastFromRotationVector(step * alpha, false) * Value).Normalized();
+        return Value;
+    }
+
+    T          MinCutoff;
+    T          Beta;
+    T          DerivativeCutoff;
+    Quat<T>    Value;
+    Vector3<T> Derivative;
+    double     LastTime;
+    bool       Initialized;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,301 @@
+/************************************************************************************
+
+Filename    :   PVR_Gestures.h
+Content     :   Hand gesture recognition over hand tracking skeletons.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Gestures_h
+#define PVR_Gestures_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Skeleton.h"
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** Gesture
+
+enum Gesture
+{
+    Gesture_Pinch,      // Thumb and index tips together.
+    Gesture_Grab,       // All four fingers curled.
+    Gesture_Point,      // Index extended, the other fingers curled.
+    Gesture_PalmUp,     // Palm facing up.
+    Gesture_OpenPalm,   // All fingers extended.
+    Gesture_Count
+};
+
+// Thresholds are in meters for distances and in curl units for fingers: 0 for a straight
+// finger, 0.5 for a 90 degree bend, 1 when the tip points back at its base.
+struct GestureParams
+{
+    float    PinchNear;         // Full pinch confidence at or below this distance.
+    float    PinchFar;          // No pinch confidence at or above.
+    float    CurlExtended;      // A finger is fully extended at or below this curl.
+    float    CurlCurled;        // A finger is fully curled at or above this curl.
+    float    PalmUpMin;         // Cosine between palm normal and Up with no confidence.
+    float    PalmUpMax;         // Cosine with full confidence.
+    float    OnThreshold;       // Confidence to activate a gesture...
+    float    OffThreshold;      // ...and to release it.
+    double   MinOnTime;         // Seconds above OnThreshold before activating.
+    Vector3f Up;                // World up for PalmUp.
+
+    GestureParams()
+        : PinchNear(0.015f), PinchFar(0.035f), CurlExtended(0.25f), CurlCurled(0.6f),
+          PalmUpMin(0.5f), PalmUpMax(0.85f), OnThreshold(0.8f), OffThreshold(0.5f), MinOnTime(0.03),
+          Up(0.0f, 1.0f, 0.0f)
+    { }
+};
+
+// Raw features of both hands, computed before confidences.
+struct GestureFeatures
+{
+    enum { FingerCount = 5 };
+
+    float    PinchDistance[pvrHand_Count][FingerCount - 1];    // Thumb tip to index..pinky tips.
+    float    Curl[pvrHand_Count][FingerCount];                  // Thumb..pinky.
+    Vector3f PalmNormal[pvrHand_Count];                         // World space, out of the palm.
+    Vector3f PinchPoint[pvrHand_Count];                         // Between thumb and index tips.
+};
+
+struct GestureEvent
+{
+    Gesture  Type;
+    uint32_t Hand;
+    bool     Active;    // true when the gesture started, false when it ended.
+    double   Time;
+};
+
+
+namespace GestureDetail {
+
+enum { Lanes = pvrHand_Count * GestureFeatures::FingerCount };
+
+// Per finger: base of the first bone, its end (knuckle) and the tip.
+static const uint8_t FingerBase[GestureFeatures::FingerCount] =
+    { HandBone_Thumb0, HandBone_IndexFinger0, HandBone_MiddleFinger0, HandBone_RingFinger0, HandBone_PinkyFinger0 };
+static const uint8_t FingerKnuckle[GestureFeatures::FingerCount] =
+    { HandBone_Thumb1, HandBone_IndexFinger1, HandBone_MiddleFinger1, HandBone_RingFinger1, HandBone_PinkyFinger1 };
+static const uint8_t FingerTip[GestureFeatures::FingerCount] =
+    { HandBone_Thumb3, HandBone_IndexFinger4, HandBone_MiddleFinger4, HandBone_RingFinger4, HandBone_PinkyFinger4 };
+
+inline float SmoothStep(float edge0, float edge1, float x)
+{
+    const float t = PVRMath_Min(PVRMath_Max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Gathers one bone per lane into x, y, z.
+inline void Gather(const SkeletalPoseSoA& pose, const uint8_t bones[GestureFeatures::FingerCount],
+                   float* x, float* y, float* z)
+{
+    for (int h = 0; h < pvrHand_Count; h++)
+    {
+        for (int f = 0; f < GestureFeatures::FingerCount; f++)
+        {
+            const int i = SkeletalPoseSoA::Index(h, bones[f]);
+            const int lane = h * GestureFeatures::FingerCount + f;
+            x[lane] = pose.Tx[i];
+            y[lane] = pose.Ty[i];
+            z[lane] = pose.Tz[i];
+        }
+    }
+}
+
+} // namespace GestureDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** ComputeGestureFeatures
+//
+// Features of both hands from world space bone poses (SkeletonEvaluator::Evaluate). The
+// five fingers of both hands form ten lanes that are processed as SoA loops.
+//
+// Curl is (1 - cos a) / 2, with a the angle between a finger's first bone and the line
+// from its knuckle to its tip. The palm normal comes from the knuckle positions, so it
+// does not depend on the runtime's bone axis conventions.
+
+inline void ComputeGestureFeatures(const SkeletalPoseSoA& world, GestureFeatures* out)
+{
+    using namespace GestureDetail;
+    const int fingers = GestureFeatures::FingerCount;
+
+    float bx[Lanes], by[Lanes], bz[Lanes];
+    float kx[Lanes], ky[Lanes], kz[Lanes];
+    float tx[Lanes], ty[Lanes], tz[Lanes];
+    Gather(world, FingerBase, bx, by, bz);
+    Gather(world, FingerKnuckle, kx, ky, kz);
+    Gather(world, FingerTip, tx, ty, tz);
+
+    float curl[Lanes], pinch[Lanes];
+    for (int l = 0; l < Lanes; l++)
+    {
+        const float ax = kx[l] - bx[l], ay = ky[l] - by[l], az = kz[l] - bz[l];
+        const float cx = tx[l] - kx[l], cy = ty[l] - ky[l], cz = tz[l] - kz[l];
+        const float lengths = (ax * ax + ay * ay + az * az) * (cx * cx + cy * cy + cz * cz);
+        const float cosine = (ax * cx + ay * cy + az * cz) / sqrtf(PVRMath_Max(lengths, 1e-12f));
+        curl[l] = 0.5f * (1.0f - cosine);
+
+        // Distance to the thumb tip of the same hand; 0 on the thumb lanes.
+        const int thumb = (l / fingers) * fingers;
+        const float dx = tx[l] - tx[thumb], dy = ty[l] - ty[thumb], dz = tz[l] - tz[thumb];
+        pinch[l] = sqrtf(dx * dx + dy * dy + dz * dz);
+    }
+
+    for (int h = 0; h < pvrHand_Count; h++)
+    {
+        const int base = h * fingers;
+        for (int f = 0; f < fingers; f++)
+            out->Curl[h][f] = curl[base + f];
+        for (int f = 1; f < fingers; f++)
+            out->PinchDistance[h][f - 1] = pinch[base + f];
+
+        // Forward along the middle finger, across from index to pinky knuckles; the cross
+        // product points out of a right palm and into a left one.
+        const Vector3f wrist = world.GetPose(h, HandBone_Wrist).Translation;
+        const Vector3f forward = Vector3f(kx[base + 2], ky[base + 2], kz[base + 2]) - wrist;
+        const Vector3f across = Vector3f(kx[base + 4] - kx[base + 1], ky[base + 4] - ky[base + 1], kz[base + 4] - kz[base + 1]);
+        Vector3f normal = forward.Cross(across);
+        if (h == pvrHand_Left)
+            normal = -normal;
+        out->PalmNormal[h] = normal.Normalized();
+        out->PinchPoint[h] = Vector3f(tx[base] + tx[base + 1], ty[base] + ty[base + 1], tz[base] + tz[base + 1]) * 0.5f;
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** GestureRecognizer
+//
+// Per hand confidences in [0, 1] for each Gesture, and a hysteresis state machine per
+// gesture: a gesture activates after its confidence stayed at or above OnThreshold for
+// MinOnTime, and releases when it falls to OffThreshold, so noisy tracking does not make
+// it flicker. Update() is a pure function of its inputs and the previous state, so
+// recorded skeletons replay to the same events.
+//
+// Example usage:
+//     GestureRecognizer gestures;
+//     fk.Evaluate(local, handToWorld, &model, &world);
+//     gestures.Update(world, valid, time);
+//     for (size_t i = 0; i < gestures.GetEvents().size(); i++)
+//         ...
+//     if (gestures.IsActive(pvrHand_Right, Gesture_Pinch))
+//         Drag(gestures.GetFeatures().PinchPoint[pvrHand_Right]);
+
+class GestureRecognizer
+{
+public:
+    explicit GestureRecognizer(const GestureParams& params = GestureParams())
+        : Params(params)
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        Features = GestureFeatures();
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            for (int g = 0; g < Gesture_Count; g++)
+            {
+                Confidence[h][g] = 0.0f;
+                State[h][g] = State_Off;
+                PendingSince[h][g] = 0.0;
+            }
+        }
+        Events.clear();
+    }
+
+    // world: bone poses of both hands in world space. Invalid hands release their gestures.
+    void Update(const SkeletalPoseSoA& world, const bool valid[pvrHand_Count], double time)
+    {
+        using namespace GestureDetail;
+        Events.clear();
+        ComputeGestureFeatures(world, &Features);
+
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            float* confidence = Confidence[h];
+            if (!valid[h])
+            {
+                for (int g = 0; g < Gesture_Count; g++)
+                    confidence[g] = 0.0f;
+            }
+            else
+            {
+                const float* curl = Features.Curl[h];
+                const float curledOthers = PVRMath_Min(PVRMath_Min(curl[2], curl[3]), curl[4]);
+                const float maxFinger = PVRMath_Max(PVRMath_Max(curl[1], curl[2]), PVRMath_Max(curl[3], curl[4]));
+                const float extended = 1.0f - SmoothStep(Params.CurlExtended, Params.CurlCurled, curl[1]);
+
+                confidence[Gesture_Pinch] = 1.0f - SmoothStep(Params.PinchNear, Params.PinchFar, Features.PinchDistance[h][0]);
+                confidence[Gesture_Grab] = SmoothStep(Params.CurlExtended, Params.CurlCurled, PVRMath_Min(curl[1], curledOthers));
+                confidence[Gesture_Point] = extended * SmoothStep(Params.CurlExtended, Params.CurlCurled, curledOthers);
+                confidence[Gesture_PalmUp] = SmoothStep(Params.PalmUpMin, Params.PalmUpMax, Features.PalmNormal[h].Dot(Params.Up));
+                confidence[Gesture_OpenPalm] = 1.0f - SmoothStep(Params.CurlExtended, Params.CurlCurled, maxFinger);
+            }
+
+            for (int g = 0; g < Gesture_Count; g++)
+                Step(uint32_t(h), Gesture(g), confidence[g], time);
+        }
+    }
+
+    float GetConfidence(uint32_t hand, Gesture gesture) const { return Confidence[hand][gesture]; }
+    bool  IsActive(uint32_t hand, Gesture gesture) const      { return State[hand][gesture] == State_Active; }
+
+    const GestureFeatures& GetFeatures() const { return Features; }
+
+    // Gestures that started or ended in the last Update().
+    const std::vector<GestureEvent>& GetEvents() const { return Events; }
+
+private:
+    enum StateType { State_Off, State_Pending, State_Active };
+
+    void Step(uint32_t hand, Gesture gesture, float confidence, double time)
+    {
+        StateType& state = State[hand][gesture];
+        switch (state)
+        {
+        case State_Off:
+            if (confidence < Params.OnThreshold)
+                break;
+            state = State_Pending;
+            PendingSince[hand][gesture] = time;
+            // MinOnTime may be 0.
+            // Fall through.
+        case State_Pending:
+            if (confidence < Params.OnThreshold)
+                state = State_Off;
+            else if (time - PendingSince[hand][gesture] >= Params.MinOnTime)
+                SetActive(hand, gesture, true, time);
+            break;
+        case State_Active:
+            if (confidence <= Params.OffThreshold)
+                SetActive(hand, gesture, false, time);
+            break;
+        }
+    }
+
+    void SetActive(uint32_t hand, Gesture gesture, bool active, double time)
+    {
+        State[hand][gesture] = active ? State_Active : State_Off;
+        const GestureEvent event = { gesture, hand, active, time };
+        Events.push_back(event);
+    }
+
+    GestureParams             Params;
+    GestureFeatures           Features;
+    float                     Confidence[pvrHand_Count][Gesture_Count];
+    StateType                 State[pvrHand_Count][Gesture_Count];
+    double                    PendingSince[pvrHand_Count][Gesture_Count];
+    std::vector<GestureEvent> Events;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,307 @@
+/************************************************************************************
+
+Filename    :   PVR_HandSignals.h
+Content     :   Calibrated and filtered finger curl and force signals.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_HandSignals_h
+#define PVR_HandSignals_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** HandSignal
+
+enum HandSignal
+{
+    HandSignal_Index,           // pvrInputState::fingerIndex
+    HandSignal_Middle,
+    HandSignal_Ring,
+    HandSignal_Pinky,
+    HandSignal_GripForce,
+    HandSignal_TouchPadForce,
+    HandSignal_Trigger,
+    HandSignal_Grip,
+    HandSignal_Count
+};
+
+struct HandSignalParams
+{
+    float MinCutoff;        // Hz at rest; One-Euro filter per signal.
+    float Beta;             // Hz per unit/s.
+    float DerivativeCutoff; // Hz; smoothing of the velocity.
+    float MinRange;         // Smallest calibrated range, so a barely moved finger is not
+                            // stretched to the full 0..1.
+    bool  AutoCalibrate;    // Widen the calibrated range to every value seen.
+
+    HandSignalParams()
+        : MinCutoff(2.0f), Beta(10.0f), DerivativeCutoff(5.0f), MinRange(0.3f), AutoCalibrate(true)
+    { }
+};
+
+// Raw range of each signal; store it per user to skip the calibration next session.
+struct HandSignalCalibration
+{
+    float Min[pvrHand_Count][HandSignal_Count];
+    float Max[pvrHand_Count][HandSignal_Count];
+};
+
+
+namespace HandSignalDetail {
+
+enum { Lanes = pvrHand_Count * HandSignal_Count };
+
+PVR_MATH_STATIC_ASSERT(Lanes % 4 == 0, "HandSignalDetail::Lanes must be a multiple of 4");
+
+inline void Gather(const pvrInputState& state, float* out)
+{
+    for (int h = 0; h < pvrHand_Count; h++)
+    {
+        float* lane = out + h * HandSignal_Count;
+        lane[HandSignal_Index] = state.fingerIndex[h];
+        lane[HandSignal_Middle] = state.fingerMiddle[h];
+        lane[HandSignal_Ring] = state.fingerRing[h];
+        lane[HandSignal_Pinky] = state.fingerPinky[h];
+        lane[HandSignal_GripForce] = state.GripForce[h];
+        lane[HandSignal_TouchPadForce] = state.TouchPadForce[h];
+        lane[HandSignal_Trigger] = state.Trigger[h];
+        lane[HandSignal_Grip] = state.Grip[h];
+    }
+}
+
+} // namespace HandSignalDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** HandSignalProcessor
+//
+// Turns the raw analog channels of pvrInputState into signals ready for gameplay and hand
+// rendering, for both hands in one step: every channel of both hands is a lane of one
+// SoA state (16 lanes, four SSE2 vectors), and each Update() runs calibration, a
+// One-Euro filter and differentiation over all lanes at once.
+//
+//  - Calibration maps each channel's raw range (learned, or loaded per user) to 0..1.
+//  - Filtering removes sensor noise at rest while fast curls pass with little lag.
+//  - Velocity (units/s of the calibrated value) is the filter's derivative, e.g. a fast
+//    opening of all fingers for throw release or a flick on the trigger.
+//  - Blend weights are the filtered curls eased with a smoothstep, for blending finger
+//    poses between open and curled.
+//
+// Example usage:
+//     HandSignalProcessor signals;
+//     signals.Update(inputState);
+//     if (signals.GetVelocity(pvrHand_Right, HandSignal_Index) < -8.0f)
+//         ReleaseThrow();
+
+class HandSignalProcessor
+{
+public:
+    explicit HandSignalProcessor(const HandSignalParams& params = HandSignalParams())
+        : Params(params)
+    {
+        ResetCalibration();
+        Reset();
+    }
+
+    void SetParams(const HandSignalParams& params) { Params = params; }
+
+    // Clears the filter state; calibration is kept.
+    void Reset()
+    {
+        for (int l = 0; l < HandSignalDetail::Lanes; l++)
+            Raw[l] = Value[l] = Velocity[l] = 0.0f;
+        LastTime = 0.0;
+        Initialized = false;
+    }
+
+    // Forgets the learned ranges. Until values are seen, the range is [0, MinRange].
+    void ResetCalibration()
+    {
+        for (int l = 0; l < HandSignalDetail::Lanes; l++)
+        {
+            Min[l] = 1.0f;
+            Max[l] = 0.0f;
+        }
+    }
+
+    void GetCalibration(HandSignalCalibration* out) const
+    {
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            for (int s = 0; s < HandSignal_Count; s++)
+            {
+                out->Min[h][s] = Min[h * HandSignal_Count + s];
+                out->Max[h][s] = Max[h * HandSignal_Count + s];
+            }
+        }
+    }
+
+    void SetCalibration(const HandSignalCalibration& calibration)
+    {
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            for (int s = 0; s < HandSignal_Count; s++)
+            {
+                Min[h * HandSignal_Count + s] = calibration.Min[h][s];
+                Max[h * HandSignal_Count + s] = calibration.Max[h][s];
+            }
+        }
+    }
+
+    // Processes a snapshot taken at state.TimeInSeconds. Snapshots not newer than the
+    // previous one are ignored. Returns false if ignored.
+    bool Update(const pvrInputState& state)
+    {
+        using namespace HandSignalDetail;
+
+        if (Initialized && state.TimeInSeconds <= LastTime)
+            return false;
+
+        float raw[Lanes];
+        Gather(state, raw);
+
+        if (Params.AutoCalibrate)
+        {
+            for (int l = 0; l < Lanes; l++)
+            {
+                Min[l] = PVRMath_Min(Min[l], raw[l]);
+                Max[l] = PVRMath_Max(Max[l], raw[l]);
+            }
+        }
+
+        if (!Initialized)
+        {
+            for (int l = 0; l < Lanes; l++)
+            {
+                Raw[l] = raw[l];
+                Value[l] = Normalize(l, raw[l]);
+                Velocity[l] = 0.0f;
+            }
+            LastTime = state.TimeInSeconds;
+            Initialized = true;
+            return true;
+        }
+
+        const float dt = float(state.TimeInSeconds - LastTime);
+        LastTime = state.TimeInSeconds;
+        Step(raw, dt);
+        return true;
+    }
+
+    // Calibrated and filtered value in [0, 1].
+    float GetValue(uint32_t hand, HandSignal signal) const      { return Value[Lane(hand, signal)]; }
+
+    // Last raw value.
+    float GetRawValue(uint32_t hand, HandSignal signal) const   { return Raw[Lane(hand, signal)]; }
+
+    // Rate of change of GetValue(), per second; negative while opening or releasing.
+    float GetVelocity(uint32_t hand, HandSignal signal) const   { return Velocity[Lane(hand, signal)]; }
+
+    // Finger pose weights (index, middle, ring, pinky): 0 open, 1 curled.
+    void GetFingerBlendWeights(uint32_t hand, float outWeights[4]) const
+    {
+        for (int f = 0; f < 4; f++)
+        {
+            const float t = Value[Lane(hand, HandSignal(HandSignal_Index + f))];
+            outWeights[f] = t * t * (3.0f - 2.0f * t);
+        }
+    }
+
+private:
+    static int Lane(uint32_t hand, HandSignal signal)
+    {
+        PVR_MATH_ASSERT(hand < pvrHand_Count && signal < HandSignal_Count);
+        return int(hand) * HandSignal_Count + signal;
+    }
+
+    float Normalize(int lane, float raw) const
+    {
+        const float range = PVRMath_Max(Max[lane] - Min[lane], Params.MinRange);
+        const float low = PVRMath_Min(Min[lane], Max[lane]);
+        return PVRMath_Min(PVRMath_Max((raw - low) / range, 0.0f), 1.0f);
+    }
+
+    // Calibration, One-Euro filter and derivative of every lane; SSE2 and scalar code
+    // give identical results. Values within settleEpsilon of their target snap to it, and
+    // velocities below it to 0: a finger at rest would otherwise decay into denormals,
+    // which cost an order of magnitude per update on x86.
+    void Step(const float* raw, float dt)
+    {
+        using namespace HandSignalDetail;
+
+        // alpha = 1 / (1 + tau / dt) with tau = 1 / (2 pi cutoff), i.e. w / (w + 1) with
+        // w = 2 pi cutoff dt.
+        const float twoPiDt = 2.0f * MATH_FLOAT_PI * dt;
+        const float rcpDt = 1.0f / dt;
+        const float derivativeW = twoPiDt * Params.DerivativeCutoff;
+        const float derivativeAlpha = derivativeW / (derivativeW + 1.0f);
+        const float settleEpsilon = 1e-6f;  // Far below the resolution of the analog inputs.
+        int l = 0;
+
+#if PVR_SIMD_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 minRange = _mm_set1_ps(Params.MinRange);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 settle = _mm_set1_ps(settleEpsilon);
+        for (; l + 4 <= Lanes; l += 4)
+        {
+            const __m128 x = _mm_loadu_ps(raw + l);
+            const __m128 lo = _mm_loadu_ps(Min + l);
+            const __m128 hi = _mm_loadu_ps(Max + l);
+            const __m128 range = _mm_max_ps(_mm_sub_ps(hi, lo), minRange);
+            const __m128 normalized = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(x, _mm_min_ps(lo, hi)), range), zero), one);
+
+            const __m128 value = _mm_loadu_ps(Value + l);
+            __m128 velocity = _mm_loadu_ps(Velocity + l);
+            const __m128 rawVelocity = _mm_mul_ps(_mm_sub_ps(normalized, value), _mm_set1_ps(rcpDt));
+            velocity = _mm_add_ps(velocity, _mm_mul_ps(_mm_sub_ps(rawVelocity, velocity), _mm_set1_ps(derivativeAlpha)));
+
+            const __m128 cutoff = _mm_add_ps(_mm_set1_ps(Params.MinCutoff), _mm_mul_ps(_mm_set1_ps(Params.Beta), _mm_and_ps(velocity, absMask)));
+            const __m128 w = _mm_mul_ps(_mm_set1_ps(twoPiDt), cutoff);
+            const __m128 alpha = _mm_div_ps(w, _mm_add_ps(w, one));
+            const __m128 filtered = _mm_add_ps(value, _mm_mul_ps(_mm_sub_ps(normalized, value), alpha));
+            const __m128 settled = _mm_cmplt_ps(_mm_and_ps(_mm_sub_ps(normalized, filtered), absMask), settle);
+            const __m128 stopped = _mm_cmplt_ps(_mm_and_ps(velocity, absMask), settle);
+            _mm_storeu_ps(Value + l, _mm_or_ps(_mm_and_ps(settled, normalized), _mm_andnot_ps(settled, filtered)));
+            _mm_storeu_ps(Velocity + l, _mm_andnot_ps(stopped, velocity));
+            _mm_storeu_ps(Raw + l, x);
+        }
+#endif
+
+        for (; l < Lanes; l++)
+        {
+            const float range = PVRMath_Max(Max[l] - Min[l], Params.MinRange);
+            const float normalized = PVRMath_Min(PVRMath_Max((raw[l] - PVRMath_Min(Min[l], Max[l])) / range, 0.0f), 1.0f);
+            const float rawVelocity = (normalized - Value[l]) * rcpDt;
+            Velocity[l] = Velocity[l] + (rawVelocity - Velocity[l]) * derivativeAlpha;
+            const float w = twoPiDt * (Params.MinCutoff + Params.Beta * fabsf(Velocity[l]));
+            Value[l] = Value[l] + (normalized - Value[l]) * (w / (w + 1.0f));
+            if (fabsf(normalized - Value[l]) < settleEpsilon)
+                Value[l] = normalized;
+            if (fabsf(Velocity[l]) < settleEpsilon)
+                Velocity[l] = 0.0f;
+            Raw[l] = raw[l];
+        }
+    }
+
+    HandSignalParams Params;
+    float            Min[HandSignalDetail::Lanes];
+    float            Max[HandSignalDetail::Lanes];
+    float            Raw[HandSignalDetail::Lanes];
+    float            Value[HandSignalDetail::Lanes];
+    float            Velocity[HandSignalDetail::Lanes];
+    double           LastTime;
+    bool             Initialized;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,427 @@
+/************************************************************************************
+
+Filename    :   PVR_Haptics.h
+Content     :   Mixing of concurrent haptic effects into rate limited pulses.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Haptics_h
+#define PVR_Haptics_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Threading.h"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** HapticEnvelope
+//
+// Amplitude over time, linear between points. Times are seconds from the start of the
+// effect, in increasing order; the effect ends at the last point.
+//
+// Example usage:
+//     HapticEnvelope hit = HapticEnvelope::ADSR(1.0f, 0.4f, 0.01, 0.03, 0.1, 0.05);
+
+struct HapticPoint
+{
+    double Time;
+    float  Amplitude;
+};
+
+struct HapticEnvelope
+{
+    std::vector<HapticPoint> Points;
+
+    void AddPoint(double time, float amplitude)
+    {
+        PVR_MATH_ASSERT(Points.empty() || time >= Points.back().Time);
+        const HapticPoint point = { time, PVRMath_Min(PVRMath_Max(amplitude, 0.0f), 1.0f) };
+        Points.push_back(point);
+    }
+
+    double GetDuration() const { return Points.empty() ? 0.0 : Points.back().Time; }
+
+    float Evaluate(double time) const
+    {
+        if (Points.empty() || time < Points.front().Time || time > Points.back().Time)
+            return 0.0f;
+        size_t i = 1;
+        while (i < Points.size() && Points[i].Time < time)
+            i++;
+        if (i == Points.size())
+            return Points.back().Amplitude;
+        const HapticPoint& a = Points[i - 1];
+        const HapticPoint& b = Points[i];
+        const double span = b.Time - a.Time;
+        const float t = (span > 0.0) ? float((time - a.Time) / span) : 1.0f;
+        return a.Amplitude + (b.Amplitude - a.Amplitude) * t;
+    }
+
+    static HapticEnvelope Constant(float amplitude, double duration)
+    {
+        HapticEnvelope result;
+        result.AddPoint(0.0, amplitude);
+        result.AddPoint(duration, amplitude);
+        return result;
+    }
+
+    static HapticEnvelope Ramp(float from, float to, double duration)
+    {
+        HapticEnvelope result;
+        result.AddPoint(0.0, from);
+        result.AddPoint(duration, to);
+        return result;
+    }
+
+    static HapticEnvelope ADSR(float peak, float sustain, double attack, double decay, double hold, double release)
+    {
+        HapticEnvelope result;
+        result.AddPoint(0.0, 0.0f);
+        result.AddPoint(attack, peak);
+        result.AddPoint(attack + decay, sustain);
+        result.AddPoint(attack + decay + hold, sustain);
+        result.AddPoint(attack + decay + hold + release, 0.0f);
+        return result;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** HapticParams
+
+enum HapticMixMode
+{
+    HapticMix_Max,  // Strongest effect wins; effects do not pile up to saturation.
+    HapticMix_Sum,  // Amplitudes add, clamped to 1.
+};
+
+struct HapticParams
+{
+    double        UpdateRate;           // Hz; resolution of the mixed envelopes.
+    double        MinSubmitInterval;    // Seconds between two pulses to one device.
+    double        MaxPulseDuration;     // Seconds; longer stretches are split.
+    float         Tolerance;            // Amplitude change that starts a new pulse.
+    HapticMixMode Mix;
+
+    HapticParams()
+        : UpdateRate(500.0), MinSubmitInterval(0.01), MaxPulseDuration(0.25), Tolerance(0.05f), Mix(HapticMix_Max)
+    { }
+};
+
+// Receives the pulses to play. Each pulse replaces the one playing on the device.
+typedef std::function<pvrResult(pvrTrackedDeviceType device, float amplitude, float durationSeconds)> HapticPulseSink;
+
+inline HapticPulseSink MakeHapticPulseSink(pvrSessionHandle session)
+{
+    return [session](pvrTrackedDeviceType device, float amplitude, float durationSeconds)
+    {
+        return pvr_triggerHapticPulse(session, device, amplitude, durationSeconds, 0.0f);
+    };
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** HapticMixer
+//
+// Mixes the effects playing on each device and resamples the result into as few pulses
+// as possible: at every Update() a device whose pulse is running out, or whose effects
+// changed, gets one pulse covering the longest stretch ahead in which the mixed amplitude
+// stays within Tolerance of its start. Pulses to one device are at least
+// MinSubmitInterval apart. Silence costs nothing, except for one zero pulse to cut a
+// running pulse short.
+//
+// Not thread safe and driven by explicit times; HapticEngine adds the thread and clock.
+
+class HapticMixer
+{
+public:
+    explicit HapticMixer(const HapticParams& params = HapticParams())
+        : Params(params), NextId(1), Submitted(0)
+    {
+        PVR_MATH_ASSERT(params.UpdateRate > 0.0 && params.MaxPulseDuration > 0.0);
+    }
+
+    // Starts an effect at startTime with its amplitudes scaled by gain. Returns its id.
+    uint32_t Play(pvrTrackedDeviceType device, const HapticEnvelope& envelope, double startTime, float gain = 1.0f)
+    {
+        Effect effect;
+        effect.Id = NextId++;
+        if (NextId == 0)
+            NextId = 1;
+        effect.Envelope = envelope;
+        effect.Start = startTime;
+        effect.Gain = gain;
+        Device& target = GetDevice(device);
+        target.Effects.push_back(effect);
+        target.Dirty = true;
+        return effect.Id;
+    }
+
+    // Returns false if the effect already ended.
+    bool Stop(uint32_t id)
+    {
+        for (size_t d = 0; d < Devices.size(); d++)
+        {
+            std::vector<Effect>& effects = Devices[d].Effects;
+            for (size_t i = 0; i < effects.size(); i++)
+            {
+                if (effects[i].Id == id)
+                {
+                    effects.erase(effects.begin() + i);
+                    Devices[d].Dirty = true;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void StopDevice(pvrTrackedDeviceType device)
+    {
+        Device& target = GetDevice(device);
+        target.Effects.clear();
+        target.Dirty = true;
+    }
+
+    // Mixed amplitude of a device at time.
+    float GetAmplitude(pvrTrackedDeviceType device, double time) const
+    {
+        for (size_t d = 0; d < Devices.size(); d++)
+            if (Devices[d].Type == device)
+                return Mix(Devices[d], time);
+        return 0.0f;
+    }
+
+    uint32_t GetActiveEffectCount() const
+    {
+        size_t count = 0;
+        for (size_t d = 0; d < Devices.size(); d++)
+            count += Devices[d].Effects.size();
+        return uint32_t(count);
+    }
+
+    // Pulses sent so far.
+    uint32_t GetSubmittedCount() const { return Submitted; }
+
+    void Update(double now, const HapticPulseSink& sink)
+    {
+        const double step = 1.0 / Params.UpdateRate;
+        const int maxSteps = PVRMath_Max(int(Params.MaxPulseDuration * Params.UpdateRate + 0.5), 1);
+
+        for (size_t d = 0; d < Devices.size(); d++)
+        {
+            Device& device = Devices[d];
+            RemoveEnded(&device, now);
+            if (now < device.NextAllowed)
+                continue;
+            // Keep the running pulse until it is about to end.
+            if (!device.Dirty && now < device.PlanEnd - 0.5 * step)
+                continue;
+
+            const float first = Mix(device, now);
+            float sum = first;
+            int steps = 1;
+            while (steps < maxSteps)
+            {
+                const float next = Mix(device, now + steps * step);
+                if (fabsf(next - first) > Params.Tolerance || ((next > 0.0f) != (first > 0.0f)))
+                    break;
+                sum += next;
+                steps++;
+            }
+            const float amplitude = sum / float(steps);
+            const double duration = steps * step;
+            device.Dirty = false;
+            device.PlanEnd = now + duration;
+
+            if (amplitude <= 0.0f)
+            {
+                // A pulse that ends within a step is left to run out.
+                if (device.PulseEnd <= now + step)
+                    continue;
+                // Cut the running pulse.
+                sink(device.Type, 0.0f, float(step));
+                device.PulseEnd = now;
+            }
+            else
+            {
+                sink(device.Type, amplitude, float(duration));
+                device.PulseEnd = device.PlanEnd;
+            }
+            device.NextAllowed = now + Params.MinSubmitInterval;
+            Submitted++;
+        }
+    }
+
+private:
+    struct Effect
+    {
+        uint32_t       Id;
+        HapticEnvelope Envelope;
+        double         Start;
+        float          Gain;
+    };
+
+    struct Device
+    {
+        pvrTrackedDeviceType Type;
+        std::vector<Effect>  Effects;
+        double               PlanEnd;       // Time covered by the last plan.
+        double               PulseEnd;      // End of the last pulse sent.
+        double               NextAllowed;
+        bool                 Dirty;
+    };
+
+    Device& GetDevice(pvrTrackedDeviceType type)
+    {
+        for (size_t d = 0; d < Devices.size(); d++)
+            if (Devices[d].Type == type)
+                return Devices[d];
+        Device device;
+        device.Type = type;
+        device.PlanEnd = device.PulseEnd = device.NextAllowed = 0.0;
+        device.Dirty = false;
+        Devices.push_back(device);
+        return Devices.back();
+    }
+
+    float Mix(const Device& device, double time) const
+    {
+        float result = 0.0f;
+        for (size_t i = 0; i < device.Effects.size(); i++)
+        {
+            const Effect& effect = device.Effects[i];
+            const float amplitude = effect.Envelope.Evaluate(time - effect.Start) * effect.Gain;
+            result = (Params.Mix == HapticMix_Max) ? PVRMath_Max(result, amplitude) : result + amplitude;
+        }
+        return PVRMath_Min(result, 1.0f);
+    }
+
+    static void RemoveEnded(Device* device, double now)
+    {
+        std::vector<Effect>& effects = device->Effects;
+        size_t kept = 0;
+        for (size_t i = 0; i < effects.size(); i++)
+        {
+            if (effects[i].Start + effects[i].Envelope.GetDuration() >= now)
+            {
+                if (kept != i)
+                    effects[kept] = effects[i];
+                kept++;
+            }
+        }
+        effects.resize(kept);
+    }
+
+    HapticParams        Params;
+    std::vector<Device> Devices;
+    uint32_t            NextId;
+    uint32_t            Submitted;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** HapticEngine
+//
+// Thread safe front end of a HapticMixer: game systems Play() effects from any thread, and
+// a single PollingThread at UpdateRate submits the mixed pulses, so overlapping effects no
+// longer overwrite each other and the runtime sees one rate limited stream per device.
+//
+// Example usage:
+//     HapticEngine haptics(MakeHapticPulseSink(session));
+//     haptics.Start();
+//     haptics.Play(pvrTrackedDevice_RightController, HapticEnvelope::Constant(0.6f, 0.05));
+
+class HapticEngine
+{
+public:
+    explicit HapticEngine(const HapticPulseSink& sink, const HapticParams& params = HapticParams())
+        : Sink(sink), Mixer(params), UpdateRate(params.UpdateRate), Epoch(Clock::now())
+    { }
+
+    ~HapticEngine() { Stop(); }
+
+    bool Start() { return Thread.Start([this]() { Update(); }, 1.0 / UpdateRate); }
+
+    void Stop() { Thread.Stop(); }
+
+    // Starts an effect after delay seconds. Returns its id for StopEffect().
+    uint32_t Play(pvrTrackedDeviceType device, const HapticEnvelope& envelope, float gain = 1.0f, double delay = 0.0)
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        return Mixer.Play(device, envelope, GetTime() + delay, gain);
+    }
+
+    bool StopEffect(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        return Mixer.Stop(id);
+    }
+
+    void StopDevice(pvrTrackedDeviceType device)
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        Mixer.StopDevice(device);
+    }
+
+    uint32_t GetActiveEffectCount() const
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        return Mixer.GetActiveEffectCount();
+    }
+
+    uint32_t GetSubmittedCount() const
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        return Mixer.GetSubmittedCount();
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double GetTime() const { return std::chrono::duration<double>(Clock::now() - Epoch).count(); }
+
+    struct Pulse
+    {
+        pvrTrackedDeviceType Device;
+        float                Amplitude;
+        float                Duration;
+    };
+
+    // Pulses are collected under the lock and sent after it, so Play() never waits on
+    // the runtime.
+    void Update()
+    {
+        Pending.clear();
+        {
+            std::lock_guard<std::mutex> lock(Lock);
+            Mixer.Update(GetTime(), [this](pvrTrackedDeviceType device, float amplitude, float duration)
+            {
+                const Pulse pulse = { device, amplitude, duration };
+                Pending.push_back(pulse);
+                return pvr_success;
+            });
+        }
+        for (size_t i = 0; i < Pending.size(); i++)
+            Sink(Pending[i].Device, Pending[i].Amplitude, Pending[i].Duration);
+    }
+
+    HapticPulseSink    Sink;
+    HapticMixer        Mixer;
+    double             UpdateRate;
+    Clock::time_point  Epoch;
+    mutable std::mutex Lock;
+    std::vector<Pulse> Pending;
+    PollingThread      Thread;
+};
+
+
+} // Namespace PVR
+
+#endif
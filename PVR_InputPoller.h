@@ -0,0 +1,262 @@
+/************************************************************************************
+
+Filename    :   PVR_InputPoller.h
+Content     :   High rate controller input polling into timestamped events.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_InputPoller_h
+#define PVR_InputPoller_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Threading.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** InputEvent
+
+enum InputEventType
+{
+    InputEvent_Press,       // Button bit set in HandButtons.
+    InputEvent_Release,
+    InputEvent_TouchBegin,  // Button bit set in HandTouches.
+    InputEvent_TouchEnd,
+    InputEvent_AxisAbove,   // Axis reached its Press threshold.
+    InputEvent_AxisBelow,   // Axis fell back to its Release threshold.
+};
+
+enum InputAxis
+{
+    InputAxis_Trigger,
+    InputAxis_Grip,
+    InputAxis_TouchPadX,
+    InputAxis_TouchPadY,
+    InputAxis_JoyStickX,
+    InputAxis_JoyStickY,
+    InputAxis_GripForce,
+    InputAxis_TouchPadForce,
+    InputAxis_FingerIndex,
+    InputAxis_FingerMiddle,
+    InputAxis_FingerRing,
+    InputAxis_FingerPinky,
+    InputAxis_Count
+};
+
+struct InputEvent
+{
+    InputEventType Type;
+    uint32_t       Hand;            // 0 left, 1 right.
+    uint32_t       Button;          // pvrButton bit; press and touch events only.
+    InputAxis      Axis;            // Axis events only.
+    float          Value;           // Axis value at the event.
+    double         TimeInSeconds;   // Runtime time of the snapshot that showed the change.
+};
+
+// Axis value of one hand in a snapshot.
+inline float GetInputAxis(const pvrInputState& state, uint32_t hand, InputAxis axis)
+{
+    switch (axis)
+    {
+    case InputAxis_Trigger:         return state.Trigger[hand];
+    case InputAxis_Grip:            return state.Grip[hand];
+    case InputAxis_TouchPadX:       return state.TouchPad[hand].x;
+    case InputAxis_TouchPadY:       return state.TouchPad[hand].y;
+    case InputAxis_JoyStickX:       return state.JoyStick[hand].x;
+    case InputAxis_JoyStickY:       return state.JoyStick[hand].y;
+    case InputAxis_GripForce:       return state.GripForce[hand];
+    case InputAxis_TouchPadForce:   return state.TouchPadForce[hand];
+    case InputAxis_FingerIndex:     return state.fingerIndex[hand];
+    case InputAxis_FingerMiddle:    return state.fingerMiddle[hand];
+    case InputAxis_FingerRing:      return state.fingerRing[hand];
+    case InputAxis_FingerPinky:     return state.fingerPinky[hand];
+    default:                        return 0.0f;
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** InputPoller
+//
+// Polls getInputState on a dedicated thread at a kHz rate and turns the differences
+// between successive snapshots into events, so short presses between two render frames
+// are not lost and carry the time they were seen rather than the time the game looked.
+//
+// Events go through an SPSCQueue: one consumer thread calls PopEvent(). When the consumer
+// falls behind and the queue is full, new events are dropped and counted.
+//
+// Axis thresholds use hysteresis: AxisAbove fires when the value reaches Press, and
+// AxisBelow when it falls back to Release (Release < Press). For axes that go negative
+// (e.g. JoyStickY pushed down) negate both thresholds: Press < Release then fires
+// AxisAbove when the value falls to Press.
+//
+// Example usage:
+//     InputPoller input;
+//     input.AddAxisThreshold(InputAxis_Trigger, 0.8f, 0.7f);
+//     input.Start(session, 1000.0);
+//     ...
+//     InputEvent event;
+//     while (input.PopEvent(&event))
+//         if (event.Type == InputEvent_Press && event.Button == pvrButton_A)
+//             Jump(event.Hand, event.TimeInSeconds);
+
+class InputPoller
+{
+public:
+    explicit InputPoller(uint32_t queueCapacity = 1024)
+        : Events(queueCapacity), Session(nullptr), HasPrevious(false), Dropped(0)
+    {
+        memset(&Previous, 0, sizeof(Previous));
+        memset(&Latest, 0, sizeof(Latest));
+    }
+
+    ~InputPoller() { Stop(); }
+
+    // Adds an axis threshold for both hands. Call before Start().
+    void AddAxisThreshold(InputAxis axis, float press, float release)
+    {
+        PVR_MATH_ASSERT(!Thread.IsRunning());
+        const Threshold threshold = { axis, press, release, { false, false } };
+        Thresholds.push_back(threshold);
+    }
+
+    bool Start(pvrSessionHandle session, double rateHz = 1000.0)
+    {
+        if (!session || rateHz <= 0.0)
+            return false;
+        Session = session;
+        return Thread.Start([this]() { Poll(); }, 1.0 / rateHz);
+    }
+
+    void Stop() { Thread.Stop(); }
+
+    bool IsRunning() const { return Thread.IsRunning(); }
+
+    // Consumer side. Returns false when no event is pending.
+    bool PopEvent(InputEvent* event) { return Events.Pop(event); }
+
+    // Newest snapshot. Returns false before the first successful poll.
+    bool GetLatestState(pvrInputState* outState) const
+    {
+        std::lock_guard<std::mutex> lock(LatestLock);
+        if (!HasPrevious)
+            return false;
+        *outState = Latest;
+        return true;
+    }
+
+    // Events lost because the queue was full.
+    uint32_t GetDroppedCount() const { return Dropped; }
+
+    // Diffs a snapshot against the previous one and queues the events. Start() calls this
+    // from the polling thread; call it directly only when not started (e.g. to replay
+    // recorded states). The first snapshot only sets the reference state.
+    void Process(const pvrInputState& state, double time)
+    {
+        if (HasPrevious)
+        {
+            for (uint32_t hand = 0; hand < 2; hand++)
+            {
+                EmitBits(Previous.HandButtons[hand], state.HandButtons[hand], hand, time,
+                         InputEvent_Press, InputEvent_Release);
+                EmitBits(Previous.HandTouches[hand], state.HandTouches[hand], hand, time,
+                         InputEvent_TouchBegin, InputEvent_TouchEnd);
+                EmitAxes(state, hand, time);
+            }
+        }
+        else
+        {
+            // Start axis states from the first snapshot so held axes do not fire.
+            for (size_t i = 0; i < Thresholds.size(); i++)
+                for (uint32_t hand = 0; hand < 2; hand++)
+                    Thresholds[i].Above[hand] = IsAbove(Thresholds[i], GetInputAxis(state, hand, Thresholds[i].Axis), false);
+        }
+
+        Previous = state;
+        std::lock_guard<std::mutex> lock(LatestLock);
+        Latest = state;
+        HasPrevious = true;
+    }
+
+private:
+    struct Threshold
+    {
+        InputAxis Axis;
+        float     Press;
+        float     Release;
+        bool      Above[2];
+    };
+
+    void Poll()
+    {
+        pvrInputState state;
+        if (pvr_getInputState(Session, &state) != pvr_success)
+            return;
+        // Timestamp by the runtime's own clock if the snapshot carries no time.
+        const double time = (state.TimeInSeconds > 0.0) ? state.TimeInSeconds : pvr_getTimeSeconds(Session->envh);
+        Process(state, time);
+    }
+
+    static bool IsAbove(const Threshold& threshold, float value, bool wasAbove)
+    {
+        const bool rising = threshold.Press >= threshold.Release;
+        if (wasAbove)
+            return rising ? (value > threshold.Release) : (value < threshold.Release);
+        return rising ? (value >= threshold.Press) : (value <= threshold.Press);
+    }
+
+    void Push(const InputEvent& event)
+    {
+        if (!Events.Push(event))
+            Dropped++;
+    }
+
+    void EmitBits(uint32_t before, uint32_t after, uint32_t hand, double time,
+                  InputEventType setType, InputEventType clearType)
+    {
+        uint32_t changed = before ^ after;
+        while (changed)
+        {
+            const uint32_t bit = changed & (~changed + 1);
+            changed &= ~bit;
+            const InputEvent event = { (after & bit) ? setType : clearType, hand, bit, InputAxis_Count, 0.0f, time };
+            Push(event);
+        }
+    }
+
+    void EmitAxes(const pvrInputState& state, uint32_t hand, double time)
+    {
+        for (size_t i = 0; i < Thresholds.size(); i++)
+        {
+            Threshold& threshold = Thresholds[i];
+            const float value = GetInputAxis(state, hand, threshold.Axis);
+            const bool above = IsAbove(threshold, value, threshold.Above[hand]);
+            if (above == threshold.Above[hand])
+                continue;
+            threshold.Above[hand] = above;
+            const InputEvent event = { above ? InputEvent_AxisAbove : InputEvent_AxisBelow, hand, 0, threshold.Axis, value, time };
+            Push(event);
+        }
+    }
+
+    SPSCQueue<InputEvent>   Events;
+    std::vector<Threshold>  Thresholds;
+    pvrSessionHandle        Session;
+    pvrInputState           Previous;
+    pvrInputState           Latest;
+    mutable std::mutex      LatestLock;
+    bool                    HasPrevious;
+    std::atomic<uint32_t>   Dropped;
+    PollingThread           Thread;
+};
+
+
+} // Namespace PVR
+
+#endif
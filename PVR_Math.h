@@ -191,6 +191,7 @@ template<class T> class Matrix3;
 template<class T> class Matrix4;
 template<class T> class Pose;
 template<class T> class PoseState;
+template<class T> class DualQuat;
 
 // CompatibleTypes::Type is used to lookup a compatible C-version of a C++ class.
 template<class C>
@@ -248,6 +249,7 @@ public:
 #define MATH_DOUBLE_PIOVER2         (0.5*MATH_DOUBLE_PI)
 #define MATH_DOUBLE_PIOVER4         (0.25*MATH_DOUBLE_PI)
 #define MATH_FLOAT_MAXVALUE             (FLT_MAX) 
+#define MATH_DOUBLE_MAXVALUE            (DBL_MAX)
 
 #define MATH_DOUBLE_RADTODEGREEFACTOR (360.0 / MATH_DOUBLE_TWOPI)
 #define MATH_DOUBLE_DEGREETORADFACTOR (MATH_DOUBLE_TWOPI / 360.0)
@@ -295,6 +297,7 @@ class Math<float>
 public:
      typedef double OtherFloatType;
 	 static inline float Pi() { return MATH_FLOAT_PI; };
+    static inline float MaxValue()          { return MATH_FLOAT_MAXVALUE; };
     static inline float Tolerance()         { return MATH_FLOAT_TOLERANCE; }; // a default number for value equality tolerance
     static inline float SingularityRadius() { return MATH_FLOAT_SINGULARITYRADIUS; };    // for gimbal lock numerical problems    
 };
@@ -306,6 +309,7 @@ class Math<double>
 public:
     typedef float OtherFloatType;
 	static inline double Pi() { return MATH_DOUBLE_PI; };
+    static inline double MaxValue()          { return MATH_DOUBLE_MAXVALUE; };
     static inline double Tolerance()         { return MATH_DOUBLE_TOLERANCE; }; // a default number for value equality tolerance
     static inline double SingularityRadius() { return MATH_DOUBLE_SINGULARITYRADIUS; };    // for gimbal lock numerical problems    
 };
@@ -911,8 +915,8 @@ public:
 
     void Clear()
     {
-        b[0].x = b[0].y = b[0].z = Math<T>::MaxValue;
-        b[1].x = b[1].y = b[1].z = -Math<T>::MaxValue;
+        b[0].x = b[0].y = b[0].z = Math<T>::MaxValue();
+        b[1].x = b[1].y = b[1].z = -Math<T>::MaxValue();
     }
 
     void AddPoint( const Vector3<T> & v )
@@ -925,6 +929,14 @@ public:
         b[1].z = (v.z < b[1].z ? b[1].z : v.z);
     }
 
+    bool IsEmpty() const
+    {
+        return b[0].x > b[1].x || b[0].y > b[1].y || b[0].z > b[1].z;
+    }
+
+    Vector3<T> GetCenter() const  { return (b[0] + b[1]) * T(0.5); }
+    Vector3<T> GetExtents() const { return (b[1] - b[0]) * T(0.5); }
+
     const Vector3<T> & GetMins() const { return b[0]; }
     const Vector3<T> & GetMaxs() const { return b[1]; }
 
@@ -1745,6 +1757,7 @@ public:
         : Rotation(orientation), Translation(pos) {  }
     Pose(const Pose& s)
         : Rotation(s.Rotation), Translation(s.Translation) {  }
+    Pose& operator=(const Pose& s) = default;
     Pose(const Matrix3<T>& R, const Vector3<T>& t)
         : Rotation((Quat<T>)R), Translation(t) {  }
     Pose(const CompatibleType& s)
@@ -1754,7 +1767,7 @@ public:
         : Rotation(s.Rotation), Translation(s.Translation)
     {
         // Ensure normalized rotation if converting from float to double
-        if (sizeof(T) > sizeof(Math<T>::OtherFloatType))
+        if (sizeof(T) > sizeof(typename Math<T>::OtherFloatType))
             Rotation.Normalize();
     }
 
@@ -1873,6 +1886,178 @@ typedef Pose<double> Posed;
 
 PVR_MATH_STATIC_ASSERT((sizeof(Posed) == sizeof(Quatd) + sizeof(Vector3d)), "sizeof(Posed) failure");
 PVR_MATH_STATIC_ASSERT((sizeof(Posef) == sizeof(Quatf) + sizeof(Vector3f)), "sizeof(Posef) failure");
+
+
+//-------------------------------------------------------------------------------------
+// ***** DualQuat
+//
+// Unit dual quaternion representing a rigid transform: Real holds the rotation and
+// Dual holds 0.5 * (t, 0) * Real, where t is the translation.
+//
+// Dual quaternions blend rigid transforms without the volume loss ("candy wrapper")
+// of linearly blended matrices, and take 8 values instead of 12, which makes them
+// the preferred palette format for skinning hand and controller meshes.
+//
+// Multiplications are done in right-to-left order, matching Pose and Matrix4.
+template<class T>
+class DualQuat
+{
+public:
+    typedef T ElementType;
+
+    Quat<T> Real;
+    Quat<T> Dual;
+
+    DualQuat() : Real(0, 0, 0, 1), Dual(0, 0, 0, 0) { }
+    DualQuat(const Quat<T>& real, const Quat<T>& dual) : Real(real), Dual(dual) { }
+    DualQuat(const Quat<T>& rotation, const Vector3<T>& translation)
+        : Real(rotation), Dual(Quat<T>(translation.x, translation.y, translation.z, 0) * rotation * T(0.5)) { }
+    explicit DualQuat(const Pose<T>& p)
+        : Real(p.Rotation), Dual(Quat<T>(p.Translation.x, p.Translation.y, p.Translation.z, 0) * p.Rotation * T(0.5)) { }
+    explicit DualQuat(const DualQuat<typename Math<T>::OtherFloatType> &src)
+        : Real(src.Real), Dual(src.Dual) { }
+
+    static DualQuat Identity() { return DualQuat(); }
+
+    Vector3<T> GetTranslation() const
+    {
+        // t = 2 * Dual * Conj(Real)
+        Quat<T> t = Dual * Real.Conj();
+        return Vector3<T>(t.x * T(2), t.y * T(2), t.z * T(2));
+    }
+
+    Quat<T> GetRotation() const { return Real; }
+
+    Pose<T> ToPose() const { return Pose<T>(Real, GetTranslation()); }
+
+    bool IsEqual(const DualQuat& b, T tolerance = Math<T>::Tolerance()) const
+    {
+        return ToPose().IsEqual(b.ToPose(), tolerance);
+    }
+
+    DualQuat  operator+  (const DualQuat& b) const { return DualQuat(Real + b.Real, Dual + b.Dual); }
+    DualQuat& operator+= (const DualQuat& b)       { Real += b.Real; Dual += b.Dual; return *this; }
+    DualQuat  operator*  (T s) const               { return DualQuat(Real * s, Dual * s); }
+    DualQuat& operator*= (T s)                     { Real *= s; Dual *= s; return *this; }
+
+    // Composition; applies b first, then *this.
+    DualQuat operator* (const DualQuat& b) const
+    {
+        return DualQuat(Real * b.Real, Real * b.Dual + Dual * b.Real);
+    }
+
+    T Dot(const DualQuat& b) const { return Real.Dot(b.Real); }
+
+    // Quaternion conjugate of both parts. Produces the inverse transform if normalized.
+    DualQuat Conj() const     { return DualQuat(Real.Conj(), Dual.Conj()); }
+    DualQuat Inverted() const { return DualQuat(Real.Conj(), Dual.Conj()); }
+
+    bool IsNormalized() const
+    {
+        return Real.IsNormalized() && fabs(Real.Dot(Dual)) < Math<T>::Tolerance();
+    }
+
+    // Scales to a unit real part and removes the component of Dual along Real,
+    // so that the result is again a rigid transform.
+    void Normalize()
+    {
+        T lenSq = Real.LengthSq();
+        if (lenSq == T(0))
+            return;
+        T rcpLen = T(1) / sqrt(lenSq);
+        Real *= rcpLen;
+        Dual *= rcpLen;
+        Dual -= Real * Real.Dot(Dual);
+    }
+
+    DualQuat Normalized() const
+    {
+        DualQuat result(*this);
+        result.Normalize();
+        return result;
+    }
+
+    // Transforms a point; same result as ToPose().Transform(v).
+    Vector3<T> Transform(const Vector3<T>& v) const
+    {
+        return Real.Rotate(v) + GetTranslation();
+    }
+
+    // Rotates a direction, ignoring translation.
+    Vector3<T> Rotate(const Vector3<T>& v) const
+    {
+        return Real.Rotate(v);
+    }
+
+    // Dual quaternion linear blending (DLB) of count transforms.
+    // Each input is flipped into the hemisphere of the first one before accumulation,
+    // then the sum is normalized. Weights do not need to be normalized.
+    static DualQuat Blend(const DualQuat* dq, const T* weights, int count)
+    {
+        PVR_MATH_ASSERT(count > 0);
+        DualQuat sum(Quat<T>(0, 0, 0, 0), Quat<T>(0, 0, 0, 0));
+        for (int i = 0; i < count; i++)
+        {
+            T w = (dq[0].Real.Dot(dq[i].Real) < T(0)) ? -weights[i] : weights[i];
+            sum.Real += dq[i].Real * w;
+            sum.Dual += dq[i].Dual * w;
+        }
+        return sum.Normalized();
+    }
+
+    // Normalized linear interpolation; cheap approximation of ScLerp for nearby transforms.
+    DualQuat Lerp(const DualQuat& b, T s) const
+    {
+        T sb = (Real.Dot(b.Real) < T(0)) ? -s : s;
+        DualQuat result(Real * (T(1) - s) + b.Real * sb, Dual * (T(1) - s) + b.Dual * sb);
+        return result.Normalized();
+    }
+
+    // Screw linear interpolation: constant speed rotation about and translation along
+    // the screw axis between *this and b. Both inputs must be normalized.
+    DualQuat ScLerp(const DualQuat& b, T s) const
+    {
+        DualQuat delta = Inverted() * b;
+        if (delta.Real.w < T(0))
+            delta = delta * T(-1);
+        return *this * delta.Pow(s);
+    }
+
+    // Raises a unit dual quaternion to a real power by scaling its screw parameters.
+    DualQuat Pow(T p) const
+    {
+        T sinHalf = sqrt(Real.x * Real.x + Real.y * Real.y + Real.z * Real.z);
+        if (sinHalf < Math<T>::SingularityRadius())
+        {
+            // Pure translation: scale the dual part.
+            return DualQuat(Quat<T>(0, 0, 0, 1), Quat<T>(Dual.x * p, Dual.y * p, Dual.z * p, 0));
+        }
+
+        T cosHalf = Real.w;
+        T halfAngle = atan2(sinHalf, cosHalf);
+        T rcpSin = T(1) / sinHalf;
+
+        // Screw axis direction l, moment m and pitch d.
+        Vector3<T> l(Real.x * rcpSin, Real.y * rcpSin, Real.z * rcpSin);
+        T d = T(-2) * Dual.w * rcpSin;
+        Vector3<T> m = (Vector3<T>(Dual.x, Dual.y, Dual.z) - l * (d * T(0.5) * cosHalf)) * rcpSin;
+
+        halfAngle *= p;
+        d *= p;
+        T sinP = sin(halfAngle);
+        T cosP = cos(halfAngle);
+
+        Vector3<T> dualV = m * sinP + l * (d * T(0.5) * cosP);
+        return DualQuat(Quat<T>(l.x * sinP, l.y * sinP, l.z * sinP, cosP),
+                        Quat<T>(dualV.x, dualV.y, dualV.z, -d * T(0.5) * sinP));
+    }
+};
+
+typedef DualQuat<float>  DualQuatf;
+typedef DualQuat<double> DualQuatd;
+
+PVR_MATH_STATIC_ASSERT((sizeof(DualQuatf) == 8*sizeof(float)), "sizeof(DualQuatf) failure");
+PVR_MATH_STATIC_ASSERT((sizeof(DualQuatd) == 8*sizeof(double)), "sizeof(DualQuatd) failure");
     
 
 //-------------------------------------------------------------------------------------
@@ -2704,6 +2889,8 @@ public:
         M[2][0] = T(0); M[2][1] = T(0); M[2][2] = m33;
     }
 
+    Matrix3(const Matrix3& b) = default;
+
     explicit Matrix3(const Matrix3<typename Math<T>::OtherFloatType> &src)
     {
         for (int i = 0; i < 3; i++)
@@ -3611,7 +3798,7 @@ public:
     Plane(T x, T y, T z, T d) : N(x,y,z), D(d) {}
 
     // construct from a point on the plane and the normal
-    Plane(const Vector3<T>& p, const Vector3<T>& n) : N(n), D(-(p * n)) {}
+    Plane(const Vector3<T>& p, const Vector3<T>& n) : N(n), D(-(p.Dot(n))) {}
 
     // Find the point to plane distance. The sign indicates what side of the plane the point is on (0 = point on plane).
     T TestSide(const Vector3<T>& p) const
@@ -3771,6 +3958,704 @@ struct FovPort
                      PVRMath_Max( a.RightTan, b.RightTan ) );
         return fov;
     }
+
+    // Narrows the Fov to the pvrHiddenAreaMesh_VisibleRectangle returned by getEyeHiddenAreaMesh.
+    // The 4 vertices are UV coordinates over this Fov's render target (origin at top left, +Y down).
+    FovPort ClippedToVisibleRectangle(const pvrVector2f rect[4]) const
+    {
+        float minU = rect[0].x, maxU = rect[0].x, minV = rect[0].y, maxV = rect[0].y;
+        for (int i = 1; i < 4; i++)
+        {
+            minU = PVRMath_Min(minU, rect[i].x); maxU = PVRMath_Max(maxU, rect[i].x);
+            minV = PVRMath_Min(minV, rect[i].y); maxV = PVRMath_Max(maxV, rect[i].y);
+        }
+        const float width  = LeftTan + RightTan;
+        const float height = UpTan + DownTan;
+        return FovPort( UpTan   - minV * height,
+                       -UpTan   + maxV * height,
+                        LeftTan - minU * width,
+                       -LeftTan + maxU * width);
+    }
+};
+
+
+//-----------------------------------------------------------------------------------
+// ***** Frustum
+//
+// Six inward-facing planes bounding a view volume; a point p is inside when
+// Plane.TestSide(p) >= 0 for all planes.
+//
+// Frustums are built in eye space from a FovPort (the eye looks down -Z with +Y up)
+// and moved to world space by the eye pose, e.g. one of the calcEyePoses outputs.
+
+template<class T>
+class Frustum
+{
+public:
+    enum PlaneIndex
+    {
+        Plane_Left = 0,
+        Plane_Right,
+        Plane_Top,
+        Plane_Bottom,
+        Plane_Near,
+        Plane_Far,
+        Plane_Count
+    };
+
+    Plane<T> Planes[Plane_Count];
+
+    Frustum() { }
+
+    // Builds the frustum of an eye. eyeToWorld is the eye pose, znear and zfar are positive distances.
+    static Frustum CreateFromFov(const FovPort& fov, const Pose<T>& eyeToWorld, T znear, T zfar)
+    {
+        Frustum f;
+        f.Planes[Plane_Left]   = Plane<T>(Vector3<T>( T(1),  T(0), -T(fov.LeftTan)).Normalized(),  T(0));
+        f.Planes[Plane_Right]  = Plane<T>(Vector3<T>(-T(1),  T(0), -T(fov.RightTan)).Normalized(), T(0));
+        f.Planes[Plane_Top]    = Plane<T>(Vector3<T>( T(0), -T(1), -T(fov.UpTan)).Normalized(),    T(0));
+        f.Planes[Plane_Bottom] = Plane<T>(Vector3<T>( T(0),  T(1), -T(fov.DownTan)).Normalized(),  T(0));
+        f.Planes[Plane_Near]   = Plane<T>(Vector3<T>( T(0),  T(0), -T(1)), -znear);
+        f.Planes[Plane_Far]    = Plane<T>(Vector3<T>( T(0),  T(0),  T(1)),  zfar);
+        f.Transform(eyeToWorld);
+        return f;
+    }
+
+    // Builds a single frustum containing both eye frustums, for culling once per stereo frame.
+    // Each plane is taken from the eye on its side (left eye for left, top, bottom, near and far)
+    // and then pushed out until the other eye's frustum is inside, which keeps the result
+    // conservative for canted displays.
+    static Frustum CreateStereo(const FovPort fov[2], const Pose<T> eyeToWorld[2], T znear, T zfar)
+    {
+        Frustum eyes[2] = { CreateFromFov(fov[0], eyeToWorld[0], znear, zfar),
+                            CreateFromFov(fov[1], eyeToWorld[1], znear, zfar) };
+        Vector3<T> corners[2][8];
+        eyes[0].GetCorners(corners[0]);
+        eyes[1].GetCorners(corners[1]);
+
+        Frustum f;
+        for (int i = 0; i < Plane_Count; i++)
+        {
+            const int src = (i == Plane_Right) ? 1 : 0;
+            const int other = 1 - src;
+            Plane<T> p = eyes[src].Planes[i];
+            for (int c = 0; c < 8; c++)
+            {
+                T d = p.TestSide(corners[other][c]);
+                if (d < T(0))
+                    p.D -= d;
+            }
+            f.Planes[i] = p;
+        }
+        return f;
+    }
+
+    // Moves the frustum by a rigid transform.
+    void Transform(const Pose<T>& pose)
+    {
+        for (int i = 0; i < Plane_Count; i++)
+        {
+            Vector3<T> n = pose.Rotate(Planes[i].N);
+            Planes[i].D -= n.Dot(pose.Translation);
+            Planes[i].N = n;
+        }
+    }
+
+    // Computes the 8 corners: near plane (TL, TR, BR, BL), then far plane in the same order.
+    // Assumes the frustum was built by CreateFromFov; uses plane intersections.
+    void GetCorners(Vector3<T> corners[8]) const
+    {
+        const int vertical[4]   = { Plane_Top, Plane_Top, Plane_Bottom, Plane_Bottom };
+        const int horizontal[4] = { Plane_Left, Plane_Right, Plane_Right, Plane_Left };
+        for (int c = 0; c < 4; c++)
+        {
+            corners[c]     = Intersect(Planes[Plane_Near], Planes[vertical[c]], Planes[horizontal[c]]);
+            corners[c + 4] = Intersect(Planes[Plane_Far],  Planes[vertical[c]], Planes[horizontal[c]]);
+        }
+    }
+
+    bool TestPoint(const Vector3<T>& p) const
+    {
+        for (int i = 0; i < Plane_Count; i++)
+        {
+            if (Planes[i].TestSide(p) < T(0))
+                return false;
+        }
+        return true;
+    }
+
+    // Returns false if the sphere is entirely outside of one plane.
+    bool TestSphere(const Vector3<T>& center, T radius) const
+    {
+        for (int i = 0; i < Plane_Count; i++)
+        {
+            if (Planes[i].TestSide(center) < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    // Returns false if the box is entirely outside of one plane (tests the corner furthest
+    // along each plane normal). Conservative: may return true for boxes near frustum edges.
+    bool TestBounds(const Bounds3<T>& bounds) const
+    {
+        for (int i = 0; i < Plane_Count; i++)
+        {
+            const Vector3<T>& n = Planes[i].N;
+            Vector3<T> p((n.x >= T(0)) ? bounds.b[1].x : bounds.b[0].x,
+                         (n.y >= T(0)) ? bounds.b[1].y : bounds.b[0].y,
+                         (n.z >= T(0)) ? bounds.b[1].z : bounds.b[0].z);
+            if (Planes[i].TestSide(p) < T(0))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    static Vector3<T> Intersect(const Plane<T>& a, const Plane<T>& b, const Plane<T>& c)
+    {
+        // p = -(Da (Nb x Nc) + Db (Nc x Na) + Dc (Na x Nb)) / (Na . (Nb x Nc))
+        Vector3<T> bc = b.N.Cross(c.N);
+        T denom = a.N.Dot(bc);
+        PVR_MATH_ASSERT(denom != T(0));
+        return (bc * a.D + c.N.Cross(a.N) * b.D + a.N.Cross(b.N) * c.D) * (-T(1) / denom);
+    }
+};
+
+typedef Frustum<float>  Frustumf;
+typedef Frustum<double> Frustumd;
+
+
+//-----------------------------------------------------------------------------------
+// ***** PoseCodec
+//
+// Compact encoding of pvrPosef / pvrPoseStatef samples for recording tracking streams
+// and for passing poses between processes.
+//
+//  - Orientation uses "smallest three" packing: the largest quaternion component is
+//    dropped (its sign is folded into the others) and the remaining three, which lie
+//    in [-1/sqrt(2), 1/sqrt(2)], are quantized to RotationBits each.
+//  - Position is quantized to PositionBits per axis inside TrackingBounds.
+//  - Velocities and accelerations are optional and quantized to DerivativeBits within
+//    +/- their configured maximum.
+//  - Encode() writes a sample as zigzag varint deltas from the previous sample, which
+//    at tracking rates brings a pose to 6-8 bytes (28 bytes raw) and a pose state with
+//    velocities to 14-20 bytes (88 bytes raw).
+//
+// Worst case reconstruction errors for the configured bit widths are available from
+// GetMaxRotationError() and GetMaxPositionError(). For the defaults (12 rotation bits,
+// 16 position bits in a 10 m box) they are 0.0012 rad (0.07 degrees) and 0.13 mm.
+
+struct PoseCodecParams
+{
+    Bounds3f TrackingBounds;            // Positions are clamped to this box.
+    int      RotationBits;              // Bits per smallest-three component, 2..20.
+    int      PositionBits;              // Bits per position axis, 2..24.
+    int      DerivativeBits;            // Bits per velocity / acceleration component, 2..24.
+    float    MaxLinearVelocity;         // Meters per second; 0 drops linear velocity.
+    float    MaxAngularVelocity;        // Radians per second; 0 drops angular velocity.
+    float    MaxLinearAcceleration;     // 0 drops linear acceleration.
+    float    MaxAngularAcceleration;    // 0 drops angular acceleration.
+    double   TimeResolution;            // Seconds per time tick.
+
+    PoseCodecParams()
+        : TrackingBounds(Vector3f(-5.0f, -5.0f, -5.0f), Vector3f(5.0f, 5.0f, 5.0f)),
+          RotationBits(12), PositionBits(16), DerivativeBits(12),
+          MaxLinearVelocity(20.0f), MaxAngularVelocity(40.0f),
+          MaxLinearAcceleration(0.0f), MaxAngularAcceleration(0.0f),
+          TimeResolution(1e-6)
+    { }
+};
+
+// Quantized representation of one sample. Field[] holds the three orientation components,
+// then position, then whichever derivatives are enabled (angular velocity, linear velocity,
+// angular acceleration, linear acceleration), 3 components each.
+struct QuantizedPoseState
+{
+    enum { MaxFields = 18 };
+
+    uint8_t  Largest;           // Index (x, y, z, w) of the dropped quaternion component.
+    uint32_t StatusFlags;
+    int64_t  Time;              // In TimeResolution ticks.
+    int32_t  Field[MaxFields];
+};
+
+class PoseCodec
+{
+public:
+    // Upper bound of bytes written by one Encode() call.
+    enum { MaxEncodedSize = 1 + 10 + 5 + QuantizedPoseState::MaxFields * 5 };
+
+    explicit PoseCodec(const PoseCodecParams& params = PoseCodecParams())
+    {
+        SetParams(params);
+    }
+
+    void SetParams(const PoseCodecParams& params)
+    {
+        PVR_MATH_ASSERT(params.RotationBits >= 2 && params.RotationBits <= 20);
+        PVR_MATH_ASSERT(params.PositionBits >= 2 && params.PositionBits <= 24);
+        PVR_MATH_ASSERT(params.DerivativeBits >= 2 && params.DerivativeBits <= 24);
+        Params = params;
+
+        RotMax = float((1 << params.RotationBits) - 1);
+        PosMax = float((1 << params.PositionBits) - 1);
+        DerMax = float((1 << params.DerivativeBits) - 1);
+
+        Vector3f extent = params.TrackingBounds.GetMaxs() - params.TrackingBounds.GetMins();
+        PosScale   = Vector3f(PosMax / extent.x, PosMax / extent.y, PosMax / extent.z);
+        PosStep    = Vector3f(extent.x / PosMax, extent.y / PosMax, extent.z / PosMax);
+
+        const float ranges[4] = { params.MaxAngularVelocity, params.MaxLinearVelocity,
+                                  params.MaxAngularAcceleration, params.MaxLinearAcceleration };
+        DerivativeCount = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            DerivativeRange[i] = ranges[i];
+            if (ranges[i] > 0.0f)
+                DerivativeCount++;
+        }
+    }
+
+    const PoseCodecParams& GetParams() const { return Params; }
+
+    // Number of Field[] entries used for pvrPoseStatef samples (6 for poses).
+    int GetFieldCount() const { return 6 + 3 * DerivativeCount; }
+
+    // Worst case angle between original and decoded orientation, in radians.
+    float GetMaxRotationError() const
+    {
+        // Each kept component is off by at most half a step; the reconstructed largest
+        // component (>= 1/2) adds at most the sum of those errors, giving |dq| <= step * sqrt(3).
+        const float step = MATH_FLOAT_SQRT2 / RotMax;
+        return 2.0f * Asin(PVRMath_Min(1.0f, step * sqrtf(3.0f)));
+    }
+
+    // Worst case distance between original and decoded position inside TrackingBounds, in meters.
+    float GetMaxPositionError() const
+    {
+        return 0.5f * PosStep.Length();
+    }
+
+    // Worst case per-component error of derivative d (0 angular velocity, 1 linear velocity,
+    // 2 angular acceleration, 3 linear acceleration) inside its range.
+    float GetMaxDerivativeError(int d) const
+    {
+        return DerivativeRange[d] / DerMax;
+    }
+
+    // Quantization constants computed by SetParams(), for other implementations of the
+    // same quantization (PVR_PoseCodecBatch.h). Max values are the largest field values,
+    // PositionScale maps meters from the box minimum to fields and PositionStep back, and
+    // derivative d is quantized in +/- GetDerivativeRange(d), 0 when dropped.
+    float    GetRotationMax() const             { return RotMax; }
+    float    GetPositionMax() const             { return PosMax; }
+    float    GetDerivativeMax() const           { return DerMax; }
+    Vector3f GetPositionScale() const           { return PosScale; }
+    Vector3f GetPositionStep() const            { return PosStep; }
+    float    GetDerivativeRange(int d) const    { return DerivativeRange[d]; }
+
+    //---------------------------------------------------------------------------
+    // Quantization
+
+    void Quantize(const pvrPosef& pose, QuantizedPoseState* out) const
+    {
+        out->StatusFlags = 0;
+        out->Time = 0;
+        QuantizePose(pose, out);
+    }
+
+    void Quantize(const pvrPoseStatef& state, QuantizedPoseState* out) const
+    {
+        out->StatusFlags = state.StatusFlags;
+        out->Time = int64_t(floor(state.TimeInSeconds / Params.TimeResolution + 0.5));
+        QuantizePose(state.ThePose, out);
+
+        const pvrVector3f* derivatives[4] = { &state.AngularVelocity, &state.LinearVelocity,
+                                              &state.AngularAcceleration, &state.LinearAcceleration };
+        int f = 6;
+        for (int d = 0; d < 4; d++)
+        {
+            if (DerivativeRange[d] <= 0.0f)
+                continue;
+            const float scale = DerMax * 0.5f / DerivativeRange[d];
+            out->Field[f++] = QuantizeUnit((derivatives[d]->x + DerivativeRange[d]) * scale, DerMax);
+            out->Field[f++] = QuantizeUnit((derivatives[d]->y + DerivativeRange[d]) * scale, DerMax);
+            out->Field[f++] = QuantizeUnit((derivatives[d]->z + DerivativeRange[d]) * scale, DerMax);
+        }
+    }
+
+    void Dequantize(const QuantizedPoseState& q, pvrPosef* out) const
+    {
+        DequantizePose(q, out);
+    }
+
+    // Derivatives that were dropped by the params decode as zero.
+    void Dequantize(const QuantizedPoseState& q, pvrPoseStatef* out) const
+    {
+        DequantizePose(q, &out->ThePose);
+        out->StatusFlags = q.StatusFlags;
+        out->TimeInSeconds = double(q.Time) * Params.TimeResolution;
+
+        pvrVector3f* derivatives[4] = { &out->AngularVelocity, &out->LinearVelocity,
+                                        &out->AngularAcceleration, &out->LinearAcceleration };
+        int f = 6;
+        for (int d = 0; d < 4; d++)
+        {
+            if (DerivativeRange[d] <= 0.0f)
+            {
+                derivatives[d]->x = derivatives[d]->y = derivatives[d]->z = 0.0f;
+                continue;
+            }
+            const float scale = 2.0f * DerivativeRange[d] / DerMax;
+            derivatives[d]->x = float(q.Field[f++]) * scale - DerivativeRange[d];
+            derivatives[d]->y = float(q.Field[f++]) * scale - DerivativeRange[d];
+            derivatives[d]->z = float(q.Field[f++]) * scale - DerivativeRange[d];
+        }
+    }
+
+    // Batch versions, one sample at a time. PVR_PoseCodecBatch.h has SSE2 versions with
+    // the same output (see there for FMA builds), about twice as fast on whole recordings.
+    void QuantizeBatch(const pvrPosef* poses, int count, QuantizedPoseState* out) const
+    {
+        for (int i = 0; i < count; i++)
+            Quantize(poses[i], &out[i]);
+    }
+
+    void QuantizeBatch(const pvrPoseStatef* states, int count, QuantizedPoseState* out) const
+    {
+        for (int i = 0; i < count; i++)
+            Quantize(states[i], &out[i]);
+    }
+
+    void DequantizeBatch(const QuantizedPoseState* q, int count, pvrPosef* out) const
+    {
+        for (int i = 0; i < count; i++)
+            Dequantize(q[i], &out[i]);
+    }
+
+    void DequantizeBatch(const QuantizedPoseState* q, int count, pvrPoseStatef* out) const
+    {
+        for (int i = 0; i < count; i++)
+            Dequantize(q[i], &out[i]);
+    }
+
+    //---------------------------------------------------------------------------
+    // Delta encoding
+    //
+    // Layout of one sample: a header byte (bit 0: key sample, bit 1: status flags present,
+    // bits 2-3: largest component), the zigzag varint time delta, the varint status flags
+    // if present, then fieldCount zigzag varint field deltas. A key sample (no previous
+    // sample, or the dropped component changed) stores absolute values instead of deltas.
+    // fieldCount is 6 for pvrPosef streams and GetFieldCount() for pvrPoseStatef streams.
+
+    size_t Encode(const QuantizedPoseState& q, const QuantizedPoseState* prev, int fieldCount, uint8_t* out) const
+    {
+        PVR_MATH_ASSERT(fieldCount <= QuantizedPoseState::MaxFields);
+        const bool key = !prev || (prev->Largest != q.Largest);
+        const bool status = key || (prev->StatusFlags != q.StatusFlags);
+
+        uint8_t* p = out;
+        *p++ = uint8_t((key ? 1 : 0) | (status ? 2 : 0) | (q.Largest << 2));
+        p = WriteVarint(p, ZigZag(key ? q.Time : q.Time - prev->Time));
+        if (status)
+            p = WriteVarint(p, q.StatusFlags);
+        for (int f = 0; f < fieldCount; f++)
+            p = WriteVarint(p, ZigZag(int64_t(key ? q.Field[f] : q.Field[f] - prev->Field[f])));
+        return size_t(p - out);
+    }
+
+    // Returns the number of bytes consumed, or 0 if the input is truncated or a delta
+    // sample has no previous sample.
+    size_t Decode(const uint8_t* in, size_t size, const QuantizedPoseState* prev, int fieldCount,
+                  QuantizedPoseState* out) const
+    {
+        PVR_MATH_ASSERT(fieldCount <= QuantizedPoseState::MaxFields);
+        const uint8_t* p = in;
+        const uint8_t* end = in + size;
+        if (p >= end)
+            return 0;
+
+        const uint8_t header = *p++;
+        const bool key = (header & 1) != 0;
+        const bool status = (header & 2) != 0;
+        if (!key && !prev)
+            return 0;
+
+        uint64_t v;
+        if (!(p = ReadVarint(p, end, &v)))
+            return 0;
+        out->Largest = uint8_t((header >> 2) & 3);
+        out->Time = key ? UnZigZag(v) : prev->Time + UnZigZag(v);
+
+        if (status)
+        {
+            if (!(p = ReadVarint(p, end, &v)))
+                return 0;
+            out->StatusFlags = uint32_t(v);
+        }
+        else
+        {
+            out->StatusFlags = prev->StatusFlags;
+        }
+
+        for (int f = 0; f < fieldCount; f++)
+        {
+            if (!(p = ReadVarint(p, end, &v)))
+                return 0;
+            out->Field[f] = int32_t(key ? UnZigZag(v) : prev->Field[f] + UnZigZag(v));
+        }
+        return size_t(p - in);
+    }
+
+private:
+    static int32_t QuantizeUnit(float v, float maxValue)
+    {
+        // v is already scaled to [0, maxValue]; clamp and round.
+        v = (v < 0.0f) ? 0.0f : ((v > maxValue) ? maxValue : v);
+        return int32_t(v + 0.5f);
+    }
+
+    void QuantizePose(const pvrPosef& pose, QuantizedPoseState* out) const
+    {
+        const float q[4] = { pose.Orientation.x, pose.Orientation.y, pose.Orientation.z, pose.Orientation.w };
+        const float a[4] = { fabsf(q[0]), fabsf(q[1]), fabsf(q[2]), fabsf(q[3]) };
+
+        int largest = 0;
+        largest = (a[1] > a[largest]) ? 1 : largest;
+        largest = (a[2] > a[largest]) ? 2 : largest;
+        largest = (a[3] > a[largest]) ? 3 : largest;
+
+        // q and -q are the same rotation; make the dropped component positive.
+        const float sign = (q[largest] < 0.0f) ? -1.0f : 1.0f;
+        const float scale = sign * MATH_FLOAT_SQRT2 * 0.5f * RotMax;
+        const float bias = 0.5f * RotMax;
+        int f = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            if (i != largest)
+                out->Field[f++] = QuantizeUnit(q[i] * scale + bias, RotMax);
+        }
+        out->Largest = uint8_t(largest);
+
+        const Vector3f& mins = Params.TrackingBounds.GetMins();
+        out->Field[3] = QuantizeUnit((pose.Position.x - mins.x) * PosScale.x, PosMax);
+        out->Field[4] = QuantizeUnit((pose.Position.y - mins.y) * PosScale.y, PosMax);
+        out->Field[5] = QuantizeUnit((pose.Position.z - mins.z) * PosScale.z, PosMax);
+    }
+
+    void DequantizePose(const QuantizedPoseState& in, pvrPosef* out) const
+    {
+        const float scale = MATH_FLOAT_SQRT2 / RotMax;
+        float q[4];
+        float sumSq = 0.0f;
+        int f = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            if (i == in.Largest)
+                continue;
+            q[i] = float(in.Field[f++]) * scale - MATH_FLOAT_SQRT1_2;
+            sumSq += q[i] * q[i];
+        }
+        q[in.Largest] = sqrtf(PVRMath_Max(0.0f, 1.0f - sumSq));
+
+        // Renormalize; rounding can leave sumSq slightly above 1.
+        const float rcpLen = 1.0f / sqrtf(sumSq + q[in.Largest] * q[in.Largest]);
+        out->Orientation.x = q[0] * rcpLen;
+        out->Orientation.y = q[1] * rcpLen;
+        out->Orientation.z = q[2] * rcpLen;
+        out->Orientation.w = q[3] * rcpLen;
+
+        const Vector3f& mins = Params.TrackingBounds.GetMins();
+        out->Position.x = mins.x + float(in.Field[3]) * PosStep.x;
+        out->Position.y = mins.y + float(in.Field[4]) * PosStep.y;
+        out->Position.z = mins.z + float(in.Field[5]) * PosStep.z;
+    }
+
+    static uint64_t ZigZag(int64_t v)   { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+    static int64_t  UnZigZag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+    static uint8_t* WriteVarint(uint8_t* p, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            *p++ = uint8_t(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = uint8_t(v);
+        return p;
+    }
+
+    static const uint8_t* ReadVarint(const uint8_t* p, const uint8_t* end, uint64_t* v)
+    {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (p >= end)
+                return nullptr;
+            const uint8_t b = *p++;
+            result |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80))
+            {
+                *v = result;
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    PoseCodecParams Params;
+    float           RotMax, PosMax, DerMax;
+    Vector3f        PosScale, PosStep;
+    float           DerivativeRange[4];
+    int             DerivativeCount;
+};
+
+
+//-----------------------------------------------------------------------------------
+// ***** CameraRelativeFrame
+//
+// Large-world helper. Applications keep world transforms in double precision (Posed)
+// and use this class each frame to produce the float poses and matrices handed to the
+// renderer and to the SDK. Render space has the axes of world space but is centered on
+// the head position of the frame, so values stay small around the viewer and keep full
+// float precision even when the viewer is kilometres away from the world origin.
+//
+// Example usage:
+//     pvrPosef eyePoses[2];
+//     pvr_calcEyePoses(envh, headPose, hmdToEyePose, eyePoses);
+//     CameraRelativeFrame frame(trackingToWorld, headPose);
+//     Matrix4f view = frame.GetViewMatrix(eyePoses[eye]);
+//     frame.ToRenderBatch(objectToWorld, objectCount, modelMatrices);
+
+class CameraRelativeFrame
+{
+public:
+    CameraRelativeFrame()
+        : TrackingToWorld(Posed::Identity()), TrackingToRender(Posed::Identity()), Origin(0, 0, 0)
+    { }
+
+    // trackingToWorld places the tracking space in the world; headPose is the head pose
+    // in tracking space, as used for calcEyePoses.
+    CameraRelativeFrame(const Posed& trackingToWorld, const pvrPosef& headPose)
+    {
+        Set(trackingToWorld, headPose);
+    }
+
+    void Set(const Posed& trackingToWorld, const pvrPosef& headPose)
+    {
+        SetOrigin(trackingToWorld, trackingToWorld.Transform(Vector3d(Vector3f(headPose.Position))));
+    }
+
+    // Use an explicit origin, e.g. one snapped to a grid so that it only moves occasionally.
+    void SetOrigin(const Posed& trackingToWorld, const Vector3d& origin)
+    {
+        TrackingToWorld  = trackingToWorld;
+        Origin           = origin;
+        TrackingToRender = Posed(trackingToWorld.Rotation, trackingToWorld.Translation - origin);
+    }
+
+    const Posed&    GetTrackingToWorld() const  { return TrackingToWorld; }
+    const Vector3d& GetOrigin() const           { return Origin; }
+
+    //---------------------------------------------------------------------------
+    // World <-> render space. The origin is subtracted in double precision before
+    // converting to float.
+
+    Vector3f ToRender(const Vector3d& worldPoint) const
+    {
+        return Vector3f(worldPoint - Origin);
+    }
+
+    Posef ToRender(const Posed& objectToWorld) const
+    {
+        return Posef(Quatf(objectToWorld.Rotation), Vector3f(objectToWorld.Translation - Origin));
+    }
+
+    Vector3d ToWorld(const Vector3f& renderPoint) const
+    {
+        return Vector3d(renderPoint) + Origin;
+    }
+
+    Posed ToWorld(const Posef& renderPose) const
+    {
+        return Posed(Quatd(renderPose.Rotation).Normalized(), Vector3d(renderPose.Translation) + Origin);
+    }
+
+    //---------------------------------------------------------------------------
+    // Tracking space (SDK poses, calcEyePoses output) -> render / world space.
+
+    Posef TrackingToRenderPose(const pvrPosef& trackingPose) const
+    {
+        return Posef(TrackingToRender * Posed(Posef(trackingPose)));
+    }
+
+    Posed TrackingToWorldPose(const pvrPosef& trackingPose) const
+    {
+        return TrackingToWorld * Posed(Posef(trackingPose));
+    }
+
+    // Render space pose of an eye from calcEyePoses.
+    Posef GetEyeRenderPose(const pvrPosef& eyePose) const
+    {
+        return TrackingToRenderPose(eyePose);
+    }
+
+    void GetEyeRenderPoses(const pvrPosef eyePoses[2], Posef outEyeRenderPoses[2]) const
+    {
+        outEyeRenderPoses[0] = GetEyeRenderPose(eyePoses[0]);
+        outEyeRenderPoses[1] = GetEyeRenderPose(eyePoses[1]);
+    }
+
+    // Render space to eye space matrix for an eye pose from calcEyePoses.
+    Matrix4f GetViewMatrix(const pvrPosef& eyePose) const
+    {
+        Posed eyeToRender = TrackingToRender * Posed(Posef(eyePose));
+        return Matrix4f(Posef(eyeToRender.Inverted()));
+    }
+
+    //---------------------------------------------------------------------------
+    // Batch conversion of world transforms, e.g. all objects of a scene once per frame.
+
+    void ToRenderBatch(const Vector3d* worldPoints, int count, Vector3f* outRenderPoints) const
+    {
+        const double ox = Origin.x, oy = Origin.y, oz = Origin.z;
+        for (int i = 0; i < count; i++)
+        {
+            outRenderPoints[i].x = float(worldPoints[i].x - ox);
+            outRenderPoints[i].y = float(worldPoints[i].y - oy);
+            outRenderPoints[i].z = float(worldPoints[i].z - oz);
+        }
+    }
+
+    void ToRenderBatch(const Posed* objectToWorld, int count, Posef* outObjectToRender) const
+    {
+        const double ox = Origin.x, oy = Origin.y, oz = Origin.z;
+        for (int i = 0; i < count; i++)
+        {
+            const Posed& src = objectToWorld[i];
+            Posef& dst = outObjectToRender[i];
+            dst.Rotation.x    = float(src.Rotation.x);
+            dst.Rotation.y    = float(src.Rotation.y);
+            dst.Rotation.z    = float(src.Rotation.z);
+            dst.Rotation.w    = float(src.Rotation.w);
+            dst.Translation.x = float(src.Translation.x - ox);
+            dst.Translation.y = float(src.Translation.y - oy);
+            dst.Translation.z = float(src.Translation.z - oz);
+        }
+    }
+
+    // Model matrices (object to render space).
+    void ToRenderBatch(const Posed* objectToWorld, int count, Matrix4f* outModelMatrices) const
+    {
+        for (int i = 0; i < count; i++)
+            outModelMatrices[i] = Matrix4f(ToRender(objectToWorld[i]));
+    }
+
+private:
+    Posed    TrackingToWorld;
+    Posed    TrackingToRender;
+    Vector3d Origin;
 };
 
 
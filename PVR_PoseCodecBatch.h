@@ -0,0 +1,348 @@
+/************************************************************************************
+
+Filename    :   PVR_PoseCodecBatch.h
+Content     :   SSE2 batch quantization of pose recordings for PoseCodec.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_PoseCodecBatch_h
+#define PVR_PoseCodecBatch_h
+
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** QuantizePoseBatch / DequantizePoseBatch
+//
+// Batch counterparts of PoseCodec::QuantizeBatch and DequantizeBatch for whole
+// recordings. With SSE2 four samples are transposed into SoA registers per iteration:
+// the dropped component is picked with compares and blends instead of the per-sample
+// index loop, and derivatives are quantized four samples at a time. The remainder, and
+// builds without SSE2, use the PoseCodec per-sample paths.
+//
+// The output matches the scalar paths bit for bit: every lane performs the same float
+// operations in the same order, rounding is the same clamp-then-truncate, and the
+// square roots and the divide are the correctly rounded SSE2 ones. That holds as long as
+// the compiler does not contract multiply-adds into FMA instructions, which it may do
+// differently in the two paths (GCC and Clang with -mfma, MSVC with /fp:contract). There
+// decoded values may differ by one float rounding and quantized fields, at a rounding
+// boundary, by one quantization step. Input and output arrays must not overlap.
+//
+// Example usage:
+//     PoseCodec codec;
+//     std::vector<QuantizedPoseState> quantized(states.size());
+//     QuantizePoseBatch(codec, states.data(), int(states.size()), quantized.data());
+
+namespace PoseCodecDetail {
+
+#if PVR_SIMD_SSE2
+
+// The quantization constants of a codec, copied once per batch.
+struct BatchConstants
+{
+    float    RotMax, PosMax, DerMax;
+    Vector3f Mins, PosScale, PosStep;
+    float    DerivativeRange[4];
+
+    explicit BatchConstants(const PoseCodec& codec)
+        : RotMax(codec.GetRotationMax()), PosMax(codec.GetPositionMax()), DerMax(codec.GetDerivativeMax()),
+          Mins(codec.GetParams().TrackingBounds.GetMins()), PosScale(codec.GetPositionScale()),
+          PosStep(codec.GetPositionStep())
+    {
+        for (int d = 0; d < 4; d++)
+            DerivativeRange[d] = codec.GetDerivativeRange(d);
+    }
+};
+
+inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Same clamp and round as PoseCodec::QuantizeUnit.
+inline __m128i QuantizeUnit4(__m128 v, __m128 maxValue)
+{
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), maxValue);
+    return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+
+inline void StoreField4(QuantizedPoseState* out, int f, __m128i v)
+{
+    PVR_ALIGNAS(16) int32_t lanes[4];
+    _mm_store_si128((__m128i*)lanes, v);
+    for (int j = 0; j < 4; j++)
+        out[j].Field[f] = lanes[j];
+}
+
+inline __m128 LoadField4(const QuantizedPoseState* in, int f)
+{
+    return _mm_cvtepi32_ps(_mm_setr_epi32(in[0].Field[f], in[1].Field[f], in[2].Field[f], in[3].Field[f]));
+}
+
+// Quantizes the poses of four samples into Field[0..5] and Largest.
+inline void QuantizePose4(const BatchConstants& c, const pvrPosef* p0, const pvrPosef* p1,
+                          const pvrPosef* p2, const pvrPosef* p3, QuantizedPoseState* out)
+{
+    __m128 qx = _mm_loadu_ps(&p0->Orientation.x);
+    __m128 qy = _mm_loadu_ps(&p1->Orientation.x);
+    __m128 qz = _mm_loadu_ps(&p2->Orientation.x);
+    __m128 qw = _mm_loadu_ps(&p3->Orientation.x);
+    _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+
+    // Largest magnitude component; strict compares keep the lower index on ties.
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 ay = _mm_and_ps(qy, absMask);
+    const __m128 az = _mm_and_ps(qz, absMask);
+    const __m128 aw = _mm_and_ps(qw, absMask);
+    __m128 largest = _mm_and_ps(qx, absMask);
+    __m128i index = _mm_setzero_si128();
+    __m128 m = _mm_cmpgt_ps(ay, largest);
+    largest = Select(m, ay, largest);
+    index = Select(_mm_castps_si128(m), _mm_set1_epi32(1), index);
+    m = _mm_cmpgt_ps(az, largest);
+    largest = Select(m, az, largest);
+    index = Select(_mm_castps_si128(m), _mm_set1_epi32(2), index);
+    m = _mm_cmpgt_ps(aw, largest);
+    index = Select(_mm_castps_si128(m), _mm_set1_epi32(3), index);
+
+    const __m128i is0 = _mm_cmpeq_epi32(index, _mm_setzero_si128());
+    const __m128i is1 = _mm_cmpeq_epi32(index, _mm_set1_epi32(1));
+    const __m128i is3 = _mm_cmpeq_epi32(index, _mm_set1_epi32(3));
+
+    // Fold the sign of the dropped component into the scale. sign * SQRT2 * 0.5 * RotMax
+    // only differs from SQRT2 * 0.5 * RotMax by the sign bit, so this is exact.
+    const __m128 dropped = Select(_mm_castsi128_ps(is0), qx,
+                           Select(_mm_castsi128_ps(is1), qy,
+                           Select(_mm_castsi128_ps(is3), qw, qz)));
+    const __m128 signBits = _mm_and_ps(_mm_cmplt_ps(dropped, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+    const __m128 scale = _mm_xor_ps(_mm_set1_ps(MATH_FLOAT_SQRT2 * 0.5f * c.RotMax), signBits);
+    const __m128 bias = _mm_set1_ps(0.5f * c.RotMax);
+    const __m128 rotMax = _mm_set1_ps(c.RotMax);
+
+    const __m128i vx = QuantizeUnit4(_mm_add_ps(_mm_mul_ps(qx, scale), bias), rotMax);
+    const __m128i vy = QuantizeUnit4(_mm_add_ps(_mm_mul_ps(qy, scale), bias), rotMax);
+    const __m128i vz = QuantizeUnit4(_mm_add_ps(_mm_mul_ps(qz, scale), bias), rotMax);
+    const __m128i vw = QuantizeUnit4(_mm_add_ps(_mm_mul_ps(qw, scale), bias), rotMax);
+
+    // The three kept components, in x, y, z, w order.
+    StoreField4(out, 0, Select(is0, vy, vx));
+    StoreField4(out, 1, Select(_mm_or_si128(is0, is1), vz, vy));
+    StoreField4(out, 2, Select(is3, vz, vw));
+
+    PVR_ALIGNAS(16) int32_t lanes[4];
+    _mm_store_si128((__m128i*)lanes, index);
+    for (int j = 0; j < 4; j++)
+        out[j].Largest = uint8_t(lanes[j]);
+
+    const __m128 posMax = _mm_set1_ps(c.PosMax);
+    const __m128 px = _mm_setr_ps(p0->Position.x, p1->Position.x, p2->Position.x, p3->Position.x);
+    const __m128 py = _mm_setr_ps(p0->Position.y, p1->Position.y, p2->Position.y, p3->Position.y);
+    const __m128 pz = _mm_setr_ps(p0->Position.z, p1->Position.z, p2->Position.z, p3->Position.z);
+    StoreField4(out, 3, QuantizeUnit4(_mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(c.Mins.x)), _mm_set1_ps(c.PosScale.x)), posMax));
+    StoreField4(out, 4, QuantizeUnit4(_mm_mul_ps(_mm_sub_ps(py, _mm_set1_ps(c.Mins.y)), _mm_set1_ps(c.PosScale.y)), posMax));
+    StoreField4(out, 5, QuantizeUnit4(_mm_mul_ps(_mm_sub_ps(pz, _mm_set1_ps(c.Mins.z)), _mm_set1_ps(c.PosScale.z)), posMax));
+}
+
+// Reconstructs the poses of four samples from Field[0..5] and Largest.
+inline void DequantizePose4(const BatchConstants& c, const QuantizedPoseState* in,
+                            pvrPosef* p0, pvrPosef* p1, pvrPosef* p2, pvrPosef* p3)
+{
+    const __m128i index = _mm_setr_epi32(in[0].Largest, in[1].Largest, in[2].Largest, in[3].Largest);
+    const __m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_setzero_si128()));
+    const __m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(1)));
+    const __m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(2)));
+    const __m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(3)));
+
+    const __m128 scale = _mm_set1_ps(MATH_FLOAT_SQRT2 / c.RotMax);
+    const __m128 offset = _mm_set1_ps(MATH_FLOAT_SQRT1_2);
+    const __m128 v0 = _mm_sub_ps(_mm_mul_ps(LoadField4(in, 0), scale), offset);
+    const __m128 v1 = _mm_sub_ps(_mm_mul_ps(LoadField4(in, 1), scale), offset);
+    const __m128 v2 = _mm_sub_ps(_mm_mul_ps(LoadField4(in, 2), scale), offset);
+    const __m128 sumSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v0, v0), _mm_mul_ps(v1, v1)), _mm_mul_ps(v2, v2));
+    const __m128 dropped = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.0f), sumSq), _mm_setzero_ps()));
+    const __m128 rcpLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_add_ps(sumSq, _mm_mul_ps(dropped, dropped))));
+
+    __m128 qx = _mm_mul_ps(Select(is0, dropped, v0), rcpLen);
+    __m128 qy = _mm_mul_ps(Select(is1, dropped, Select(is0, v0, v1)), rcpLen);
+    __m128 qz = _mm_mul_ps(Select(is2, dropped, Select(is3, v2, v1)), rcpLen);
+    __m128 qw = _mm_mul_ps(Select(is3, dropped, v2), rcpLen);
+    _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+    _mm_storeu_ps(&p0->Orientation.x, qx);
+    _mm_storeu_ps(&p1->Orientation.x, qy);
+    _mm_storeu_ps(&p2->Orientation.x, qz);
+    _mm_storeu_ps(&p3->Orientation.x, qw);
+
+    PVR_ALIGNAS(16) float px[4], py[4], pz[4];
+    _mm_store_ps(px, _mm_add_ps(_mm_set1_ps(c.Mins.x), _mm_mul_ps(LoadField4(in, 3), _mm_set1_ps(c.PosStep.x))));
+    _mm_store_ps(py, _mm_add_ps(_mm_set1_ps(c.Mins.y), _mm_mul_ps(LoadField4(in, 4), _mm_set1_ps(c.PosStep.y))));
+    _mm_store_ps(pz, _mm_add_ps(_mm_set1_ps(c.Mins.z), _mm_mul_ps(LoadField4(in, 5), _mm_set1_ps(c.PosStep.z))));
+    pvrPosef* poses[4] = { p0, p1, p2, p3 };
+    for (int j = 0; j < 4; j++)
+    {
+        poses[j]->Position.x = px[j];
+        poses[j]->Position.y = py[j];
+        poses[j]->Position.z = pz[j];
+    }
+}
+
+// pvrPoseStatef member of derivative d (0 angular velocity, 1 linear velocity, 2 angular
+// acceleration, 3 linear acceleration), in the Field[] order of PoseCodec::Quantize.
+inline pvrVector3f pvrPoseStatef::* GetDerivative(int d)
+{
+    return (d == 0) ? &pvrPoseStatef::AngularVelocity :
+           (d == 1) ? &pvrPoseStatef::LinearVelocity :
+           (d == 2) ? &pvrPoseStatef::AngularAcceleration : &pvrPoseStatef::LinearAcceleration;
+}
+
+#endif // PVR_SIMD_SSE2
+
+} // namespace PoseCodecDetail
+
+
+inline void QuantizePoseBatch(const PoseCodec& codec, const pvrPosef* PVR_RESTRICT poses, int count,
+                              QuantizedPoseState* PVR_RESTRICT out)
+{
+    int i = 0;
+
+#if PVR_SIMD_SSE2
+    using namespace PoseCodecDetail;
+    const BatchConstants c(codec);
+    for (; i + 4 <= count; i += 4)
+    {
+        QuantizePose4(c, &poses[i], &poses[i + 1], &poses[i + 2], &poses[i + 3], out + i);
+        for (int j = 0; j < 4; j++)
+        {
+            out[i + j].StatusFlags = 0;
+            out[i + j].Time = 0;
+        }
+    }
+#endif // PVR_SIMD_SSE2
+
+    for (; i < count; i++)
+        codec.Quantize(poses[i], &out[i]);
+}
+
+inline void QuantizePoseBatch(const PoseCodec& codec, const pvrPoseStatef* PVR_RESTRICT states, int count,
+                              QuantizedPoseState* PVR_RESTRICT out)
+{
+    int i = 0;
+
+#if PVR_SIMD_SSE2
+    using namespace PoseCodecDetail;
+    const BatchConstants c(codec);
+    const double timeResolution = codec.GetParams().TimeResolution;
+    const __m128 derMax = _mm_set1_ps(c.DerMax);
+    for (; i + 4 <= count; i += 4)
+    {
+        const pvrPoseStatef* s = states + i;
+        QuantizedPoseState* q = out + i;
+        QuantizePose4(c, &s[0].ThePose, &s[1].ThePose, &s[2].ThePose, &s[3].ThePose, q);
+        for (int j = 0; j < 4; j++)
+        {
+            q[j].StatusFlags = s[j].StatusFlags;
+            q[j].Time = int64_t(floor(s[j].TimeInSeconds / timeResolution + 0.5));
+        }
+
+        int f = 6;
+        for (int d = 0; d < 4; d++)
+        {
+            if (c.DerivativeRange[d] <= 0.0f)
+                continue;
+            const __m128 range = _mm_set1_ps(c.DerivativeRange[d]);
+            const __m128 scale = _mm_set1_ps(c.DerMax * 0.5f / c.DerivativeRange[d]);
+            pvrVector3f pvrPoseStatef::* const member = GetDerivative(d);
+            const pvrVector3f& d0 = s[0].*member;
+            const pvrVector3f& d1 = s[1].*member;
+            const pvrVector3f& d2 = s[2].*member;
+            const pvrVector3f& d3 = s[3].*member;
+            const __m128 x = _mm_setr_ps(d0.x, d1.x, d2.x, d3.x);
+            const __m128 y = _mm_setr_ps(d0.y, d1.y, d2.y, d3.y);
+            const __m128 z = _mm_setr_ps(d0.z, d1.z, d2.z, d3.z);
+            StoreField4(q, f++, QuantizeUnit4(_mm_mul_ps(_mm_add_ps(x, range), scale), derMax));
+            StoreField4(q, f++, QuantizeUnit4(_mm_mul_ps(_mm_add_ps(y, range), scale), derMax));
+            StoreField4(q, f++, QuantizeUnit4(_mm_mul_ps(_mm_add_ps(z, range), scale), derMax));
+        }
+    }
+#endif // PVR_SIMD_SSE2
+
+    for (; i < count; i++)
+        codec.Quantize(states[i], &out[i]);
+}
+
+inline void DequantizePoseBatch(const PoseCodec& codec, const QuantizedPoseState* PVR_RESTRICT q, int count,
+                                pvrPosef* PVR_RESTRICT out)
+{
+    int i = 0;
+
+#if PVR_SIMD_SSE2
+    using namespace PoseCodecDetail;
+    const BatchConstants c(codec);
+    for (; i + 4 <= count; i += 4)
+        DequantizePose4(c, q + i, &out[i], &out[i + 1], &out[i + 2], &out[i + 3]);
+#endif // PVR_SIMD_SSE2
+
+    for (; i < count; i++)
+        codec.Dequantize(q[i], &out[i]);
+}
+
+// Derivatives that were dropped by the params decode as zero.
+inline void DequantizePoseBatch(const PoseCodec& codec, const QuantizedPoseState* PVR_RESTRICT q, int count,
+                                pvrPoseStatef* PVR_RESTRICT out)
+{
+    int i = 0;
+
+#if PVR_SIMD_SSE2
+    using namespace PoseCodecDetail;
+    const BatchConstants c(codec);
+    const double timeResolution = codec.GetParams().TimeResolution;
+    for (; i + 4 <= count; i += 4)
+    {
+        const QuantizedPoseState* in = q + i;
+        pvrPoseStatef* s = out + i;
+        DequantizePose4(c, in, &s[0].ThePose, &s[1].ThePose, &s[2].ThePose, &s[3].ThePose);
+        for (int j = 0; j < 4; j++)
+        {
+            s[j].StatusFlags = in[j].StatusFlags;
+            s[j].TimeInSeconds = double(in[j].Time) * timeResolution;
+        }
+
+        // Derivatives are a single multiply-subtract each; they stay per sample.
+        for (int d = 0, f = 6; d < 4; d++)
+        {
+            pvrVector3f pvrPoseStatef::* const member = GetDerivative(d);
+            if (c.DerivativeRange[d] <= 0.0f)
+            {
+                for (int j = 0; j < 4; j++)
+                    (s[j].*member).x = (s[j].*member).y = (s[j].*member).z = 0.0f;
+                continue;
+            }
+            const float range = c.DerivativeRange[d];
+            const float scale = 2.0f * c.DerivativeRange[d] / c.DerMax;
+            for (int j = 0; j < 4; j++)
+            {
+                pvrVector3f& v = s[j].*member;
+                v.x = float(in[j].Field[f]) * scale - range;
+                v.y = float(in[j].Field[f + 1]) * scale - range;
+                v.z = float(in[j].Field[f + 2]) * scale - range;
+            }
+            f += 3;
+        }
+    }
+#endif // PVR_SIMD_SSE2
+
+    for (; i < count; i++)
+        codec.Dequantize(q[i], &out[i]);
+}
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,233 @@
+/************************************************************************************
+
+Filename    :   PVR_PoseFilter.h
+Content     :   Adaptive smoothing of tracked device poses.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_PoseFilter_h
+#define PVR_PoseFilter_h
+
+#include "PVR_API.h"
+#include "PVR_Filter.h"
+#include "PVR_Math.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** PoseFilterParams
+//
+// One-Euro parameters for position (meters) and rotation (radians). With
+// UseReportedVelocity the cutoff follows the velocities in pvrPoseStatef, which the
+// tracker estimates from its IMU, so a prop starting to move is released from smoothing
+// on the first sample instead of after the filtered derivative catches up.
+
+struct PoseFilterParams
+{
+    float PositionMinCutoff;    // Hz at rest.
+    float PositionBeta;         // Hz per m/s.
+    float RotationMinCutoff;    // Hz at rest.
+    float RotationBeta;         // Hz per rad/s.
+    float DerivativeCutoff;     // Hz; smoothing of the estimated speed.
+    bool  UseReportedVelocity;
+
+    PoseFilterParams()
+        : PositionMinCutoff(1.5f), PositionBeta(20.0f), RotationMinCutoff(1.5f), RotationBeta(10.0f),
+          DerivativeCutoff(1.0f), UseReportedVelocity(true)
+    { }
+
+    // Light smoothing for hand held controllers, where lag is felt most.
+    static PoseFilterParams Controller()
+    {
+        PoseFilterParams params;
+        params.PositionMinCutoff = 3.0f;
+        params.RotationMinCutoff = 3.0f;
+        return params;
+    }
+
+    // Stronger smoothing for Lighthouse trackers on props, which jitter more at rest.
+    static PoseFilterParams Tracker()
+    {
+        PoseFilterParams params;
+        params.PositionMinCutoff = 0.8f;
+        params.RotationMinCutoff = 0.8f;
+        return params;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** PoseFilter
+//
+// One tracked device: OneEuroFilter on the position and OneEuroRotationFilter on the
+// orientation.
+
+class PoseFilter
+{
+public:
+    explicit PoseFilter(const PoseFilterParams& params = PoseFilterParams()) { SetParams(params); }
+
+    void SetParams(const PoseFilterParams& params)
+    {
+        Params = params;
+        Position.SetParams(params.PositionMinCutoff, params.PositionBeta, params.DerivativeCutoff);
+        Rotation.SetParams(params.RotationMinCutoff, params.RotationBeta, params.DerivativeCutoff);
+    }
+
+    const PoseFilterParams& GetParams() const { return Params; }
+
+    void Reset()
+    {
+        Position.Reset();
+        Rotation.Reset();
+    }
+
+    Posef Filter(const Posef& pose, double time)
+    {
+        return Posef(Rotation.Filter(pose.Rotation, time), Position.Filter(pose.Translation, time));
+    }
+
+    // Filters the pose of a state; velocities and accelerations pass through unchanged.
+    pvrPoseStatef Filter(const pvrPoseStatef& state)
+    {
+        pvrPoseStatef result = state;
+        const Posef pose(state.ThePose);
+        Posef filtered;
+        if (Params.UseReportedVelocity)
+        {
+            filtered.Translation = Position.Filter(pose.Translation, state.TimeInSeconds,
+                                                   Vector3f(state.LinearVelocity).Length());
+            filtered.Rotation = Rotation.Filter(pose.Rotation, state.TimeInSeconds,
+                                                Vector3f(state.AngularVelocity).Length());
+        }
+        else
+        {
+            filtered = Filter(pose, state.TimeInSeconds);
+        }
+        result.ThePose = filtered;
+        return result;
+    }
+
+private:
+    PoseFilterParams             Params;
+    OneEuroFilter<Vector3f>      Position;
+    OneEuroRotationFilter<float> Rotation;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** TrackedDevicePoseFilter
+//
+// Filters every connected device in one call. Each device bit of pvrTrackedDeviceType has
+// its own PoseFilter, reset when the device disconnects or loses tracking. By default the
+// HMD is passed through unfiltered (the runtime already predicts it, and smoothing it
+// adds visible lag), controllers use PoseFilterParams::Controller() and everything else
+// PoseFilterParams::Tracker().
+//
+// Example usage:
+//     TrackedDevicePoseFilter filters;
+//     filters.Update(session, 0.0);
+//     pvrPoseStatef prop;
+//     if (filters.GetState(pvrTrackedDevice_Tracker0, &prop))
+//         ...
+
+class TrackedDevicePoseFilter
+{
+public:
+    enum { MaxDevices = 32 };
+
+    TrackedDevicePoseFilter() : FilteredMask(0xFFFFFFFFu & ~uint32_t(pvrTrackedDevice_HMD)), ValidMask(0)
+    {
+        for (uint32_t i = 0; i < MaxDevices; i++)
+        {
+            const uint32_t bit = 1u << i;
+            const bool controller = (bit == pvrTrackedDevice_LeftController || bit == pvrTrackedDevice_RightController);
+            Filters[i].SetParams(controller ? PoseFilterParams::Controller() : PoseFilterParams::Tracker());
+        }
+    }
+
+    void SetParams(pvrTrackedDeviceType device, const PoseFilterParams& params) { Filters[Slot(device)].SetParams(params); }
+
+    // Devices in mask are filtered, the others passed through.
+    void SetFilteredDevices(uint32_t mask) { FilteredMask = mask; }
+
+    // Polls the state of every connected device at absTime (0 for the latest) and filters it.
+    // Returns the mask of devices with a valid state.
+    uint32_t Update(pvrSessionHandle session, double absTime)
+    {
+        uint32_t connected = 0;
+        if (pvr_getConnectedDevices(session, &connected) != pvr_success)
+            connected = 0;
+
+        pvrPoseStatef states[MaxDevices];
+        uint32_t polled = 0;
+        for (uint32_t mask = connected; mask; mask &= mask - 1)
+        {
+            const uint32_t i = LowestBit(mask);
+            if (pvr_getTrackedDevicePoseState(session, pvrTrackedDeviceType(1u << i), absTime, &states[i]) == pvr_success)
+                polled |= 1u << i;
+        }
+        return Filter(states, polled);
+    }
+
+    // Filters states[i] for every bit i of mask (states of devices not in mask are unused).
+    // Devices tracking neither position nor orientation are reset, so they do not smooth
+    // across a tracking loss. Returns the mask of devices with a valid state.
+    uint32_t Filter(const pvrPoseStatef states[MaxDevices], uint32_t mask)
+    {
+        const uint32_t tracked = pvrStatus_OrientationTracked | pvrStatus_PositionTracked;
+        uint32_t valid = 0;
+        for (uint32_t i = 0; i < MaxDevices; i++)
+        {
+            const uint32_t bit = 1u << i;
+            if (!(mask & bit))
+            {
+                Filters[i].Reset();
+                continue;
+            }
+            if (!(states[i].StatusFlags & tracked))
+                Filters[i].Reset();
+            States[i] = (FilteredMask & bit) ? Filters[i].Filter(states[i]) : states[i];
+            valid |= bit;
+        }
+        ValidMask = valid;
+        return valid;
+    }
+
+    bool GetState(pvrTrackedDeviceType device, pvrPoseStatef* outState) const
+    {
+        const uint32_t i = Slot(device);
+        if (!(ValidMask & (1u << i)))
+            return false;
+        *outState = States[i];
+        return true;
+    }
+
+    uint32_t GetValidMask() const { return ValidMask; }
+
+private:
+    static uint32_t LowestBit(uint32_t mask)
+    {
+        uint32_t i = 0;
+        while (!(mask & (1u << i)))
+            i++;
+        return i;
+    }
+
+    static uint32_t Slot(pvrTrackedDeviceType device)
+    {
+        PVR_MATH_ASSERT(device != 0 && (uint32_t(device) & (uint32_t(device) - 1)) == 0);
+        return LowestBit(uint32_t(device));
+    }
+
+    PoseFilter    Filters[MaxDevices];
+    pvrPoseStatef States[MaxDevices];
+    uint32_t      FilteredMask;
+    uint32_t      ValidMask;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,151 @@
+/************************************************************************************
+
+Filename    :   PVR_PoseHistory.h
+Content     :   Time-indexed history of tracked device poses.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_PoseHistory_h
+#define PVR_PoseHistory_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Threading.h"
+#include "PVR_TimedRing.h"
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** PoseHistory
+//
+// TimedRing of pose states that can be sampled at any time it covers, e.g. the
+// exposure time of a camera frame or the time of a button press. Thread safe: one
+// thread can Add() while others Sample().
+//
+// Between two samples the position and velocities are interpolated linearly and the
+// rotation with FastSlerp(). Times after the newest sample are extrapolated from its
+// velocities, by at most maxExtrapolation seconds.
+
+class PoseHistory
+{
+public:
+    explicit PoseHistory(int capacity = 1024, double maxExtrapolation = 0.05)
+        : Ring(capacity), MaxExtrapolation(maxExtrapolation)
+    { }
+
+    void Clear() { Ring.Clear(); }
+
+    // Returns false if the state is not newer than the newest stored state (e.g. the
+    // same tracker sample polled twice).
+    bool Add(const pvrPoseStatef& state) { return Ring.Add(state); }
+
+    int GetCount() const { return Ring.GetCount(); }
+
+    bool GetLatest(pvrPoseStatef* outState) const { return Ring.GetLatest(outState); }
+
+    // Pose state at absTime. StatusFlags are those common to both surrounding samples.
+    // Returns false if the history is empty or absTime is older than the oldest sample.
+    bool Sample(double absTime, pvrPoseStatef* outState) const
+    {
+        return Ring.Sample(absTime, [&](const pvrPoseStatef& a, const pvrPoseStatef& b, float t)
+        {
+            if (&a == &b)
+            {
+                const float dt = float(PVRMath_Min(absTime - a.TimeInSeconds, MaxExtrapolation));
+                const Posef pose = Posef(a.ThePose).TimeIntegrate(a.LinearVelocity, a.AngularVelocity, dt);
+                *outState = a;
+                outState->ThePose = pose;
+                outState->TimeInSeconds = absTime;
+                return;
+            }
+            outState->ThePose = Posef(a.ThePose).FastLerp(Posef(b.ThePose), t);
+            outState->AngularVelocity = Vector3f(a.AngularVelocity).Lerp(b.AngularVelocity, t);
+            outState->LinearVelocity = Vector3f(a.LinearVelocity).Lerp(b.LinearVelocity, t);
+            outState->AngularAcceleration = Vector3f(a.AngularAcceleration).Lerp(b.AngularAcceleration, t);
+            outState->LinearAcceleration = Vector3f(a.LinearAcceleration).Lerp(b.LinearAcceleration, t);
+            outState->TimeInSeconds = absTime;
+            outState->StatusFlags = a.StatusFlags & b.StatusFlags;
+        });
+    }
+
+    bool Sample(double absTime, Posef* outPose) const
+    {
+        pvrPoseStatef state;
+        if (!Sample(absTime, &state))
+            return false;
+        *outPose = state.ThePose;
+        return true;
+    }
+
+    // Copies the samples with fromTime <= TimeInSeconds <= toTime, oldest first, replacing
+    // the content of outStates. Returns the number of samples copied.
+    int GetRange(double fromTime, double toTime, std::vector<pvrPoseStatef>* outStates) const
+    {
+        return Ring.GetRange(fromTime, toTime, outStates);
+    }
+
+private:
+    TimedRing<pvrPoseStatef> Ring;
+    double                   MaxExtrapolation;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** PoseHistoryPoller
+//
+// Polls getTrackedDevicePoseState for one device on a background thread and feeds a
+// PoseHistory, so consumers sample the history instead of each making tracking calls.
+// Poll at or above the tracker rate; repeated samples are dropped by the history.
+//
+// Example usage:
+//     PoseHistoryPoller hmdPoller(pvrTrackedDevice_HMD);
+//     hmdPoller.Start(session, 1000.0);
+//     Posef hmdPose;
+//     if (hmdPoller.GetHistory().Sample(frame.exposureTime, &hmdPose))
+//         ...
+
+class PoseHistoryPoller
+{
+public:
+    explicit PoseHistoryPoller(pvrTrackedDeviceType device = pvrTrackedDevice_HMD, int historyCapacity = 1024)
+        : History(historyCapacity), Session(nullptr), Device(device)
+    { }
+
+    ~PoseHistoryPoller() { Stop(); }
+
+    bool Start(pvrSessionHandle session, double rateHz = 1000.0)
+    {
+        if (!session || rateHz <= 0.0)
+            return false;
+        Session = session;
+        return Thread.Start([this]() { Poll(); }, 1.0 / rateHz);
+    }
+
+    void Stop() { Thread.Stop(); }
+
+    bool IsRunning() const { return Thread.IsRunning(); }
+
+    pvrTrackedDeviceType GetDevice() const { return Device; }
+
+    const PoseHistory& GetHistory() const { return History; }
+
+private:
+    void Poll()
+    {
+        pvrPoseStatef state;
+        if (pvr_getTrackedDevicePoseState(Session, Device, 0.0, &state) == pvr_success)
+            History.Add(state);
+    }
+
+    PoseHistory          History;
+    pvrSessionHandle     Session;
+    pvrTrackedDeviceType Device;
+    PollingThread        Thread;
+};
+
+
+} // Namespace PVR
+
+#endif
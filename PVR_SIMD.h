@@ -0,0 +1,88 @@
+/************************************************************************************
+
+Filename    :   PVR_SIMD.h
+Content     :   SIMD instruction set detection for the PVR CPU kernels.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_SIMD_h
+#define PVR_SIMD_h
+
+#include "PVR_Types.h"
+
+
+//-----------------------------------------------------------------------------------
+// ***** PVR_SIMD_SSE2 / PVR_SIMD_SSSE3 / PVR_SIMD_AVX / PVR_SIMD_AVX2
+//
+// Set to 1 when the instruction set is enabled for the current compilation unit
+// (e.g. /arch:AVX2 or -mavx2). SSE2 is always available on x64.
+// Define PVR_SIMD_DISABLE to force the scalar code paths.
+//
+// Example usage:
+//     #if PVR_SIMD_SSE2
+//         __m128 v = _mm_loadu_ps(src);
+//     #endif
+
+#if defined(PVR_SIMD_DISABLE)
+    #define PVR_SIMD_SSE2  0
+    #define PVR_SIMD_SSSE3 0
+    #define PVR_SIMD_AVX   0
+    #define PVR_SIMD_AVX2  0
+#else
+    #if !defined(PVR_SIMD_SSE2)
+        #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+            #define PVR_SIMD_SSE2 1
+        #else
+            #define PVR_SIMD_SSE2 0
+        #endif
+    #endif
+
+    #if !defined(PVR_SIMD_AVX2)
+        #if defined(__AVX2__)
+            #define PVR_SIMD_AVX2 1
+        #else
+            #define PVR_SIMD_AVX2 0
+        #endif
+    #endif
+
+    #if !defined(PVR_SIMD_AVX)
+        #if defined(__AVX__) || PVR_SIMD_AVX2
+            #define PVR_SIMD_AVX 1
+        #else
+            #define PVR_SIMD_AVX 0
+        #endif
+    #endif
+
+    // MSVC has no SSSE3 switch; it is implied by /arch:AVX.
+    #if !defined(PVR_SIMD_SSSE3)
+        #if defined(__SSSE3__) || PVR_SIMD_AVX
+            #define PVR_SIMD_SSSE3 1
+        #else
+            #define PVR_SIMD_SSSE3 0
+        #endif
+    #endif
+#endif
+
+#if PVR_SIMD_AVX
+    #include <immintrin.h>
+#elif PVR_SIMD_SSSE3
+    #include <tmmintrin.h>
+#elif PVR_SIMD_SSE2
+    #include <emmintrin.h>
+#endif
+
+
+//-----------------------------------------------------------------------------------
+// ***** PVR_RESTRICT
+
+#if !defined(PVR_RESTRICT)
+    #if defined(_MSC_VER)
+        #define PVR_RESTRICT __restrict
+    #elif defined(__GNUC__) || defined(__clang__)
+        #define PVR_RESTRICT __restrict__
+    #else
+        #define PVR_RESTRICT
+    #endif
+#endif
+
+#endif
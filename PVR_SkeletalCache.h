@@ -0,0 +1,281 @@
+/************************************************************************************
+
+Filename    :   PVR_SkeletalCache.h
+Content     :   Timestamped client-side cache of skeletal data.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_SkeletalCache_h
+#define PVR_SkeletalCache_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Skeleton.h"
+#include "PVR_Threading.h"
+#include "PVR_TimedRing.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkeletalSource
+
+enum SkeletalSource
+{
+    SkeletalSource_WithController    = pvrSkeletalMotionRange_WithController,    // getSkeletalData
+    SkeletalSource_WithoutController = pvrSkeletalMotionRange_WithoutController, // getSkeletalData
+    SkeletalSource_HandTracking,                                                 // getHandTrackingSkeletalData
+    SkeletalSource_Count
+};
+
+enum SkeletalSourceMask
+{
+    SkeletalSourceMask_WithController    = 1 << SkeletalSource_WithController,
+    SkeletalSourceMask_WithoutController = 1 << SkeletalSource_WithoutController,
+    SkeletalSourceMask_HandTracking      = 1 << SkeletalSource_HandTracking,
+    SkeletalSourceMask_Controllers       = SkeletalSourceMask_WithController | SkeletalSourceMask_WithoutController,
+    SkeletalSourceMask_All               = SkeletalSourceMask_Controllers | SkeletalSourceMask_HandTracking
+};
+
+// Bone sets of every source for both hands at one time. Valid has bit
+// source * pvrHand_Count + hand set for each bone set that was returned by the runtime.
+struct SkeletalSnapshot
+{
+    double          TimeInSeconds;
+    uint32_t        Valid;
+    uint32_t        BoneCount[SkeletalSource_Count][pvrHand_Count];
+    SkeletalPoseSoA Poses[SkeletalSource_Count];
+
+    static uint32_t Bit(SkeletalSource source, uint32_t hand) { return 1u << (source * pvrHand_Count + hand); }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkeletalCache
+//
+// Polls the skeletal data once per tracker update on a background thread and keeps a
+// TimedRing of snapshots, so that a frame asks the cache instead of making one call per
+// device, motion range, hand and time. A tracker update is detected from the
+// TimeInSeconds of the HMD and controller pose states; with nothing tracked, no snapshot
+// is taken. Hand tracking is queried at the snapshot time.
+//
+// Queries at any time covered by the history interpolate the two surrounding snapshots
+// per bone with SkeletonEvaluator::Blend, a normalized lerp (as Quat::Lerp) over both
+// hands in one SoA pass. This deliberately differs from Posef::FastLerp, whose rotation
+// vector slerp costs a transcendental per bone; between two tracker updates a bone turns
+// by a few degrees, where both agree to well below the tracking noise. Times after the
+// newest snapshot return it unchanged: bones are not extrapolated. Thread safe: queries
+// may run on any thread while the poller adds.
+//
+// Example usage:
+//     SkeletalCache skeletons;
+//     skeletons.Start(session);
+//     ...
+//     SkeletalPoseSoA local;
+//     uint32_t validHands;
+//     if (skeletons.Sample(displayTime, SkeletalSource_WithController, &local, &validHands))
+//         fk.Evaluate(local, handToWorld, &model, &world);
+
+class SkeletalCache
+{
+public:
+    explicit SkeletalCache(uint32_t sourceMask = SkeletalSourceMask_All, int capacity = 64)
+        : Snapshots(capacity), SourceMask(sourceMask), Session(nullptr)
+    {
+        Staging.TimeInSeconds = 0.0;
+        Staging.Valid = 0;
+        memset(Staging.BoneCount, 0, sizeof(Staging.BoneCount));
+        for (int source = 0; source < SkeletalSource_Count; source++)
+            Staging.Poses[source].SetIdentity();
+    }
+
+    ~SkeletalCache() { Stop(); }
+
+    // Polls at rateHz, which should be at or above the tracker rate; polls without a new
+    // tracker update only cost the pose state calls.
+    bool Start(pvrSessionHandle session, double rateHz = 1000.0)
+    {
+        if (!session || rateHz <= 0.0)
+            return false;
+        Session = session;
+        return Thread.Start([this]() { Poll(); }, 1.0 / rateHz);
+    }
+
+    void Stop() { Thread.Stop(); }
+
+    bool IsRunning() const { return Thread.IsRunning(); }
+
+    void Clear() { Snapshots.Clear(); }
+
+    // Adds a snapshot. Start() calls this; call it directly to replay recorded data.
+    // Returns false if the snapshot is not newer than the newest one.
+    bool Add(const SkeletalSnapshot& snapshot) { return Snapshots.Add(snapshot); }
+
+    int GetCount() const { return Snapshots.GetCount(); }
+
+    double GetLatestTime() const { return Snapshots.GetLatestTime(); }
+
+    // Both hands of one source at absTime (0 for the newest snapshot). Bones of a hand
+    // missing from outValidHands (bit per pvrHandDeviceType) are identity. Returns false if
+    // neither hand is valid, including when absTime is older than the oldest snapshot.
+    bool Sample(double absTime, SkeletalSource source, SkeletalPoseSoA* outPoses, uint32_t* outValidHands,
+                uint32_t outBoneCount[pvrHand_Count] = nullptr) const
+    {
+        uint32_t valid = 0;
+        const double time = (absTime == 0.0) ? MATH_DOUBLE_MAXVALUE : absTime;
+        Snapshots.Sample(time, [&](const SkeletalSnapshot& a, const SkeletalSnapshot& b, float t)
+        {
+            float weight[pvrHand_Count];
+            for (uint32_t h = 0; h < pvrHand_Count; h++)
+            {
+                // A hand missing from one of the snapshots uses the other one alone.
+                const uint32_t bit = SkeletalSnapshot::Bit(source, h);
+                const bool inA = (a.Valid & bit) != 0, inB = (b.Valid & bit) != 0;
+                weight[h] = (inA && inB) ? t : inA ? 0.0f : 1.0f;
+                if (!inA && !inB)
+                    continue;
+                valid |= 1u << h;
+                if (outBoneCount)
+                    outBoneCount[h] = (weight[h] < 1.0f ? a : b).BoneCount[source][h];
+            }
+            SkeletonEvaluator::Blend(a.Poses[source], b.Poses[source], weight, outPoses);
+            for (uint32_t h = 0; h < pvrHand_Count; h++)
+            {
+                if (!(valid & (1u << h)))
+                    ClearHand(outPoses, h);
+            }
+        });
+        *outValidHands = valid;
+        return valid != 0;
+    }
+
+    // One hand of one source at absTime in the runtime layout. Returns false if the cache
+    // has no data for that hand and source at absTime.
+    bool Sample(double absTime, SkeletalSource source, uint32_t hand, pvrSkeletalData* outData) const
+    {
+        PVR_MATH_ASSERT(hand < pvrHand_Count);
+        SkeletalPoseSoA poses;
+        uint32_t valid, boneCount[pvrHand_Count];
+        if (!Sample(absTime, source, &poses, &valid, boneCount) || !(valid & (1u << hand)))
+            return false;
+        poses.Store(int(hand), outData, boneCount[hand]);
+        return true;
+    }
+
+    // Both hands of both controller motion ranges at absTime, blended per hand like
+    // SkeletonEvaluator::Evaluate: 0 gives _WithController, 1 gives _WithoutController.
+    bool SampleBlended(double absTime, const float withoutControllerWeight[pvrHand_Count],
+                       SkeletalPoseSoA* outPoses, uint32_t* outValidHands) const
+    {
+        SkeletalPoseSoA withoutController;
+        uint32_t validWith = 0, validWithout = 0;
+        if (!Sample(absTime, SkeletalSource_WithController, outPoses, &validWith))
+            outPoses->SetIdentity();
+        if (!Sample(absTime, SkeletalSource_WithoutController, &withoutController, &validWithout))
+            withoutController.SetIdentity();
+
+        // A hand with only one range valid uses that range alone.
+        float weight[pvrHand_Count];
+        for (uint32_t h = 0; h < pvrHand_Count; h++)
+        {
+            const uint32_t bit = 1u << h;
+            weight[h] = !(validWithout & bit) ? 0.0f : !(validWith & bit) ? 1.0f : withoutControllerWeight[h];
+        }
+        SkeletonEvaluator::Blend(*outPoses, withoutController, weight, outPoses);
+        *outValidHands = validWith | validWithout;
+        return *outValidHands != 0;
+    }
+
+private:
+    static void ClearHand(SkeletalPoseSoA* poses, uint32_t hand)
+    {
+        const int base = int(hand) * SkeletalPoseSoA::BonesPerHand;
+        for (int i = base; i < base + SkeletalPoseSoA::BonesPerHand; i++)
+        {
+            poses->Qx[i] = poses->Qy[i] = poses->Qz[i] = 0.0f; poses->Qw[i] = 1.0f;
+            poses->Tx[i] = poses->Ty[i] = poses->Tz[i] = 0.0f;
+        }
+    }
+
+    void Poll()
+    {
+        static const pvrTrackedDeviceType controllers[pvrHand_Count] = { pvrTrackedDevice_LeftController,
+                                                                         pvrTrackedDevice_RightController };
+        uint32_t connected = 0;
+        if (pvr_getConnectedDevices(Session, &connected) != pvr_success)
+            connected = 0;
+
+        // Time of the newest tracker update. The HMD pose updates with or without
+        // controllers, so hand tracking alone also polls once per update.
+        static const pvrTrackedDeviceType devices[] = { pvrTrackedDevice_HMD, pvrTrackedDevice_LeftController,
+                                                        pvrTrackedDevice_RightController };
+        double time = 0.0;
+        for (size_t d = 0; d < sizeof(devices) / sizeof(devices[0]); d++)
+        {
+            pvrPoseStatef state;
+            if ((connected & devices[d]) &&
+                pvr_getTrackedDevicePoseState(Session, devices[d], 0.0, &state) == pvr_success)
+            {
+                time = PVRMath_Max(time, state.TimeInSeconds);
+            }
+        }
+        if (time == 0.0 || time <= GetLatestTime())
+            return;
+
+        SkeletalSnapshot& s = Staging;
+        s.TimeInSeconds = time;
+        s.Valid = 0;
+        pvrSkeletalData data;
+        for (uint32_t h = 0; h < pvrHand_Count; h++)
+        {
+            for (int r = 0; r < pvrSkeletalMotionRange_Max; r++)
+            {
+                const SkeletalSource source = SkeletalSource(r);
+                if (!(SourceMask & (1u << source)) || !(connected & controllers[h]) ||
+                    pvr_getSkeletalData(Session, controllers[h], pvrSkeletalMotionRange(r), &data) != pvr_success)
+                {
+                    continue;
+                }
+                Store(source, h, data);
+            }
+            if ((SourceMask & SkeletalSourceMask_HandTracking) &&
+                pvr_getHandTrackingSkeletalData(Session, pvrHandDeviceType(h), time, &data) == pvr_success)
+            {
+                Store(SkeletalSource_HandTracking, h, data);
+            }
+        }
+
+        // Bone sets missing from this poll are identity, not those of an earlier poll:
+        // Blend reads both hands even when one has weight 0.
+        for (int source = 0; source < SkeletalSource_Count; source++)
+        {
+            for (uint32_t h = 0; h < pvrHand_Count; h++)
+            {
+                if (!(s.Valid & SkeletalSnapshot::Bit(SkeletalSource(source), h)))
+                {
+                    ClearHand(&s.Poses[source], h);
+                    s.BoneCount[source][h] = 0;
+                }
+            }
+        }
+        Add(s);
+    }
+
+    void Store(SkeletalSource source, uint32_t hand, const pvrSkeletalData& data)
+    {
+        Staging.Poses[source].Load(int(hand), data);
+        Staging.BoneCount[source][hand] = PVRMath_Min<uint32_t>(data.boneCount, SkeletalPoseSoA::BonesPerHand);
+        Staging.Valid |= SkeletalSnapshot::Bit(source, hand);
+    }
+
+    TimedRing<SkeletalSnapshot> Snapshots;
+    uint32_t                    SourceMask;
+    SkeletalSnapshot            Staging;    // Poll thread only.
+    pvrSessionHandle            Session;
+    PollingThread               Thread;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,406 @@
+/************************************************************************************
+
+Filename    :   PVR_Skeleton.h
+Content     :   Hand skeleton description and batched forward kinematics for pvrSkeletalData.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Skeleton_h
+#define PVR_Skeleton_h
+
+#include "PVR_Math.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** HandBone
+//
+// Bone indices of the hand skeleton reported by getSkeletalData, getGripLimitSkeletalData
+// and getHandTrackingSkeletalData. boneTransforms[] are expressed relative to the parent
+// bone, with the root expressed relative to the tracked device (or hand) pose.
+
+enum HandBone
+{
+    HandBone_Root = 0,
+    HandBone_Wrist,
+    HandBone_Thumb0,
+    HandBone_Thumb1,
+    HandBone_Thumb2,
+    HandBone_Thumb3,
+    HandBone_IndexFinger0,
+    HandBone_IndexFinger1,
+    HandBone_IndexFinger2,
+    HandBone_IndexFinger3,
+    HandBone_IndexFinger4,
+    HandBone_MiddleFinger0,
+    HandBone_MiddleFinger1,
+    HandBone_MiddleFinger2,
+    HandBone_MiddleFinger3,
+    HandBone_MiddleFinger4,
+    HandBone_RingFinger0,
+    HandBone_RingFinger1,
+    HandBone_RingFinger2,
+    HandBone_RingFinger3,
+    HandBone_RingFinger4,
+    HandBone_PinkyFinger0,
+    HandBone_PinkyFinger1,
+    HandBone_PinkyFinger2,
+    HandBone_PinkyFinger3,
+    HandBone_PinkyFinger4,
+    HandBone_Aux_Thumb,
+    HandBone_Aux_IndexFinger,
+    HandBone_Aux_MiddleFinger,
+    HandBone_Aux_RingFinger,
+    HandBone_Aux_PinkyFinger,
+    HandBone_Count
+};
+
+PVR_MATH_STATIC_ASSERT(int(HandBone_Count) <= int(PVR_MAX_SKELETAL_BONE_COUNT), "HandBone_Count failure");
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkeletonDesc
+//
+// Describes the hierarchy of a skeleton as one parent index per bone.
+// Parents must precede their children (Parent[i] < i), the root has Parent = -1.
+
+struct SkeletonDesc
+{
+    uint32_t BoneCount;
+    int8_t   Parent[PVR_MAX_SKELETAL_BONE_COUNT];
+
+    SkeletonDesc() : BoneCount(0)
+    {
+        for (int i = 0; i < PVR_MAX_SKELETAL_BONE_COUNT; i++)
+            Parent[i] = -1;
+    }
+
+    SkeletonDesc(const int8_t* parents, uint32_t boneCount) : BoneCount(boneCount)
+    {
+        PVR_MATH_ASSERT(boneCount <= PVR_MAX_SKELETAL_BONE_COUNT);
+        for (int i = 0; i < PVR_MAX_SKELETAL_BONE_COUNT; i++)
+            Parent[i] = (uint32_t(i) < boneCount) ? parents[i] : int8_t(-1);
+    }
+
+    // Hierarchy matching the HandBone layout. Auxiliary bones hang off the root.
+    static SkeletonDesc Hand()
+    {
+        static const int8_t parents[HandBone_Count] =
+        {
+            -1,                                                     // Root
+            HandBone_Root,                                          // Wrist
+            HandBone_Wrist, 2, 3, 4,                                // Thumb0..3
+            HandBone_Wrist, 6, 7, 8, 9,                             // IndexFinger0..4
+            HandBone_Wrist, 11, 12, 13, 14,                         // MiddleFinger0..4
+            HandBone_Wrist, 16, 17, 18, 19,                         // RingFinger0..4
+            HandBone_Wrist, 21, 22, 23, 24,                         // PinkyFinger0..4
+            HandBone_Root, HandBone_Root, HandBone_Root,             // Aux_Thumb, Aux_Index, Aux_Middle
+            HandBone_Root, HandBone_Root                            // Aux_Ring, Aux_Pinky
+        };
+        return SkeletonDesc(parents, HandBone_Count);
+    }
+
+    // Returns true if every parent index precedes its child, which FK evaluation relies on.
+    bool IsValid() const
+    {
+        if (BoneCount > PVR_MAX_SKELETAL_BONE_COUNT)
+            return false;
+        for (uint32_t i = 0; i < BoneCount; i++)
+        {
+            if (Parent[i] >= int(i) || Parent[i] < -1)
+                return false;
+        }
+        return true;
+    }
+
+    // Number of edges between bone and the root.
+    int GetDepth(uint32_t bone) const
+    {
+        int depth = 0;
+        for (int p = Parent[bone]; p >= 0; p = Parent[p])
+            depth++;
+        return depth;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkeletalPoseSoA
+//
+// Bone poses of both hands stored one component per array, so that the evaluation loops
+// run over contiguous floats. Bone b of hand h lives at index h * PVR_MAX_SKELETAL_BONE_COUNT + b.
+
+struct PVR_ALIGNAS(16) SkeletalPoseSoA
+{
+    enum { BonesPerHand = PVR_MAX_SKELETAL_BONE_COUNT,
+           Capacity     = PVR_MAX_SKELETAL_BONE_COUNT * pvrHand_Count };
+
+    float Qx[Capacity], Qy[Capacity], Qz[Capacity], Qw[Capacity];
+    float Tx[Capacity], Ty[Capacity], Tz[Capacity];
+
+    static int Index(int hand, int bone) { return hand * BonesPerHand + bone; }
+
+    Posef GetPose(int hand, int bone) const
+    {
+        const int i = Index(hand, bone);
+        return Posef(Quatf(Qx[i], Qy[i], Qz[i], Qw[i]), Vector3f(Tx[i], Ty[i], Tz[i]));
+    }
+
+    void SetPose(int hand, int bone, const Posef& p)
+    {
+        const int i = Index(hand, bone);
+        Qx[i] = p.Rotation.x;    Qy[i] = p.Rotation.y;    Qz[i] = p.Rotation.z;    Qw[i] = p.Rotation.w;
+        Tx[i] = p.Translation.x; Ty[i] = p.Translation.y; Tz[i] = p.Translation.z;
+    }
+
+    void SetIdentity()
+    {
+        for (int i = 0; i < Capacity; i++)
+        {
+            Qx[i] = Qy[i] = Qz[i] = 0.0f; Qw[i] = 1.0f;
+            Tx[i] = Ty[i] = Tz[i] = 0.0f;
+        }
+    }
+
+    // Transposes the runtime AoS layout into this one. Bones past boneCount are set to identity.
+    void Load(int hand, const pvrSkeletalData& data)
+    {
+        const uint32_t count = PVRMath_Min<uint32_t>(data.boneCount, BonesPerHand);
+        const int base = hand * BonesPerHand;
+        for (uint32_t b = 0; b < count; b++)
+        {
+            const pvrPosef& p = data.boneTransforms[b];
+            Qx[base + b] = p.Orientation.x; Qy[base + b] = p.Orientation.y;
+            Qz[base + b] = p.Orientation.z; Qw[base + b] = p.Orientation.w;
+            Tx[base + b] = p.Position.x;    Ty[base + b] = p.Position.y;    Tz[base + b] = p.Position.z;
+        }
+        for (uint32_t b = count; b < BonesPerHand; b++)
+        {
+            Qx[base + b] = Qy[base + b] = Qz[base + b] = 0.0f; Qw[base + b] = 1.0f;
+            Tx[base + b] = Ty[base + b] = Tz[base + b] = 0.0f;
+        }
+    }
+
+    void Store(int hand, pvrSkeletalData* data, uint32_t boneCount = BonesPerHand) const
+    {
+        const int base = hand * BonesPerHand;
+        data->boneCount = PVRMath_Min<uint32_t>(boneCount, BonesPerHand);
+        for (uint32_t b = 0; b < data->boneCount; b++)
+        {
+            pvrPosef& p = data->boneTransforms[b];
+            p.Orientation.x = Qx[base + b]; p.Orientation.y = Qy[base + b];
+            p.Orientation.z = Qz[base + b]; p.Orientation.w = Qw[base + b];
+            p.Position.x = Tx[base + b];    p.Position.y = Ty[base + b];    p.Position.z = Tz[base + b];
+        }
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkeletonEvaluator
+//
+// Forward kinematics for both hands in one pass.
+//
+// At construction the bones of both hands are sorted into depth levels. Bones of the same
+// level never depend on each other, so each level is evaluated as one dependency-free loop
+// over the SoA arrays; a 31-bone hand skeleton yields 7 levels (depths 0 to 6) of up to
+// 12 bones for the two hands combined.
+//
+// Typical use, once per tracking update:
+//
+//     SkeletonEvaluator fk(SkeletonDesc::Hand());
+//     SkeletalPoseSoA   local, model, world;
+//     local.Load(pvrHand_Left, leftData);
+//     local.Load(pvrHand_Right, rightData);
+//     fk.Evaluate(local, handToWorld, &model, &world);
+
+class SkeletonEvaluator
+{
+public:
+    enum { Capacity = SkeletalPoseSoA::Capacity };
+
+    SkeletonEvaluator() : LevelCount(0) { LevelStart[0] = 0; }
+
+    explicit SkeletonEvaluator(const SkeletonDesc& desc) { SetSkeleton(desc); }
+
+    void SetSkeleton(const SkeletonDesc& desc)
+    {
+        PVR_MATH_ASSERT(desc.IsValid());
+        Desc = desc;
+
+        int depth[PVR_MAX_SKELETAL_BONE_COUNT];
+        int maxDepth = -1;
+        for (uint32_t b = 0; b < desc.BoneCount; b++)
+        {
+            depth[b] = desc.GetDepth(b);
+            maxDepth = PVRMath_Max(maxDepth, depth[b]);
+        }
+
+        // Bucket flat (hand, bone) indices by depth. Roots (level 0) keep Parent -1: their model
+        // pose is their local pose, and EvaluateWorld() composes them with handToWorld like every bone.
+        int n = 0;
+        LevelCount = 0;
+        for (int d = 0; d <= maxDepth; d++)
+        {
+            LevelStart[LevelCount++] = n;
+            for (int h = 0; h < pvrHand_Count; h++)
+            {
+                for (uint32_t b = 0; b < desc.BoneCount; b++)
+                {
+                    if (depth[b] != d)
+                        continue;
+                    const int i = SkeletalPoseSoA::Index(h, b);
+                    Order[n]  = uint8_t(i);
+                    Parent[n] = (desc.Parent[b] < 0) ? int8_t(-1) : int8_t(SkeletalPoseSoA::Index(h, desc.Parent[b]));
+                    n++;
+                }
+            }
+        }
+        LevelStart[LevelCount] = n;
+    }
+
+    const SkeletonDesc& GetSkeleton() const { return Desc; }
+
+    // Blends two local-space bone sets per hand: out = lerp(a, b, weight[hand]). Rotations use
+    // normalized lerp with hemisphere correction, which is accurate for the small angular
+    // differences between pvrSkeletalMotionRange_WithController and _WithoutController.
+    // out may alias a or b.
+    static void Blend(const SkeletalPoseSoA& a, const SkeletalPoseSoA& b,
+                      const float weight[pvrHand_Count], SkeletalPoseSoA* out)
+    {
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            const float s = weight[h];
+            const int base = h * SkeletalPoseSoA::BonesPerHand;
+            for (int i = base; i < base + SkeletalPoseSoA::BonesPerHand; i++)
+            {
+                const float d  = a.Qx[i] * b.Qx[i] + a.Qy[i] * b.Qy[i] + a.Qz[i] * b.Qz[i] + a.Qw[i] * b.Qw[i];
+                const float sb = (d < 0.0f) ? -s : s;
+                const float sa = 1.0f - s;
+                float qx = a.Qx[i] * sa + b.Qx[i] * sb;
+                float qy = a.Qy[i] * sa + b.Qy[i] * sb;
+                float qz = a.Qz[i] * sa + b.Qz[i] * sb;
+                float qw = a.Qw[i] * sa + b.Qw[i] * sb;
+                const float rcpLen = 1.0f / sqrtf(qx * qx + qy * qy + qz * qz + qw * qw);
+                out->Qx[i] = qx * rcpLen;
+                out->Qy[i] = qy * rcpLen;
+                out->Qz[i] = qz * rcpLen;
+                out->Qw[i] = qw * rcpLen;
+                out->Tx[i] = a.Tx[i] * sa + b.Tx[i] * s;
+                out->Ty[i] = a.Ty[i] * sa + b.Ty[i] * s;
+                out->Tz[i] = a.Tz[i] * sa + b.Tz[i] * s;
+            }
+        }
+    }
+
+    // Computes model-space poses (relative to each hand's device pose) from parent-relative
+    // local poses. model must not alias local.
+    void EvaluateModel(const SkeletalPoseSoA& local, SkeletalPoseSoA* model) const
+    {
+        PVR_MATH_ASSERT(&local != model);
+        for (int l = 0; l < LevelCount; l++)
+        {
+            for (int k = LevelStart[l]; k < LevelStart[l + 1]; k++)
+            {
+                const int i = Order[k];
+                const int p = Parent[k];
+                if (p < 0)
+                {
+                    model->Qx[i] = local.Qx[i]; model->Qy[i] = local.Qy[i];
+                    model->Qz[i] = local.Qz[i]; model->Qw[i] = local.Qw[i];
+                    model->Tx[i] = local.Tx[i]; model->Ty[i] = local.Ty[i]; model->Tz[i] = local.Tz[i];
+                    continue;
+                }
+                Compose(model->Qx[p], model->Qy[p], model->Qz[p], model->Qw[p],
+                        model->Tx[p], model->Ty[p], model->Tz[p],
+                        local.Qx[i], local.Qy[i], local.Qz[i], local.Qw[i],
+                        local.Tx[i], local.Ty[i], local.Tz[i],
+                        model, i);
+            }
+        }
+    }
+
+    // Transforms model-space poses to world space: world[h][b] = handToWorld[h] * model[h][b].
+    // world may alias model.
+    void EvaluateWorld(const SkeletalPoseSoA& model, const pvrPosef handToWorld[pvrHand_Count],
+                       SkeletalPoseSoA* world) const
+    {
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            const float px = handToWorld[h].Orientation.x, py = handToWorld[h].Orientation.y;
+            const float pz = handToWorld[h].Orientation.z, pw = handToWorld[h].Orientation.w;
+            const float tx = handToWorld[h].Position.x, ty = handToWorld[h].Position.y, tz = handToWorld[h].Position.z;
+            const int base = h * SkeletalPoseSoA::BonesPerHand;
+            const int end  = base + int(Desc.BoneCount);
+            for (int i = base; i < end; i++)
+            {
+                Compose(px, py, pz, pw, tx, ty, tz,
+                        model.Qx[i], model.Qy[i], model.Qz[i], model.Qw[i],
+                        model.Tx[i], model.Ty[i], model.Tz[i],
+                        world, i);
+            }
+        }
+    }
+
+    // Model and world evaluation in one call. Either output may be the only one requested
+    // by the caller, but model is needed as scratch and must not be null.
+    void Evaluate(const SkeletalPoseSoA& local, const pvrPosef handToWorld[pvrHand_Count],
+                  SkeletalPoseSoA* model, SkeletalPoseSoA* world) const
+    {
+        EvaluateModel(local, model);
+        if (world)
+            EvaluateWorld(*model, handToWorld, world);
+    }
+
+    // Convenience overload blending the two motion ranges before evaluation.
+    // withoutControllerWeight = 0 gives pvrSkeletalMotionRange_WithController, 1 gives _WithoutController.
+    void Evaluate(const pvrSkeletalData withController[pvrHand_Count],
+                  const pvrSkeletalData withoutController[pvrHand_Count],
+                  const float withoutControllerWeight[pvrHand_Count],
+                  const pvrPosef handToWorld[pvrHand_Count],
+                  SkeletalPoseSoA* model, SkeletalPoseSoA* world) const
+    {
+        SkeletalPoseSoA a, b;
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            a.Load(h, withController[h]);
+            b.Load(h, withoutController[h]);
+        }
+        Blend(a, b, withoutControllerWeight, &a);
+        Evaluate(a, handToWorld, model, world);
+    }
+
+private:
+    // out[i] = (pq, pt) * (lq, lt)
+    static inline void Compose(float pqx, float pqy, float pqz, float pqw,
+                               float ptx, float pty, float ptz,
+                               float lqx, float lqy, float lqz, float lqw,
+                               float ltx, float lty, float ltz,
+                               SkeletalPoseSoA* out, int i)
+    {
+        // Same formulation as Quat::Rotate: rv = v + w*uv + imag x uv, uv = 2 * imag x v.
+        const float uvx = 2.0f * (pqy * ltz - pqz * lty);
+        const float uvy = 2.0f * (pqz * ltx - pqx * ltz);
+        const float uvz = 2.0f * (pqx * lty - pqy * ltx);
+        out->Tx[i] = ptx + ltx + pqw * uvx + pqy * uvz - pqz * uvy;
+        out->Ty[i] = pty + lty + pqw * uvy + pqz * uvx - pqx * uvz;
+        out->Tz[i] = ptz + ltz + pqw * uvz + pqx * uvy - pqy * uvx;
+
+        out->Qx[i] = pqw * lqx + pqx * lqw + pqy * lqz - pqz * lqy;
+        out->Qy[i] = pqw * lqy - pqx * lqz + pqy * lqw + pqz * lqx;
+        out->Qz[i] = pqw * lqz + pqx * lqy - pqy * lqx + pqz * lqw;
+        out->Qw[i] = pqw * lqw - pqx * lqx - pqy * lqy - pqz * lqz;
+    }
+
+    SkeletonDesc Desc;
+    int          LevelCount;
+    int          LevelStart[PVR_MAX_SKELETAL_BONE_COUNT + 1];
+    uint8_t      Order[Capacity];
+    int8_t       Parent[Capacity];
+};
+
+
+} // Namespace PVR
+
+#endif
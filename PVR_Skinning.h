@@ -0,0 +1,338 @@
+/************************************************************************************
+
+Filename    :   PVR_Skinning.h
+Content     :   CPU skinning kernels for hand and controller meshes driven by pvrSkeletalData.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Skinning_h
+#define PVR_Skinning_h
+
+#include "PVR_Math.h"
+#include "PVR_Skeleton.h"
+#include "PVR_SIMD.h"
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkinInfluence
+//
+// Up to four bone influences per vertex. Unused slots must have zero weight; their bone
+// index still has to be valid for the palette (0 is fine). Weights should sum to 1.
+
+enum { SkinMaxInfluences = 4 };
+
+struct SkinInfluence
+{
+    uint16_t Bone[SkinMaxInfluences];
+    float    Weight[SkinMaxInfluences];
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** Palette construction
+
+// Builds the dual quaternion palette of one hand: palette[b] = model[b] * inverseBind[b].
+// inverseBind holds the inverse of each bone's bind pose in mesh space.
+inline void BuildSkinningPalette(const SkeletalPoseSoA& model, int hand, const Posef* inverseBind,
+                                 int boneCount, DualQuatf* palette)
+{
+    for (int b = 0; b < boneCount; b++)
+        palette[b] = DualQuatf(model.GetPose(hand, b) * inverseBind[b]);
+}
+
+// Matrix palette counterpart of the above, for the linear blend skinning path.
+inline void BuildSkinningPalette(const SkeletalPoseSoA& model, int hand, const Posef* inverseBind,
+                                 int boneCount, Matrix4f* palette)
+{
+    for (int b = 0; b < boneCount; b++)
+        palette[b] = Matrix4f(model.GetPose(hand, b) * inverseBind[b]);
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkinDualQuat
+//
+// Dual quaternion skinning (DLB) of vertexCount vertices. normals and outNormals may be
+// null. Input and output arrays must not overlap.
+//
+// With SSE2 the kernel skins four vertices per iteration: the palette entries of the four
+// lanes are transposed into SoA registers, after which blending, normalization and the
+// transform are purely vertical. The remainder is handled by the scalar path.
+
+namespace SkinningDetail {
+
+inline void SkinDualQuatScalar(const DualQuatf* palette, const SkinInfluence& inf,
+                               const Vector3f& p, const Vector3f* n, Vector3f* outP, Vector3f* outN)
+{
+    const DualQuatf& dq0 = palette[inf.Bone[0]];
+    Quatf r(0, 0, 0, 0), d(0, 0, 0, 0);
+    for (int k = 0; k < SkinMaxInfluences; k++)
+    {
+        const DualQuatf& dq = palette[inf.Bone[k]];
+        float w = (dq0.Real.Dot(dq.Real) < 0.0f) ? -inf.Weight[k] : inf.Weight[k];
+        r += dq.Real * w;
+        d += dq.Dual * w;
+    }
+
+    const float rcpLen = 1.0f / r.Length();
+    r *= rcpLen;
+    d *= rcpLen;
+
+    // t = 2 * (r.w * d.xyz - d.w * r.xyz + r.xyz x d.xyz)
+    Vector3f rv(r.x, r.y, r.z), dv(d.x, d.y, d.z);
+    Vector3f t = (dv * r.w - rv * d.w + rv.Cross(dv)) * 2.0f;
+    *outP = r.Rotate(p) + t;
+    if (n)
+        *outN = r.Rotate(*n);
+}
+
+inline void SkinLinearScalar(const Matrix4f* palette, const SkinInfluence& inf,
+                             const Vector3f& p, const Vector3f* n, Vector3f* outP, Vector3f* outN)
+{
+    float m[3][4] = { { 0 } };
+    for (int k = 0; k < SkinMaxInfluences; k++)
+    {
+        const Matrix4f& b = palette[inf.Bone[k]];
+        const float w = inf.Weight[k];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                m[r][c] += b.M[r][c] * w;
+    }
+    outP->x = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3];
+    outP->y = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3];
+    outP->z = m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3];
+    if (n)
+    {
+        // Blended matrices are not orthonormal; renormalize the transformed normal.
+        Vector3f tn(m[0][0] * n->x + m[0][1] * n->y + m[0][2] * n->z,
+                    m[1][0] * n->x + m[1][1] * n->y + m[1][2] * n->z,
+                    m[2][0] * n->x + m[2][1] * n->y + m[2][2] * n->z);
+        *outN = tn.Normalized();
+    }
+}
+
+#if PVR_SIMD_SSE2
+
+// Loads the x/y/z of four Vector3f into SoA registers.
+inline void LoadVector3x4(const Vector3f* v, __m128& x, __m128& y, __m128& z)
+{
+    x = _mm_set_ps(v[3].x, v[2].x, v[1].x, v[0].x);
+    y = _mm_set_ps(v[3].y, v[2].y, v[1].y, v[0].y);
+    z = _mm_set_ps(v[3].z, v[2].z, v[1].z, v[0].z);
+}
+
+inline void StoreVector3x4(Vector3f* v, __m128 x, __m128 y, __m128 z)
+{
+    PVR_ALIGNAS(16) float fx[4], fy[4], fz[4];
+    _mm_store_ps(fx, x);
+    _mm_store_ps(fy, y);
+    _mm_store_ps(fz, z);
+    for (int j = 0; j < 4; j++)
+    {
+        v[j].x = fx[j];
+        v[j].y = fy[j];
+        v[j].z = fz[j];
+    }
+}
+
+// Rotates (vx, vy, vz) by the unit quaternions (qx, qy, qz, qw), four lanes at once.
+// Same formulation as Quat::Rotate.
+inline void RotateX4(__m128 qx, __m128 qy, __m128 qz, __m128 qw,
+                     __m128& vx, __m128& vy, __m128& vz)
+{
+    const __m128 two = _mm_set1_ps(2.0f);
+    __m128 uvx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qy, vz), _mm_mul_ps(qz, vy)));
+    __m128 uvy = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qz, vx), _mm_mul_ps(qx, vz)));
+    __m128 uvz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qx, vy), _mm_mul_ps(qy, vx)));
+    __m128 rx = _mm_add_ps(vx, _mm_add_ps(_mm_mul_ps(qw, uvx), _mm_sub_ps(_mm_mul_ps(qy, uvz), _mm_mul_ps(qz, uvy))));
+    __m128 ry = _mm_add_ps(vy, _mm_add_ps(_mm_mul_ps(qw, uvy), _mm_sub_ps(_mm_mul_ps(qz, uvx), _mm_mul_ps(qx, uvz))));
+    __m128 rz = _mm_add_ps(vz, _mm_add_ps(_mm_mul_ps(qw, uvz), _mm_sub_ps(_mm_mul_ps(qx, uvy), _mm_mul_ps(qy, uvx))));
+    vx = rx;
+    vy = ry;
+    vz = rz;
+}
+
+#endif // PVR_SIMD_SSE2
+
+} // namespace SkinningDetail
+
+
+inline void SkinDualQuat(const DualQuatf* PVR_RESTRICT palette, const SkinInfluence* PVR_RESTRICT influences,
+                         const Vector3f* PVR_RESTRICT positions, const Vector3f* PVR_RESTRICT normals,
+                         int vertexCount,
+                         Vector3f* PVR_RESTRICT outPositions, Vector3f* PVR_RESTRICT outNormals)
+{
+    int i = 0;
+
+#if PVR_SIMD_SSE2
+    using namespace SkinningDetail;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    for (; i + 4 <= vertexCount; i += 4)
+    {
+        const SkinInfluence* inf = influences + i;
+        __m128 rx = zero, ry = zero, rz = zero, rw = zero;
+        __m128 dx = zero, dy = zero, dz = zero, dw = zero;
+        __m128 r0x = zero, r0y = zero, r0z = zero, r0w = zero;
+
+        for (int k = 0; k < SkinMaxInfluences; k++)
+        {
+            // Transpose the four lanes' real and dual parts into SoA registers.
+            __m128 qx = _mm_loadu_ps(&palette[inf[0].Bone[k]].Real.x);
+            __m128 qy = _mm_loadu_ps(&palette[inf[1].Bone[k]].Real.x);
+            __m128 qz = _mm_loadu_ps(&palette[inf[2].Bone[k]].Real.x);
+            __m128 qw = _mm_loadu_ps(&palette[inf[3].Bone[k]].Real.x);
+            _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+            __m128 ex = _mm_loadu_ps(&palette[inf[0].Bone[k]].Dual.x);
+            __m128 ey = _mm_loadu_ps(&palette[inf[1].Bone[k]].Dual.x);
+            __m128 ez = _mm_loadu_ps(&palette[inf[2].Bone[k]].Dual.x);
+            __m128 ew = _mm_loadu_ps(&palette[inf[3].Bone[k]].Dual.x);
+            _MM_TRANSPOSE4_PS(ex, ey, ez, ew);
+
+            __m128 w = _mm_set_ps(inf[3].Weight[k], inf[2].Weight[k], inf[1].Weight[k], inf[0].Weight[k]);
+            if (k == 0)
+            {
+                r0x = qx; r0y = qy; r0z = qz; r0w = qw;
+            }
+            else
+            {
+                // Flip the weight of influences in the opposite hemisphere of the first one.
+                __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, r0x), _mm_mul_ps(qy, r0y)),
+                                        _mm_add_ps(_mm_mul_ps(qz, r0z), _mm_mul_ps(qw, r0w)));
+                w = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, zero), signMask));
+            }
+
+            rx = _mm_add_ps(rx, _mm_mul_ps(qx, w)); ry = _mm_add_ps(ry, _mm_mul_ps(qy, w));
+            rz = _mm_add_ps(rz, _mm_mul_ps(qz, w)); rw = _mm_add_ps(rw, _mm_mul_ps(qw, w));
+            dx = _mm_add_ps(dx, _mm_mul_ps(ex, w)); dy = _mm_add_ps(dy, _mm_mul_ps(ey, w));
+            dz = _mm_add_ps(dz, _mm_mul_ps(ez, w)); dw = _mm_add_ps(dw, _mm_mul_ps(ew, w));
+        }
+
+        // Normalize by the length of the real part. Uses a full-precision divide; _mm_rsqrt_ps
+        // alone leaves visible error on meshes a metre from the skeleton root.
+        __m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)),
+                                  _mm_add_ps(_mm_mul_ps(rz, rz), _mm_mul_ps(rw, rw)));
+        __m128 rcpLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lenSq));
+        rx = _mm_mul_ps(rx, rcpLen); ry = _mm_mul_ps(ry, rcpLen);
+        rz = _mm_mul_ps(rz, rcpLen); rw = _mm_mul_ps(rw, rcpLen);
+        dx = _mm_mul_ps(dx, rcpLen); dy = _mm_mul_ps(dy, rcpLen);
+        dz = _mm_mul_ps(dz, rcpLen); dw = _mm_mul_ps(dw, rcpLen);
+
+        // t = 2 * (r.w * d.xyz - d.w * r.xyz + r.xyz x d.xyz)
+        const __m128 two = _mm_set1_ps(2.0f);
+        __m128 tx = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, dx), _mm_mul_ps(dw, rx)),
+                                               _mm_sub_ps(_mm_mul_ps(ry, dz), _mm_mul_ps(rz, dy))));
+        __m128 ty = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, dy), _mm_mul_ps(dw, ry)),
+                                               _mm_sub_ps(_mm_mul_ps(rz, dx), _mm_mul_ps(rx, dz))));
+        __m128 tz = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, dz), _mm_mul_ps(dw, rz)),
+                                               _mm_sub_ps(_mm_mul_ps(rx, dy), _mm_mul_ps(ry, dx))));
+
+        __m128 px, py, pz;
+        LoadVector3x4(positions + i, px, py, pz);
+        RotateX4(rx, ry, rz, rw, px, py, pz);
+        StoreVector3x4(outPositions + i, _mm_add_ps(px, tx), _mm_add_ps(py, ty), _mm_add_ps(pz, tz));
+
+        if (normals)
+        {
+            __m128 nx, ny, nz;
+            LoadVector3x4(normals + i, nx, ny, nz);
+            RotateX4(rx, ry, rz, rw, nx, ny, nz);
+            StoreVector3x4(outNormals + i, nx, ny, nz);
+        }
+    }
+#endif // PVR_SIMD_SSE2
+
+    for (; i < vertexCount; i++)
+    {
+        SkinningDetail::SkinDualQuatScalar(palette, influences[i], positions[i],
+                                           normals ? &normals[i] : nullptr,
+                                           &outPositions[i], normals ? &outNormals[i] : nullptr);
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** SkinLinear
+//
+// Matrix palette (linear blend) skinning with the same interface and lane layout as
+// SkinDualQuat, so that the two can be compared on the same mesh. Only the upper 3x4
+// part of each palette matrix is used.
+
+inline void SkinLinear(const Matrix4f* PVR_RESTRICT palette, const SkinInfluence* PVR_RESTRICT influences,
+                       const Vector3f* PVR_RESTRICT positions, const Vector3f* PVR_RESTRICT normals,
+                       int vertexCount,
+                       Vector3f* PVR_RESTRICT outPositions, Vector3f* PVR_RESTRICT outNormals)
+{
+    int i = 0;
+
+#if PVR_SIMD_SSE2
+    using namespace SkinningDetail;
+    const __m128 zero = _mm_setzero_ps();
+
+    for (; i + 4 <= vertexCount; i += 4)
+    {
+        const SkinInfluence* inf = influences + i;
+        __m128 m[3][4];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                m[r][c] = zero;
+
+        for (int k = 0; k < SkinMaxInfluences; k++)
+        {
+            __m128 w = _mm_set_ps(inf[3].Weight[k], inf[2].Weight[k], inf[1].Weight[k], inf[0].Weight[k]);
+            for (int r = 0; r < 3; r++)
+            {
+                __m128 c0 = _mm_loadu_ps(palette[inf[0].Bone[k]].M[r]);
+                __m128 c1 = _mm_loadu_ps(palette[inf[1].Bone[k]].M[r]);
+                __m128 c2 = _mm_loadu_ps(palette[inf[2].Bone[k]].M[r]);
+                __m128 c3 = _mm_loadu_ps(palette[inf[3].Bone[k]].M[r]);
+                _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                m[r][0] = _mm_add_ps(m[r][0], _mm_mul_ps(c0, w));
+                m[r][1] = _mm_add_ps(m[r][1], _mm_mul_ps(c1, w));
+                m[r][2] = _mm_add_ps(m[r][2], _mm_mul_ps(c2, w));
+                m[r][3] = _mm_add_ps(m[r][3], _mm_mul_ps(c3, w));
+            }
+        }
+
+        __m128 px, py, pz;
+        LoadVector3x4(positions + i, px, py, pz);
+        __m128 o[3];
+        for (int r = 0; r < 3; r++)
+        {
+            o[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], px), _mm_mul_ps(m[r][1], py)),
+                              _mm_add_ps(_mm_mul_ps(m[r][2], pz), m[r][3]));
+        }
+        StoreVector3x4(outPositions + i, o[0], o[1], o[2]);
+
+        if (normals)
+        {
+            __m128 nx, ny, nz;
+            LoadVector3x4(normals + i, nx, ny, nz);
+            for (int r = 0; r < 3; r++)
+            {
+                o[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], nx), _mm_mul_ps(m[r][1], ny)),
+                                  _mm_mul_ps(m[r][2], nz));
+            }
+            __m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(o[0], o[0]), _mm_mul_ps(o[1], o[1])),
+                                      _mm_mul_ps(o[2], o[2]));
+            __m128 rcpLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lenSq));
+            StoreVector3x4(outNormals + i, _mm_mul_ps(o[0], rcpLen), _mm_mul_ps(o[1], rcpLen), _mm_mul_ps(o[2], rcpLen));
+        }
+    }
+#endif // PVR_SIMD_SSE2
+
+    for (; i < vertexCount; i++)
+    {
+        SkinningDetail::SkinLinearScalar(palette, influences[i], positions[i],
+                                         normals ? &normals[i] : nullptr,
+                                         &outPositions[i], normals ? &outNormals[i] : nullptr);
+    }
+}
+
+
+} // Namespace PVR
+
+#endif
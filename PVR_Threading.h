@@ -0,0 +1,363 @@
+/************************************************************************************
+
+Filename    :   PVR_Threading.h
+Content     :   Small threading helpers used by the PVR client-side utilities.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_Threading_h
+#define PVR_Threading_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <mmsystem.h>
+    #if defined(_MSC_VER)
+        #pragma comment(lib, "winmm.lib")
+    #endif
+#endif
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** PollingThread
+//
+// Calls a function at a fixed rate on a dedicated thread until Stop() is called or the
+// object is destroyed. Ticks are scheduled on absolute times, so a slow call does not
+// shift later ones; ticks that are already late are skipped rather than bunched up.
+//
+// On Windows timed waits end on the system timer tick, 15.6 ms by default, which would
+// cap a poller at 64 Hz whatever its interval. For intervals below 10 ms the thread
+// raises the timer resolution to 1 ms with timeBeginPeriod() while it runs, so ticks
+// are then accurate to about a millisecond. This raises the interrupt rate system wide
+// and costs some power, so prefer longer intervals where they suffice.
+//
+// Example usage:
+//     PollingThread poller;
+//     poller.Start([&]() { Poll(); }, 1.0 / 200.0);
+
+class PollingThread
+{
+public:
+    PollingThread() : Running(false) { }
+    ~PollingThread() { Stop(); }
+
+    // Returns false if the thread is already running.
+    bool Start(const std::function<void()>& poll, double intervalSeconds)
+    {
+        std::lock_guard<std::mutex> lock(ControlLock);
+        if (Thread.joinable())
+            return false;
+        Running = true;
+        Thread = std::thread(&PollingThread::Run, this, poll, intervalSeconds);
+        return true;
+    }
+
+    void Stop()
+    {
+        std::lock_guard<std::mutex> lock(ControlLock);
+        if (!Thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> wakeLock(WakeLock);
+            Running = false;
+        }
+        Wake.notify_all();
+        Thread.join();
+    }
+
+    bool IsRunning() const { return Running; }
+
+private:
+    PollingThread(const PollingThread&);
+    PollingThread& operator=(const PollingThread&);
+
+    // Holds a 1 ms Windows timer resolution while alive, if enabled.
+    class TimerResolution
+    {
+    public:
+#if defined(_WIN32)
+        explicit TimerResolution(bool enable) : Enabled(enable && timeBeginPeriod(1) == TIMERR_NOERROR) { }
+        ~TimerResolution() { if (Enabled) timeEndPeriod(1); }
+
+    private:
+        bool Enabled;
+#else
+        explicit TimerResolution(bool) { }
+#endif
+    };
+
+    void Run(std::function<void()> poll, double intervalSeconds)
+    {
+        const TimerResolution resolution(intervalSeconds < 0.010);
+
+        typedef std::chrono::steady_clock Clock;
+        const Clock::duration interval =
+            std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(intervalSeconds));
+        Clock::time_point next = Clock::now();
+
+        std::unique_lock<std::mutex> lock(WakeLock);
+        while (Running)
+        {
+            lock.unlock();
+            poll();
+            lock.lock();
+
+            next += interval;
+            const Clock::time_point now = Clock::now();
+            if (next < now)
+                next = now;
+            Wake.wait_until(lock, next, [this]() { return !Running; });
+        }
+    }
+
+    std::atomic<bool>       Running;
+    std::thread             Thread;
+    std::mutex              ControlLock;
+    std::mutex              WakeLock;
+    std::condition_variable Wake;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** WorkerPool
+//
+// Persistent worker threads for data parallel loops over image rows and similar work.
+// ParallelFor() splits [0, count) into chunks of at least grain items, hands them out
+// through an atomic counter (the calling thread takes chunks too) and returns when all
+// chunks are done. Calls from several threads at once are serialized.
+//
+// A ParallelFor() made from inside a body, on this or any other pool, runs the whole
+// nested loop inline on the current thread. The workers are busy with the outer loop,
+// and waiting for them would deadlock on the call lock held by the outer call.
+//
+// Example usage:
+//     WorkerPool::GetDefault().ParallelFor(height, 16, [&](int begin, int end)
+//     {
+//         for (int y = begin; y < end; y++)
+//             ConvertRow(y);
+//     });
+
+class WorkerPool
+{
+public:
+    // threadCount includes the calling thread; 0 uses the number of hardware threads.
+    explicit WorkerPool(int threadCount = 0)
+        : Body(nullptr), Count(0), Grain(1), Next(0), Busy(0), Generation(0), Exiting(false)
+    {
+        if (threadCount <= 0)
+            threadCount = int(std::thread::hardware_concurrency());
+        if (threadCount <= 0)
+            threadCount = 1;
+        for (int i = 1; i < threadCount; i++)
+            Workers.push_back(std::thread(&WorkerPool::WorkerMain, this));
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(StateLock);
+            Exiting = true;
+        }
+        WorkAvailable.notify_all();
+        for (size_t i = 0; i < Workers.size(); i++)
+            Workers[i].join();
+    }
+
+    int GetThreadCount() const { return int(Workers.size()) + 1; }
+
+    void ParallelFor(int count, int grain, const std::function<void(int, int)>& body)
+    {
+        if (count <= 0)
+            return;
+        if (grain < 1)
+            grain = 1;
+
+        // Small loops are not worth waking the workers for.
+        if (Workers.empty() || count <= grain || IsInsideBody())
+        {
+            body(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> callLock(CallLock);
+
+        // About 4 chunks per thread balances uneven rows without much overhead.
+        const int chunks = GetThreadCount() * 4;
+        grain = MaxInt(grain, (count + chunks - 1) / chunks);
+        {
+            std::lock_guard<std::mutex> lock(StateLock);
+            Body = &body;
+            Count = count;
+            Grain = grain;
+            Next = 0;
+            Busy = int(Workers.size());
+            Generation++;
+        }
+        WorkAvailable.notify_all();
+
+        RunChunks();
+
+        std::unique_lock<std::mutex> lock(StateLock);
+        WorkDone.wait(lock, [this]() { return Busy == 0; });
+        Body = nullptr;
+    }
+
+    // Process wide pool shared by the SDK helpers.
+    static WorkerPool& GetDefault()
+    {
+        static WorkerPool pool;
+        return pool;
+    }
+
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    // Not std::min/max, which clash with the windows.h macros.
+    static int MinInt(int a, int b) { return (a < b) ? a : b; }
+    static int MaxInt(int a, int b) { return (a > b) ? a : b; }
+
+    // Set while the current thread runs chunks of any pool.
+    static bool& IsInsideBody()
+    {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    void RunChunks()
+    {
+        IsInsideBody() = true;
+        for (;;)
+        {
+            const int begin = Next.fetch_add(Grain);
+            if (begin >= Count)
+                break;
+            (*Body)(begin, MinInt(begin + Grain, Count));
+        }
+        IsInsideBody() = false;
+    }
+
+    void WorkerMain()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(StateLock);
+                WorkAvailable.wait(lock, [&]() { return Exiting || Generation != seen; });
+                if (Exiting)
+                    return;
+                seen = Generation;
+            }
+
+            RunChunks();
+
+            {
+                std::lock_guard<std::mutex> lock(StateLock);
+                Busy--;
+            }
+            WorkDone.notify_one();
+        }
+    }
+
+    std::vector<std::thread>              Workers;
+    std::mutex                            CallLock;
+    std::mutex                            StateLock;
+    std::condition_variable               WorkAvailable;
+    std::condition_variable               WorkDone;
+    const std::function<void(int, int)>*  Body;
+    int                                   Count;
+    int                                   Grain;
+    std::atomic<int>                      Next;
+    int                                   Busy;
+    uint64_t                              Generation;
+    bool                                  Exiting;
+};
+
+
+// ParallelFor on the default pool.
+inline void ParallelFor(int count, int grain, const std::function<void(int, int)>& body)
+{
+    WorkerPool::GetDefault().ParallelFor(count, grain, body);
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** SPSCQueue
+//
+// Bounded lock-free queue for exactly one producer thread and one consumer thread, e.g.
+// a polling thread handing events to the game thread. Capacity is rounded up to a power
+// of two. Push() fails when the queue is full rather than blocking the producer.
+//
+// Example usage:
+//     SPSCQueue<Event> events(256);
+//     events.Push(event);             // Producer thread.
+//     while (events.Pop(&event))      // Consumer thread.
+//         Handle(event);
+
+template<class T>
+class SPSCQueue
+{
+public:
+    explicit SPSCQueue(uint32_t capacity = 256)
+        : Head(0), Tail(0)
+    {
+        uint32_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        Items.resize(size);
+        Mask = size - 1;
+    }
+
+    // Producer only.
+    bool Push(const T& item)
+    {
+        const uint32_t tail = Tail.load(std::memory_order_relaxed);
+        if (tail - Head.load(std::memory_order_acquire) > Mask)
+            return false;
+        Items[tail & Mask] = item;
+        Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool Pop(T* item)
+    {
+        const uint32_t head = Head.load(std::memory_order_relaxed);
+        if (head == Tail.load(std::memory_order_acquire))
+            return false;
+        *item = Items[head & Mask];
+        Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called while the other side is active.
+    uint32_t GetCount() const { return Tail.load(std::memory_order_acquire) - Head.load(std::memory_order_acquire); }
+
+    uint32_t GetCapacity() const { return Mask + 1; }
+
+private:
+    SPSCQueue(const SPSCQueue&);
+    SPSCQueue& operator=(const SPSCQueue&);
+
+    // Head and Tail on separate cache lines so the two threads do not share one.
+    alignas(64) std::atomic<uint32_t> Head;
+    alignas(64) std::atomic<uint32_t> Tail;
+    alignas(64) uint32_t              Mask;
+    std::vector<T>                    Items;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,258 @@
+/************************************************************************************
+
+Filename    :   PVR_ThrowEstimator.h
+Content     :   Release velocity of thrown objects from controller pose history.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_ThrowEstimator_h
+#define PVR_ThrowEstimator_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_PoseHistory.h"
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** ThrowParams
+
+struct ThrowParams
+{
+    double Window;      // Seconds of history before the release used by the fit.
+    int    FitOrder;    // 1 fits a constant velocity, 2 also an acceleration.
+    int    MinSamples;  // Below this, the reported velocities of the last sample are used.
+
+    ThrowParams() : Window(0.04), FitOrder(2), MinSamples(4)
+    { }
+};
+
+struct ThrowEstimate
+{
+    Vector3f LinearVelocity;    // Of the object center, m/s.
+    Vector3f AngularVelocity;   // rad/s.
+    Vector3f Position;          // Object center at the release time.
+    Quatf    Orientation;       // Controller orientation at the release time.
+    int      SampleCount;       // Samples used by the fit.
+    float    ResidualRms;       // Position fit error in meters, to tune Window and FitOrder.
+    bool     Fitted;            // False if the reported velocities were used instead.
+};
+
+
+namespace ThrowDetail {
+
+enum { Channels = 6 };
+
+// Solves a * x = b in place for n <= 3 unknowns and Channels right hand sides, by
+// Gaussian elimination with partial pivoting. Returns false if a is singular.
+inline bool Solve(double a[3][3], double b[3][Channels], int n)
+{
+    for (int c = 0; c < n; c++)
+    {
+        int pivot = c;
+        for (int r = c + 1; r < n; r++)
+        {
+            if (fabs(a[r][c]) > fabs(a[pivot][c]))
+                pivot = r;
+        }
+        if (fabs(a[pivot][c]) < 1e-12)
+            return false;
+        if (pivot != c)
+        {
+            for (int k = 0; k < n; k++)
+                PVRMath_Swap(a[c][k], a[pivot][k]);
+            for (int k = 0; k < Channels; k++)
+                PVRMath_Swap(b[c][k], b[pivot][k]);
+        }
+        for (int r = c + 1; r < n; r++)
+        {
+            const double f = a[r][c] / a[c][c];
+            for (int k = c; k < n; k++)
+                a[r][k] -= f * a[c][k];
+            for (int k = 0; k < Channels; k++)
+                b[r][k] -= f * b[c][k];
+        }
+    }
+    for (int c = n - 1; c >= 0; c--)
+    {
+        for (int k = 0; k < Channels; k++)
+        {
+            double sum = b[c][k];
+            for (int j = c + 1; j < n; j++)
+                sum -= a[c][j] * b[j][k];
+            b[c][k] = sum / a[c][c];
+        }
+    }
+    return true;
+}
+
+} // namespace ThrowDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** ThrowEstimator
+//
+// Estimates the velocity to give a released object. The instantaneous velocities of
+// pvrPoseStatef are noisy at the end of a throw, when the hand decelerates hard, so
+// instead the position and the rotation vector (relative to the last sample) of the
+// controller are fitted by least squares against time over the last Window seconds,
+// and the velocities are the derivatives of the fit at the release time.
+//
+// The object is held at objectOffset from the controller origin (in controller space,
+// e.g. from the grip to the center of a ball), so it moves faster than the controller
+// when the wrist flicks: its velocity is v + w x (R * objectOffset).
+//
+// The default window is short enough for a quadratic fit to follow the braking just
+// before the release; longer windows smooth the angular velocity further but miss the
+// braking in the linear one. At 1 kHz one estimate fits about forty samples and takes
+// a few microseconds. The scratch buffer grows once to the window size; keep one
+// estimator per hand.
+//
+// Example usage:
+//     PoseHistoryPoller rightHand(pvrTrackedDevice_RightController);
+//     ThrowEstimator throws;
+//     ...
+//     ThrowEstimate estimate;
+//     if (throws.Estimate(rightHand.GetHistory(), 0.0, ballOffset, &estimate))
+//         ball.Launch(estimate.Position, estimate.LinearVelocity, estimate.AngularVelocity);
+
+class ThrowEstimator
+{
+public:
+    explicit ThrowEstimator(const ThrowParams& params = ThrowParams()) : Params(params)
+    {
+        PVR_MATH_ASSERT(params.FitOrder == 1 || params.FitOrder == 2);
+    }
+
+    void SetParams(const ThrowParams& params) { Params = params; }
+
+    const ThrowParams& GetParams() const { return Params; }
+
+    // Estimates the throw at releaseTime (0 for the newest sample of the history).
+    // Returns false if the history has no sample in the window.
+    bool Estimate(const PoseHistory& history, double releaseTime, const Vector3f& objectOffset, ThrowEstimate* outEstimate)
+    {
+        if (releaseTime == 0.0)
+        {
+            pvrPoseStatef latest;
+            if (!history.GetLatest(&latest))
+                return false;
+            releaseTime = latest.TimeInSeconds;
+        }
+        history.GetRange(releaseTime - Params.Window, releaseTime, &Scratch);
+        return Estimate(Scratch.data(), int(Scratch.size()), releaseTime, objectOffset, outEstimate);
+    }
+
+    // Estimates the throw from samples sorted by time, e.g. a recorded throw replayed to
+    // tune the parameters. Only the samples in [releaseTime - Window, releaseTime] are used.
+    bool Estimate(const pvrPoseStatef* samples, int count, double releaseTime, const Vector3f& objectOffset,
+                  ThrowEstimate* outEstimate) const
+    {
+        using namespace ThrowDetail;
+
+        // Last tracked sample at or before the release; rotations are fitted relative to it.
+        int last = count - 1;
+        while (last >= 0 && (samples[last].TimeInSeconds > releaseTime ||
+                             !(samples[last].StatusFlags & pvrStatus_PositionTracked)))
+        {
+            last--;
+        }
+        if (last < 0 || samples[last].TimeInSeconds < releaseTime - Params.Window)
+            return false;
+
+        const pvrPoseStatef& reference = samples[last];
+        const Quatf referenceInverse = Quatf(reference.ThePose.Orientation).Inverted();
+        const int n = Params.FitOrder + 1;
+
+        // Normal equations for y(tau) = c0 + c1 tau [+ c2 tau^2], tau = t - releaseTime, with
+        // position and rotation vector as the 6 channels.
+        double a[3][3] = {};
+        double b[3][Channels] = {};
+        int used = 0;
+        for (int i = last; i >= 0 && samples[i].TimeInSeconds >= releaseTime - Params.Window; i--)
+        {
+            const pvrPoseStatef& s = samples[i];
+            if (!(s.StatusFlags & pvrStatus_PositionTracked))
+                continue;
+
+            const double tau = s.TimeInSeconds - releaseTime;
+            const double basis[3] = { 1.0, tau, tau * tau };
+            const Vector3f rotation = (Quatf(s.ThePose.Orientation) * referenceInverse).ToRotationVector();
+            const double y[Channels] = { s.ThePose.Position.x, s.ThePose.Position.y, s.ThePose.Position.z,
+                                         rotation.x, rotation.y, rotation.z };
+            for (int j = 0; j < n; j++)
+            {
+                for (int k = 0; k < n; k++)
+                    a[j][k] += basis[j] * basis[k];
+                for (int k = 0; k < Channels; k++)
+                    b[j][k] += basis[j] * y[k];
+            }
+            used++;
+        }
+
+        Vector3f position, linearVelocity, rotation, angularVelocity;
+        outEstimate->Fitted = used >= PVRMath_Max(Params.MinSamples, n) && Solve(a, b, n);
+        if (outEstimate->Fitted)
+        {
+            position = Vector3f(float(b[0][0]), float(b[0][1]), float(b[0][2]));
+            linearVelocity = Vector3f(float(b[1][0]), float(b[1][1]), float(b[1][2]));
+            rotation = Vector3f(float(b[0][3]), float(b[0][4]), float(b[0][5]));
+            angularVelocity = Vector3f(float(b[1][3]), float(b[1][4]), float(b[1][5]));
+            outEstimate->ResidualRms = Residual(samples, last, releaseTime, b, n);
+        }
+        else
+        {
+            const float dt = float(releaseTime - reference.TimeInSeconds);
+            linearVelocity = reference.LinearVelocity;
+            angularVelocity = reference.AngularVelocity;
+            position = Vector3f(reference.ThePose.Position) + linearVelocity * dt;
+            rotation = angularVelocity * dt;
+            outEstimate->ResidualRms = 0.0f;
+        }
+
+        const Quatf orientation = Quatf::FromRotationVector(rotation) * Quatf(reference.ThePose.Orientation);
+        const Vector3f leverArm = orientation.Rotate(objectOffset);
+        outEstimate->Position = position + leverArm;
+        outEstimate->Orientation = orientation;
+        outEstimate->LinearVelocity = linearVelocity + angularVelocity.Cross(leverArm);
+        outEstimate->AngularVelocity = angularVelocity;
+        outEstimate->SampleCount = used;
+        return true;
+    }
+
+private:
+    float Residual(const pvrPoseStatef* samples, int last, double releaseTime, const double coefficients[3][ThrowDetail::Channels],
+                   int n) const
+    {
+        double sum = 0.0;
+        int used = 0;
+        for (int i = last; i >= 0 && samples[i].TimeInSeconds >= releaseTime - Params.Window; i--)
+        {
+            const pvrPoseStatef& s = samples[i];
+            if (!(s.StatusFlags & pvrStatus_PositionTracked))
+                continue;
+            const double tau = s.TimeInSeconds - releaseTime;
+            const double basis[3] = { 1.0, tau, tau * tau };
+            const double p[3] = { s.ThePose.Position.x, s.ThePose.Position.y, s.ThePose.Position.z };
+            for (int k = 0; k < 3; k++)
+            {
+                double fit = 0.0;
+                for (int j = 0; j < n; j++)
+                    fit += coefficients[j][k] * basis[j];
+                sum += (p[k] - fit) * (p[k] - fit);
+            }
+            used++;
+        }
+        return used ? float(sqrt(sum / used)) : 0.0f;
+    }
+
+    ThrowParams                Params;
+    std::vector<pvrPoseStatef> Scratch;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,165 @@
+/************************************************************************************
+
+Filename    :   PVR_TimedRing.h
+Content     :   Thread safe ring buffer of timestamped samples.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_TimedRing_h
+#define PVR_TimedRing_h
+
+#include "PVR_Math.h"
+#include <mutex>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** TimedRing
+//
+// Ring buffer of samples of type T ordered by their TimeInSeconds member, the storage
+// behind PoseHistory, EyeTrackingHistory and SkeletalCache. Thread safe: one thread can
+// Add() while others query.
+//
+// Sample() finds the samples around a time and hands them to an interpolation hook,
+// called with the ring locked as interpolate(a, b, t): a is the last sample at or before
+// the time, b the next one and t in [0, 1) the weight of b. Times at or after the newest
+// sample pass the newest one as both a and b with t = 0, so the hook decides whether to
+// extrapolate. The references are only valid during the call.
+//
+// Example usage:
+//     TimedRing<pvrPoseStatef> ring(1024);
+//     ring.Add(state);
+//     Posef pose;
+//     ring.Sample(absTime, [&](const pvrPoseStatef& a, const pvrPoseStatef& b, float t)
+//                          { pose = Posef(a.ThePose).FastLerp(Posef(b.ThePose), t); });
+
+template <typename T>
+class TimedRing
+{
+public:
+    explicit TimedRing(int capacity)
+        : Samples(capacity), Newest(-1), Count(0)
+    {
+        PVR_MATH_ASSERT(capacity >= 2);
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        Newest = -1;
+        Count = 0;
+    }
+
+    // Returns false if the sample is not newer than the newest stored sample (e.g. the
+    // same tracker sample polled twice).
+    bool Add(const T& sample)
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        if (Count > 0 && sample.TimeInSeconds <= Samples[Newest].TimeInSeconds)
+            return false;
+        const int capacity = int(Samples.size());
+        Newest = (Newest + 1) % capacity;
+        Samples[Newest] = sample;
+        Count = PVRMath_Min(Count + 1, capacity);
+        return true;
+    }
+
+    int GetCount() const
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        return Count;
+    }
+
+    bool GetLatest(T* outSample) const
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        if (Count == 0)
+            return false;
+        *outSample = Samples[Newest];
+        return true;
+    }
+
+    // 0 if the ring is empty.
+    double GetLatestTime() const
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        return Count ? Samples[Newest].TimeInSeconds : 0.0;
+    }
+
+    // Calls interpolate for absTime as described above. Returns false without calling it
+    // if the ring is empty or absTime is older than the oldest sample.
+    template <typename Interpolate>
+    bool Sample(double absTime, Interpolate&& interpolate) const
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        if (Count == 0 || absTime < At(0).TimeInSeconds)
+            return false;
+
+        const T& newest = Samples[Newest];
+        if (absTime >= newest.TimeInSeconds)
+        {
+            interpolate(newest, newest, 0.0f);
+            return true;
+        }
+
+        // Last sample at or before absTime.
+        int lo = 0, hi = Count - 1;
+        while (hi - lo > 1)
+        {
+            const int mid = (lo + hi) / 2;
+            if (At(mid).TimeInSeconds <= absTime)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        const T& a = At(lo);
+        const T& b = At(hi);
+        interpolate(a, b, float((absTime - a.TimeInSeconds) / (b.TimeInSeconds - a.TimeInSeconds)));
+        return true;
+    }
+
+    // Copies the samples with fromTime <= TimeInSeconds <= toTime, oldest first, replacing
+    // the content of outSamples. Returns the number of samples copied.
+    int GetRange(double fromTime, double toTime, std::vector<T>* outSamples) const
+    {
+        outSamples->clear();
+        std::lock_guard<std::mutex> lock(Lock);
+        if (Count == 0)
+            return 0;
+
+        // First sample at or after fromTime.
+        int lo = 0, hi = Count;
+        while (lo < hi)
+        {
+            const int mid = (lo + hi) / 2;
+            if (At(mid).TimeInSeconds < fromTime)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (int i = lo; i < Count && At(i).TimeInSeconds <= toTime; i++)
+            outSamples->push_back(At(i));
+        return int(outSamples->size());
+    }
+
+private:
+    // i = 0 is the oldest sample.
+    const T& At(int i) const
+    {
+        const int capacity = int(Samples.size());
+        return Samples[(Newest - Count + 1 + i + capacity) % capacity];
+    }
+
+    mutable std::mutex Lock;
+    std::vector<T>     Samples;
+    int                Newest;
+    int                Count;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,853 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTConvert.h
+Content     :   Conversion of NV12 and RAW8 (Bayer) VST stream frames to RGBA, RGB and
+                gray images, with optional downscaling.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTConvert_h
+#define PVR_VSTConvert_h
+
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+#include "PVR_Threading.h"
+#include <string.h>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTPixelFormat / VSTBayerPattern
+
+enum VSTPixelFormat
+{
+    VSTPixel_Gray8,     // 1 byte per pixel, full range luma.
+    VSTPixel_RGB8,      // 3 bytes per pixel, R G B.
+    VSTPixel_RGBA8,     // 4 bytes per pixel, R G B A with A = 255.
+};
+
+// Color of the top-left 2x2 quad of a RAW8 frame.
+enum VSTBayerPattern
+{
+    VSTBayer_RGGB,
+    VSTBayer_BGGR,
+    VSTBayer_GRBG,
+    VSTBayer_GBRG,
+};
+
+inline uint32_t GetVSTPixelSize(VSTPixelFormat format)
+{
+    return (format == VSTPixel_RGBA8) ? 4 : (format == VSTPixel_RGB8) ? 3 : 1;
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTConvertParams
+
+struct VSTConvertParams
+{
+    VSTPixelFormat  Format;
+    uint32_t        Downscale;      // 1, 2 or 4; box filtered.
+    VSTBayerPattern Bayer;          // RAW8 only.
+    bool            FullRange;      // NV12 only; false for BT.601 video range (Y 16-235).
+    bool            Multithreaded;  // Split rows across WorkerPool::GetDefault().
+
+    VSTConvertParams()
+        : Format(VSTPixel_RGBA8), Downscale(1), Bayer(VSTBayer_RGGB), FullRange(false), Multithreaded(true)
+    { }
+};
+
+// Destination image. Stride is in bytes.
+struct VSTImage
+{
+    uint8_t* Data;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t Stride;
+};
+
+// Size of the image produced by ConvertVSTFrame for the given frame and params.
+inline void GetVSTConvertedSize(const pvrVSTStreamFrame& frame, const VSTConvertParams& params,
+                                uint32_t* outWidth, uint32_t* outHeight)
+{
+    const uint32_t scale = (params.Downscale > 0) ? params.Downscale : 1;
+    *outWidth = frame.width / scale;
+    *outHeight = frame.height / scale;
+}
+
+
+namespace VSTConvertDetail {
+
+//-------------------------------------------------------------------------------------
+// YUV -> RGB in 16-bit fixed point. Luma and chroma are pre-shifted by 7 bits and
+// multiplied (high 16 bits) by coefficients scaled by 8192, leaving 4 fractional bits.
+// The scalar and SIMD paths produce identical results.
+
+struct YuvCoefficients
+{
+    int16_t YOffset;
+    int16_t Y;      // Luma gain.
+    int16_t RV;
+    int16_t GU;     // Negated in use.
+    int16_t GV;     // Negated in use.
+    int16_t BU;
+};
+
+inline const YuvCoefficients& GetYuvCoefficients(bool fullRange)
+{
+    // BT.601, video range and full range.
+    static const YuvCoefficients video = { 16, 9535, 13074, 3209, 6660, 16531 };
+    static const YuvCoefficients full  = {  0, 8192, 11485, 2819, 5850, 14516 };
+    return fullRange ? full : video;
+}
+
+inline int MulHi16(int a, int b)
+{
+    return (a * b) >> 16;
+}
+
+inline uint8_t ClampU8(int v)
+{
+    return uint8_t((v < 0) ? 0 : ((v > 255) ? 255 : v));
+}
+
+inline void YuvToRgbScalar(const YuvCoefficients& c, int y, int u, int v, uint8_t* rgba)
+{
+    const int yv = MulHi16((y - c.YOffset) << 7, c.Y);
+    const int uu = (u - 128) << 7;
+    const int vv = (v - 128) << 7;
+    rgba[0] = ClampU8((yv + MulHi16(vv, c.RV) + 8) >> 4);
+    rgba[1] = ClampU8((yv - MulHi16(uu, c.GU) - MulHi16(vv, c.GV) + 8) >> 4);
+    rgba[2] = ClampU8((yv + MulHi16(uu, c.BU) + 8) >> 4);
+    rgba[3] = 255;
+}
+
+#if PVR_SIMD_SSE2
+// y: 8 luma values, u/v: matching chroma, all as 16-bit. Returns R, G, B as 16-bit.
+inline void YuvToRgbSSE2(const YuvCoefficients& c, __m128i y, __m128i u, __m128i v,
+                         __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i round = _mm_set1_epi16(8);
+    const __m128i yv = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(c.YOffset)), 7), _mm_set1_epi16(c.Y));
+    const __m128i uu = _mm_slli_epi16(_mm_sub_epi16(u, _mm_set1_epi16(128)), 7);
+    const __m128i vv = _mm_slli_epi16(_mm_sub_epi16(v, _mm_set1_epi16(128)), 7);
+    *r = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(yv, _mm_mulhi_epi16(vv, _mm_set1_epi16(c.RV))), round), 4);
+    *g = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(_mm_sub_epi16(yv, _mm_mulhi_epi16(uu, _mm_set1_epi16(c.GU))),
+                                                    _mm_mulhi_epi16(vv, _mm_set1_epi16(c.GV))), round), 4);
+    *b = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(yv, _mm_mulhi_epi16(uu, _mm_set1_epi16(c.BU))), round), 4);
+}
+
+// Interleaves 16 R, G, B bytes with A = 255 into 64 bytes.
+inline void StoreRgbaSSE2(__m128i r, __m128i g, __m128i b, uint8_t* dst)
+{
+    const __m128i a = _mm_set1_epi8(-1);
+    const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+    const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+    const __m128i baLo = _mm_unpacklo_epi8(b, a);
+    const __m128i baHi = _mm_unpackhi_epi8(b, a);
+    _mm_storeu_si128((__m128i*)(dst +  0), _mm_unpacklo_epi16(rgLo, baLo));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(rgLo, baLo));
+    _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(rgHi, baHi));
+    _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(rgHi, baHi));
+}
+#endif
+
+#if PVR_SIMD_AVX2
+inline void YuvToRgbAVX2(const YuvCoefficients& c, __m256i y, __m256i u, __m256i v,
+                         __m256i* r, __m256i* g, __m256i* b)
+{
+    const __m256i round = _mm256_set1_epi16(8);
+    const __m256i yv = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(c.YOffset)), 7), _mm256_set1_epi16(c.Y));
+    const __m256i uu = _mm256_slli_epi16(_mm256_sub_epi16(u, _mm256_set1_epi16(128)), 7);
+    const __m256i vv = _mm256_slli_epi16(_mm256_sub_epi16(v, _mm256_set1_epi16(128)), 7);
+    *r = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(yv, _mm256_mulhi_epi16(vv, _mm256_set1_epi16(c.RV))), round), 4);
+    *g = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(_mm256_sub_epi16(yv, _mm256_mulhi_epi16(uu, _mm256_set1_epi16(c.GU))),
+                                                             _mm256_mulhi_epi16(vv, _mm256_set1_epi16(c.GV))), round), 4);
+    *b = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(yv, _mm256_mulhi_epi16(uu, _mm256_set1_epi16(c.BU))), round), 4);
+}
+#endif
+
+
+//-------------------------------------------------------------------------------------
+// NV12 row (luma row plus interleaved half resolution chroma row) to RGBA.
+
+inline void Nv12RowToRgba(const YuvCoefficients& c, const uint8_t* PVR_RESTRICT y, const uint8_t* PVR_RESTRICT uv,
+                          int width, uint8_t* PVR_RESTRICT rgba)
+{
+    int x = 0;
+
+#if PVR_SIMD_AVX2
+    const __m256i lowBytes256 = _mm256_set1_epi16(0x00FF);
+    for (; x + 32 <= width; x += 32)
+    {
+        const __m256i yv   = _mm256_loadu_si256((const __m256i*)(y + x));
+        const __m256i uvv  = _mm256_loadu_si256((const __m256i*)(uv + x));
+        const __m256i zero = _mm256_setzero_si256();
+
+        // Unpacking works within 128-bit lanes: yLo holds pixels 0-7 and 16-23, yHi 8-15
+        // and 24-31, and the duplicated chroma below lines up with the same pixels.
+        const __m256i yLo = _mm256_unpacklo_epi8(yv, zero);
+        const __m256i yHi = _mm256_unpackhi_epi8(yv, zero);
+        const __m256i u16 = _mm256_and_si256(uvv, lowBytes256);
+        const __m256i v16 = _mm256_srli_epi16(uvv, 8);
+
+        __m256i rLo, gLo, bLo, rHi, gHi, bHi;
+        YuvToRgbAVX2(c, yLo, _mm256_unpacklo_epi16(u16, u16), _mm256_unpacklo_epi16(v16, v16), &rLo, &gLo, &bLo);
+        YuvToRgbAVX2(c, yHi, _mm256_unpackhi_epi16(u16, u16), _mm256_unpackhi_epi16(v16, v16), &rHi, &gHi, &bHi);
+
+        const __m256i r = _mm256_packus_epi16(rLo, rHi);
+        const __m256i g = _mm256_packus_epi16(gLo, gHi);
+        const __m256i b = _mm256_packus_epi16(bLo, bHi);
+        const __m256i a = _mm256_set1_epi8(-1);
+
+        const __m256i rgLo = _mm256_unpacklo_epi8(r, g);
+        const __m256i rgHi = _mm256_unpackhi_epi8(r, g);
+        const __m256i baLo = _mm256_unpacklo_epi8(b, a);
+        const __m256i baHi = _mm256_unpackhi_epi8(b, a);
+        const __m256i q0 = _mm256_unpacklo_epi16(rgLo, baLo);   // Pixels 0-3,   16-19
+        const __m256i q1 = _mm256_unpackhi_epi16(rgLo, baLo);   // Pixels 4-7,   20-23
+        const __m256i q2 = _mm256_unpacklo_epi16(rgHi, baHi);   // Pixels 8-11,  24-27
+        const __m256i q3 = _mm256_unpackhi_epi16(rgHi, baHi);   // Pixels 12-15, 28-31
+
+        uint8_t* dst = rgba + x * 4;
+        _mm256_storeu_si256((__m256i*)(dst +  0), _mm256_permute2x128_si256(q0, q1, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(q2, q3, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(q0, q1, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + 96), _mm256_permute2x128_si256(q2, q3, 0x31));
+    }
+#endif
+
+#if PVR_SIMD_SSE2
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i yv   = _mm_loadu_si128((const __m128i*)(y + x));
+        const __m128i uvv  = _mm_loadu_si128((const __m128i*)(uv + x));
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i u16  = _mm_and_si128(uvv, lowBytes);
+        const __m128i v16  = _mm_srli_epi16(uvv, 8);
+
+        __m128i rLo, gLo, bLo, rHi, gHi, bHi;
+        YuvToRgbSSE2(c, _mm_unpacklo_epi8(yv, zero), _mm_unpacklo_epi16(u16, u16), _mm_unpacklo_epi16(v16, v16), &rLo, &gLo, &bLo);
+        YuvToRgbSSE2(c, _mm_unpackhi_epi8(yv, zero), _mm_unpackhi_epi16(u16, u16), _mm_unpackhi_epi16(v16, v16), &rHi, &gHi, &bHi);
+        StoreRgbaSSE2(_mm_packus_epi16(rLo, rHi), _mm_packus_epi16(gLo, gHi), _mm_packus_epi16(bLo, bHi), rgba + x * 4);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        const int cx = x & ~1;
+        YuvToRgbScalar(c, y[x], uv[cx], uv[cx + 1], rgba + x * 4);
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// Video range luma to full range gray.
+
+struct LumaExpandTable
+{
+    uint8_t Values[256];
+
+    LumaExpandTable()
+    {
+        for (int i = 0; i < 256; i++)
+            Values[i] = ClampU8(((i - 16) * 255 + 109) / 219);
+    }
+};
+
+inline const uint8_t* GetLumaExpandTable()
+{
+    static const LumaExpandTable table;
+    return table.Values;
+}
+
+inline void LumaRowToGray(const uint8_t* PVR_RESTRICT y, int width, bool fullRange, const uint8_t* table,
+                          uint8_t* PVR_RESTRICT gray)
+{
+    if (fullRange)
+    {
+        memcpy(gray, y, width);
+        return;
+    }
+    for (int x = 0; x < width; x++)
+        gray[x] = table[y[x]];
+}
+
+
+//-------------------------------------------------------------------------------------
+// 2x2 box downscale of an 8-bit plane row pair, rounded.
+
+inline void DownscaleRow2(const uint8_t* PVR_RESTRICT r0, const uint8_t* PVR_RESTRICT r1, int outWidth,
+                          uint8_t* PVR_RESTRICT out)
+{
+    int x = 0;
+
+#if PVR_SIMD_AVX2
+    const __m256i lowBytes256 = _mm256_set1_epi16(0x00FF);
+    for (; x + 32 <= outWidth; x += 32)
+    {
+        __m256i sums[2];
+        for (int h = 0; h < 2; h++)
+        {
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(r0 + 2 * x + 32 * h));
+            const __m256i b = _mm256_loadu_si256((const __m256i*)(r1 + 2 * x + 32 * h));
+            const __m256i s = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(a, lowBytes256), _mm256_srli_epi16(a, 8)),
+                                               _mm256_add_epi16(_mm256_and_si256(b, lowBytes256), _mm256_srli_epi16(b, 8)));
+            sums[h] = _mm256_srli_epi16(_mm256_add_epi16(s, _mm256_set1_epi16(2)), 2);
+        }
+        // packus interleaves the 128-bit lanes; restore the pixel order.
+        const __m256i packed = _mm256_packus_epi16(sums[0], sums[1]);
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+#endif
+
+#if PVR_SIMD_SSE2
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for (; x + 16 <= outWidth; x += 16)
+    {
+        __m128i sums[2];
+        for (int h = 0; h < 2; h++)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(r0 + 2 * x + 16 * h));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(r1 + 2 * x + 16 * h));
+            const __m128i s = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8)),
+                                            _mm_add_epi16(_mm_and_si128(b, lowBytes), _mm_srli_epi16(b, 8)));
+            sums[h] = _mm_srli_epi16(_mm_add_epi16(s, _mm_set1_epi16(2)), 2);
+        }
+        _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(sums[0], sums[1]));
+    }
+#endif
+
+    for (; x < outWidth; x++)
+        out[x] = uint8_t((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+}
+
+// 4x4 box downscale of an 8-bit plane, rounded. rows[] holds the four source rows.
+inline void DownscaleRow4(const uint8_t* const* rows, int outWidth, uint8_t* PVR_RESTRICT out)
+{
+    int x = 0;
+
+#if PVR_SIMD_SSE2
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    const __m128i ones = _mm_set1_epi16(1);
+    for (; x + 16 <= outWidth; x += 16)
+    {
+        // Each 16 source bytes give 4 outputs: byte pairs summed over the rows as 16 bits,
+        // then adjacent pairs by madd.
+        __m128i sums[4];
+        for (int q = 0; q < 4; q++)
+        {
+            __m128i s = _mm_setzero_si128();
+            for (int j = 0; j < 4; j++)
+            {
+                const __m128i a = _mm_loadu_si128((const __m128i*)(rows[j] + 4 * x + 16 * q));
+                s = _mm_add_epi16(s, _mm_add_epi16(_mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8)));
+            }
+            sums[q] = _mm_madd_epi16(s, ones);
+        }
+        const __m128i rounding = _mm_set1_epi16(8);
+        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(sums[0], sums[1]), rounding), 4);
+        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(sums[2], sums[3]), rounding), 4);
+        _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; x < outWidth; x++)
+    {
+        int sum = 0;
+        for (int j = 0; j < 4; j++)
+            sum += rows[j][4 * x] + rows[j][4 * x + 1] + rows[j][4 * x + 2] + rows[j][4 * x + 3];
+        out[x] = uint8_t((sum + 8) >> 4);
+    }
+}
+
+// Interior of DownscaleRowN with the scale and channel count known at compile time, so
+// that the sums unroll and the division becomes a shift.
+template <int Scale, int Channels>
+inline void DownscaleRowBox(const uint8_t* const* rows, int outWidth, uint8_t* PVR_RESTRICT out)
+{
+    const int count = Scale * Scale;
+    for (int x = 0; x < outWidth; x++)
+    {
+        for (int ch = 0; ch < Channels; ch++)
+        {
+            int sum = 0;
+            for (int j = 0; j < Scale; j++)
+            {
+                const uint8_t* src = rows[j] + x * Scale * Channels + ch;
+                for (int i = 0; i < Scale * Channels; i += Channels)
+                    sum += src[i];
+            }
+            out[x * Channels + ch] = uint8_t((sum + count / 2) / count);
+        }
+    }
+}
+
+// scale x scale box downscale of a plane with channels interleaved bytes per pixel.
+// rows[] holds the scale source rows; columns past srcWidth are clamped.
+inline void DownscaleRowN(const uint8_t* const* rows, int scale, int channels, int srcWidth, int outWidth,
+                          uint8_t* PVR_RESTRICT out)
+{
+    const int count = scale * scale;
+    const int stride = scale * channels;
+    const int inside = PVRMath_Min(outWidth, srcWidth / scale);
+
+    // The cases ConvertVSTFrame uses: 4x luma and chroma, 2x RGBA after Bayer quads.
+    bool specialized = true;
+    if (scale == 4 && channels == 1)
+        DownscaleRow4(rows, inside, out);
+    else if (scale == 4 && channels == 2)
+        DownscaleRowBox<4, 2>(rows, inside, out);
+    else if (scale == 2 && channels == 4)
+        DownscaleRowBox<2, 4>(rows, inside, out);
+    else
+        specialized = false;
+
+    for (int x = specialized ? inside : 0; x < inside; x++)
+    {
+        for (int ch = 0; ch < channels; ch++)
+        {
+            int sum = 0;
+            for (int j = 0; j < scale; j++)
+            {
+                const uint8_t* src = rows[j] + x * stride + ch;
+                for (int i = 0; i < stride; i += channels)
+                    sum += src[i];
+            }
+            out[x * channels + ch] = uint8_t((sum + count / 2) / count);
+        }
+    }
+
+    for (int x = inside; x < outWidth; x++)
+    {
+        for (int ch = 0; ch < channels; ch++)
+        {
+            int sum = 0;
+            for (int j = 0; j < scale; j++)
+            {
+                for (int i = 0; i < scale; i++)
+                {
+                    const int sx = PVRMath_Min(x * scale + i, srcWidth - 1);
+                    sum += rows[j][sx * channels + ch];
+                }
+            }
+            out[x * channels + ch] = uint8_t((sum + count / 2) / count);
+        }
+    }
+}
+
+// 2x2 box downscale of an interleaved chroma (UV) row pair.
+inline void DownscaleChromaRow2(const uint8_t* PVR_RESTRICT r0, const uint8_t* PVR_RESTRICT r1, int outPairs,
+                                uint8_t* PVR_RESTRICT out)
+{
+    for (int x = 0; x < outPairs; x++)
+    {
+        out[2 * x + 0] = uint8_t((r0[4 * x + 0] + r0[4 * x + 2] + r1[4 * x + 0] + r1[4 * x + 2] + 2) >> 2);
+        out[2 * x + 1] = uint8_t((r0[4 * x + 1] + r0[4 * x + 3] + r1[4 * x + 1] + r1[4 * x + 3] + 2) >> 2);
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// Bayer
+
+// Positions of red and blue within the 2x2 quad, as (row << 1) | column.
+inline void GetBayerLayout(VSTBayerPattern pattern, int* red, int* blue)
+{
+    switch (pattern)
+    {
+    case VSTBayer_BGGR: *red = 3; *blue = 0; break;
+    case VSTBayer_GRBG: *red = 1; *blue = 2; break;
+    case VSTBayer_GBRG: *red = 2; *blue = 1; break;
+    default:            *red = 0; *blue = 3; break;
+    }
+}
+
+// One RGBA pixel per 2x2 quad: red, blue and the average of both greens.
+inline void BayerQuadRowToRgba(const uint8_t* PVR_RESTRICT r0, const uint8_t* PVR_RESTRICT r1, int outWidth,
+                               VSTBayerPattern pattern, uint8_t* PVR_RESTRICT rgba)
+{
+    int red, blue;
+    GetBayerLayout(pattern, &red, &blue);
+    const int green0 = (red == 0 || blue == 0) ? 1 : 0;
+    const int green1 = 3 - green0;
+    int x = 0;
+
+#if PVR_SIMD_SSE2
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for (; x + 16 <= outWidth; x += 16)
+    {
+        __m128i rr[2], gg[2], bb[2];
+        for (int h = 0; h < 2; h++)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(r0 + 2 * x + 16 * h));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(r1 + 2 * x + 16 * h));
+            const __m128i q[4] = { _mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8),
+                                   _mm_and_si128(b, lowBytes), _mm_srli_epi16(b, 8) };
+            rr[h] = q[red];
+            bb[h] = q[blue];
+            gg[h] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(q[green0], q[green1]), _mm_set1_epi16(1)), 1);
+        }
+        StoreRgbaSSE2(_mm_packus_epi16(rr[0], rr[1]), _mm_packus_epi16(gg[0], gg[1]), _mm_packus_epi16(bb[0], bb[1]), rgba + x * 4);
+    }
+#endif
+
+    for (; x < outWidth; x++)
+    {
+        const int q[4] = { r0[2 * x], r0[2 * x + 1], r1[2 * x], r1[2 * x + 1] };
+        uint8_t* dst = rgba + x * 4;
+        dst[0] = uint8_t(q[red]);
+        dst[1] = uint8_t((q[green0] + q[green1] + 1) >> 1);
+        dst[2] = uint8_t(q[blue]);
+        dst[3] = 255;
+    }
+}
+
+// Bilinear demosaic candidates for each pixel, and which of them supplies R, G and B
+// depending on the Bayer site of the pixel.
+enum BayerCandidate
+{
+    Bayer_Center,   // The pixel itself.
+    Bayer_Cross,    // Average of the 4 direct neighbours.
+    Bayer_Diagonal, // Average of the 4 diagonal neighbours.
+    Bayer_Horiz,    // Average of left and right.
+    Bayer_Vert,     // Average of up and down.
+    Bayer_CandidateCount
+};
+
+// sel[site][channel] for the two sites (even and odd column) of a row with parity rowParity.
+inline void GetBayerSelection(VSTBayerPattern pattern, int rowParity, int sel[2][3])
+{
+    int red, blue;
+    GetBayerLayout(pattern, &red, &blue);
+    const bool redInRow = ((red >> 1) == rowParity);
+
+    for (int col = 0; col < 2; col++)
+    {
+        const int site = (rowParity << 1) | col;
+        if (site == red)
+        {
+            sel[col][0] = Bayer_Center; sel[col][1] = Bayer_Cross; sel[col][2] = Bayer_Diagonal;
+        }
+        else if (site == blue)
+        {
+            sel[col][0] = Bayer_Diagonal; sel[col][1] = Bayer_Cross; sel[col][2] = Bayer_Center;
+        }
+        else
+        {
+            // Green site: red and blue neighbours are either left/right or up/down.
+            sel[col][0] = redInRow ? Bayer_Horiz : Bayer_Vert;
+            sel[col][1] = Bayer_Center;
+            sel[col][2] = redInRow ? Bayer_Vert : Bayer_Horiz;
+        }
+    }
+}
+
+inline void BayerBilinearPixel(const uint8_t* up, const uint8_t* mid, const uint8_t* down, int x, int xl, int xr,
+                               const int sel[3], uint8_t* dst)
+{
+    int cand[Bayer_CandidateCount];
+    cand[Bayer_Center]   = mid[x];
+    cand[Bayer_Cross]    = (up[x] + down[x] + mid[xl] + mid[xr] + 2) >> 2;
+    cand[Bayer_Diagonal] = (up[xl] + up[xr] + down[xl] + down[xr] + 2) >> 2;
+    cand[Bayer_Horiz]    = (mid[xl] + mid[xr] + 1) >> 1;
+    cand[Bayer_Vert]     = (up[x] + down[x] + 1) >> 1;
+    dst[0] = uint8_t(cand[sel[0]]);
+    dst[1] = uint8_t(cand[sel[1]]);
+    dst[2] = uint8_t(cand[sel[2]]);
+    dst[3] = 255;
+}
+
+#if PVR_SIMD_SSE2
+// Rounded average of 4 16-bit vectors.
+inline __m128i Average4SSE2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, d)), _mm_set1_epi16(2)), 2);
+}
+
+// Channel c of 8 pixels starting at an even column.
+inline __m128i SelectBayerSSE2(const __m128i cand[Bayer_CandidateCount], const int sel[2][3], int c, __m128i evenMask)
+{
+    return _mm_or_si128(_mm_and_si128(evenMask, cand[sel[0][c]]), _mm_andnot_si128(evenMask, cand[sel[1][c]]));
+}
+#endif
+
+// Full resolution bilinear demosaic of row y. rows[0..2] are rows y-1, y, y+1 with the
+// borders mirrored, which keeps the Bayer phase.
+inline void BayerBilinearRowToRgba(const uint8_t* const* rows, int y, int width, VSTBayerPattern pattern,
+                                   uint8_t* PVR_RESTRICT rgba)
+{
+    const uint8_t* up = rows[0];
+    const uint8_t* mid = rows[1];
+    const uint8_t* down = rows[2];
+    int sel[2][3];
+    GetBayerSelection(pattern, y & 1, sel);
+
+    // Border columns mirror like the rows.
+    BayerBilinearPixel(up, mid, down, 0, 1, 1, sel[0], rgba);
+    int x = 1;
+
+#if PVR_SIMD_SSE2
+    // Start at an even column so lane parity matches column parity.
+    for (; x < 2 && x < width - 1; x++)
+        BayerBilinearPixel(up, mid, down, x, x - 1, x + 1, sel[x & 1], rgba + x * 4);
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i evenMask = _mm_set1_epi32(0x0000FFFF);
+    for (; x + 16 < width; x += 16)
+    {
+        __m128i ch[2][3];
+        for (int h = 0; h < 2; h++)
+        {
+            const int c = x + 8 * h;
+            const __m128i uL = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(up + c - 1)), zero);
+            const __m128i uC = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(up + c)), zero);
+            const __m128i uR = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(up + c + 1)), zero);
+            const __m128i mL = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mid + c - 1)), zero);
+            const __m128i mC = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mid + c)), zero);
+            const __m128i mR = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mid + c + 1)), zero);
+            const __m128i dL = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(down + c - 1)), zero);
+            const __m128i dC = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(down + c)), zero);
+            const __m128i dR = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(down + c + 1)), zero);
+
+            const __m128i one = _mm_set1_epi16(1);
+            __m128i cand[Bayer_CandidateCount];
+            cand[Bayer_Center]   = mC;
+            cand[Bayer_Cross]    = Average4SSE2(uC, dC, mL, mR);
+            cand[Bayer_Diagonal] = Average4SSE2(uL, uR, dL, dR);
+            cand[Bayer_Horiz]    = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(mL, mR), one), 1);
+            cand[Bayer_Vert]     = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(uC, dC), one), 1);
+            for (int c3 = 0; c3 < 3; c3++)
+                ch[h][c3] = SelectBayerSSE2(cand, sel, c3, evenMask);
+        }
+        StoreRgbaSSE2(_mm_packus_epi16(ch[0][0], ch[1][0]), _mm_packus_epi16(ch[0][1], ch[1][1]),
+                      _mm_packus_epi16(ch[0][2], ch[1][2]), rgba + x * 4);
+    }
+#endif
+
+    for (; x < width - 1; x++)
+        BayerBilinearPixel(up, mid, down, x, x - 1, x + 1, sel[x & 1], rgba + x * 4);
+    if (width > 1)
+        BayerBilinearPixel(up, mid, down, width - 1, width - 2, width - 2, sel[(width - 1) & 1], rgba + (width - 1) * 4);
+}
+
+
+//-------------------------------------------------------------------------------------
+// RGBA row to the output format.
+
+inline void StoreRgbaRow(const uint8_t* PVR_RESTRICT rgba, int width, VSTPixelFormat format, uint8_t* PVR_RESTRICT dst)
+{
+    if (format == VSTPixel_RGBA8)
+    {
+        memcpy(dst, rgba, size_t(width) * 4);
+    }
+    else if (format == VSTPixel_RGB8)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            dst[x * 3 + 0] = rgba[x * 4 + 0];
+            dst[x * 3 + 1] = rgba[x * 4 + 1];
+            dst[x * 3 + 2] = rgba[x * 4 + 2];
+        }
+    }
+    else
+    {
+        // BT.601 luma.
+        for (int x = 0; x < width; x++)
+            dst[x] = uint8_t((77 * rgba[x * 4 + 0] + 150 * rgba[x * 4 + 1] + 29 * rgba[x * 4 + 2] + 128) >> 8);
+    }
+}
+
+inline int MirrorIndex(int i, int size)
+{
+    i = (i < 0) ? -i : i;
+    return (i >= size) ? (2 * size - 2 - i) : i;
+}
+
+
+//-------------------------------------------------------------------------------------
+// Row band converters; rows [y0, y1) of the destination.
+
+inline void ConvertNv12Rows(const pvrVSTStreamFrame& frame, const VSTConvertParams& params, const VSTImage& dst,
+                            int y0, int y1)
+{
+    const int scale  = int(params.Downscale);
+    const int srcW   = int(frame.width);
+    const int srcH   = int(frame.height);
+    const int stride = int(frame.stride);
+    const int outW   = int(dst.Width);
+    const uint8_t* lumaPlane   = frame.buffer;
+    const uint8_t* chromaPlane = frame.buffer + size_t(stride) * srcH;
+    const YuvCoefficients& coef = GetYuvCoefficients(params.FullRange);
+    const uint8_t* expand = GetLumaExpandTable();
+
+    // Scratch for the downscaled luma / chroma rows and the RGBA row. Chroma rows are
+    // padded to an even width so the converter can read whole pairs.
+    std::vector<uint8_t> lumaRow(scale > 1 ? outW : 0);
+    std::vector<uint8_t> chromaRow(scale > 1 ? (outW + 1) & ~1 : 0);
+    std::vector<uint8_t> rgbaRow(params.Format != VSTPixel_Gray8 ? size_t(outW) * 4 : 0);
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* luma;
+        const uint8_t* chroma = nullptr;
+
+        if (scale == 1)
+        {
+            luma = lumaPlane + size_t(stride) * y;
+            chroma = chromaPlane + size_t(stride) * (y >> 1);
+        }
+        else
+        {
+            const uint8_t* rows[4];
+            for (int j = 0; j < scale; j++)
+                rows[j] = lumaPlane + size_t(stride) * PVRMath_Min(y * scale + j, srcH - 1);
+            if (scale == 2)
+                DownscaleRow2(rows[0], rows[1], outW, &lumaRow[0]);
+            else
+                DownscaleRowN(rows, scale, 1, srcW, outW, &lumaRow[0]);
+            luma = &lumaRow[0];
+
+            if (params.Format != VSTPixel_Gray8)
+            {
+                // The downscaled image keeps NV12 chroma subsampling: each output chroma
+                // pair averages scale x scale source pairs.
+                const int chromaH = srcH / 2;
+                const int cy = y >> 1;
+                for (int j = 0; j < scale; j++)
+                    rows[j] = chromaPlane + size_t(stride) * PVRMath_Min(cy * scale + j, chromaH - 1);
+                const int pairs = int(chromaRow.size()) / 2;
+                if (scale == 2 && pairs * 2 <= srcW / 2)
+                    DownscaleChromaRow2(rows[0], rows[1], pairs, &chromaRow[0]);
+                else
+                    DownscaleRowN(rows, scale, 2, srcW / 2, pairs, &chromaRow[0]);
+                chroma = &chromaRow[0];
+            }
+        }
+
+        uint8_t* out = dst.Data + size_t(dst.Stride) * y;
+        if (params.Format == VSTPixel_Gray8)
+        {
+            LumaRowToGray(luma, outW, params.FullRange, expand, out);
+        }
+        else if (params.Format == VSTPixel_RGBA8)
+        {
+            Nv12RowToRgba(coef, luma, chroma, outW, out);
+        }
+        else
+        {
+            Nv12RowToRgba(coef, luma, chroma, outW, &rgbaRow[0]);
+            StoreRgbaRow(&rgbaRow[0], outW, params.Format, out);
+        }
+    }
+}
+
+inline void ConvertRaw8Rows(const pvrVSTStreamFrame& frame, const VSTConvertParams& params, const VSTImage& dst,
+                            int y0, int y1)
+{
+    const int scale  = int(params.Downscale);
+    const int srcH   = int(frame.height);
+    const int stride = int(frame.stride);
+    const int outW   = int(dst.Width);
+
+    std::vector<uint8_t> rgbaRow(size_t(outW) * 4);
+    std::vector<uint8_t> quadRows(scale == 4 ? size_t(outW) * 2 * 4 * 2 : 0);
+
+    for (int y = y0; y < y1; y++)
+    {
+        uint8_t* out = dst.Data + size_t(dst.Stride) * y;
+        uint8_t* rgba = (params.Format == VSTPixel_RGBA8) ? out : &rgbaRow[0];
+
+        if (scale == 1)
+        {
+            const uint8_t* rows[3];
+            for (int j = 0; j < 3; j++)
+                rows[j] = frame.buffer + size_t(stride) * MirrorIndex(y - 1 + j, srcH);
+            BayerBilinearRowToRgba(rows, y, outW, params.Bayer, rgba);
+        }
+        else if (scale == 2)
+        {
+            BayerQuadRowToRgba(frame.buffer + size_t(stride) * (2 * y), frame.buffer + size_t(stride) * (2 * y + 1),
+                               outW, params.Bayer, rgba);
+        }
+        else
+        {
+            // Two rows of quads at twice the output width, then a 2x2 box on RGBA.
+            uint8_t* quads[2] = { &quadRows[0], &quadRows[size_t(outW) * 2 * 4] };
+            for (int j = 0; j < 2; j++)
+            {
+                const int sy = 4 * y + 2 * j;
+                BayerQuadRowToRgba(frame.buffer + size_t(stride) * sy, frame.buffer + size_t(stride) * (sy + 1),
+                                   outW * 2, params.Bayer, quads[j]);
+            }
+            const uint8_t* rows[2] = { quads[0], quads[1] };
+            DownscaleRowN(rows, 2, 4, outW * 2, outW, rgba);
+        }
+
+        if (rgba != out)
+            StoreRgbaRow(rgba, outW, params.Format, out);
+    }
+}
+
+} // namespace VSTConvertDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** ConvertVSTFrame
+//
+// Converts a frame returned by getVSTStreamFrame to dst in a single pass over the source
+// (downscaling, demosaicing and color conversion are fused per row). dst must be at least
+// the size reported by GetVSTConvertedSize.
+//
+//  - NV12: the luma plane (height rows of stride bytes) is followed by the interleaved
+//    chroma plane (height / 2 rows of stride bytes). Gray output is the luma plane,
+//    expanded to full range unless FullRange is set.
+//  - RAW8: one byte per pixel in the given Bayer pattern. Downscale 1 uses bilinear
+//    demosaicing; 2 and 4 average whole 2x2 quads, which avoids demosaic artifacts.
+//
+// NV12 color conversion and the 2x downscales use SSE2 (and AVX2 where available), the
+// 4x luma downscale SSE2.
+// Rows are split across WorkerPool::GetDefault() when Multithreaded is set.
+
+inline pvrResult ConvertVSTFrame(const pvrVSTStreamFrame& frame, pvrVSTStreamFormat format,
+                                 const VSTConvertParams& params, const VSTImage& dst)
+{
+    if (!frame.buffer || !dst.Data || frame.width < 2 || frame.height < 2 || frame.stride < frame.width)
+        return pvr_invalid_param;
+    if (params.Downscale != 1 && params.Downscale != 2 && params.Downscale != 4)
+        return pvr_invalid_param;
+    if ((format == pvrVST_FORMAT_NV12 || format == pvrVST_FORMAT_RAW8) && ((frame.width | frame.height) & 1))
+        return pvr_invalid_param;
+
+    uint32_t width, height;
+    GetVSTConvertedSize(frame, params, &width, &height);
+    if (width == 0 || height == 0 || dst.Width < width || dst.Height < height ||
+        dst.Stride < width * GetVSTPixelSize(params.Format))
+        return pvr_invalid_param;
+
+    VSTImage target = dst;
+    target.Width = width;
+    target.Height = height;
+
+    std::function<void(int, int)> body;
+    if (format == pvrVST_FORMAT_NV12)
+        body = [&](int y0, int y1) { VSTConvertDetail::ConvertNv12Rows(frame, params, target, y0, y1); };
+    else if (format == pvrVST_FORMAT_RAW8)
+        body = [&](int y0, int y1) { VSTConvertDetail::ConvertRaw8Rows(frame, params, target, y0, y1); };
+    else
+        return pvr_not_support;
+
+    if (params.Multithreaded)
+        ParallelFor(int(height), 16, body);
+    else
+        body(0, int(height));
+    return pvr_success;
+}
+
+
+} // Namespace PVR
+
+#endif
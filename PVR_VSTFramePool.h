@@ -0,0 +1,371 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTFramePool.h
+Content     :   Reference counted, zero-copy access to VST stream frames.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTFramePool_h
+#define PVR_VSTFramePool_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_PoseHistory.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace PVR {
+
+
+// Fetches a frame, with the signature of getVSTStreamFrame. Replaces the runtime for
+// recorded streams and tests.
+typedef std::function<pvrResult(uint32_t frameIdx, pvrVSTStreamFrame* frame)> VSTFrameSource;
+
+inline VSTFrameSource MakeVSTFrameSource(pvrSessionHandle session)
+{
+    return [session](uint32_t frameIdx, pvrVSTStreamFrame* frame) { return pvr_getVSTStreamFrame(session, frameIdx, frame); };
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTFramePoolDesc
+
+struct VSTFramePoolDesc
+{
+    // Number of most recent frames whose buffers the runtime keeps valid. Fetching a frame
+    // invalidates the buffer of the frame fetched RuntimeBufferDepth fetches earlier.
+    uint32_t RuntimeBufferDepth;
+
+    // Maximum number of simultaneous references to one frame (producer plus consumers).
+    uint32_t MaxReferences;
+
+    VSTFramePoolDesc() : RuntimeBufferDepth(2), MaxReferences(4) { }
+};
+
+
+class VSTFramePool;
+
+//-------------------------------------------------------------------------------------
+// ***** VSTFrameRef
+//
+// Move-only reference to a frame held by a VSTFramePool. The buffer stays valid, and is
+// not refetched over, while any reference to it exists. Use Share() to hand the frame to
+// another consumer; it fails once the frame has MaxReferences references.
+
+class VSTFrameRef
+{
+public:
+    VSTFrameRef() : Pool(nullptr), Slot(-1) { }
+    VSTFrameRef(VSTFrameRef&& other) : Pool(other.Pool), Slot(other.Slot) { other.Pool = nullptr; other.Slot = -1; }
+    ~VSTFrameRef() { Reset(); }
+
+    VSTFrameRef& operator=(VSTFrameRef&& other)
+    {
+        if (this != &other)
+        {
+            Reset();
+            Pool = other.Pool;
+            Slot = other.Slot;
+            other.Pool = nullptr;
+            other.Slot = -1;
+        }
+        return *this;
+    }
+
+    bool IsValid() const { return Pool != nullptr; }
+
+    // Returns an invalid reference if this one is invalid or the frame is at MaxReferences.
+    inline VSTFrameRef Share() const;
+
+    inline void Reset();
+
+    inline const pvrVSTStreamFrame& GetFrame() const;
+    const uint8_t* GetData() const          { return GetFrame().buffer; }
+    uint32_t       GetFrameIndex() const    { return GetFrame().frameIdx; }
+    double         GetExposureTime() const  { return GetFrame().exposureTime; }
+
+private:
+    friend class VSTFramePool;
+    VSTFrameRef(VSTFramePool* pool, int slot) : Pool(pool), Slot(slot) { }
+    VSTFrameRef(const VSTFrameRef&);
+    VSTFrameRef& operator=(const VSTFrameRef&);
+
+    VSTFramePool* Pool;
+    int           Slot;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTFramePool
+//
+// Hands out references to runtime-owned frame buffers instead of copies. Because the
+// runtime reuses a buffer after RuntimeBufferDepth newer frames were fetched, Acquire()
+// only fetches when the oldest frame has no references left. A lagging consumer
+// therefore makes Acquire() report VSTAcquire_Busy (or wait) instead of letting the
+// runtime overwrite memory that is still being read.
+//
+// Example usage:
+//     VSTFramePool pool(MakeVSTFrameSource(session));
+//     VSTFrameRef frame;
+//     if (pool.Acquire(0, &frame) == VSTAcquire_Success)
+//     {
+//         VSTFrameRef forRecorder = frame.Share();
+//         recorder.Push(std::move(forRecorder));
+//         Display(frame.GetData());
+//     }
+
+enum VSTAcquireResult
+{
+    VSTAcquire_Success,
+    VSTAcquire_Busy,        // The buffer to be reused is still referenced.
+    VSTAcquire_Failed,      // The frame source returned an error.
+};
+
+class VSTFramePool
+{
+public:
+    // Called with the frame index when the last reference to a frame is released and its
+    // runtime buffer may be reused. Runs on the releasing thread; keep it short.
+    typedef std::function<void(uint32_t frameIdx)> ReclaimCallback;
+
+    explicit VSTFramePool(const VSTFrameSource& source, const VSTFramePoolDesc& desc = VSTFramePoolDesc())
+        : Source(source), Desc(desc), Slots(desc.RuntimeBufferDepth > 0 ? desc.RuntimeBufferDepth : 1), Next(0)
+    {
+        for (size_t i = 0; i < Slots.size(); i++)
+        {
+            memset(&Slots[i].Frame, 0, sizeof(Slots[i].Frame));
+            Slots[i].RefCount = 0;
+        }
+    }
+
+    ~VSTFramePool()
+    {
+        // References must not outlive the pool.
+        for (size_t i = 0; i < Slots.size(); i++)
+            PVR_MATH_ASSERT(Slots[i].RefCount == 0);
+    }
+
+    void SetReclaimCallback(const ReclaimCallback& callback)
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        OnReclaim = callback;
+    }
+
+    // Fetches frame frameIdx from the source. With timeoutSeconds > 0 waits up to that long
+    // for the oldest frame to be released instead of returning VSTAcquire_Busy.
+    // Acquire() must not be called from several threads at once.
+    VSTAcquireResult Acquire(uint32_t frameIdx, VSTFrameRef* outRef, double timeoutSeconds = 0.0)
+    {
+        FrameSlot& slot = Slots[Next];
+        if (slot.RefCount.load() != 0)
+        {
+            if (timeoutSeconds <= 0.0)
+                return VSTAcquire_Busy;
+            std::unique_lock<std::mutex> lock(Lock);
+            const bool released = Released.wait_for(lock, std::chrono::duration<double>(timeoutSeconds),
+                                                    [&]() { return slot.RefCount.load() == 0; });
+            if (!released)
+                return VSTAcquire_Busy;
+        }
+
+        pvrVSTStreamFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        if (Source(frameIdx, &frame) != pvr_success || !frame.buffer)
+            return VSTAcquire_Failed;
+
+        slot.Frame = frame;
+        slot.RefCount = 1;
+        *outRef = VSTFrameRef(this, int(Next));
+        Next = (Next + 1) % uint32_t(Slots.size());
+        return VSTAcquire_Success;
+    }
+
+    // Number of frames currently referenced.
+    uint32_t GetReferencedFrameCount() const
+    {
+        uint32_t count = 0;
+        for (size_t i = 0; i < Slots.size(); i++)
+            count += (Slots[i].RefCount.load() != 0) ? 1 : 0;
+        return count;
+    }
+
+    const VSTFramePoolDesc& GetDesc() const { return Desc; }
+
+private:
+    friend class VSTFrameRef;
+
+    struct FrameSlot
+    {
+        pvrVSTStreamFrame Frame;
+        std::atomic<int>  RefCount;
+
+        FrameSlot() : RefCount(0) { }
+    };
+
+    bool AddRef(int slot)
+    {
+        std::atomic<int>& count = Slots[slot].RefCount;
+        int current = count.load();
+        while (current > 0 && current < int(Desc.MaxReferences))
+        {
+            if (count.compare_exchange_weak(current, current + 1))
+                return true;
+        }
+        return false;
+    }
+
+    void Release(int slot)
+    {
+        const uint32_t frameIdx = Slots[slot].Frame.frameIdx;
+        if (Slots[slot].RefCount.fetch_sub(1) != 1)
+            return;
+
+        // Notify under the lock so a waiting Acquire() cannot miss the release.
+        ReclaimCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(Lock);
+            callback = OnReclaim;
+            Released.notify_all();
+        }
+        if (callback)
+            callback(frameIdx);
+    }
+
+    const pvrVSTStreamFrame& GetFrame(int slot) const { return Slots[slot].Frame; }
+
+    VSTFrameSource          Source;
+    VSTFramePoolDesc        Desc;
+    std::vector<FrameSlot>  Slots;
+    uint32_t                Next;
+    std::mutex              Lock;
+    std::condition_variable Released;
+    ReclaimCallback         OnReclaim;
+};
+
+
+inline VSTFrameRef VSTFrameRef::Share() const
+{
+    if (Pool && Pool->AddRef(Slot))
+        return VSTFrameRef(Pool, Slot);
+    return VSTFrameRef();
+}
+
+inline void VSTFrameRef::Reset()
+{
+    if (Pool)
+        Pool->Release(Slot);
+    Pool = nullptr;
+    Slot = -1;
+}
+
+inline const pvrVSTStreamFrame& VSTFrameRef::GetFrame() const
+{
+    PVR_MATH_ASSERT(Pool != nullptr);
+    return Pool->GetFrame(Slot);
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTFramePoseSync
+//
+// Pairs VST frames with the camera poses at their exposure time, by sampling an HMD
+// PoseHistory (see PoseHistoryPoller) and composing with the camera extrinsics. Pairing
+// is a lookup in memory and makes no runtime calls. exposureTime is expected on the
+// same clock as pose TimeInSeconds (pvr_getTimeSeconds).
+//
+// Example usage:
+//     VSTFramePoseSync sync;
+//     sync.Init(session);
+//     VSTPosedFrame posed;
+//     if (pool.Acquire(0, &frame) == VSTAcquire_Success &&
+//         sync.Pair(std::move(frame), hmdPoller.GetHistory(), &posed))
+//         Reproject(posed.Frame.GetData(), posed.Pose.CameraToWorld[0]);
+
+struct VSTFramePose
+{
+    enum { MaxCameras = 2 };
+
+    double ExposureTime;
+    Posef  HmdToWorld;
+    Posef  CameraToWorld[MaxCameras];
+};
+
+struct VSTPosedFrame
+{
+    VSTFrameRef  Frame;
+    VSTFramePose Pose;
+};
+
+class VSTFramePoseSync
+{
+public:
+    VSTFramePoseSync() : CameraCount(0)
+    {
+        for (int i = 0; i < VSTFramePose::MaxCameras; i++)
+            CameraToHmd[i] = Posef::Identity();
+    }
+
+    // Reads the extrinsics of the first cameraCount cameras.
+    pvrResult Init(pvrSessionHandle session, uint32_t cameraCount = VSTFramePose::MaxCameras)
+    {
+        if (cameraCount == 0 || cameraCount > VSTFramePose::MaxCameras)
+            return pvr_invalid_param;
+        for (uint32_t i = 0; i < cameraCount; i++)
+        {
+            pvrPosef cameraToHmd;
+            const pvrResult result = pvr_getVSTCameraExtrinsics(session, i, &cameraToHmd);
+            if (result != pvr_success)
+                return result;
+            CameraToHmd[i] = cameraToHmd;
+        }
+        CameraCount = cameraCount;
+        return pvr_success;
+    }
+
+    // For recorded streams or calibration overrides.
+    void SetCameraToHmd(uint32_t cameraIdx, const Posef& cameraToHmd)
+    {
+        PVR_MATH_ASSERT(cameraIdx < VSTFramePose::MaxCameras);
+        CameraToHmd[cameraIdx] = cameraToHmd;
+        CameraCount = PVRMath_Max(CameraCount, cameraIdx + 1);
+    }
+
+    uint32_t GetCameraCount() const { return CameraCount; }
+
+    // Returns false if the history does not cover exposureTime.
+    bool GetPose(double exposureTime, const PoseHistory& hmdHistory, VSTFramePose* outPose) const
+    {
+        Posef hmdToWorld;
+        if (!hmdHistory.Sample(exposureTime, &hmdToWorld))
+            return false;
+        outPose->ExposureTime = exposureTime;
+        outPose->HmdToWorld = hmdToWorld;
+        for (uint32_t i = 0; i < CameraCount; i++)
+            outPose->CameraToWorld[i] = hmdToWorld * CameraToHmd[i];
+        for (uint32_t i = CameraCount; i < VSTFramePose::MaxCameras; i++)
+            outPose->CameraToWorld[i] = hmdToWorld;
+        return true;
+    }
+
+    // Takes ownership of frame only on success.
+    bool Pair(VSTFrameRef&& frame, const PoseHistory& hmdHistory, VSTPosedFrame* outFrame) const
+    {
+        if (!frame.IsValid() || !GetPose(frame.GetExposureTime(), hmdHistory, &outFrame->Pose))
+            return false;
+        outFrame->Frame = std::move(frame);
+        return true;
+    }
+
+private:
+    Posef    CameraToHmd[VSTFramePose::MaxCameras];
+    uint32_t CameraCount;
+};
+
+
+} // Namespace PVR
+
+#endif
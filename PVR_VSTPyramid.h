@@ -0,0 +1,449 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTPyramid.h
+Content     :   Shared gray image pyramids of VST frames.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTPyramid_h
+#define PVR_VSTPyramid_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+#include "PVR_Threading.h"
+#include "PVR_VSTConvert.h"
+#include "PVR_VSTFramePool.h"
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTPyramidParams
+
+enum VSTPyramidFilter
+{
+    VSTPyramid_Box,         // 2x2 average. Cheapest.
+    VSTPyramid_Binomial,    // Separable [1 3 3 1] / 8, a Gaussian approximation with less aliasing.
+};
+
+struct VSTPyramidParams
+{
+    VSTPyramidFilter Filter;
+    VSTBayerPattern  Bayer;         // RAW8 only.
+    uint32_t         MinSize;       // No level narrower or lower than this.
+    uint32_t         MaxPyramids;   // Pyramids alive at once; Build() fails beyond.
+    bool             Multithreaded; // Split rows across WorkerPool::GetDefault().
+
+    VSTPyramidParams()
+        : Filter(VSTPyramid_Binomial), Bayer(VSTBayer_RGGB), MinSize(16), MaxPyramids(4), Multithreaded(true)
+    { }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTPyramidLevel
+//
+// Read-only view of one level. Level pixel (x, y) covers Scale x Scale source pixels, so
+// its center is at source position (x + 0.5) * Scale - 0.5.
+
+struct VSTPyramidLevel
+{
+    const uint8_t* Data;
+    uint32_t       Width;
+    uint32_t       Height;
+    uint32_t       Stride;
+    uint32_t       Scale;
+
+    Vector2f ToSource(const Vector2f& p) const   { return (p + Vector2f(0.5f)) * float(Scale) - Vector2f(0.5f); }
+    Vector2f FromSource(const Vector2f& p) const { return (p + Vector2f(0.5f)) / float(Scale) - Vector2f(0.5f); }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTPyramid
+//
+// Gray pyramid of one frame. Level 0 is the full resolution luma: for NV12 frames built
+// from a VSTFrameRef it is the frame's own Y plane (video range values, not expanded),
+// otherwise a copy or, for RAW8, the demosaiced gray image.
+
+class VSTPyramid
+{
+public:
+    enum { MaxLevels = 16 };
+
+    uint32_t GetFrameIndex() const      { return FrameIdx; }
+    double   GetExposureTime() const    { return ExposureTime; }
+    uint32_t GetLevelCount() const      { return LevelCount; }
+
+    const VSTPyramidLevel& GetLevel(uint32_t level) const
+    {
+        PVR_MATH_ASSERT(level < LevelCount);
+        return Levels[level];
+    }
+
+private:
+    friend class VSTPyramidBuilder;
+
+    VSTPyramid() : FrameIdx(0), ExposureTime(0.0), LevelCount(0) { }
+
+    uint32_t             FrameIdx;
+    double               ExposureTime;
+    uint32_t             LevelCount;
+    VSTPyramidLevel      Levels[MaxLevels];
+    std::vector<uint8_t> Arena;
+    VSTFrameRef          Source;
+};
+
+
+namespace VSTPyramidDetail {
+
+// Vertical [1 3 3 1] of four rows into temp, which has two extra columns on each side
+// filled by clamping.
+inline void BinomialColumns(const uint8_t* const* rows, int width, uint16_t* temp)
+{
+    int x = 0;
+
+#if PVR_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i r[4];
+        for (int i = 0; i < 4; i++)
+            r[i] = _mm_loadu_si128((const __m128i*)(rows[i] + x));
+        for (int h = 0; h < 2; h++)
+        {
+            const __m128i a = h ? _mm_unpackhi_epi8(r[0], zero) : _mm_unpacklo_epi8(r[0], zero);
+            const __m128i b = h ? _mm_unpackhi_epi8(r[1], zero) : _mm_unpacklo_epi8(r[1], zero);
+            const __m128i c = h ? _mm_unpackhi_epi8(r[2], zero) : _mm_unpacklo_epi8(r[2], zero);
+            const __m128i d = h ? _mm_unpackhi_epi8(r[3], zero) : _mm_unpacklo_epi8(r[3], zero);
+            const __m128i middle = _mm_add_epi16(b, c);
+            const __m128i sum = _mm_add_epi16(_mm_add_epi16(a, d), _mm_add_epi16(middle, _mm_add_epi16(middle, middle)));
+            _mm_storeu_si128((__m128i*)(temp + x + 8 * h), sum);
+        }
+    }
+#endif
+
+    for (; x < width; x++)
+        temp[x] = uint16_t(rows[0][x] + rows[3][x] + 3 * (rows[1][x] + rows[2][x]));
+
+    temp[-2] = temp[-1] = temp[0];
+    temp[width] = temp[width + 1] = temp[width - 1];
+}
+
+// Horizontal [1 3 3 1] / 64 (with the vertical weights) and decimation of temp.
+inline void BinomialRow(const uint16_t* temp, int outWidth, uint8_t* out)
+{
+    int x = 0;
+
+#if PVR_SIMD_SSE2
+    // 32-bit lanes hold sample pairs (even, odd): output x needs the odd sample of pair
+    // x - 1, both samples of pair x and the even sample of pair x + 1.
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    const __m128i rounding = _mm_set1_epi32(32);
+    for (; x + 8 <= outWidth; x += 8)
+    {
+        __m128i halves[2];
+        for (int h = 0; h < 2; h++)
+        {
+            const uint16_t* t = temp + 2 * (x + 4 * h);
+            const __m128i previous = _mm_loadu_si128((const __m128i*)(t - 2));
+            const __m128i current = _mm_loadu_si128((const __m128i*)t);
+            const __m128i next = _mm_loadu_si128((const __m128i*)(t + 2));
+            const __m128i middle = _mm_add_epi32(_mm_and_si128(current, low), _mm_srli_epi32(current, 16));
+            __m128i sum = _mm_add_epi32(_mm_srli_epi32(previous, 16), _mm_and_si128(next, low));
+            sum = _mm_add_epi32(sum, _mm_add_epi32(middle, _mm_add_epi32(middle, middle)));
+            halves[h] = _mm_srli_epi32(_mm_add_epi32(sum, rounding), 6);
+        }
+        const __m128i words = _mm_packs_epi32(halves[0], halves[1]);
+        _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(words, words));
+    }
+#endif
+
+    for (; x < outWidth; x++)
+        out[x] = uint8_t((temp[2 * x - 1] + 3 * (temp[2 * x] + temp[2 * x + 1]) + temp[2 * x + 2] + 32) >> 6);
+}
+
+inline uint32_t AlignStride(uint32_t width) { return (width + 15) & ~15u; }
+
+} // namespace VSTPyramidDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTPyramidBuilder
+//
+// Builds the pyramid of each frame once for all consumers. Consumers register the levels
+// they read with Subscribe(); Build() computes levels up to the deepest one requested,
+// each in a single pass over the previous level, into a pooled arena. The result is
+// shared: consumers keep the shared_ptr as long as they read it, and the arena returns
+// to the pool when the last one lets go.
+//
+// Example usage:
+//     VSTPyramidBuilder pyramids(pvr_getVSTStreamFormat(session));
+//     const int handsId = pyramids.Subscribe(1 << 2);
+//     const int markerId = pyramids.Subscribe((1 << 0) | (1 << 1));
+//     ...
+//     std::shared_ptr<const VSTPyramid> pyramid = pyramids.Build(frame.Share());
+//     if (pyramid)
+//         hands.Process(pyramid->GetLevel(2));
+
+class VSTPyramidBuilder
+{
+public:
+    explicit VSTPyramidBuilder(pvrVSTStreamFormat format, const VSTPyramidParams& params = VSTPyramidParams())
+        : Format(format), Params(params), State(std::make_shared<PoolState>()), NextId(0), Dropped(0)
+    { }
+
+    // Adds a consumer of the levels set in levelMask (bit i for level i). Returns an id
+    // for Unsubscribe().
+    int Subscribe(uint32_t levelMask)
+    {
+        std::lock_guard<std::mutex> lock(SubscriberLock);
+        const Subscriber subscriber = { NextId++, levelMask };
+        Subscribers.push_back(subscriber);
+        return subscriber.Id;
+    }
+
+    void Unsubscribe(int id)
+    {
+        std::lock_guard<std::mutex> lock(SubscriberLock);
+        for (size_t i = 0; i < Subscribers.size(); i++)
+        {
+            if (Subscribers[i].Id == id)
+            {
+                Subscribers.erase(Subscribers.begin() + i);
+                return;
+            }
+        }
+    }
+
+    // Number of levels Build() produces for the current subscribers (at least 1).
+    uint32_t GetRequestedLevelCount() const
+    {
+        std::lock_guard<std::mutex> lock(SubscriberLock);
+        uint32_t mask = 1;
+        for (size_t i = 0; i < Subscribers.size(); i++)
+            mask |= Subscribers[i].LevelMask;
+        uint32_t count = 0;
+        while (mask)
+        {
+            mask >>= 1;
+            count++;
+        }
+        return PVRMath_Min(count, uint32_t(VSTPyramid::MaxLevels));
+    }
+
+    // Builds from a pooled frame; an NV12 level 0 references the frame, which is held
+    // until the pyramid is released. Returns null if MaxPyramids are in use or the frame
+    // is invalid.
+    std::shared_ptr<const VSTPyramid> Build(VSTFrameRef&& frame)
+    {
+        if (!frame.IsValid())
+            return std::shared_ptr<const VSTPyramid>();
+        std::shared_ptr<VSTPyramid> pyramid = Allocate();
+        if (!pyramid)
+            return pyramid;
+        const pvrVSTStreamFrame source = frame.GetFrame();
+        pyramid->Source = std::move(frame);
+        if (!Fill(source, true, pyramid.get()))
+            return std::shared_ptr<const VSTPyramid>();
+        return pyramid;
+    }
+
+    // Builds from a frame owned by the caller, copying level 0.
+    std::shared_ptr<const VSTPyramid> Build(const pvrVSTStreamFrame& frame)
+    {
+        std::shared_ptr<VSTPyramid> pyramid = Allocate();
+        if (pyramid && !Fill(frame, false, pyramid.get()))
+            return std::shared_ptr<const VSTPyramid>();
+        return pyramid;
+    }
+
+    // Frames Build() rejected because all MaxPyramids were in use.
+    uint32_t GetDroppedCount() const { return Dropped; }
+
+private:
+    struct Subscriber
+    {
+        int      Id;
+        uint32_t LevelMask;
+    };
+
+    // Shared with the deleters of pyramids in use, so they can outlive the builder.
+    struct PoolState
+    {
+        std::mutex                Lock;
+        std::vector<VSTPyramid*>  Free;
+        uint32_t                  Allocated;
+
+        PoolState() : Allocated(0) { }
+        ~PoolState()
+        {
+            for (size_t i = 0; i < Free.size(); i++)
+                delete Free[i];
+        }
+    };
+
+    std::shared_ptr<VSTPyramid> Allocate()
+    {
+        VSTPyramid* pyramid = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(State->Lock);
+            if (!State->Free.empty())
+            {
+                pyramid = State->Free.back();
+                State->Free.pop_back();
+            }
+            else if (State->Allocated < Params.MaxPyramids)
+            {
+                pyramid = new VSTPyramid();
+                State->Allocated++;
+            }
+        }
+        if (!pyramid)
+        {
+            Dropped++;
+            return std::shared_ptr<VSTPyramid>();
+        }
+
+        std::shared_ptr<PoolState> state = State;
+        return std::shared_ptr<VSTPyramid>(pyramid, [state](VSTPyramid* released)
+        {
+            released->Source.Reset();
+            std::lock_guard<std::mutex> lock(state->Lock);
+            state->Free.push_back(released);
+        });
+    }
+
+    void Run(int count, int grain, const std::function<void(int, int)>& body)
+    {
+        if (Params.Multithreaded)
+            ParallelFor(count, grain, body);
+        else
+            body(0, count);
+    }
+
+    bool Fill(const pvrVSTStreamFrame& frame, bool referenceFrame, VSTPyramid* pyramid)
+    {
+        using namespace VSTPyramidDetail;
+
+        if (!frame.buffer || frame.width < 2 || frame.height < 2 || frame.stride < frame.width ||
+            (Format != pvrVST_FORMAT_NV12 && Format != pvrVST_FORMAT_RAW8))
+            return false;
+
+        pyramid->FrameIdx = frame.frameIdx;
+        pyramid->ExposureTime = frame.exposureTime;
+
+        // Level sizes and arena layout.
+        const uint32_t requested = GetRequestedLevelCount();
+        const bool copyLevel0 = !(referenceFrame && Format == pvrVST_FORMAT_NV12);
+        uint32_t width = frame.width, height = frame.height;
+        size_t arenaSize = 0;
+        size_t offsets[VSTPyramid::MaxLevels];
+        uint32_t count = 0;
+        while (count < requested && (count == 0 || (width >= Params.MinSize && height >= Params.MinSize)))
+        {
+            VSTPyramidLevel& level = pyramid->Levels[count];
+            level.Width = width;
+            level.Height = height;
+            level.Scale = 1u << count;
+            level.Stride = AlignStride(width);
+            offsets[count] = arenaSize;
+            if (count > 0 || copyLevel0)
+                arenaSize += size_t(level.Stride) * height;
+            count++;
+            width /= 2;
+            height /= 2;
+        }
+        pyramid->LevelCount = count;
+        if (pyramid->Arena.size() < arenaSize)
+            pyramid->Arena.resize(arenaSize);
+        for (uint32_t i = 0; i < count; i++)
+            pyramid->Levels[i].Data = pyramid->Arena.data() + offsets[i];
+
+        VSTPyramidLevel& base = pyramid->Levels[0];
+        if (!copyLevel0)
+        {
+            base.Data = frame.buffer;
+            base.Stride = frame.stride;
+        }
+        else if (Format == pvrVST_FORMAT_NV12)
+        {
+            uint8_t* data = const_cast<uint8_t*>(base.Data);
+            Run(int(base.Height), 64, [&](int y0, int y1)
+            {
+                for (int y = y0; y < y1; y++)
+                    memcpy(data + size_t(y) * base.Stride, frame.buffer + size_t(y) * frame.stride, base.Width);
+            });
+        }
+        else
+        {
+            VSTConvertParams convert;
+            convert.Format = VSTPixel_Gray8;
+            convert.Bayer = Params.Bayer;
+            convert.Multithreaded = Params.Multithreaded;
+            const VSTImage image = { const_cast<uint8_t*>(base.Data), base.Width, base.Height, base.Stride };
+            if (ConvertVSTFrame(frame, Format, convert, image) != pvr_success)
+                return false;
+        }
+
+        for (uint32_t i = 1; i < count; i++)
+            BuildLevel(pyramid->Levels[i - 1], pyramid->Levels[i]);
+        return true;
+    }
+
+    void BuildLevel(const VSTPyramidLevel& source, const VSTPyramidLevel& target)
+    {
+        using namespace VSTPyramidDetail;
+        uint8_t* data = const_cast<uint8_t*>(target.Data);
+
+        if (Params.Filter == VSTPyramid_Box)
+        {
+            Run(int(target.Height), 16, [&](int y0, int y1)
+            {
+                for (int y = y0; y < y1; y++)
+                {
+                    VSTConvertDetail::DownscaleRow2(source.Data + size_t(2 * y) * source.Stride,
+                                                    source.Data + size_t(2 * y + 1) * source.Stride,
+                                                    int(target.Width), data + size_t(y) * target.Stride);
+                }
+            });
+            return;
+        }
+
+        Run(int(target.Height), 16, [&](int y0, int y1)
+        {
+            std::vector<uint16_t> temp(source.Width + 4);
+            for (int y = y0; y < y1; y++)
+            {
+                const uint8_t* rows[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    const int row = PVRMath_Min(PVRMath_Max(2 * y - 1 + k, 0), int(source.Height) - 1);
+                    rows[k] = source.Data + size_t(row) * source.Stride;
+                }
+                BinomialColumns(rows, int(source.Width), temp.data() + 2);
+                BinomialRow(temp.data() + 2, int(target.Width), data + size_t(y) * target.Stride);
+            }
+        });
+    }
+
+    pvrVSTStreamFormat         Format;
+    VSTPyramidParams           Params;
+    std::shared_ptr<PoolState> State;
+    mutable std::mutex         SubscriberLock;
+    std::vector<Subscriber>    Subscribers;
+    int                        NextId;
+    std::atomic<uint32_t>      Dropped;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,1121 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTRecorder.h
+Content     :   Recording of VST streams to a compressed, indexed file, and playback
+                of recordings in place of getVSTStreamFrame.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTRecorder_h
+#define PVR_VSTRecorder_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Threading.h"
+#include "PVR_VSTFramePool.h"
+#include "PVR_VSTUndistort.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTRecordingInfo
+//
+// Stream format and camera calibration stored at the start of a recording.
+
+struct VSTCameraCalibration
+{
+    uint32_t             Width;
+    uint32_t             Height;
+    Vector2f             Focal;
+    Vector2f             Center;
+    pvrVSTDistortionType DistortionType;
+    float                K[8];
+    Posef                CameraToHmd;
+
+    VSTCameraCalibration()
+        : Width(0), Height(0), Focal(1.0f, 1.0f), Center(0.0f, 0.0f), DistortionType(pvrVST_DISTORTION_UNKNOWN),
+          CameraToHmd(Posef::Identity())
+    {
+        memset(K, 0, sizeof(K));
+    }
+};
+
+struct VSTRecordingInfo
+{
+    enum { MaxCameras = 2 };
+
+    pvrVSTType           Type;
+    pvrVSTStreamFormat   Format;
+    uint32_t             CameraCount;
+    VSTCameraCalibration Cameras[MaxCameras];
+
+    VSTRecordingInfo() : Type(pvrVSTTypeNone), Format(pvrVST_FORMAT_UNKNOWN), CameraCount(0) { }
+
+    // Reads the stream format and the calibration of all cameras.
+    pvrResult Load(pvrSessionHandle session)
+    {
+        Type = pvr_getVSTType(session);
+        Format = pvr_getVSTStreamFormat(session);
+        CameraCount = (Type == pvrVSTTypeStereo) ? 2 : (Type == pvrVSTTypeMono) ? 1 : 0;
+        if (CameraCount == 0 || Format == pvrVST_FORMAT_UNKNOWN)
+            return pvr_not_support;
+
+        for (uint32_t i = 0; i < CameraCount; i++)
+        {
+            VSTCameraCalibration& camera = Cameras[i];
+            pvrVector2f focal, center;
+            pvrPosef cameraToHmd;
+            pvrResult result = pvr_getVSTCameraDistortionParams(session, i, &camera.DistortionType, camera.K);
+            if (result == pvr_success)
+                result = pvr_getVSTCameraIntrinsics(session, i, &camera.Width, &camera.Height, &focal, &center);
+            if (result == pvr_success)
+                result = pvr_getVSTCameraExtrinsics(session, i, &cameraToHmd);
+            if (result != pvr_success)
+                return result;
+            camera.Focal = focal;
+            camera.Center = center;
+            camera.CameraToHmd = cameraToHmd;
+        }
+        return pvr_success;
+    }
+
+    // Same as VSTCameraModel::Load() on the recorded calibration.
+    pvrResult GetCameraModel(uint32_t cameraIdx, VSTCameraModel* outModel) const
+    {
+        if (cameraIdx >= CameraCount)
+            return pvr_invalid_param;
+        const VSTCameraCalibration& camera = Cameras[cameraIdx];
+        if (camera.DistortionType != pvrVST_DISTORTION_FISHEYE4)
+            return pvr_not_support;
+        outModel->Width = camera.Width;
+        outModel->Height = camera.Height;
+        outModel->Focal = camera.Focal;
+        outModel->Center = camera.Center;
+        for (int i = 0; i < 4; i++)
+            outModel->K[i] = camera.K[i];
+        outModel->CameraToHmd = camera.CameraToHmd;
+        return pvr_success;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTRecorderParams
+
+struct VSTRecorderParams
+{
+    // Largest error allowed per sample; 0 is lossless. 1 or 2 remove most sensor noise
+    // from the bit stream and roughly double the compression ratio.
+    int NearLossless;
+
+    // Planes are coded in bands of this many rows, compressed and decompressed in
+    // parallel. Smaller bands parallelize better and compress slightly worse.
+    int BandRows;
+
+    // Frames Submit() may queue before it drops new ones.
+    int MaxQueuedFrames;
+
+    VSTRecorderParams() : NearLossless(0), BandRows(32), MaxQueuedFrames(4) { }
+};
+
+// One entry of the seek index.
+struct VSTRecordingIndexEntry
+{
+    uint32_t FrameIdx;
+    double   ExposureTime;
+    uint64_t Offset;        // Of the frame chunk in the file.
+};
+
+
+namespace VSTRecorderDetail {
+
+// File layout, all little endian:
+//     header      'PVRV', version
+//     chunks      type, reserved, payload size (64-bit), payload
+//                     'CALB'  VSTRecordingInfo, once after the header
+//                     'FRAM'  frame header, band sizes, bands
+//                     'INDX'  VSTRecordingIndexEntry array, written by Close()
+//     trailer     'PVRE', reserved, offset of the INDX chunk (64-bit)
+// A recording without a trailer (e.g. the process died) is indexed by scanning the chunks.
+
+inline uint32_t MakeFourCC(char a, char b, char c, char d)
+{
+    return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+enum
+{
+    FileVersion     = 1,
+    ChunkHeaderSize = 16,
+    TrailerSize     = 16,
+    FrameHeaderSize = 28,
+    UnaryLimit      = 24,   // Longer Rice quotients escape to a raw 9-bit value.
+    EscapeBits      = 9,
+    MaxNearLossless = 64,
+};
+
+template<class T> inline void Append(std::vector<uint8_t>* out, const T& value)
+{
+    const uint8_t* bytes = (const uint8_t*)&value;
+    out->insert(out->end(), bytes, bytes + sizeof(T));
+}
+
+template<class T> inline bool Extract(const uint8_t** data, const uint8_t* end, T* value)
+{
+    if (size_t(end - *data) < sizeof(T))
+        return false;
+    memcpy(value, *data, sizeof(T));
+    *data += sizeof(T);
+    return true;
+}
+
+inline bool FileSeek(FILE* file, uint64_t offset)
+{
+#if defined(_WIN32)
+    return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+inline uint64_t FileSize(FILE* file)
+{
+#if defined(_WIN32)
+    _fseeki64(file, 0, SEEK_END);
+    return uint64_t(_ftelli64(file));
+#else
+    fseeko(file, 0, SEEK_END);
+    return uint64_t(ftello(file));
+#endif
+}
+
+// Byte rows of one image plane. Prediction uses the samples LeftStep bytes to the left
+// and UpStep rows above, which have the same color in NV12 chroma and Bayer images.
+struct PlaneDesc
+{
+    uint32_t Offset;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t LeftStep;
+    uint32_t UpStep;
+};
+
+inline uint32_t GetPlanes(pvrVSTStreamFormat format, uint32_t width, uint32_t height, uint32_t stride, PlaneDesc planes[2])
+{
+    if (format == pvrVST_FORMAT_NV12)
+    {
+        const PlaneDesc luma = { 0, width, height, 1, 1 };
+        const PlaneDesc chroma = { stride * height, width, height / 2, 2, 1 };
+        planes[0] = luma;
+        planes[1] = chroma;
+        return 2;
+    }
+    if (format == pvrVST_FORMAT_RAW8)
+    {
+        const PlaneDesc bayer = { 0, width, height, 2, 2 };
+        planes[0] = bayer;
+        return 1;
+    }
+    return 0;
+}
+
+inline uint32_t GetFrameSize(pvrVSTStreamFormat format, uint32_t width, uint32_t height)
+{
+    return (format == pvrVST_FORMAT_NV12) ? width * height + width * (height / 2) : width * height;
+}
+
+// A band of rows of one plane.
+struct Band
+{
+    PlaneDesc Plane;
+    uint32_t  Y0;
+    uint32_t  Y1;
+};
+
+inline void GetBands(const PlaneDesc* planes, uint32_t planeCount, uint32_t bandRows, std::vector<Band>* bands)
+{
+    bands->clear();
+    for (uint32_t p = 0; p < planeCount; p++)
+    {
+        for (uint32_t y = 0; y < planes[p].Height; y += bandRows)
+        {
+            const Band band = { planes[p], y, PVRMath_Min(y + bandRows, planes[p].Height) };
+            bands->push_back(band);
+        }
+    }
+}
+
+inline uint32_t LeadingZeros32(uint32_t value)
+{
+    PVR_MATH_ASSERT(value != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return 31 - uint32_t(index);
+#elif defined(__GNUC__)
+    return uint32_t(__builtin_clz(value));
+#else
+    uint32_t zeros = 0;
+    while (!(value & 0x80000000u))
+    {
+        value <<= 1;
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+// MSB first bit writer into a buffer sized for the worst case.
+struct BitWriter
+{
+    uint8_t*       Out;
+    const uint8_t* Start;
+    uint64_t       Bits;
+    int            Count;
+
+    explicit BitWriter(uint8_t* out) : Out(out), Start(out), Bits(0), Count(0) { }
+
+    // n <= 32.
+    void Put(uint32_t value, int n)
+    {
+        Bits = (Bits << n) | (uint64_t(value) & ((uint64_t(1) << n) - 1));
+        Count += n;
+        if (Count >= 32)
+        {
+            Count -= 32;
+            const uint32_t word = uint32_t(Bits >> Count);
+            Out[0] = uint8_t(word >> 24);
+            Out[1] = uint8_t(word >> 16);
+            Out[2] = uint8_t(word >> 8);
+            Out[3] = uint8_t(word);
+            Out += 4;
+        }
+    }
+
+    // Returns the number of bytes written.
+    size_t Flush()
+    {
+        while (Count >= 8)
+        {
+            Count -= 8;
+            *Out++ = uint8_t(Bits >> Count);
+        }
+        if (Count > 0)
+            *Out++ = uint8_t(Bits << (8 - Count));
+        Count = 0;
+        return size_t(Out - Start);
+    }
+};
+
+struct BitReader
+{
+    const uint8_t* Data;
+    const uint8_t* End;
+    uint64_t       Bits;
+    int            Count;
+    size_t         Overrun;
+
+    BitReader(const uint8_t* data, const uint8_t* end) : Data(data), End(end), Bits(0), Count(0), Overrun(0) { }
+
+    // Buffers at least 57 bits; Get() and GetUnary() below do not refill.
+    void Fill()
+    {
+        while (Count <= 56)
+        {
+            uint8_t byte = 0;
+            if (Data < End)
+                byte = *Data++;
+            else
+                Overrun++;
+            Bits = (Bits << 8) | byte;
+            Count += 8;
+        }
+    }
+
+    uint32_t Get(int n)
+    {
+        Count -= n;
+        return uint32_t(Bits >> Count) & uint32_t((uint64_t(1) << n) - 1);
+    }
+
+    // Zeros before the next one bit, which is consumed; at most limit (< 32).
+    int GetUnary(int limit)
+    {
+        const uint32_t window = uint32_t(Bits >> (Count - 32));
+        const int zeros = int(LeadingZeros32(window | (1u << (31 - limit))));
+        Count -= zeros + 1;
+        return zeros;
+    }
+
+    // Reading a few bytes past the end is normal for the last codes; more is corruption.
+    bool IsValid() const { return Overrun <= 8; }
+};
+
+// Adaptive Rice parameter (LOCO-I style): k grows with the running mean of the codes.
+struct RiceState
+{
+    uint32_t Sum;
+    uint32_t Count;
+
+    RiceState() : Sum(4), Count(1) { }
+
+    // Valid streams never need more than 8 bits as codes are at most 255; the clamp keeps a
+    // corrupt stream within the code length the decoder budgets for.
+    int GetK() const
+    {
+        int k = 0;
+        while (k < EscapeBits && (Count << k) < Sum)
+            k++;
+        return k;
+    }
+
+    void Update(uint32_t code)
+    {
+        Sum += code;
+        if (++Count == 64)
+        {
+            Sum >>= 1;
+            Count >>= 1;
+        }
+    }
+};
+
+// Median edge detector.
+inline int Predict(int left, int up, int upLeft)
+{
+    const int low = PVRMath_Min(left, up);
+    const int high = PVRMath_Max(left, up);
+    if (upLeft >= high)
+        return low;
+    if (upLeft <= low)
+        return high;
+    return left + up - upLeft;
+}
+
+// Prediction of sample x of row from the band's reconstructed rows; up is null in the
+// first UpStep rows of a band, so bands decode independently.
+inline int PredictSample(const uint8_t* row, const uint8_t* up, uint32_t x, uint32_t leftStep)
+{
+    if (x >= leftStep)
+    {
+        const int left = row[x - leftStep];
+        return up ? Predict(left, up[x], up[x - leftStep]) : left;
+    }
+    return up ? up[x] : 128;
+}
+
+inline uint32_t ZigZag(int value) { return (value >= 0) ? uint32_t(value) << 1 : (uint32_t(-value) << 1) - 1; }
+inline int UnZigZag(uint32_t code) { return (code & 1) ? -int((code + 1) >> 1) : int(code >> 1); }
+
+// Worst case size of an encoded band: every sample escaped.
+inline size_t GetMaxEncodedSize(const Band& band)
+{
+    return size_t(band.Y1 - band.Y0) * band.Plane.Width * 5 + 8;
+}
+
+inline void EncodeBand(const uint8_t* frame, uint32_t stride, const Band& band, int nearLossless,
+                       std::vector<uint8_t>* out)
+{
+    const PlaneDesc& plane = band.Plane;
+    const int step = 2 * nearLossless + 1;
+    std::vector<uint8_t> recon(size_t(band.Y1 - band.Y0) * plane.Width);
+    out->resize(GetMaxEncodedSize(band));
+    BitWriter writer(out->data());
+    RiceState rice;
+
+    for (uint32_t y = band.Y0; y < band.Y1; y++)
+    {
+        const uint32_t row = y - band.Y0;
+        const uint8_t* src = frame + plane.Offset + size_t(y) * stride;
+        uint8_t* current = &recon[size_t(row) * plane.Width];
+        const uint8_t* up = (row >= plane.UpStep) ? current - size_t(plane.UpStep) * plane.Width : nullptr;
+
+        for (uint32_t x = 0; x < plane.Width; x++)
+        {
+            const int prediction = PredictSample(current, up, x, plane.LeftStep);
+            int residual;
+            if (nearLossless == 0)
+            {
+                residual = int8_t(uint8_t(src[x] - prediction));
+                current[x] = src[x];
+            }
+            else
+            {
+                const int error = src[x] - prediction;
+                residual = (error >= 0) ? (error + nearLossless) / step : -((nearLossless - error) / step);
+                const int value = prediction + residual * step;
+                current[x] = uint8_t((value < 0) ? 0 : (value > 255 ? 255 : value));
+            }
+
+            const uint32_t code = ZigZag(residual);
+            const int k = rice.GetK();
+            const uint32_t quotient = code >> k;
+            if (quotient < UnaryLimit)
+            {
+                writer.Put(1, int(quotient) + 1);
+                writer.Put(code, k);
+            }
+            else
+            {
+                writer.Put(1, UnaryLimit + 1);
+                writer.Put(code, EscapeBits);
+            }
+            rice.Update(code);
+        }
+    }
+    out->resize(writer.Flush());
+}
+
+// Decodes into a frame with stride plane.Width (planes packed).
+inline bool DecodeBand(const uint8_t* data, size_t size, const Band& band, int nearLossless, uint8_t* frame)
+{
+    const PlaneDesc& plane = band.Plane;
+    const int step = 2 * nearLossless + 1;
+    BitReader reader(data, data + size);
+    RiceState rice;
+
+    for (uint32_t y = band.Y0; y < band.Y1; y++)
+    {
+        const uint32_t row = y - band.Y0;
+        uint8_t* current = frame + plane.Offset + size_t(y) * plane.Width;
+        const uint8_t* up = (row >= plane.UpStep) ? current - size_t(plane.UpStep) * plane.Width : nullptr;
+
+        for (uint32_t x = 0; x < plane.Width; x++)
+        {
+            // A code is at most UnaryLimit + 1 + EscapeBits bits.
+            reader.Fill();
+            const int prediction = PredictSample(current, up, x, plane.LeftStep);
+            const int k = rice.GetK();
+            const int quotient = reader.GetUnary(UnaryLimit);
+            const uint32_t code = (quotient < UnaryLimit) ? ((uint32_t(quotient) << k) | reader.Get(k))
+                                                          : reader.Get(EscapeBits);
+            const int residual = UnZigZag(code);
+            if (nearLossless == 0)
+            {
+                current[x] = uint8_t(prediction + residual);
+            }
+            else
+            {
+                const int value = prediction + residual * step;
+                current[x] = uint8_t((value < 0) ? 0 : (value > 255 ? 255 : value));
+            }
+            rice.Update(code);
+        }
+    }
+    return reader.IsValid();
+}
+
+} // namespace VSTRecorderDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTRecorder
+//
+// Writes a VST stream to a file. Frames are coded losslessly, or near-losslessly with a
+// bounded per-sample error, by a LOCO-I style predictor with adaptive Rice codes; the
+// bands of each frame are compressed in parallel on the default WorkerPool. Close()
+// appends a seek index.
+//
+// WriteFrame() compresses on the calling thread (and the pool). Submit() queues a pooled
+// frame for a background thread instead, so capture is never blocked by the disk; the
+// frame reference is released as soon as it is compressed.
+//
+// Example usage:
+//     VSTRecordingInfo info;
+//     info.Load(session);
+//     VSTRecorder recorder;
+//     recorder.Open("session.pvrv", info);
+//     ...
+//     if (pool.Acquire(0, &frame) == VSTAcquire_Success)
+//         recorder.Submit(frame.Share());
+//     ...
+//     recorder.Close();
+
+class VSTRecorder
+{
+public:
+    VSTRecorder() : File(nullptr), Offset(0), Exiting(true), Dropped(0), LastError(pvr_success) { }
+    ~VSTRecorder() { Close(); }
+
+    pvrResult Open(const char* path, const VSTRecordingInfo& info, const VSTRecorderParams& params = VSTRecorderParams())
+    {
+        using namespace VSTRecorderDetail;
+
+        if (File)
+            return pvr_failed;
+        if (!path || info.CameraCount > VSTRecordingInfo::MaxCameras || params.NearLossless < 0 ||
+            params.NearLossless > MaxNearLossless || params.BandRows < 2 || params.MaxQueuedFrames < 1)
+            return pvr_invalid_param;
+        if (info.Format != pvrVST_FORMAT_NV12 && info.Format != pvrVST_FORMAT_RAW8)
+            return pvr_not_support;
+
+        File = fopen(path, "wb");
+        if (!File)
+            return pvr_failed;
+        Info = info;
+        Params = params;
+        Offset = 0;
+        Index.clear();
+        Dropped = 0;
+        LastError = pvr_success;
+
+        std::vector<uint8_t> header;
+        Append(&header, MakeFourCC('P', 'V', 'R', 'V'));
+        Append(&header, uint32_t(FileVersion));
+        std::vector<uint8_t> calibration;
+        Append(&calibration, uint32_t(info.Type));
+        Append(&calibration, uint32_t(info.Format));
+        Append(&calibration, info.CameraCount);
+        for (uint32_t i = 0; i < info.CameraCount; i++)
+        {
+            const VSTCameraCalibration& camera = info.Cameras[i];
+            Append(&calibration, camera.Width);
+            Append(&calibration, camera.Height);
+            Append(&calibration, pvrVector2f(camera.Focal));
+            Append(&calibration, pvrVector2f(camera.Center));
+            Append(&calibration, uint32_t(camera.DistortionType));
+            Append(&calibration, camera.K);
+            Append(&calibration, pvrPosef(camera.CameraToHmd));
+        }
+
+        if (!WriteBytes(header.data(), header.size()) || !WriteChunk(MakeFourCC('C', 'A', 'L', 'B'), calibration))
+        {
+            fclose(File);
+            File = nullptr;
+            return pvr_failed;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(QueueLock);
+            Exiting = false;
+        }
+        Worker = std::thread(&VSTRecorder::WorkerMain, this);
+        return pvr_success;
+    }
+
+    // Finishes queued frames, then writes the index and closes the file.
+    pvrResult Close()
+    {
+        using namespace VSTRecorderDetail;
+
+        if (!File)
+            return pvr_success;
+        {
+            std::lock_guard<std::mutex> lock(QueueLock);
+            Exiting = true;
+        }
+        QueueChanged.notify_all();
+        Worker.join();
+
+        std::lock_guard<std::mutex> lock(WriteLock);
+        std::vector<uint8_t> index;
+        for (size_t i = 0; i < Index.size(); i++)
+        {
+            Append(&index, Index[i].FrameIdx);
+            Append(&index, uint32_t(0));
+            Append(&index, Index[i].ExposureTime);
+            Append(&index, Index[i].Offset);
+        }
+        const uint64_t indexOffset = Offset;
+        std::vector<uint8_t> trailer;
+        Append(&trailer, MakeFourCC('P', 'V', 'R', 'E'));
+        Append(&trailer, uint32_t(0));
+        Append(&trailer, indexOffset);
+
+        bool written = WriteChunk(MakeFourCC('I', 'N', 'D', 'X'), index) && WriteBytes(trailer.data(), trailer.size());
+        written = (fclose(File) == 0) && written;
+        File = nullptr;
+        if (!written)
+            LastError = pvr_failed;
+        return LastError;
+    }
+
+    bool IsOpen() const { return File != nullptr; }
+
+    // Compresses and writes a frame. Thread safe.
+    pvrResult WriteFrame(const pvrVSTStreamFrame& frame)
+    {
+        using namespace VSTRecorderDetail;
+
+        if (!frame.buffer || frame.width < 2 || frame.height < 2 || frame.stride < frame.width ||
+            ((frame.width | frame.height) & 1))
+            return pvr_invalid_param;
+
+        std::lock_guard<std::mutex> lock(WriteLock);
+        if (!File)
+            return pvr_failed;
+
+        PlaneDesc planes[2];
+        const uint32_t planeCount = GetPlanes(Info.Format, frame.width, frame.height, frame.stride, planes);
+        GetBands(planes, planeCount, uint32_t(Params.BandRows), &Bands);
+        if (BandData.size() < Bands.size())
+            BandData.resize(Bands.size());
+
+        ParallelFor(int(Bands.size()), 1, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                BandData[i].clear();
+                EncodeBand(frame.buffer, frame.stride, Bands[i], Params.NearLossless, &BandData[i]);
+            }
+        });
+
+        std::vector<uint8_t>& header = Scratch;
+        header.clear();
+        Append(&header, frame.frameIdx);
+        Append(&header, frame.width);
+        Append(&header, frame.height);
+        Append(&header, uint32_t(Params.NearLossless));
+        Append(&header, uint32_t(Params.BandRows));
+        Append(&header, frame.exposureTime);
+        uint64_t payloadSize = header.size();
+        for (size_t i = 0; i < Bands.size(); i++)
+        {
+            Append(&header, uint32_t(BandData[i].size()));
+            payloadSize += sizeof(uint32_t) + BandData[i].size();
+        }
+
+        const VSTRecordingIndexEntry entry = { frame.frameIdx, frame.exposureTime, Offset };
+        bool written = WriteChunkHeader(MakeFourCC('F', 'R', 'A', 'M'), payloadSize) && WriteBytes(header.data(), header.size());
+        for (size_t i = 0; i < Bands.size() && written; i++)
+            written = WriteBytes(BandData[i].data(), BandData[i].size());
+        if (!written)
+        {
+            LastError = pvr_failed;
+            return pvr_failed;
+        }
+        Index.push_back(entry);
+        return pvr_success;
+    }
+
+    // Queues a frame for the background thread. Returns false, dropping the frame, if
+    // MaxQueuedFrames frames are already waiting.
+    bool Submit(VSTFrameRef&& frame)
+    {
+        if (!frame.IsValid())
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(QueueLock);
+            if (Exiting || Queue.size() >= size_t(Params.MaxQueuedFrames))
+            {
+                Dropped++;
+                return false;
+            }
+            Queue.push_back(std::move(frame));
+        }
+        QueueChanged.notify_one();
+        return true;
+    }
+
+    uint32_t GetFrameCount() const
+    {
+        std::lock_guard<std::mutex> lock(WriteLock);
+        return uint32_t(Index.size());
+    }
+
+    uint32_t GetDroppedCount() const { return Dropped; }
+
+    uint64_t GetBytesWritten() const
+    {
+        std::lock_guard<std::mutex> lock(WriteLock);
+        return Offset;
+    }
+
+    // First error of a background write, or of Close().
+    pvrResult GetLastError() const { return LastError; }
+
+private:
+    VSTRecorder(const VSTRecorder&);
+    VSTRecorder& operator=(const VSTRecorder&);
+
+    bool WriteBytes(const void* data, size_t size)
+    {
+        if (size > 0 && fwrite(data, 1, size, File) != size)
+            return false;
+        Offset += size;
+        return true;
+    }
+
+    bool WriteChunkHeader(uint32_t type, uint64_t size)
+    {
+        std::vector<uint8_t> header;
+        VSTRecorderDetail::Append(&header, type);
+        VSTRecorderDetail::Append(&header, uint32_t(0));
+        VSTRecorderDetail::Append(&header, size);
+        return WriteBytes(header.data(), header.size());
+    }
+
+    bool WriteChunk(uint32_t type, const std::vector<uint8_t>& payload)
+    {
+        return WriteChunkHeader(type, payload.size()) && WriteBytes(payload.data(), payload.size());
+    }
+
+    void WorkerMain()
+    {
+        std::unique_lock<std::mutex> lock(QueueLock);
+        for (;;)
+        {
+            QueueChanged.wait(lock, [this]() { return Exiting || !Queue.empty(); });
+            if (Queue.empty())
+                return;
+            VSTFrameRef frame = std::move(Queue.front());
+            Queue.pop_front();
+            lock.unlock();
+
+            if (WriteFrame(frame.GetFrame()) != pvr_success)
+                LastError = pvr_failed;
+            frame.Reset();
+
+            lock.lock();
+        }
+    }
+
+    FILE*                              File;
+    uint64_t                           Offset;
+    VSTRecordingInfo                   Info;
+    VSTRecorderParams                  Params;
+    std::vector<VSTRecordingIndexEntry> Index;
+    std::vector<VSTRecorderDetail::Band> Bands;
+    std::vector<std::vector<uint8_t> > BandData;
+    std::vector<uint8_t>               Scratch;
+    mutable std::mutex                 WriteLock;
+
+    std::thread                        Worker;
+    std::deque<VSTFrameRef>            Queue;
+    std::mutex                         QueueLock;
+    std::condition_variable            QueueChanged;
+    bool                               Exiting;    // Also while closed; QueueLock.
+    std::atomic<uint32_t>              Dropped;
+    std::atomic<pvrResult>             LastError;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTRecording
+//
+// Reads a file written by VSTRecorder. Frames are decoded into caller buffers, with the
+// bands decompressed in parallel on the default WorkerPool. Decoded frames are packed:
+// stride equals width.
+
+class VSTRecording
+{
+public:
+    VSTRecording() : File(nullptr), FileBytes(0) { }
+    ~VSTRecording() { Close(); }
+
+    pvrResult Open(const char* path)
+    {
+        using namespace VSTRecorderDetail;
+
+        Close();
+        if (!path)
+            return pvr_invalid_param;
+        File = fopen(path, "rb");
+        if (!File)
+            return pvr_failed;
+
+        const pvrResult result = ReadHeaders();
+        if (result != pvr_success)
+            Close();
+        return result;
+    }
+
+    void Close()
+    {
+        if (File)
+            fclose(File);
+        File = nullptr;
+        FileBytes = 0;
+        Index.clear();
+        Info = VSTRecordingInfo();
+    }
+
+    const VSTRecordingInfo& GetInfo() const { return Info; }
+
+    uint32_t GetFrameCount() const { return uint32_t(Index.size()); }
+
+    const VSTRecordingIndexEntry& GetIndexEntry(uint32_t i) const { return Index[i]; }
+
+    // Index of the last frame exposed at or before exposureTime (0 if none is).
+    uint32_t FindFrame(double exposureTime) const
+    {
+        uint32_t lo = 0, hi = uint32_t(Index.size());
+        while (hi - lo > 1)
+        {
+            const uint32_t mid = (lo + hi) / 2;
+            if (Index[mid].ExposureTime <= exposureTime)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Decodes frame i into buffer; outFrame->buffer points into it.
+    pvrResult ReadFrame(uint32_t i, std::vector<uint8_t>* buffer, pvrVSTStreamFrame* outFrame)
+    {
+        using namespace VSTRecorderDetail;
+
+        if (!File || i >= Index.size() || !buffer || !outFrame)
+            return pvr_invalid_param;
+
+        uint32_t type;
+        uint64_t size;
+        // The index and chunk sizes come from the file; check them before allocating.
+        if (Index[i].Offset > FileBytes || !FileSeek(File, Index[i].Offset) || !ReadChunkHeader(&type, &size) ||
+            type != MakeFourCC('F', 'R', 'A', 'M') || size > FileBytes - Index[i].Offset - ChunkHeaderSize)
+            return pvr_failed;
+        Payload.resize(size_t(size));
+        if (size > 0 && fread(Payload.data(), 1, size_t(size), File) != size_t(size))
+            return pvr_failed;
+
+        const uint8_t* data = Payload.data();
+        const uint8_t* end = data + Payload.size();
+        uint32_t frameIdx, width, height, nearLossless, bandRows;
+        double exposureTime;
+        if (!Extract(&data, end, &frameIdx) || !Extract(&data, end, &width) || !Extract(&data, end, &height) ||
+            !Extract(&data, end, &nearLossless) || !Extract(&data, end, &bandRows) || !Extract(&data, end, &exposureTime) ||
+            width < 2 || height < 2 || width > 16384 || height > 16384 || bandRows < 2 ||
+            nearLossless > MaxNearLossless)
+            return pvr_failed;
+
+        PlaneDesc planes[2];
+        const uint32_t planeCount = GetPlanes(Info.Format, width, height, width, planes);
+        GetBands(planes, planeCount, bandRows, &Bands);
+        BandOffsets.resize(Bands.size() + 1);
+        BandOffsets[0] = 0;
+        for (size_t b = 0; b < Bands.size(); b++)
+        {
+            uint32_t bandSize;
+            if (!Extract(&data, end, &bandSize))
+                return pvr_failed;
+            BandOffsets[b + 1] = BandOffsets[b] + bandSize;
+        }
+        if (BandOffsets.back() > size_t(end - data))
+            return pvr_failed;
+
+        buffer->resize(GetFrameSize(Info.Format, width, height));
+        std::atomic<bool> valid(true);
+        ParallelFor(int(Bands.size()), 1, [&](int begin, int bandEnd)
+        {
+            for (int b = begin; b < bandEnd; b++)
+            {
+                if (!DecodeBand(data + BandOffsets[b], BandOffsets[b + 1] - BandOffsets[b], Bands[b],
+                                int(nearLossless), buffer->data()))
+                    valid = false;
+            }
+        });
+        if (!valid)
+            return pvr_failed;
+
+        outFrame->frameIdx = frameIdx;
+        outFrame->exposureTime = exposureTime;
+        outFrame->width = width;
+        outFrame->height = height;
+        outFrame->stride = width;
+        outFrame->buffer = buffer->data();
+        return pvr_success;
+    }
+
+private:
+    VSTRecording(const VSTRecording&);
+    VSTRecording& operator=(const VSTRecording&);
+
+    bool ReadChunkHeader(uint32_t* type, uint64_t* size)
+    {
+        uint8_t header[VSTRecorderDetail::ChunkHeaderSize];
+        if (fread(header, 1, sizeof(header), File) != sizeof(header))
+            return false;
+        memcpy(type, header, sizeof(*type));
+        memcpy(size, header + 8, sizeof(*size));
+        return true;
+    }
+
+    pvrResult ReadHeaders()
+    {
+        using namespace VSTRecorderDetail;
+
+        uint32_t magic, version, type;
+        uint64_t size;
+        if (fread(&magic, sizeof(magic), 1, File) != 1 || fread(&version, sizeof(version), 1, File) != 1 ||
+            magic != MakeFourCC('P', 'V', 'R', 'V') || version != FileVersion)
+            return pvr_failed;
+
+        if (!ReadChunkHeader(&type, &size) || type != MakeFourCC('C', 'A', 'L', 'B') || size > 4096)
+            return pvr_failed;
+        Payload.resize(size_t(size));
+        if (size > 0 && fread(Payload.data(), 1, size_t(size), File) != size_t(size))
+            return pvr_failed;
+        if (!ParseCalibration())
+            return pvr_failed;
+
+        const uint64_t fileSize = FileSize(File);
+        FileBytes = fileSize;
+        const uint64_t firstChunk = 8 + ChunkHeaderSize + size;
+        if (ReadIndex(fileSize))
+            return pvr_success;
+
+        // No usable trailer: rebuild the index from the frame chunks.
+        Index.clear();
+        uint64_t offset = firstChunk;
+        while (offset + ChunkHeaderSize + FrameHeaderSize <= fileSize)
+        {
+            uint8_t header[FrameHeaderSize];
+            if (!FileSeek(File, offset) || !ReadChunkHeader(&type, &size) ||
+                offset + ChunkHeaderSize + size > fileSize || type != MakeFourCC('F', 'R', 'A', 'M') ||
+                size < FrameHeaderSize || fread(header, 1, sizeof(header), File) != sizeof(header))
+                break;
+            VSTRecordingIndexEntry entry;
+            entry.Offset = offset;
+            memcpy(&entry.FrameIdx, header, sizeof(entry.FrameIdx));
+            memcpy(&entry.ExposureTime, header + 20, sizeof(entry.ExposureTime));
+            Index.push_back(entry);
+            offset += ChunkHeaderSize + size;
+        }
+        return pvr_success;
+    }
+
+    bool ParseCalibration()
+    {
+        using namespace VSTRecorderDetail;
+
+        const uint8_t* data = Payload.data();
+        const uint8_t* end = data + Payload.size();
+        uint32_t type, format;
+        if (!Extract(&data, end, &type) || !Extract(&data, end, &format) || !Extract(&data, end, &Info.CameraCount) ||
+            Info.CameraCount > VSTRecordingInfo::MaxCameras)
+            return false;
+        Info.Type = pvrVSTType(type);
+        Info.Format = pvrVSTStreamFormat(format);
+        for (uint32_t i = 0; i < Info.CameraCount; i++)
+        {
+            VSTCameraCalibration& camera = Info.Cameras[i];
+            uint32_t distortion;
+            pvrVector2f focal, center;
+            pvrPosef cameraToHmd;
+            if (!Extract(&data, end, &camera.Width) || !Extract(&data, end, &camera.Height) ||
+                !Extract(&data, end, &focal) || !Extract(&data, end, &center) ||
+                !Extract(&data, end, &distortion) || !Extract(&data, end, &camera.K) ||
+                !Extract(&data, end, &cameraToHmd))
+                return false;
+            camera.Focal = focal;
+            camera.Center = center;
+            camera.DistortionType = pvrVSTDistortionType(distortion);
+            camera.CameraToHmd = cameraToHmd;
+        }
+        return Info.Format == pvrVST_FORMAT_NV12 || Info.Format == pvrVST_FORMAT_RAW8;
+    }
+
+    bool ReadIndex(uint64_t fileSize)
+    {
+        using namespace VSTRecorderDetail;
+
+        uint8_t trailer[TrailerSize];
+        uint32_t magic, type;
+        uint64_t indexOffset, size;
+        if (fileSize < TrailerSize || !FileSeek(File, fileSize - TrailerSize) ||
+            fread(trailer, 1, sizeof(trailer), File) != sizeof(trailer))
+            return false;
+        memcpy(&magic, trailer, sizeof(magic));
+        memcpy(&indexOffset, trailer + 8, sizeof(indexOffset));
+        if (magic != MakeFourCC('P', 'V', 'R', 'E') || indexOffset + ChunkHeaderSize > fileSize - TrailerSize ||
+            !FileSeek(File, indexOffset) || !ReadChunkHeader(&type, &size) || type != MakeFourCC('I', 'N', 'D', 'X') ||
+            size % 24 != 0 || indexOffset + ChunkHeaderSize + size > fileSize - TrailerSize)
+            return false;
+
+        Payload.resize(size_t(size));
+        if (size > 0 && fread(Payload.data(), 1, size_t(size), File) != size_t(size))
+            return false;
+        Index.resize(size_t(size / 24));
+        for (size_t i = 0; i < Index.size(); i++)
+        {
+            const uint8_t* entry = &Payload[i * 24];
+            memcpy(&Index[i].FrameIdx, entry, sizeof(Index[i].FrameIdx));
+            memcpy(&Index[i].ExposureTime, entry + 8, sizeof(Index[i].ExposureTime));
+            memcpy(&Index[i].Offset, entry + 16, sizeof(Index[i].Offset));
+        }
+        return true;
+    }
+
+    FILE*                                File;
+    uint64_t                             FileBytes;
+    VSTRecordingInfo                     Info;
+    std::vector<VSTRecordingIndexEntry>  Index;
+    std::vector<uint8_t>                 Payload;
+    std::vector<VSTRecorderDetail::Band> Bands;
+    std::vector<size_t>                  BandOffsets;
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTReplaySource
+//
+// Plays a recording back through the getVSTStreamFrame signature, e.g. as the source of
+// a VSTFramePool for replay benchmarks. Each call decodes the next recorded frame into
+// the oldest of bufferDepth buffers, so, like the runtime, a returned buffer stays valid
+// for bufferDepth - 1 further calls. The frameIdx argument is ignored.
+//
+// Example usage:
+//     VSTRecording recording;
+//     recording.Open("session.pvrv");
+//     VSTReplaySource replay(&recording);
+//     VSTFramePool pool(replay.AsFrameSource());
+
+class VSTReplaySource
+{
+public:
+    explicit VSTReplaySource(VSTRecording* recording, uint32_t bufferDepth = 2, bool loop = true)
+        : Recording(recording), Buffers(bufferDepth > 0 ? bufferDepth : 1), NextBuffer(0), NextFrame(0), Loop(loop)
+    { }
+
+    void Seek(uint32_t frame) { NextFrame = frame; }
+
+    pvrResult GetFrame(uint32_t frameIdx, pvrVSTStreamFrame* frame)
+    {
+        (void)frameIdx;
+        if (!frame || Recording->GetFrameCount() == 0)
+            return pvr_invalid_param;
+        if (NextFrame >= Recording->GetFrameCount())
+        {
+            if (!Loop)
+                return pvr_failed;
+            NextFrame = 0;
+        }
+
+        const pvrResult result = Recording->ReadFrame(NextFrame, &Buffers[NextBuffer], frame);
+        if (result != pvr_success)
+            return result;
+        NextFrame++;
+        NextBuffer = (NextBuffer + 1) % uint32_t(Buffers.size());
+        return pvr_success;
+    }
+
+    VSTFrameSource AsFrameSource()
+    {
+        return [this](uint32_t frameIdx, pvrVSTStreamFrame* frame) { return GetFrame(frameIdx, frame); };
+    }
+
+private:
+    VSTRecording*                      Recording;
+    std::vector<std::vector<uint8_t> > Buffers;
+    uint32_t                           NextBuffer;
+    uint32_t                           NextFrame;
+    bool                               Loop;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,342 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTReprojection.h
+Content     :   CPU reference reprojection of VST frames to eye views.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTReprojection_h
+#define PVR_VSTReprojection_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_Threading.h"
+#include "PVR_VSTConvert.h"
+#include "PVR_VSTStereo.h"
+#include "PVR_VSTUndistort.h"
+#include <functional>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTReprojectionSource
+//
+// One camera image as captured (still distorted), e.g. converted with ConvertVSTFrame at
+// Downscale 1, 2 or 4, and where the camera was at its exposure time, e.g. from
+// VSTFramePoseSync. Camera keeps the full resolution calibration; images smaller than
+// Camera.Width are scaled to it.
+
+struct VSTReprojectionSource
+{
+    const uint8_t* Data;
+    uint32_t       Width;
+    uint32_t       Height;
+    uint32_t       Stride;
+    uint32_t       Channels;        // 1 (Gray8) or 4 (RGBA8).
+    VSTCameraModel Camera;
+    Posef          CameraToWorld;   // SDK convention.
+    double         ExposureTime;
+
+    VSTReprojectionSource()
+        : Data(nullptr), Width(0), Height(0), Stride(0), Channels(1), CameraToWorld(Posef::Identity()), ExposureTime(0.0)
+    { }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTReprojectionTarget
+//
+// The eye view to produce: an undistorted (pre lens distortion) image with the eye's
+// field of view, seen from the eye pose predicted at display time.
+
+struct VSTReprojectionTarget
+{
+    uint32_t Width;
+    uint32_t Height;
+    FovPort  Fov;
+    Posef    EyeToWorld;            // SDK convention.
+    double   DisplayTime;
+
+    VSTReprojectionTarget() : Width(0), Height(0), EyeToWorld(Posef::Identity()), DisplayTime(0.0) { }
+
+    // Ray through the center of pixel (x, y), in eye space with z = -1.
+    Vector3f GetRay(float x, float y) const
+    {
+        const float tanX = -Fov.LeftTan + (x + 0.5f) * (Fov.LeftTan + Fov.RightTan) / float(Width);
+        const float tanY = Fov.UpTan - (y + 0.5f) * (Fov.UpTan + Fov.DownTan) / float(Height);
+        return Vector3f(tanX, tanY, -1.0f);
+    }
+
+    // Eye view of the HMD pose predicted by the runtime for displayTime.
+    static pvrResult FromSession(pvrSessionHandle session, pvrEyeType eye, double displayTime,
+                                 uint32_t width, uint32_t height, VSTReprojectionTarget* out)
+    {
+        if (!out || width == 0 || height == 0)
+            return pvr_invalid_param;
+        pvrEyeRenderInfo info;
+        pvrResult result = pvr_getEyeRenderInfo(session, eye, &info);
+        if (result != pvr_success)
+            return result;
+        pvrPoseStatef hmd;
+        result = pvr_getTrackedDevicePoseState(session, pvrTrackedDevice_HMD, displayTime, &hmd);
+        if (result != pvr_success)
+            return result;
+
+        out->Width = width;
+        out->Height = height;
+        out->Fov = info.Fov;
+        out->EyeToWorld = Posef(hmd.ThePose) * Posef(info.HmdToEyePose);
+        out->DisplayTime = displayTime;
+        return pvr_success;
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTReprojectionParams
+//
+// Without a depth map every eye ray is assumed to hit a plane FixedDepth meters in front
+// of the eye. With one, the depth along each ray is refined DepthIterations times from
+// that guess; rays without valid depth keep the plane.
+
+struct VSTReprojectionParams
+{
+    float    FixedDepth;        // Meters along the eye's forward axis.
+    uint32_t DepthIterations;
+    uint32_t TileSize;          // Pixels; tiles are spread across threads.
+    bool     Multithreaded;     // Split tiles across WorkerPool::GetDefault().
+
+    VSTReprojectionParams() : FixedDepth(2.0f), DepthIterations(3), TileSize(32), Multithreaded(true) { }
+};
+
+// Depth map with the world pose of its rectified camera at exposure time, i.e.
+// HmdToWorld * DepthMap->RectifiedToHmd.
+struct VSTReprojectionDepth
+{
+    const VSTDepthMap* DepthMap;
+    Posef              RectifiedToWorld;
+
+    VSTReprojectionDepth() : DepthMap(nullptr), RectifiedToWorld(Posef::Identity()) { }
+};
+
+struct VSTReprojectionStats
+{
+    uint32_t ValidPixels;   // Pixels seen by the camera.
+    uint32_t DepthPixels;   // Pixels placed using the depth map.
+    double   Latency;       // DisplayTime - ExposureTime, seconds.
+};
+
+
+namespace VSTReprojectionDetail {
+
+// Bilinear sample at a position known to be inside the image.
+inline void SampleBilinear(const VSTReprojectionSource& source, float x, float y, uint8_t* out)
+{
+    const uint32_t x0 = PVRMath_Min(uint32_t(x), source.Width - 2);
+    const uint32_t y0 = PVRMath_Min(uint32_t(y), source.Height - 2);
+    const float fx = x - float(x0);
+    const float fy = y - float(y0);
+    const uint32_t c = source.Channels;
+    const uint8_t* r0 = source.Data + size_t(y0) * source.Stride + size_t(x0) * c;
+    const uint8_t* r1 = r0 + source.Stride;
+    for (uint32_t i = 0; i < c; i++)
+    {
+        const float top = r0[i] + (r0[i + c] - r0[i]) * fx;
+        const float bottom = r1[i] + (r1[i + c] - r1[i]) * fx;
+        out[i] = uint8_t(top + (bottom - top) * fy + 0.5f);
+    }
+}
+
+// Distance along the eye ray (in units of the z = -1 ray) at which the depth map sees
+// the same depth, starting from t. Returns false if the map has no depth along the way.
+inline bool RefineDepth(const VSTReprojectionDepth& depth, uint32_t iterations,
+                        const Vector3f& eye, const Vector3f& ray, float* t)
+{
+    const VSTDepthMap& map = *depth.DepthMap;
+    const Vector3f origin = depth.RectifiedToWorld.Translation;
+    const Vector3f forward = depth.RectifiedToWorld.Rotate(Vector3f(0.0f, 0.0f, -1.0f));
+    const float rayForward = forward.Dot(ray);
+    if (rayForward < 1e-4f)
+        return false;
+    const float eyeForward = forward.Dot(eye - origin);
+
+    bool found = false;
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        const Vector3f point = VSTUndistortDetail::FlipYZ(depth.RectifiedToWorld.InverseTransform(eye + ray * *t));
+        if (point.z <= 1e-4f)
+            break;
+        const float px = map.Camera.Focal.x * point.x / point.z + map.Camera.Center.x + 0.5f;
+        const float py = map.Camera.Focal.y * point.y / point.z + map.Camera.Center.y + 0.5f;
+        if (px < 0.0f || py < 0.0f || px >= float(map.Width) || py >= float(map.Height))
+            break;
+        const float d = map.GetDepth(uint32_t(px), uint32_t(py));
+        if (d <= 0.0f)
+            break;
+        const float next = (d - eyeForward) / rayForward;
+        if (next <= 0.0f)
+            break;
+        *t = next;
+        found = true;
+    }
+    return found;
+}
+
+} // namespace VSTReprojectionDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** ReprojectVSTFrame
+//
+// Reference warp of a camera image to an eye view: for every target pixel, the eye ray
+// is intersected with the assumed scene, the point is projected into the camera at its
+// exposure pose through the fisheye model, and the image is sampled bilinearly. Pixels
+// the camera did not see are cleared to 0.
+//
+// This favors exactness over speed: it is the ground truth to measure the runtime's
+// passthrough warp against, not a replacement for it. outSourceCoords, if given, receives
+// Width * Height source positions (in source image pixels, -1 where invalid) so warps
+// can be compared geometrically with MeasureVSTWarpError().
+//
+// Example usage:
+//     VSTReprojectionTarget target;
+//     VSTReprojectionTarget::FromSession(session, pvrEye_Left, displayTime, 1024, 1024, &target);
+//     source.CameraToWorld = posedFrame.Pose.CameraToWorld[0];
+//     ReprojectVSTFrame(source, target, VSTReprojectionParams(), eyeImage, nullptr, &coords, &stats);
+
+inline pvrResult ReprojectVSTFrame(const VSTReprojectionSource& source, const VSTReprojectionTarget& target,
+                                   const VSTReprojectionParams& params, const VSTImage& dst,
+                                   const VSTReprojectionDepth* depth = nullptr,
+                                   std::vector<Vector2f>* outSourceCoords = nullptr,
+                                   VSTReprojectionStats* outStats = nullptr)
+{
+    using namespace VSTReprojectionDetail;
+
+    if (!source.Data || source.Width < 2 || source.Height < 2 || (source.Channels != 1 && source.Channels != 4) ||
+        source.Stride < source.Width * source.Channels || source.Camera.Width == 0 || source.Camera.Height == 0)
+        return pvr_invalid_param;
+    if (!dst.Data || dst.Width != target.Width || dst.Height != target.Height ||
+        dst.Stride < dst.Width * source.Channels || target.Width == 0 || target.Height == 0)
+        return pvr_invalid_param;
+    if (params.FixedDepth <= 0.0f || params.TileSize == 0)
+        return pvr_invalid_param;
+    if (depth && (!depth->DepthMap || depth->DepthMap->Width == 0 || depth->DepthMap->Height == 0))
+        return pvr_invalid_param;
+
+    if (outSourceCoords)
+        outSourceCoords->resize(size_t(target.Width) * target.Height);
+
+    const Vector2f imageScale(float(source.Width) / float(source.Camera.Width),
+                              float(source.Height) / float(source.Camera.Height));
+    const Posef worldToCamera = source.CameraToWorld.Inverted();
+    const uint32_t tile = params.TileSize;
+    const uint32_t tilesX = (target.Width + tile - 1) / tile;
+    const uint32_t tilesY = (target.Height + tile - 1) / tile;
+    std::vector<uint32_t> validPixels(size_t(tilesX) * tilesY);
+    std::vector<uint32_t> depthPixels(size_t(tilesX) * tilesY);
+
+    std::function<void(int, int)> body = [&](int t0, int t1)
+    {
+        for (int t = t0; t < t1; t++)
+        {
+            const uint32_t x0 = (uint32_t(t) % tilesX) * tile;
+            const uint32_t y0 = (uint32_t(t) / tilesX) * tile;
+            const uint32_t x1 = PVRMath_Min(x0 + tile, target.Width);
+            const uint32_t y1 = PVRMath_Min(y0 + tile, target.Height);
+            uint32_t valid = 0, fromDepth = 0;
+
+            for (uint32_t y = y0; y < y1; y++)
+            {
+                uint8_t* out = dst.Data + size_t(y) * dst.Stride;
+                for (uint32_t x = x0; x < x1; x++)
+                {
+                    const Vector3f eye = target.EyeToWorld.Translation;
+                    const Vector3f ray = target.EyeToWorld.Rotate(target.GetRay(float(x), float(y)));
+                    float distance = params.FixedDepth;
+                    if (depth && RefineDepth(*depth, params.DepthIterations, eye, ray, &distance))
+                        fromDepth++;
+
+                    const Vector3f point = VSTUndistortDetail::FlipYZ(worldToCamera.Transform(eye + ray * distance));
+                    Vector2f pixel = source.Camera.Project(point);
+                    // Pixel centers, as VSTPyramidLevel::FromSource.
+                    pixel = Vector2f((pixel.x + 0.5f) * imageScale.x - 0.5f, (pixel.y + 0.5f) * imageScale.y - 0.5f);
+
+                    uint8_t* texel = out + size_t(x) * source.Channels;
+                    const bool inside = point.z > 0.0f && pixel.x >= 0.0f && pixel.y >= 0.0f &&
+                                        pixel.x <= float(source.Width - 1) && pixel.y <= float(source.Height - 1);
+                    if (inside)
+                    {
+                        SampleBilinear(source, pixel.x, pixel.y, texel);
+                        valid++;
+                    }
+                    else
+                    {
+                        memset(texel, 0, source.Channels);
+                        pixel = Vector2f(-1.0f, -1.0f);
+                    }
+                    if (outSourceCoords)
+                        (*outSourceCoords)[size_t(y) * target.Width + x] = pixel;
+                }
+            }
+            validPixels[t] = valid;
+            depthPixels[t] = fromDepth;
+        }
+    };
+
+    const int tileCount = int(tilesX * tilesY);
+    if (params.Multithreaded)
+        ParallelFor(tileCount, 1, body);
+    else
+        body(0, tileCount);
+
+    if (outStats)
+    {
+        outStats->ValidPixels = 0;
+        outStats->DepthPixels = 0;
+        for (size_t i = 0; i < validPixels.size(); i++)
+        {
+            outStats->ValidPixels += validPixels[i];
+            outStats->DepthPixels += depthPixels[i];
+        }
+        outStats->Latency = target.DisplayTime - source.ExposureTime;
+    }
+    return pvr_success;
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** MeasureVSTWarpError
+//
+// Geometric error between two warps of the same view, e.g. this reference and the source
+// positions recovered from the runtime's output: RMS and maximum distance in source
+// pixels over the pixels valid in both. Returns the number of such pixels.
+
+inline uint32_t MeasureVSTWarpError(const std::vector<Vector2f>& reference, const std::vector<Vector2f>& measured,
+                                    float* outRms, float* outMax)
+{
+    const size_t count = PVRMath_Min(reference.size(), measured.size());
+    double sum = 0.0;
+    float worst = 0.0f;
+    uint32_t valid = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reference[i].x < 0.0f || measured[i].x < 0.0f)
+            continue;
+        const float d2 = (reference[i] - measured[i]).LengthSq();
+        sum += d2;
+        worst = PVRMath_Max(worst, d2);
+        valid++;
+    }
+    if (outRms)
+        *outRms = valid ? float(sqrt(sum / valid)) : 0.0f;
+    if (outMax)
+        *outMax = sqrtf(worst);
+    return valid;
+}
+
+
+} // Namespace PVR
+
+#endif
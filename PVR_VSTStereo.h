@@ -0,0 +1,750 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTStereo.h
+Content     :   Stereo depth from the rectified VST camera pair, by block matching or
+                semi-global matching on census costs.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTStereo_h
+#define PVR_VSTStereo_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+#include "PVR_Threading.h"
+#include "PVR_VSTConvert.h"
+#include "PVR_VSTUndistort.h"
+#include <functional>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTStereoParams
+
+enum VSTStereoMethod
+{
+    VSTStereo_BlockMatching,    // Census costs summed over a square window. Fastest.
+    VSTStereo_SemiGlobal,       // Census costs smoothed along 4 paths. Fills weak texture.
+};
+
+struct VSTStereoParams
+{
+    VSTStereoMethod Method;
+
+    // Resolution to match at: 0 is the rectified resolution, each level halves it. Cost
+    // is about proportional to width * height * MaxDisparity, so one level is about 8x
+    // cheaper at the same depth range.
+    int  Level;
+
+    // Largest disparity searched, in pixels at Level. Rounded up to a multiple of 16.
+    // The nearest measurable depth is Focal * Baseline / MaxDisparity.
+    int  MaxDisparity;
+
+    // Block matching window is (2 * BlockRadius + 1)^2 pixels, BlockRadius <= 7.
+    int  BlockRadius;
+
+    // Semi-global penalties for disparity changes of one pixel and of more, in census
+    // cost units (0 to 24 per pixel). 0 <= P1 <= P2 <= 1000.
+    int  P1;
+    int  P2;
+
+    // Percent by which the best cost must beat any other non-adjacent disparity; 0 off.
+    // 0 <= UniquenessRatio < 100.
+    int  UniquenessRatio;
+
+    // Rejects pixels whose match from the right image disagrees by more than a pixel,
+    // mostly occlusions.
+    bool LeftRightCheck;
+
+    bool Multithreaded;
+
+    VSTStereoParams()
+        : Method(VSTStereo_SemiGlobal), Level(1), MaxDisparity(64), BlockRadius(3), P1(3), P2(20),
+          UniquenessRatio(10), LeftRightCheck(true), Multithreaded(true)
+    { }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTDepthMap
+//
+// Depth seen by rectified camera 0 at the matching level. Depth is the distance along the
+// rectified optical axis in meters, 0 where no match was found or the match is at
+// infinity (disparity 0). Camera describes the pixel grid at this level and
+// RectifiedToHmd places it in HMD space (SDK convention), so every pixel with a depth
+// maps to an HMD space point for occlusion or reprojection.
+
+struct VSTDepthMap
+{
+    uint32_t           Width;
+    uint32_t           Height;
+    PinholeCamera      Camera;
+    Posef              RectifiedToHmd;
+    std::vector<float> Disparity;       // Pixels at this level; -1 where no match was found.
+    std::vector<float> Depth;
+
+    VSTDepthMap() : Width(0), Height(0), RectifiedToHmd(Posef::Identity()) { }
+
+    float GetDepth(uint32_t x, uint32_t y) const { return Depth[size_t(y) * Width + x]; }
+
+    // Returns false where the depth is invalid.
+    bool GetHmdPoint(uint32_t x, uint32_t y, Vector3f* outPoint) const
+    {
+        const float depth = GetDepth(x, y);
+        if (depth <= 0.0f)
+            return false;
+        const Vector3f point = Camera.Unproject(float(x), float(y)) * depth;
+        *outPoint = RectifiedToHmd.Transform(VSTUndistortDetail::FlipYZ(point));
+        return true;
+    }
+};
+
+
+namespace VSTStereoDetail {
+
+enum { MaxCost = 24, PathSentinel = 0x3FFF };
+
+inline uint32_t PopCount(uint32_t v)
+{
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    v = (v + (v >> 4)) & 0x0F0F0F0Fu;
+    v = v + (v >> 8);
+    v = v + (v >> 16);
+    return v & 0x3F;
+}
+
+#if PVR_SIMD_SSE2
+inline __m128i PopCount4(__m128i v)
+{
+    v = _mm_sub_epi32(v, _mm_and_si128(_mm_srli_epi32(v, 1), _mm_set1_epi32(0x55555555)));
+    v = _mm_add_epi32(_mm_and_si128(v, _mm_set1_epi32(0x33333333)),
+                      _mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0x33333333)));
+    v = _mm_and_si128(_mm_add_epi32(v, _mm_srli_epi32(v, 4)), _mm_set1_epi32(0x0F0F0F0F));
+    v = _mm_add_epi32(v, _mm_srli_epi32(v, 8));
+    v = _mm_add_epi32(v, _mm_srli_epi32(v, 16));
+    return _mm_and_si128(v, _mm_set1_epi32(0x3F));
+}
+#endif
+
+inline int ClampIndex(int i, int size) { return (i < 0) ? 0 : (i >= size ? size - 1 : i); }
+
+// 5x5 census transform: one bit per neighbor darker than the center, in row order with
+// the first neighbor in bit 23. Rows and columns are clamped at the borders.
+inline uint32_t CensusPixel(const uint8_t* const* rows, int x, int width)
+{
+    int columns[5];
+    for (int k = 0; k < 5; k++)
+        columns[k] = ClampIndex(x + k - 2, width);
+
+    const uint8_t center = rows[2][x];
+    uint32_t bits = 0;
+    for (int dy = 0; dy < 5; dy++)
+    {
+        for (int dx = 0; dx < 5; dx++)
+        {
+            if (dy == 2 && dx == 2)
+                continue;
+            bits = (bits << 1) | ((rows[dy][columns[dx]] < center) ? 1u : 0u);
+        }
+    }
+    return bits;
+}
+
+inline void CensusRow(const uint8_t* image, uint32_t stride, int width, int height, int y, uint32_t* out)
+{
+    const uint8_t* rows[5];
+    for (int k = 0; k < 5; k++)
+        rows[k] = image + size_t(ClampIndex(y + k - 2, height)) * stride;
+
+    int x = 0;
+    for (; x < 2 && x < width; x++)
+        out[x] = CensusPixel(rows, x, width);
+
+#if PVR_SIMD_SSE2
+    // 16 pixels at a time, building each byte of the words in its own register:
+    // b + b - mask shifts in a bit, as the compare mask is 0 or -1.
+    const __m128i signBit = _mm_set1_epi8(char(0x80));
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 18 <= width; x += 16)
+    {
+        const __m128i center = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(rows[2] + x)), signBit);
+        __m128i bytes[3] = { zero, zero, zero };
+        int bit = 0;
+        for (int dy = 0; dy < 5; dy++)
+        {
+            for (int dx = 0; dx < 5; dx++)
+            {
+                if (dy == 2 && dx == 2)
+                    continue;
+                const __m128i neighbor = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(rows[dy] + x + dx - 2)), signBit);
+                __m128i& b = bytes[bit / 8];
+                b = _mm_sub_epi8(_mm_add_epi8(b, b), _mm_cmplt_epi8(neighbor, center));
+                bit++;
+            }
+        }
+        const __m128i low = _mm_unpacklo_epi8(bytes[2], bytes[1]);
+        const __m128i high = _mm_unpackhi_epi8(bytes[2], bytes[1]);
+        const __m128i lowTop = _mm_unpacklo_epi8(bytes[0], zero);
+        const __m128i highTop = _mm_unpackhi_epi8(bytes[0], zero);
+        _mm_storeu_si128((__m128i*)(out + x), _mm_unpacklo_epi16(low, lowTop));
+        _mm_storeu_si128((__m128i*)(out + x + 4), _mm_unpackhi_epi16(low, lowTop));
+        _mm_storeu_si128((__m128i*)(out + x + 8), _mm_unpacklo_epi16(high, highTop));
+        _mm_storeu_si128((__m128i*)(out + x + 12), _mm_unpackhi_epi16(high, highTop));
+    }
+#endif
+
+    for (; x < width; x++)
+        out[x] = CensusPixel(rows, x, width);
+}
+
+// Hamming costs of all disparities for one row, disparityCount per pixel. reversed needs
+// width + disparityCount entries. Disparities reaching past the left edge cost MaxCost.
+inline void CostRow(const uint32_t* left, const uint32_t* right, int width, int disparityCount,
+                    uint32_t* reversed, uint8_t* out)
+{
+    // right[x - d] is reversed[width - 1 - x + d], contiguous in d.
+    for (int i = 0; i < width; i++)
+        reversed[width - 1 - i] = right[i];
+    for (int i = width; i < width + disparityCount; i++)
+        reversed[i] = 0;
+
+    for (int x = 0; x < width; x++)
+    {
+        const uint32_t* r = reversed + (width - 1 - x);
+        uint8_t* cost = out + size_t(x) * disparityCount;
+        int d = 0;
+
+#if PVR_SIMD_SSE2
+        const __m128i l = _mm_set1_epi32(int(left[x]));
+        for (; d + 16 <= disparityCount; d += 16)
+        {
+            const __m128i c0 = PopCount4(_mm_xor_si128(l, _mm_loadu_si128((const __m128i*)(r + d))));
+            const __m128i c1 = PopCount4(_mm_xor_si128(l, _mm_loadu_si128((const __m128i*)(r + d + 4))));
+            const __m128i c2 = PopCount4(_mm_xor_si128(l, _mm_loadu_si128((const __m128i*)(r + d + 8))));
+            const __m128i c3 = PopCount4(_mm_xor_si128(l, _mm_loadu_si128((const __m128i*)(r + d + 12))));
+            _mm_storeu_si128((__m128i*)(cost + d),
+                             _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3)));
+        }
+#endif
+
+        for (; d < disparityCount; d++)
+            cost[d] = uint8_t(PopCount(left[x] ^ r[d]));
+        for (d = x + 1; d < disparityCount; d++)
+            cost[d] = MaxCost;
+    }
+}
+
+inline void AddCosts(uint16_t* PVR_RESTRICT acc, const uint8_t* PVR_RESTRICT cost, int count)
+{
+    int i = 0;
+#if PVR_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(cost + i));
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(acc + i)), _mm_unpacklo_epi8(c, zero)));
+        _mm_storeu_si128((__m128i*)(acc + i + 8), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(acc + i + 8)), _mm_unpackhi_epi8(c, zero)));
+    }
+#endif
+    for (; i < count; i++)
+        acc[i] = uint16_t(acc[i] + cost[i]);
+}
+
+inline void SubCosts(uint16_t* PVR_RESTRICT acc, const uint8_t* PVR_RESTRICT cost, int count)
+{
+    int i = 0;
+#if PVR_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(cost + i));
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(acc + i)), _mm_unpacklo_epi8(c, zero)));
+        _mm_storeu_si128((__m128i*)(acc + i + 8), _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(acc + i + 8)), _mm_unpackhi_epi8(c, zero)));
+    }
+#endif
+    for (; i < count; i++)
+        acc[i] = uint16_t(acc[i] - cost[i]);
+}
+
+// acc += add - sub, all 16-bit.
+inline void AddSubSums(uint16_t* PVR_RESTRICT acc, const uint16_t* add, const uint16_t* sub, int count)
+{
+    int i = 0;
+#if PVR_SIMD_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(acc + i));
+        const __m128i delta = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(add + i)), _mm_loadu_si128((const __m128i*)(sub + i)));
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi16(a, delta));
+    }
+#endif
+    for (; i < count; i++)
+        acc[i] = uint16_t(acc[i] + add[i] - sub[i]);
+}
+
+// One step along a semi-global path:
+//     L(d) = C(d) + min(L'(d), L'(d - 1) + P1, L'(d + 1) + P1, min L' + P2) - min L'
+// prev and cur have a PathSentinel entry before and after their disparityCount entries.
+// Adds L to sum, or stores it if accumulate is false. Returns min L.
+inline uint16_t PathStep(const uint8_t* PVR_RESTRICT cost, const uint16_t* PVR_RESTRICT prev, uint16_t prevMin,
+                         int disparityCount, int p1, int p2, uint16_t* PVR_RESTRICT cur,
+                         uint16_t* PVR_RESTRICT sum, bool accumulate)
+{
+    const int jump = prevMin + p2;
+    int curMin = 0xFFFF;
+    int d = 0;
+
+#if PVR_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i penalty1 = _mm_set1_epi16(short(p1));
+    const __m128i jumpCost = _mm_set1_epi16(short(jump));
+    const __m128i offset = _mm_set1_epi16(short(prevMin));
+    __m128i minimum = _mm_set1_epi16(0x7FFF);
+    for (; d + 8 <= disparityCount; d += 8)
+    {
+        const __m128i same = _mm_loadu_si128((const __m128i*)(prev + d));
+        const __m128i below = _mm_adds_epu16(_mm_loadu_si128((const __m128i*)(prev + d - 1)), penalty1);
+        const __m128i above = _mm_adds_epu16(_mm_loadu_si128((const __m128i*)(prev + d + 1)), penalty1);
+        __m128i best = _mm_min_epi16(_mm_min_epi16(same, below), _mm_min_epi16(above, jumpCost));
+        best = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cost + d)), zero),
+                             _mm_sub_epi16(best, offset));
+        _mm_storeu_si128((__m128i*)(cur + d), best);
+        minimum = _mm_min_epi16(minimum, best);
+        const __m128i total = accumulate ? _mm_add_epi16(_mm_loadu_si128((const __m128i*)(sum + d)), best) : best;
+        _mm_storeu_si128((__m128i*)(sum + d), total);
+    }
+    minimum = _mm_min_epi16(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+    minimum = _mm_min_epi16(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+    minimum = _mm_min_epi16(minimum, _mm_shufflelo_epi16(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+    curMin = _mm_extract_epi16(minimum, 0);
+#endif
+
+    for (; d < disparityCount; d++)
+    {
+        int best = prev[d];
+        best = PVRMath_Min(best, prev[d - 1] + p1);
+        best = PVRMath_Min(best, prev[d + 1] + p1);
+        best = PVRMath_Min(best, jump);
+        const uint16_t value = uint16_t(cost[d] + best - prevMin);
+        cur[d] = value;
+        curMin = PVRMath_Min(curMin, int(value));
+        sum[d] = accumulate ? uint16_t(sum[d] + value) : value;
+    }
+    return uint16_t(curMin);
+}
+
+// First step of a path: L = C.
+inline uint16_t PathStart(const uint8_t* cost, int disparityCount, uint16_t* cur, uint16_t* sum, bool accumulate)
+{
+    int curMin = 0xFFFF;
+    for (int d = 0; d < disparityCount; d++)
+    {
+        cur[d] = cost[d];
+        curMin = PVRMath_Min(curMin, int(cost[d]));
+        sum[d] = accumulate ? uint16_t(sum[d] + cost[d]) : uint16_t(cost[d]);
+    }
+    return uint16_t(curMin);
+}
+
+// Path buffer of count entries per pixel with a sentinel on each side.
+struct PathBuffer
+{
+    std::vector<uint16_t> Data;
+    int                   Pitch;
+
+    PathBuffer(int pixels, int disparityCount) : Data(size_t(pixels) * (disparityCount + 2), uint16_t(PathSentinel)), Pitch(disparityCount + 2) { }
+    uint16_t* operator[](int i) { return &Data[size_t(i) * Pitch + 1]; }
+};
+
+// Horizontal paths (left to right, then right to left) of one row.
+inline void AggregateRowPaths(const uint8_t* cost, int width, int disparityCount, int p1, int p2, uint16_t* sum)
+{
+    PathBuffer buffers(2, disparityCount);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const int first = (pass == 0) ? 0 : width - 1;
+        const int step = (pass == 0) ? 1 : -1;
+        const bool accumulate = (pass != 0);
+        uint16_t* prev = buffers[0];
+        uint16_t* cur = buffers[1];
+        uint16_t prevMin = PathStart(cost + size_t(first) * disparityCount, disparityCount, prev,
+                                     sum + size_t(first) * disparityCount, accumulate);
+        for (int x = first + step; x >= 0 && x < width; x += step)
+        {
+            const size_t offset = size_t(x) * disparityCount;
+            prevMin = PathStep(cost + offset, prev, prevMin, disparityCount, p1, p2, cur, sum + offset, accumulate);
+            std::swap(prev, cur);
+        }
+    }
+}
+
+// Vertical paths (top to bottom, then bottom to top) of columns [x0, x1), added to sum.
+inline void AggregateColumnPaths(const uint8_t* cost, int width, int height, int disparityCount, int p1, int p2,
+                                 int x0, int x1, uint16_t* sum)
+{
+    const int columns = x1 - x0;
+    PathBuffer buffers[2] = { PathBuffer(columns, disparityCount), PathBuffer(columns, disparityCount) };
+    std::vector<uint16_t> mins(columns);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const int first = (pass == 0) ? 0 : height - 1;
+        const int step = (pass == 0) ? 1 : -1;
+        int current = 0;
+        for (int y = first; y >= 0 && y < height; y += step)
+        {
+            PathBuffer& prev = buffers[current];
+            PathBuffer& cur = buffers[current ^ 1];
+            for (int i = 0; i < columns; i++)
+            {
+                const size_t offset = (size_t(y) * width + x0 + i) * disparityCount;
+                if (y == first)
+                    mins[i] = PathStart(cost + offset, disparityCount, cur[i], sum + offset, true);
+                else
+                    mins[i] = PathStep(cost + offset, prev[i], mins[i], disparityCount, p1, p2, cur[i], sum + offset, true);
+            }
+            current ^= 1;
+        }
+    }
+}
+
+// Scratch of SelectRow() for one row.
+struct SelectBuffers
+{
+    std::vector<int>      LeftBest;
+    std::vector<uint16_t> RightCost;    // Indexed by width - 1 - xr, so contiguous in d.
+    std::vector<uint16_t> RightBest;
+
+    void Reset(int width, int disparityCount)
+    {
+        LeftBest.resize(width);
+        RightCost.assign(width + disparityCount, 0x7FFF);
+        RightBest.assign(width + disparityCount, 0);
+    }
+};
+
+// Best disparity of one pixel, the first one on ties, or -1 if another disparity further
+// than one from it is within uniquenessRatio percent. Also folds the costs into the best
+// match of each right image pixel x - d.
+inline int SelectPixel(const uint16_t* PVR_RESTRICT c, int disparityCount, int uniquenessRatio,
+                       uint16_t* PVR_RESTRICT rightCost, uint16_t* PVR_RESTRICT rightBest)
+{
+    int best = 0x7FFF;
+    int d = 0;
+
+#if PVR_SIMD_SSE2
+    __m128i minimum = _mm_set1_epi16(0x7FFF);
+    __m128i index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    for (; d + 8 <= disparityCount; d += 8)
+    {
+        const __m128i cost = _mm_loadu_si128((const __m128i*)(c + d));
+        minimum = _mm_min_epi16(minimum, cost);
+
+        const __m128i previous = _mm_loadu_si128((const __m128i*)(rightCost + d));
+        const __m128i better = _mm_cmplt_epi16(cost, previous);
+        const __m128i previousBest = _mm_loadu_si128((const __m128i*)(rightBest + d));
+        _mm_storeu_si128((__m128i*)(rightCost + d), _mm_min_epi16(previous, cost));
+        _mm_storeu_si128((__m128i*)(rightBest + d),
+                         _mm_or_si128(_mm_and_si128(better, index), _mm_andnot_si128(better, previousBest)));
+        index = _mm_add_epi16(index, _mm_set1_epi16(8));
+    }
+    minimum = _mm_min_epi16(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+    minimum = _mm_min_epi16(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+    minimum = _mm_min_epi16(minimum, _mm_shufflelo_epi16(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+    best = _mm_extract_epi16(minimum, 0);
+#endif
+
+    for (; d < disparityCount; d++)
+    {
+        best = PVRMath_Min(best, int(c[d]));
+        if (c[d] < rightCost[d])
+        {
+            rightCost[d] = c[d];
+            rightBest[d] = uint16_t(d);
+        }
+    }
+
+    int bestD = 0;
+    while (c[bestD] != best)
+        bestD++;
+
+    if (uniquenessRatio > 0)
+    {
+        // c[d] * (100 - ratio) < best * 100 is c[d] < threshold.
+        const int threshold = (best * 100 + 99 - uniquenessRatio) / (100 - uniquenessRatio);
+        int below = 0;
+        d = 0;
+#if PVR_SIMD_SSE2
+        const __m128i limit = _mm_set1_epi16(short(threshold));
+        for (; d + 8 <= disparityCount; d += 8)
+            below += int(PopCount(uint32_t(_mm_movemask_epi8(_mm_cmplt_epi16(_mm_loadu_si128((const __m128i*)(c + d)), limit)))) / 2);
+#endif
+        for (; d < disparityCount; d++)
+            below += (c[d] < threshold) ? 1 : 0;
+
+        for (d = PVRMath_Max(bestD - 1, 0); d <= PVRMath_Min(bestD + 1, disparityCount - 1); d++)
+            below -= (c[d] < threshold) ? 1 : 0;
+        if (below > 0)
+            return -1;
+    }
+    return bestD;
+}
+
+// Winner-takes-all disparities of one row of aggregated costs, with uniqueness and
+// left-right checks and parabolic sub-pixel refinement.
+inline void SelectRow(const uint16_t* costs, int width, int disparityCount, int uniquenessRatio, bool leftRightCheck,
+                      SelectBuffers* buffers, float* disparity)
+{
+    buffers->Reset(width, disparityCount);
+    for (int x = 0; x < width; x++)
+    {
+        const int offset = width - 1 - x;
+        buffers->LeftBest[x] = SelectPixel(costs + size_t(x) * disparityCount, disparityCount, uniquenessRatio,
+                                           &buffers->RightCost[offset], &buffers->RightBest[offset]);
+    }
+
+    for (int x = 0; x < width; x++)
+    {
+        const uint16_t* c = costs + size_t(x) * disparityCount;
+        const int bestD = buffers->LeftBest[x];
+        disparity[x] = -1.0f;
+        if (bestD < 0 || bestD > x)
+            continue;
+
+        if (leftRightCheck)
+        {
+            const int rightD = buffers->RightBest[width - 1 - (x - bestD)];
+            if (rightD < bestD - 1 || rightD > bestD + 1)
+                continue;
+        }
+
+        float refined = float(bestD);
+        if (bestD > 0 && bestD < disparityCount - 1)
+        {
+            const int denominator = c[bestD - 1] + c[bestD + 1] - 2 * c[bestD];
+            if (denominator > 0)
+                refined += float(c[bestD - 1] - c[bestD + 1]) / float(2 * denominator);
+        }
+        disparity[x] = refined;
+    }
+}
+
+} // namespace VSTStereoDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTStereoMatcher
+//
+// Computes a VSTDepthMap from a pair of rectified gray images (see VSTStereoRectification
+// and RemapBilinear). The matcher keeps its buffers between calls, so reuse one instance
+// per stream. Census costs make the match robust to the exposure and gain differences
+// between the two cameras.
+//
+// Example usage:
+//     VSTStereoMatcher matcher;
+//     RemapBilinear(gray0, stride0, 1, rect->Tables[0], left, width);
+//     RemapBilinear(gray1, stride1, 1, rect->Tables[1], right, width);
+//     if (matcher.Compute(left, width, right, width, *rect, &depthMap) == pvr_success)
+//         ...
+
+class VSTStereoMatcher
+{
+public:
+    explicit VSTStereoMatcher(const VSTStereoParams& params = VSTStereoParams()) : Params(params) { }
+
+    void SetParams(const VSTStereoParams& params) { Params = params; }
+    const VSTStereoParams& GetParams() const { return Params; }
+
+    // left and right are rect.Target.Width x rect.Target.Height gray images rectified with
+    // rect.Tables[0] and rect.Tables[1].
+    pvrResult Compute(const uint8_t* left, uint32_t leftStride, const uint8_t* right, uint32_t rightStride,
+                      const VSTStereoRectification& rect, VSTDepthMap* out)
+    {
+        using namespace VSTStereoDetail;
+
+        if (!left || !right || !out || Params.Level < 0 || Params.Level > 4 ||
+            Params.BlockRadius < 0 || Params.BlockRadius > 7 || Params.MaxDisparity < 1 ||
+            Params.P1 < 0 || Params.P2 < Params.P1 || Params.P2 > 1000 ||
+            Params.UniquenessRatio < 0 || Params.UniquenessRatio >= 100)
+            return pvr_invalid_param;
+
+        const int scale = 1 << Params.Level;
+        const int width = int(rect.Target.Width) / scale;
+        const int height = int(rect.Target.Height) / scale;
+        const int disparityCount = (Params.MaxDisparity + 15) & ~15;
+        if (width < 8 || height < 8 || disparityCount >= width)
+            return pvr_invalid_param;
+
+        const uint8_t* images[2] = { left, right };
+        uint32_t strides[2] = { leftStride, rightStride };
+        for (int i = 0; i < 2; i++)
+            Downscale(i, int(rect.Target.Width), int(rect.Target.Height), &images[i], &strides[i]);
+
+        const size_t pixels = size_t(width) * height;
+        Census[0].resize(pixels);
+        Census[1].resize(pixels);
+        Costs.resize(pixels * disparityCount);
+
+        Run(height, 16, [&](int y0, int y1)
+        {
+            std::vector<uint32_t> reversed(width + disparityCount);
+            for (int y = y0; y < y1; y++)
+            {
+                for (int i = 0; i < 2; i++)
+                    CensusRow(images[i], strides[i], width, height, y, &Census[i][size_t(y) * width]);
+                CostRow(&Census[0][size_t(y) * width], &Census[1][size_t(y) * width], width, disparityCount,
+                        reversed.data(), &Costs[size_t(y) * width * disparityCount]);
+            }
+        });
+
+        out->Width = uint32_t(width);
+        out->Height = uint32_t(height);
+        out->Disparity.resize(pixels);
+        out->Depth.resize(pixels);
+
+        if (Params.Method == VSTStereo_SemiGlobal)
+            MatchSemiGlobal(width, height, disparityCount, out);
+        else
+            MatchBlocks(width, height, disparityCount, out);
+
+        // Rectified camera at this level: pixel centers move with the box downscale.
+        out->Camera.Width = uint32_t(width);
+        out->Camera.Height = uint32_t(height);
+        out->Camera.Focal = rect.Target.Focal / float(scale);
+        out->Camera.Center = (rect.Target.Center + Vector2f(0.5f)) / float(scale) - Vector2f(0.5f);
+        out->RectifiedToHmd = rect.RectifiedToHmd[0];
+
+        const float focalBaseline = out->Camera.Focal.x * rect.Baseline;
+        for (size_t i = 0; i < pixels; i++)
+        {
+            const float d = out->Disparity[i];
+            out->Depth[i] = (d > 0.0f) ? focalBaseline / d : 0.0f;
+        }
+        return pvr_success;
+    }
+
+private:
+    void Run(int count, int grain, const std::function<void(int, int)>& body)
+    {
+        if (Params.Multithreaded)
+            ParallelFor(count, grain, body);
+        else
+            body(0, count);
+    }
+
+    // Box downscales image i by 2^Level in place of *image and *stride; level 0 uses the
+    // input as is.
+    void Downscale(int i, int width, int height, const uint8_t** image, uint32_t* stride)
+    {
+        const uint8_t* source = *image;
+        uint32_t sourceStride = *stride;
+        for (int level = 1; level <= Params.Level; level++)
+        {
+            width /= 2;
+            height /= 2;
+            std::vector<uint8_t>& target = Levels[i][level & 1];
+            target.resize(size_t(width) * height);
+            Run(height, 32, [&](int y0, int y1)
+            {
+                for (int y = y0; y < y1; y++)
+                {
+                    VSTConvertDetail::DownscaleRow2(source + size_t(2 * y) * sourceStride,
+                                                    source + size_t(2 * y + 1) * sourceStride,
+                                                    width, &target[size_t(y) * width]);
+                }
+            });
+            source = target.data();
+            sourceStride = uint32_t(width);
+        }
+        *image = source;
+        *stride = sourceStride;
+    }
+
+    void MatchSemiGlobal(int width, int height, int disparityCount, VSTDepthMap* out)
+    {
+        using namespace VSTStereoDetail;
+        const size_t rowSize = size_t(width) * disparityCount;
+        Sums.resize(size_t(height) * rowSize);
+
+        Run(height, 8, [&](int y0, int y1)
+        {
+            for (int y = y0; y < y1; y++)
+                AggregateRowPaths(&Costs[y * rowSize], width, disparityCount, Params.P1, Params.P2, &Sums[y * rowSize]);
+        });
+        Run(width, 16, [&](int x0, int x1)
+        {
+            AggregateColumnPaths(Costs.data(), width, height, disparityCount, Params.P1, Params.P2, x0, x1, Sums.data());
+        });
+        Run(height, 8, [&](int y0, int y1)
+        {
+            SelectBuffers buffers;
+            for (int y = y0; y < y1; y++)
+            {
+                SelectRow(&Sums[y * rowSize], width, disparityCount, Params.UniquenessRatio, Params.LeftRightCheck,
+                          &buffers, &out->Disparity[size_t(y) * width]);
+            }
+        });
+    }
+
+    // Window sums by running column sums down each band of rows and a running sum along
+    // each row.
+    void MatchBlocks(int width, int height, int disparityCount, VSTDepthMap* out)
+    {
+        using namespace VSTStereoDetail;
+        const int radius = Params.BlockRadius;
+        const size_t rowSize = size_t(width) * disparityCount;
+
+        Run(height, 16, [&](int y0, int y1)
+        {
+            std::vector<uint16_t> columns(rowSize, 0);
+            std::vector<uint16_t> window(rowSize);
+            SelectBuffers buffers;
+
+            for (int k = -radius; k <= radius; k++)
+                AddCosts(columns.data(), &Costs[ClampIndex(y0 + k, height) * rowSize], int(rowSize));
+
+            for (int y = y0; y < y1; y++)
+            {
+                if (y > y0)
+                {
+                    AddCosts(columns.data(), &Costs[ClampIndex(y + radius, height) * rowSize], int(rowSize));
+                    SubCosts(columns.data(), &Costs[ClampIndex(y - radius - 1, height) * rowSize], int(rowSize));
+                }
+
+                uint16_t* sum = window.data();
+                memset(sum, 0, disparityCount * sizeof(uint16_t));
+                for (int k = -radius; k <= radius; k++)
+                {
+                    const uint16_t* column = &columns[size_t(ClampIndex(k, width)) * disparityCount];
+                    for (int d = 0; d < disparityCount; d++)
+                        sum[d] = uint16_t(sum[d] + column[d]);
+                }
+                for (int x = 1; x < width; x++)
+                {
+                    uint16_t* next = sum + disparityCount;
+                    memcpy(next, sum, disparityCount * sizeof(uint16_t));
+                    AddSubSums(next, &columns[size_t(ClampIndex(x + radius, width)) * disparityCount],
+                               &columns[size_t(ClampIndex(x - radius - 1, width)) * disparityCount], disparityCount);
+                    sum = next;
+                }
+
+                SelectRow(window.data(), width, disparityCount, Params.UniquenessRatio, Params.LeftRightCheck,
+                          &buffers, &out->Disparity[size_t(y) * width]);
+            }
+        });
+    }
+
+    VSTStereoParams       Params;
+    std::vector<uint8_t>  Levels[2][2];
+    std::vector<uint32_t> Census[2];
+    std::vector<uint8_t>  Costs;
+    std::vector<uint16_t> Sums;
+};
+
+
+} // Namespace PVR
+
+#endif
@@ -0,0 +1,523 @@
+/************************************************************************************
+
+Filename    :   PVR_VSTUndistort.h
+Content     :   Fisheye undistortion and stereo rectification remap tables for the VST
+                cameras, with a bilinear remap kernel.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_VSTUndistort_h
+#define PVR_VSTUndistort_h
+
+#include "PVR_API.h"
+#include "PVR_Math.h"
+#include "PVR_SIMD.h"
+#include "PVR_Threading.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PVR {
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTCameraModel
+//
+// Calibration of one VST camera. Focal length and center are in pixels. For
+// pvrVST_DISTORTION_FISHEYE4, K holds k1..k4 of the equidistant fisheye model:
+//     theta_d = theta * (1 + k1 theta^2 + k2 theta^4 + k3 theta^6 + k4 theta^8)
+//
+// Rays passed to Project() use the image convention (x right, y down, z forward), while
+// CameraToHmd uses the SDK convention (x right, y up, -z forward).
+
+struct VSTCameraModel
+{
+    uint32_t Width;
+    uint32_t Height;
+    Vector2f Focal;
+    Vector2f Center;
+    float    K[4];
+    Posef    CameraToHmd;
+
+    VSTCameraModel()
+        : Width(0), Height(0), Focal(1.0f, 1.0f), Center(0.0f, 0.0f), CameraToHmd(Posef::Identity())
+    {
+        K[0] = K[1] = K[2] = K[3] = 0.0f;
+    }
+
+    // Reads the calibration of camera cameraIdx. Returns pvr_not_support for distortion
+    // models other than FISHEYE4.
+    pvrResult Load(pvrSessionHandle session, uint32_t cameraIdx)
+    {
+        pvrVSTDistortionType type = pvrVST_DISTORTION_UNKNOWN;
+        float k[8] = { };
+        pvrVector2f focal, center;
+        pvrPosef cameraToHmd;
+
+        pvrResult result = pvr_getVSTCameraDistortionParams(session, cameraIdx, &type, k);
+        if (result != pvr_success)
+            return result;
+        if (type != pvrVST_DISTORTION_FISHEYE4)
+            return pvr_not_support;
+        result = pvr_getVSTCameraIntrinsics(session, cameraIdx, &Width, &Height, &focal, &center);
+        if (result != pvr_success)
+            return result;
+        result = pvr_getVSTCameraExtrinsics(session, cameraIdx, &cameraToHmd);
+        if (result != pvr_success)
+            return result;
+
+        Focal = focal;
+        Center = center;
+        for (int i = 0; i < 4; i++)
+            K[i] = k[i];
+        CameraToHmd = cameraToHmd;
+        return pvr_success;
+    }
+
+    // Distorted pixel position of a ray in camera space (image convention). Works for
+    // rays beyond 90 degrees from the optical axis.
+    Vector2f Project(const Vector3f& ray) const
+    {
+        const float r = sqrtf(ray.x * ray.x + ray.y * ray.y);
+        const float theta = atan2f(r, ray.z);
+        const float t2 = theta * theta;
+        const float thetaD = theta * (1.0f + t2 * (K[0] + t2 * (K[1] + t2 * (K[2] + t2 * K[3]))));
+        const float scale = (r > 1e-8f) ? (thetaD / r) : (1.0f / PVRMath_Max(ray.z, 1e-8f));
+        return Vector2f(Focal.x * ray.x * scale + Center.x, Focal.y * ray.y * scale + Center.y);
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** PinholeCamera
+//
+// Undistorted target of a remap table.
+
+struct PinholeCamera
+{
+    uint32_t Width;
+    uint32_t Height;
+    Vector2f Focal;
+    Vector2f Center;
+
+    PinholeCamera() : Width(0), Height(0), Focal(1.0f, 1.0f), Center(0.0f, 0.0f) { }
+
+    // Same size as the source camera, centered, with the source focal length times zoom.
+    // zoom < 1 widens the field of view.
+    static PinholeCamera FromModel(const VSTCameraModel& camera, float zoom = 1.0f)
+    {
+        PinholeCamera result;
+        result.Width = camera.Width;
+        result.Height = camera.Height;
+        result.Focal = camera.Focal * zoom;
+        result.Center = Vector2f(0.5f * (camera.Width - 1), 0.5f * (camera.Height - 1));
+        return result;
+    }
+
+    // Ray (image convention, z = 1) through the center of pixel (x, y).
+    Vector3f Unproject(float x, float y) const
+    {
+        return Vector3f((x - Center.x) / Focal.x, (y - Center.y) / Focal.y, 1.0f);
+    }
+};
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTRemapTable
+//
+// Source position for every destination pixel in 12.4 fixed point, packed as x | (y << 16).
+// Entries outside the source image are InvalidEntry. Sources up to 4095 pixels wide and
+// high are supported; 4 bytes per pixel keep the table cheap to stream next to the image.
+
+struct VSTRemapTable
+{
+    enum { FractionBits = 4, InvalidEntry = 0xFFFFFFFFu };
+
+    uint32_t              Width;
+    uint32_t              Height;
+    uint32_t              SourceWidth;
+    uint32_t              SourceHeight;
+    std::vector<uint32_t> Entries;
+
+    VSTRemapTable() : Width(0), Height(0), SourceWidth(0), SourceHeight(0) { }
+
+    // Stores a source position. Positions on the last row or column are moved inside by
+    // 1/16 pixel so the kernel can always read the 2x2 neighbourhood.
+    void SetEntry(uint32_t x, uint32_t y, const Vector2f& source)
+    {
+        const float one = float(1 << FractionBits);
+        const float maxX = float(SourceWidth - 1) * one - 1.0f;
+        const float maxY = float(SourceHeight - 1) * one - 1.0f;
+        const float sx = source.x * one;
+        const float sy = source.y * one;
+        uint32_t entry = InvalidEntry;
+        if (sx >= 0.0f && sy >= 0.0f && sx <= maxX + 1.0f && sy <= maxY + 1.0f)
+        {
+            const uint32_t ix = uint32_t(PVRMath_Min(sx + 0.5f, maxX));
+            const uint32_t iy = uint32_t(PVRMath_Min(sy + 0.5f, maxY));
+            entry = ix | (iy << 16);
+        }
+        Entries[size_t(y) * Width + x] = entry;
+    }
+};
+
+
+namespace VSTUndistortDetail {
+
+// Rotation from the SDK convention to the image convention (and back): flip y and z.
+inline Vector3f FlipYZ(const Vector3f& v) { return Vector3f(v.x, -v.y, -v.z); }
+
+inline void BuildTable(const VSTCameraModel& camera, const PinholeCamera& target, const Quatf& targetToCamera,
+                       VSTRemapTable* out)
+{
+    PVR_MATH_ASSERT(camera.Width > 1 && camera.Width < 4096 && camera.Height > 1 && camera.Height < 4096);
+    out->Width = target.Width;
+    out->Height = target.Height;
+    out->SourceWidth = camera.Width;
+    out->SourceHeight = camera.Height;
+    out->Entries.resize(size_t(target.Width) * target.Height);
+
+    // targetToCamera is in the SDK convention; rays are in the image convention.
+    ParallelFor(int(target.Height), 32, [&](int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            for (uint32_t x = 0; x < target.Width; x++)
+            {
+                const Vector3f ray = FlipYZ(targetToCamera.Rotate(FlipYZ(target.Unproject(float(x), float(y)))));
+                out->SetEntry(x, uint32_t(y), camera.Project(ray));
+            }
+        }
+    });
+}
+
+} // namespace VSTUndistortDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** BuildUndistortTable
+//
+// Table mapping target pixels to camera pixels, removing the fisheye distortion.
+
+inline void BuildUndistortTable(const VSTCameraModel& camera, const PinholeCamera& target, VSTRemapTable* out)
+{
+    VSTUndistortDetail::BuildTable(camera, target, Quatf::Identity(), out);
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTStereoRectification
+//
+// Rectifies a stereo pair into a common pinhole camera. Both rectified cameras share the
+// orientation RectifiedToHmd[i].Rotation, with the x axis along the baseline from camera 0
+// to camera 1, so corresponding points lie on the same row and the disparity d (pixels)
+// gives the depth Target.Focal.x * Baseline / d.
+
+struct VSTStereoRectification
+{
+    PinholeCamera Target;
+    Posef         RectifiedToHmd[2];    // SDK convention.
+    float         Baseline;             // Meters.
+    VSTRemapTable Tables[2];
+};
+
+// Returns false if the cameras are at the same position.
+inline bool BuildStereoRectification(const VSTCameraModel cameras[2], const PinholeCamera& target,
+                                     VSTStereoRectification* out)
+{
+    const Vector3f baseline = cameras[1].CameraToHmd.Translation - cameras[0].CameraToHmd.Translation;
+    const float length = baseline.Length();
+    if (length < 1e-6f)
+        return false;
+
+    // Common orientation: x along the baseline, z (backward) as close as possible to the
+    // average backward axis of both cameras.
+    const Vector3f xAxis = baseline / length;
+    const Vector3f back = cameras[0].CameraToHmd.Rotate(Vector3f(0, 0, 1)) + cameras[1].CameraToHmd.Rotate(Vector3f(0, 0, 1));
+    Vector3f zAxis = back - xAxis * back.Dot(xAxis);
+    zAxis.Normalize();
+    const Vector3f yAxis = zAxis.Cross(xAxis);
+    const Quatf rectToHmd(Matrix4f(xAxis.x, yAxis.x, zAxis.x,
+                                   xAxis.y, yAxis.y, zAxis.y,
+                                   xAxis.z, yAxis.z, zAxis.z));
+
+    out->Target = target;
+    out->Baseline = length;
+    for (int i = 0; i < 2; i++)
+    {
+        out->RectifiedToHmd[i] = Posef(rectToHmd, cameras[i].CameraToHmd.Translation);
+        const Quatf rectToCamera = cameras[i].CameraToHmd.Rotation.Inverted() * rectToHmd;
+        VSTUndistortDetail::BuildTable(cameras[i], target, rectToCamera, &out->Tables[i]);
+    }
+    return true;
+}
+
+
+namespace VSTUndistortDetail {
+
+inline void DecodeEntry(uint32_t e, uint32_t* x, uint32_t* y, uint32_t* fx, uint32_t* fy)
+{
+    const uint32_t mask = (1 << VSTRemapTable::FractionBits) - 1;
+    *x  = (e & 0xFFFF) >> VSTRemapTable::FractionBits;
+    *y  = (e >> 16) >> VSTRemapTable::FractionBits;
+    *fx = e & mask;
+    *fy = (e >> 16) & mask;
+}
+
+inline void RemapRowScalar(const uint8_t* src, uint32_t srcStride, uint32_t channels, const uint32_t* entries,
+                           uint32_t begin, uint32_t end, uint8_t fill, uint8_t* dst)
+{
+    const uint32_t one = 1 << VSTRemapTable::FractionBits;
+    for (uint32_t x = begin; x < end; x++)
+    {
+        uint8_t* d = dst + x * channels;
+        const uint32_t e = entries[x];
+        if (e == VSTRemapTable::InvalidEntry)
+        {
+            for (uint32_t c = 0; c < channels; c++)
+                d[c] = fill;
+            continue;
+        }
+        uint32_t sx, sy, fx, fy;
+        DecodeEntry(e, &sx, &sy, &fx, &fy);
+        const uint8_t* p0 = src + size_t(sy) * srcStride + sx * channels;
+        const uint8_t* p1 = p0 + srcStride;
+        const uint32_t w00 = (one - fx) * (one - fy), w01 = fx * (one - fy);
+        const uint32_t w10 = (one - fx) * fy,         w11 = fx * fy;
+        for (uint32_t c = 0; c < channels; c++)
+            d[c] = uint8_t((p0[c] * w00 + p0[c + channels] * w01 + p1[c] * w10 + p1[c + channels] * w11 + 128) >> 8);
+    }
+}
+
+#if PVR_SIMD_SSE2
+// 8 gray pixels per iteration. The 2x2 neighbourhoods are gathered with scalar loads;
+// weights and blending run in 16-bit lanes.
+inline uint32_t RemapRowGraySSE2(const uint8_t* src, uint32_t srcStride, const uint32_t* entries, uint32_t width,
+                                 uint8_t fill, uint8_t* dst)
+{
+    const __m128i one = _mm_set1_epi16(1 << VSTRemapTable::FractionBits);
+    const __m128i round = _mm_set1_epi16(128);
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        PVR_ALIGNAS(16) uint16_t p00[8], p01[8], p10[8], p11[8], fx[8], fy[8];
+        for (int i = 0; i < 8; i++)
+        {
+            const uint32_t e = entries[x + i];
+            if (e == VSTRemapTable::InvalidEntry)
+            {
+                p00[i] = p01[i] = p10[i] = p11[i] = fill;
+                fx[i] = fy[i] = 0;
+                continue;
+            }
+            uint32_t sx, sy, ex, ey;
+            DecodeEntry(e, &sx, &sy, &ex, &ey);
+            const uint8_t* p = src + size_t(sy) * srcStride + sx;
+            p00[i] = p[0];
+            p01[i] = p[1];
+            p10[i] = p[srcStride];
+            p11[i] = p[srcStride + 1];
+            fx[i] = uint16_t(ex);
+            fy[i] = uint16_t(ey);
+        }
+        const __m128i vfx = _mm_load_si128((const __m128i*)fx);
+        const __m128i vfy = _mm_load_si128((const __m128i*)fy);
+        const __m128i ifx = _mm_sub_epi16(one, vfx);
+        const __m128i ify = _mm_sub_epi16(one, vfy);
+        __m128i sum = _mm_mullo_epi16(_mm_load_si128((const __m128i*)p00), _mm_mullo_epi16(ifx, ify));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_load_si128((const __m128i*)p01), _mm_mullo_epi16(vfx, ify)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_load_si128((const __m128i*)p10), _mm_mullo_epi16(ifx, vfy)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_load_si128((const __m128i*)p11), _mm_mullo_epi16(vfx, vfy)));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 8);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(sum, sum));
+    }
+    return x;
+}
+
+// 2 RGBA pixels per iteration; each pixel's top and bottom pairs are one 8-byte load.
+inline uint32_t RemapRowRgbaSSE2(const uint8_t* src, uint32_t srcStride, const uint32_t* entries, uint32_t width,
+                                 uint8_t fill, uint8_t* dst)
+{
+    const uint32_t one = 1 << VSTRemapTable::FractionBits;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i fillPixel = _mm_set1_epi16(fill);
+    uint32_t x = 0;
+    for (; x + 2 <= width; x += 2)
+    {
+        __m128i result[2];
+        for (int i = 0; i < 2; i++)
+        {
+            const uint32_t e = entries[x + i];
+            if (e == VSTRemapTable::InvalidEntry)
+            {
+                result[i] = fillPixel;
+                continue;
+            }
+            uint32_t sx, sy, fx, fy;
+            DecodeEntry(e, &sx, &sy, &fx, &fy);
+            const uint8_t* p = src + size_t(sy) * srcStride + sx * 4;
+            const __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), zero);
+            const __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + srcStride)), zero);
+            const __m128i wTop = _mm_unpacklo_epi64(_mm_set1_epi16(short((one - fx) * (one - fy))), _mm_set1_epi16(short(fx * (one - fy))));
+            const __m128i wBottom = _mm_unpacklo_epi64(_mm_set1_epi16(short((one - fx) * fy)), _mm_set1_epi16(short(fx * fy)));
+            const __m128i sum = _mm_add_epi16(_mm_mullo_epi16(top, wTop), _mm_mullo_epi16(bottom, wBottom));
+            result[i] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum, _mm_srli_si128(sum, 8)), round), 8);
+        }
+        _mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packus_epi16(_mm_unpacklo_epi64(result[0], result[1]), zero));
+    }
+    return x;
+}
+#endif
+
+} // namespace VSTUndistortDetail
+
+
+//-------------------------------------------------------------------------------------
+// ***** RemapBilinear
+//
+// Applies a remap table to a gray (1), RGB (3) or RGBA (4 channels) image of
+// table.SourceWidth x table.SourceHeight, writing table.Width x table.Height pixels.
+// Destination pixels without a source are set to fill. Gray and RGBA use SSE2.
+
+inline void RemapBilinear(const uint8_t* src, uint32_t srcStride, uint32_t channels, const VSTRemapTable& table,
+                          uint8_t* dst, uint32_t dstStride, uint8_t fill = 0, bool multithreaded = true)
+{
+    PVR_MATH_ASSERT(channels == 1 || channels == 3 || channels == 4);
+    std::function<void(int, int)> body = [&](int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            const uint32_t* entries = &table.Entries[size_t(y) * table.Width];
+            uint8_t* out = dst + size_t(y) * dstStride;
+            uint32_t x = 0;
+#if PVR_SIMD_SSE2
+            if (channels == 1)
+                x = VSTUndistortDetail::RemapRowGraySSE2(src, srcStride, entries, table.Width, fill, out);
+            else if (channels == 4)
+                x = VSTUndistortDetail::RemapRowRgbaSSE2(src, srcStride, entries, table.Width, fill, out);
+#endif
+            VSTUndistortDetail::RemapRowScalar(src, srcStride, channels, entries, x, table.Width, fill, out);
+        }
+    };
+
+    if (multithreaded)
+        ParallelFor(int(table.Height), 16, body);
+    else
+        body(0, int(table.Height));
+}
+
+
+//-------------------------------------------------------------------------------------
+// ***** VSTRemapCache
+//
+// Builds remap tables once per headset and calibration. Entries are keyed by the HMD
+// serial number, the camera calibration and the requested zoom, so a recalibrated or
+// swapped headset gets new tables while repeated requests return the shared ones.
+//
+// Example usage:
+//     std::shared_ptr<const VSTStereoRectification> rect =
+//         VSTRemapCache::GetDefault().GetStereoRectification(session);
+//     if (rect)
+//         RemapBilinear(left, leftStride, 4, rect->Tables[0], out, outStride);
+
+class VSTRemapCache
+{
+public:
+    std::shared_ptr<const VSTRemapTable> GetUndistortTable(pvrSessionHandle session, uint32_t cameraIdx, float zoom = 1.0f)
+    {
+        VSTCameraModel camera;
+        std::string key;
+        if (!LoadCamera(session, cameraIdx, &camera, &key))
+            return std::shared_ptr<const VSTRemapTable>();
+        key += FormatZoom("undistort", zoom);
+
+        std::lock_guard<std::mutex> lock(Lock);
+        std::shared_ptr<const void>& entry = Entries[key];
+        if (!entry)
+        {
+            std::shared_ptr<VSTRemapTable> table = std::make_shared<VSTRemapTable>();
+            BuildUndistortTable(camera, PinholeCamera::FromModel(camera, zoom), table.get());
+            entry = table;
+        }
+        return std::static_pointer_cast<const VSTRemapTable>(entry);
+    }
+
+    // Rectification of cameras 0 and 1 into a pinhole camera derived from camera 0.
+    std::shared_ptr<const VSTStereoRectification> GetStereoRectification(pvrSessionHandle session, float zoom = 1.0f)
+    {
+        VSTCameraModel cameras[2];
+        std::string key, key1;
+        if (!LoadCamera(session, 0, &cameras[0], &key) || !LoadCamera(session, 1, &cameras[1], &key1))
+            return std::shared_ptr<const VSTStereoRectification>();
+        key += key1 + FormatZoom("stereo", zoom);
+
+        std::lock_guard<std::mutex> lock(Lock);
+        std::shared_ptr<const void>& entry = Entries[key];
+        if (!entry)
+        {
+            std::shared_ptr<VSTStereoRectification> rect = std::make_shared<VSTStereoRectification>();
+            if (!BuildStereoRectification(cameras, PinholeCamera::FromModel(cameras[0], zoom), rect.get()))
+            {
+                Entries.erase(key);
+                return std::shared_ptr<const VSTStereoRectification>();
+            }
+            entry = rect;
+        }
+        return std::static_pointer_cast<const VSTStereoRectification>(entry);
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        Entries.clear();
+    }
+
+    static VSTRemapCache& GetDefault()
+    {
+        static VSTRemapCache cache;
+        return cache;
+    }
+
+private:
+    static bool LoadCamera(pvrSessionHandle session, uint32_t cameraIdx, VSTCameraModel* camera, std::string* key)
+    {
+        pvrHmdInfo info;
+        if (pvr_getHmdInfo(session, &info) != pvr_success || camera->Load(session, cameraIdx) != pvr_success)
+            return false;
+
+        // FNV-1a over the calibration values.
+        const float values[] = { float(camera->Width), float(camera->Height), camera->Focal.x, camera->Focal.y,
+                                 camera->Center.x, camera->Center.y, camera->K[0], camera->K[1], camera->K[2], camera->K[3],
+                                 camera->CameraToHmd.Rotation.x, camera->CameraToHmd.Rotation.y,
+                                 camera->CameraToHmd.Rotation.z, camera->CameraToHmd.Rotation.w,
+                                 camera->CameraToHmd.Translation.x, camera->CameraToHmd.Translation.y,
+                                 camera->CameraToHmd.Translation.z };
+        const uint8_t* bytes = (const uint8_t*)values;
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(values); i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "%.*s/%u/%016llx|", int(sizeof(info.SerialNumber)), info.SerialNumber,
+                 cameraIdx, (unsigned long long)hash);
+        *key = buffer;
+        return true;
+    }
+
+    static std::string FormatZoom(const char* kind, float zoom)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%s/%.6g", kind, zoom);
+        return buffer;
+    }
+
+    std::mutex                                         Lock;
+    std::map<std::string, std::shared_ptr<const void>> Entries;
+};
+
+
+} // Namespace PVR
+
+#endif
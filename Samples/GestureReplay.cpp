@@ -0,0 +1,205 @@
+/************************************************************************************
+
+Filename    :   GestureReplay.cpp
+Content     :   Replays recorded hand skeletons through GestureRecognizer.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Usage: GestureReplay [recording] [--write recording]
+//
+// A recording is a file of GestureFrame records, written with fwrite while an app polls
+// the hand skeletons. The frames are run through SkeletonEvaluator and GestureRecognizer
+// twice, and the events are printed. The second pass must give the same events, since
+// Update() depends only on its inputs and the previous state. Without a recording a
+// synthetic one is used: an open hand that grabs, points, opens and turns palm up.
+// --write saves the synthetic recording, as a starting point for a new harness.
+
+#include "../PVR_Gestures.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace PVR;
+
+namespace {
+
+struct GestureFrame
+{
+    double          Time;
+    uint32_t        Valid[pvrHand_Count];
+    pvrPosef        HandToWorld[pvrHand_Count];
+    pvrSkeletalData Local[pvrHand_Count];       // Relative to the parent bones.
+};
+
+const char* GestureNames[Gesture_Count] = { "Pinch", "Grab", "Point", "PalmUp", "OpenPalm" };
+
+// Local poses of one palm-down hand with the fingers along -Z, the thumb on the inside,
+// and each joint of finger f bent toward the palm by curl[f] radians.
+void MakeHand(int hand, const float curl[GestureFeatures::FingerCount], pvrSkeletalData* out)
+{
+    static const float offsetX[GestureFeatures::FingerCount] = { -0.06f, -0.02f, 0.0f, 0.02f, 0.04f };
+    static const uint8_t first[GestureFeatures::FingerCount] =
+        { HandBone_Thumb0, HandBone_IndexFinger0, HandBone_MiddleFinger0, HandBone_RingFinger0, HandBone_PinkyFinger0 };
+    static const uint8_t last[GestureFeatures::FingerCount] =
+        { HandBone_Thumb3, HandBone_IndexFinger4, HandBone_MiddleFinger4, HandBone_RingFinger4, HandBone_PinkyFinger4 };
+    const float side = (hand == pvrHand_Left) ? -1.0f : 1.0f;
+
+    out->boneCount = HandBone_Count;
+    for (int b = 0; b < HandBone_Count; b++)
+        out->boneTransforms[b] = Posef::Identity();
+
+    for (int f = 0; f < GestureFeatures::FingerCount; f++)
+    {
+        out->boneTransforms[first[f]] = Posef(Quatf::Identity(), Vector3f(side * offsetX[f], 0.0f, -0.03f));
+        const Quatf bend(Vector3f(1.0f, 0.0f, 0.0f), -curl[f]);
+        for (int b = first[f] + 1; b <= last[f]; b++)
+            out->boneTransforms[b] = Posef(bend, Vector3f(0.0f, 0.0f, -0.03f));
+    }
+}
+
+std::vector<GestureFrame> MakeRecording()
+{
+    enum { Open, Grab, Point, Count };
+    static const float poses[Count][GestureFeatures::FingerCount] =
+    {
+        { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+        { 0.6f, 1.2f, 1.2f, 1.2f, 1.2f },
+        { 0.6f, 0.0f, 1.2f, 1.2f, 1.2f },
+    };
+    // Pose held from each time on; the last stretch turns the open hand palm up.
+    static const struct { double Time; int Pose; } script[] =
+        { { 0.0, Open }, { 0.5, Grab }, { 1.0, Point }, { 1.5, Open }, { 2.0, Open } };
+    const int scriptCount = int(sizeof(script) / sizeof(script[0]));
+    const double rate = 90.0, length = 3.0, blend = 0.1;
+
+    std::vector<GestureFrame> frames;
+    for (int i = 0; i < int(length * rate); i++)
+    {
+        GestureFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.Time = i / rate;
+
+        int s = 0;
+        while (s + 1 < scriptCount && script[s + 1].Time <= frame.Time)
+            s++;
+        const float* from = poses[script[PVRMath_Max(s - 1, 0)].Pose];
+        const float* to = poses[script[s].Pose];
+        const float t = float(PVRMath_Min((frame.Time - script[s].Time) / blend, 1.0));
+        float curl[GestureFeatures::FingerCount];
+        for (int f = 0; f < GestureFeatures::FingerCount; f++)
+            curl[f] = from[f] + (to[f] - from[f]) * t;
+
+        // Palm down (normal -Y), rolling to palm up over the last second.
+        const float roll = float(PVRMath_Max(frame.Time - 2.0, 0.0) * MATH_DOUBLE_PI);
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            frame.Valid[h] = 1;
+            const float side = (h == pvrHand_Left) ? -1.0f : 1.0f;
+            frame.HandToWorld[h] = Posef(Quatf(Vector3f(0.0f, 0.0f, 1.0f), side * roll), Vector3f(side * 0.2f, 1.2f, -0.3f));
+            MakeHand(h, curl, &frame.Local[h]);
+        }
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+bool ReadRecording(const char* path, std::vector<GestureFrame>* frames)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    GestureFrame frame;
+    while (fread(&frame, sizeof(frame), 1, file) == 1)
+        frames->push_back(frame);
+    fclose(file);
+    return true;
+}
+
+bool WriteRecording(const char* path, const std::vector<GestureFrame>& frames)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    const bool written = fwrite(frames.data(), sizeof(GestureFrame), frames.size(), file) == frames.size();
+    fclose(file);
+    return written;
+}
+
+std::vector<GestureEvent> Replay(const std::vector<GestureFrame>& frames, bool print)
+{
+    SkeletonEvaluator fk(SkeletonDesc::Hand());
+    GestureRecognizer gestures;
+    std::vector<GestureEvent> events;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        const GestureFrame& frame = frames[i];
+        SkeletalPoseSoA local, model, world;
+        bool valid[pvrHand_Count];
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            local.Load(h, frame.Local[h]);
+            valid[h] = frame.Valid[h] != 0;
+        }
+        fk.Evaluate(local, frame.HandToWorld, &model, &world);
+        gestures.Update(world, valid, frame.Time);
+
+        const std::vector<GestureEvent>& update = gestures.GetEvents();
+        for (size_t e = 0; e < update.size(); e++)
+        {
+            if (print)
+            {
+                printf("%8.3f s  %-5s  %-8s %s\n", update[e].Time, (update[e].Hand == pvrHand_Left) ? "left" : "right",
+                       GestureNames[update[e].Type], update[e].Active ? "start" : "end");
+            }
+            events.push_back(update[e]);
+        }
+    }
+    return events;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* input = nullptr;
+    const char* output = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--write") && i + 1 < argc)
+            output = argv[++i];
+        else
+            input = argv[i];
+    }
+
+    std::vector<GestureFrame> frames;
+    if (input)
+    {
+        if (!ReadRecording(input, &frames))
+        {
+            printf("Cannot read %s\n", input);
+            return 1;
+        }
+    }
+    else
+    {
+        frames = MakeRecording();
+    }
+    if (output && !WriteRecording(output, frames))
+    {
+        printf("Cannot write %s\n", output);
+        return 1;
+    }
+
+    printf("%u frames\n", unsigned(frames.size()));
+    const std::vector<GestureEvent> first = Replay(frames, true);
+    const std::vector<GestureEvent> second = Replay(frames, false);
+    bool same = first.size() == second.size();
+    for (size_t i = 0; same && i < first.size(); i++)
+    {
+        same = first[i].Type == second[i].Type && first[i].Hand == second[i].Hand &&
+               first[i].Active == second[i].Active && first[i].Time == second[i].Time;
+    }
+    printf("%u events, replay %s\n", unsigned(first.size()), same ? "identical" : "DIFFERS");
+    return same ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/************************************************************************************
+
+Filename    :   HapticMixerPulseCount.cpp
+Content     :   Counts the pulses HapticMixer sends for 50 overlapping effects.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Plays 50 random effects on both controllers over two seconds through a HapticMixer
+// driven at its update rate, and prints the pulses sent against the runtime calls of
+// resending each effect every 10 ms, together with the mean difference between the
+// mixed amplitude and the amplitude of the pulse actually playing, and how late each
+// effect starts: the time from its requested start until the pulse playing on its
+// controller is within Tolerance of the mixed amplitude.
+
+#include "../PVR_Haptics.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+struct PlayingPulse
+{
+    float  Amplitude;
+    double End;
+};
+
+struct Request
+{
+    int    Device;
+    double Start;
+    double Delay;       // Negative until the effect is playing.
+};
+
+} // namespace
+
+int main()
+{
+    const int EffectCount = 50;
+    const double Length = 2.0;
+    const double ResendInterval = 0.01;
+    const pvrTrackedDeviceType devices[2] = { pvrTrackedDevice_LeftController, pvrTrackedDevice_RightController };
+
+    srand(1);
+    HapticParams params;
+    HapticMixer mixer(params);
+    int perEffectCalls = 0;
+    std::vector<Request> requests;
+    for (int i = 0; i < EffectCount; i++)
+    {
+        const double start = Uniform(0.0, Length - 0.3);
+        const Request request = { i % 2, start, -1.0 };
+        requests.push_back(request);
+        HapticEnvelope envelope;
+        switch (i % 3)
+        {
+        case 0:  envelope = HapticEnvelope::Constant(float(Uniform(0.2, 1.0)), Uniform(0.02, 0.2)); break;
+        case 1:  envelope = HapticEnvelope::Ramp(1.0f, 0.0f, Uniform(0.05, 0.3)); break;
+        default: envelope = HapticEnvelope::ADSR(1.0f, 0.4f, 0.01, 0.03, Uniform(0.0, 0.1), 0.05); break;
+        }
+        mixer.Play(devices[i % 2], envelope, start);
+        perEffectCalls += int(envelope.GetDuration() / ResendInterval) + 1;
+    }
+
+    PlayingPulse playing[2] = { { 0.0f, 0.0 }, { 0.0f, 0.0 } };
+    double now = 0.0;
+    HapticPulseSink sink = [&](pvrTrackedDeviceType device, float amplitude, float duration) -> pvrResult
+    {
+        PlayingPulse& pulse = playing[(device == devices[0]) ? 0 : 1];
+        pulse.Amplitude = amplitude;
+        pulse.End = now + duration;
+        return pvr_success;
+    };
+
+    const double step = 1.0 / params.UpdateRate;
+    double errorSum = 0.0;
+    int errorSamples = 0;
+    for (int tick = 0; tick * step <= Length; tick++)
+    {
+        now = tick * step;
+        mixer.Update(now, sink);
+        float error[2];
+        for (int d = 0; d < 2; d++)
+        {
+            const float actual = (now < playing[d].End) ? playing[d].Amplitude : 0.0f;
+            error[d] = fabsf(actual - mixer.GetAmplitude(devices[d], now));
+            errorSum += error[d];
+            errorSamples++;
+        }
+        for (size_t r = 0; r < requests.size(); r++)
+        {
+            Request& request = requests[r];
+            if (request.Delay < 0.0 && request.Start <= now && error[request.Device] <= params.Tolerance)
+                request.Delay = now - request.Start;
+        }
+    }
+
+    double delaySum = 0.0, delayMax = 0.0;
+    int started = 0;
+    for (size_t r = 0; r < requests.size(); r++)
+    {
+        if (requests[r].Delay < 0.0)
+            continue;
+        delaySum += requests[r].Delay;
+        delayMax = PVRMath_Max(delayMax, requests[r].Delay);
+        started++;
+    }
+
+    printf("Effects:                 %d on 2 controllers over %.1f s\n", EffectCount, Length);
+    printf("Mixed pulses sent:       %u\n", mixer.GetSubmittedCount());
+    printf("Per-effect 10 ms resend: %d\n", perEffectCalls);
+    printf("Mean amplitude error:    %.3f (tolerance %.2f)\n", errorSum / errorSamples, params.Tolerance);
+    printf("Start delay:             %.1f ms mean, %.1f ms max over %d effects (update step %.1f ms)\n",
+           1000.0 * delaySum / PVRMath_Max(started, 1), 1000.0 * delayMax, started, 1000.0 * step);
+    return 0;
+}
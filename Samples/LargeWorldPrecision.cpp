@@ -0,0 +1,132 @@
+/************************************************************************************
+
+Filename    :   LargeWorldPrecision.cpp
+Content     :   Eye-space precision of CameraRelativeFrame far from the world origin.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Places the tracking space at increasing distances from the world origin, up to
+// 1000 km, and renders a scene of objects 0.5 to 50 m around a moving head. For every
+// eye and frame it builds float model-view matrices twice: from CameraRelativeFrame, and
+// from float world poses as an application without it would. It prints the largest and
+// mean eye-space error of points on the objects against the same transforms in double
+// precision, and the time per object of the batch conversion.
+
+#include "../PVR_Math.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const int   ObjectCount = 10000;
+const int   FrameCount = 90;
+const float Ipd = 0.064f;
+
+struct Scene
+{
+    Posed                 TrackingToWorld;
+    std::vector<Posed>    ObjectToWorld;
+    std::vector<Vector3f> Points;           // One point on each object, in object space.
+};
+
+Scene MakeScene(double distance)
+{
+    Scene scene;
+    const Vector3d direction = Vector3d(0.6, 0.0, -0.8);
+    scene.TrackingToWorld = Posed(Quatd(Vector3d(0.0, 1.0, 0.0), 0.7), direction * distance);
+    const Vector3d head = scene.TrackingToWorld.Transform(Vector3d(0.0, 1.7, 0.0));
+    for (int i = 0; i < ObjectCount; i++)
+    {
+        const Vector3f offset = GaussianVector(1.0f).Normalized() * Uniform(0.5f, 50.0f);
+        scene.ObjectToWorld.push_back(Posed(Quatd(Quatf::FromRotationVector(GaussianVector(1.0f))),
+                                            head + Vector3d(offset)));
+        scene.Points.push_back(GaussianVector(0.3f));
+    }
+    return scene;
+}
+
+// Head pose in tracking space at frame f: walking slowly and looking around.
+pvrPosef HeadPose(int f)
+{
+    const float t = f / 90.0f;
+    return Posef(Quatf(Vector3f(0.0f, 1.0f, 0.0f), 0.5f * sinf(t)) * Quatf(Vector3f(1.0f, 0.0f, 0.0f), 0.2f * t),
+                 Vector3f(0.3f * t, 1.7f + 0.02f * sinf(5.0f * t), -0.2f * t));
+}
+
+struct Errors
+{
+    double Max, Sum;
+    int    Count;
+
+    Errors() : Max(0.0), Sum(0.0), Count(0) { }
+
+    void Add(const Vector3f& measured, const Vector3d& truth)
+    {
+        const double error = (Vector3d(measured) - truth).Length();
+        Max = PVRMath_Max(Max, error);
+        Sum += error;
+        Count++;
+    }
+};
+
+void Run(double distance)
+{
+    const Scene scene = MakeScene(distance);
+    Errors relative, world;
+    std::vector<Matrix4f> models(ObjectCount);
+
+    for (int f = 0; f < FrameCount; f++)
+    {
+        // Eye poses as calcEyePoses returns them, in tracking space.
+        const pvrPosef head = HeadPose(f);
+        pvrPosef eyePoses[2];
+        for (int eye = 0; eye < 2; eye++)
+            eyePoses[eye] = Posef(head) * Posef(Quatf(), Vector3f((eye ? 0.5f : -0.5f) * Ipd, 0.0f, 0.0f));
+
+        const CameraRelativeFrame frame(scene.TrackingToWorld, head);
+        frame.ToRenderBatch(scene.ObjectToWorld.data(), ObjectCount, models.data());
+
+        for (int eye = 0; eye < 2; eye++)
+        {
+            const Posed eyeToWorld = scene.TrackingToWorld * Posed(Posef(eyePoses[eye]));
+            const Matrix4f view = frame.GetViewMatrix(eyePoses[eye]);
+            const Matrix4f worldView(Posef(eyeToWorld).Inverted());
+            for (int i = 0; i < ObjectCount; i++)
+            {
+                const Vector3d truth =
+                    eyeToWorld.InverseTransform(scene.ObjectToWorld[i].Transform(Vector3d(scene.Points[i])));
+                relative.Add((view * models[i]).Transform(scene.Points[i]), truth);
+                const Matrix4f worldModel(Posef(scene.ObjectToWorld[i]));
+                world.Add((worldView * worldModel).Transform(scene.Points[i]), truth);
+            }
+        }
+    }
+
+    const CameraRelativeFrame frame(scene.TrackingToWorld, HeadPose(0));
+    const int repeats = 100;
+    const double start = Seconds();
+    for (int r = 0; r < repeats; r++)
+        frame.ToRenderBatch(scene.ObjectToWorld.data(), ObjectCount, models.data());
+    const double seconds = (Seconds() - start) / (repeats * ObjectCount);
+
+    printf("%9.0f km %10.4f mm %9.4f mm %10.3f mm %9.3f mm %8.1f ns\n", distance / 1000.0, 1000.0 * relative.Max,
+           1000.0 * relative.Sum / relative.Count, 1000.0 * world.Max, 1000.0 * world.Sum / world.Count, 1e9 * seconds);
+}
+
+} // namespace
+
+int main()
+{
+    srand(1);
+    printf("%d objects, %d frames, both eyes; eye-space errors\n", ObjectCount, FrameCount);
+    printf("%12s %13s %12s %13s %12s %11s\n", "Distance", "Relative max", "mean", "World max", "mean", "Batch");
+    static const double distances[] = { 0.0, 1e3, 1e4, 1e5, 1e6 };
+    for (size_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++)
+        Run(distances[d]);
+    return 0;
+}
@@ -0,0 +1,118 @@
+/************************************************************************************
+
+Filename    :   PoseFilterTuning.cpp
+Content     :   Jitter against lag of PoseFilter presets on a simulated tracker.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Simulates a 1 kHz tracker with 2 mm position and 3 mrad rotation noise: two seconds at
+// rest, then two seconds moving on a circle at 0.5 m/s while turning at 1 rad/s. For each
+// PoseFilter configuration it prints how much the sample to sample jitter at rest shrinks,
+// and the worst position and rotation error against the true pose while moving, which is
+// the lag the smoothing costs. Edit the configurations to tune presets.
+
+#include "../PVR_PoseFilter.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const double Rate = 1000.0;
+const double RestTime = 2.0;
+const double MoveTime = 2.0;
+const float  PositionNoise = 0.002f;
+const float  RotationNoise = 0.003f;
+const float  VelocityNoise = 0.02f;     // Of the reported velocities, m/s and rad/s.
+const float  Speed = 0.5f;
+const float  TurnRate = 1.0f;
+const float  Radius = 0.3f;
+
+struct Sample
+{
+    Posef         Truth;
+    pvrPoseStatef Measured;
+};
+
+std::vector<Sample> MakeTrack()
+{
+    srand(1);
+    std::vector<Sample> samples;
+    const int count = int((RestTime + MoveTime) * Rate);
+    const Vector3f center(0.0f, 1.0f, -0.5f);
+    for (int i = 0; i < count; i++)
+    {
+        const double time = i / Rate;
+        const float moving = float(PVRMath_Max(time - RestTime, 0.0));
+        const float angle = moving * Speed / Radius;
+        const bool isMoving = time >= RestTime;
+
+        Sample sample;
+        sample.Truth = Posef(Quatf(Vector3f(0.0f, 1.0f, 0.0f), moving * TurnRate),
+                             center + Vector3f(Radius * sinf(angle), 0.0f, Radius * (1.0f - cosf(angle))));
+        const Vector3f velocity = isMoving ? Vector3f(cosf(angle), 0.0f, sinf(angle)) * Speed : Vector3f(0.0f, 0.0f, 0.0f);
+        const Vector3f angularVelocity(0.0f, isMoving ? TurnRate : 0.0f, 0.0f);
+
+        pvrPoseStatef& m = sample.Measured;
+        m = MeasuredPose(sample.Truth, time, PositionNoise, RotationNoise);
+        m.LinearVelocity = velocity + GaussianVector(VelocityNoise);
+        m.AngularVelocity = angularVelocity + GaussianVector(VelocityNoise);
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+void Run(const char* name, const PoseFilterParams& params, const std::vector<Sample>& samples)
+{
+    PoseFilter filter(params);
+    double rawJitter = 0.0, filteredJitter = 0.0;
+    float positionLag = 0.0f, rotationLag = 0.0f;
+    int restSteps = 0;
+    Posef previousRaw, previousFiltered;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        const Posef raw(samples[i].Measured.ThePose);
+        const Posef filtered(filter.Filter(samples[i].Measured).ThePose);
+        const double time = samples[i].Measured.TimeInSeconds;
+
+        // Jitter over the second half of the rest, once the filter has settled.
+        if (time >= 0.5 * RestTime && time < RestTime && i > 0)
+        {
+            rawJitter += (raw.Translation - previousRaw.Translation).LengthSq();
+            filteredJitter += (filtered.Translation - previousFiltered.Translation).LengthSq();
+            restSteps++;
+        }
+        // Lag after the first 0.2 s of motion, past the start transient.
+        if (time >= RestTime + 0.2)
+        {
+            positionLag = PVRMath_Max(positionLag, (filtered.Translation - samples[i].Truth.Translation).Length());
+            rotationLag = PVRMath_Max(rotationLag, filtered.Rotation.Angle(samples[i].Truth.Rotation));
+        }
+        previousRaw = raw;
+        previousFiltered = filtered;
+    }
+
+    printf("%-28s %10.0fx %11.1f mm %9.3f rad\n", name, sqrt(rawJitter / PVRMath_Max(filteredJitter, 1e-30)),
+           positionLag * 1000.0f, rotationLag);
+}
+
+} // namespace
+
+int main()
+{
+    const std::vector<Sample> samples = MakeTrack();
+
+    PoseFilterParams withoutVelocity = PoseFilterParams::Tracker();
+    withoutVelocity.UseReportedVelocity = false;
+
+    printf("%-28s %11s %14s %13s\n", "Configuration", "Jitter cut", "Position lag", "Rotation lag");
+    Run("Default", PoseFilterParams(), samples);
+    Run("Controller", PoseFilterParams::Controller(), samples);
+    Run("Tracker", PoseFilterParams::Tracker(), samples);
+    Run("Tracker, filtered speed", withoutVelocity, samples);
+    return 0;
+}
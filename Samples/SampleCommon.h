@@ -0,0 +1,73 @@
+/************************************************************************************
+
+Filename    :   SampleCommon.h
+Content     :   Noise, simulated tracking and timing shared by the samples.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+#ifndef PVR_SampleCommon_h
+#define PVR_SampleCommon_h
+
+// The samples run without a headset or runtime: they feed the SDK helpers simulated
+// data, seeded with srand() so that every run prints the same results.
+
+#include "../PVR_Math.h"
+#include "../PVR_Types.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+namespace PVRSamples {
+
+using namespace PVR;
+
+// Standard normal deviate, by Box-Muller.
+inline float Gaussian()
+{
+    const float u = (float(rand()) + 1.0f) / (float(RAND_MAX) + 2.0f);
+    const float v = (float(rand()) + 1.0f) / (float(RAND_MAX) + 2.0f);
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * MATH_FLOAT_PI * v);
+}
+
+inline Vector3f GaussianVector(float sigma)
+{
+    const float x = Gaussian();
+    const float y = Gaussian();
+    const float z = Gaussian();
+    return Vector3f(x, y, z) * sigma;
+}
+
+inline float Uniform(float from, float to)
+{
+    return from + (to - from) * (float(rand()) / float(RAND_MAX));
+}
+
+inline double Uniform(double from, double to)
+{
+    return from + (to - from) * (double(rand()) / double(RAND_MAX));
+}
+
+// Tracked pose state at time of a device whose true pose is truth, with Gaussian
+// position noise in meters and rotation noise in radians. Velocities and accelerations
+// are 0; set them for trackers that report them.
+inline pvrPoseStatef MeasuredPose(const Posef& truth, double time, float positionNoise, float rotationNoise)
+{
+    pvrPoseStatef state;
+    memset(&state, 0, sizeof(state));
+    const Quatf rotationError = Quatf::FromRotationVector(GaussianVector(rotationNoise));
+    const Vector3f positionError = GaussianVector(positionNoise);
+    state.ThePose = Posef(rotationError * truth.Rotation, truth.Translation + positionError);
+    state.TimeInSeconds = time;
+    state.StatusFlags = pvrStatus_OrientationTracked | pvrStatus_PositionTracked;
+    return state;
+}
+
+// Monotonic time in seconds, for timing the loops being measured.
+inline double Seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace PVRSamples
+
+#endif
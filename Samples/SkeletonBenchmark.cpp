@@ -0,0 +1,170 @@
+/************************************************************************************
+
+Filename    :   SkeletonBenchmark.cpp
+Content     :   Cost and accuracy of SkeletonEvaluator for two hands at 1 kHz.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Evaluates one second of 1 kHz skeletal updates for both hands: the hand skeleton with
+// its 31 bones, and a 32-bone chain, the deepest hierarchy pvrSkeletalData can hold.
+// Each update blends the WithController and WithoutController ranges with weights that
+// change every update, then computes model and world poses. It prints the time per
+// update with and without the blend and loading, the share of the 1 ms budget, and the
+// largest world-space error against composing Posef transforms bone by bone.
+
+#include "../PVR_Skeleton.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const int UpdateCount = 1000;           // One second at 1 kHz.
+const int Repeats = 20;
+
+struct Update
+{
+    pvrSkeletalData WithController[pvrHand_Count];
+    pvrSkeletalData WithoutController[pvrHand_Count];
+    float           Weight[pvrHand_Count];
+    pvrPosef        HandToWorld[pvrHand_Count];
+};
+
+// Bones rotated by up to about 0.3 rad and offset by a few centimeters, as in a hand.
+pvrSkeletalData RandomBones(uint32_t boneCount)
+{
+    pvrSkeletalData data;
+    data.boneCount = boneCount;
+    for (uint32_t b = 0; b < PVR_MAX_SKELETAL_BONE_COUNT; b++)
+    {
+        const Posef bone(Quatf::FromRotationVector(GaussianVector(0.3f)),
+                         Vector3f(Uniform(-0.01f, 0.01f), Uniform(-0.01f, 0.01f), -Uniform(0.02f, 0.04f)));
+        data.boneTransforms[b] = bone;
+    }
+    return data;
+}
+
+std::vector<Update> MakeUpdates(uint32_t boneCount)
+{
+    std::vector<Update> updates(UpdateCount);
+    for (int u = 0; u < UpdateCount; u++)
+    {
+        for (int h = 0; h < pvrHand_Count; h++)
+        {
+            updates[u].WithController[h] = RandomBones(boneCount);
+            updates[u].WithoutController[h] = RandomBones(boneCount);
+            updates[u].Weight[h] = Uniform(0.0f, 1.0f);
+            updates[u].HandToWorld[h] = Posef(Quatf::FromRotationVector(GaussianVector(1.0f)),
+                                              Vector3f(Uniform(-0.5f, 0.5f), Uniform(0.8f, 1.6f), Uniform(-0.5f, 0.5f)));
+        }
+    }
+    return updates;
+}
+
+// Same blend as SkeletonEvaluator::Blend, on Posef.
+Posef BlendPose(const Posef& a, const Posef& b, float s)
+{
+    const float d = a.Rotation.Dot(b.Rotation);
+    const float sb = (d < 0.0f) ? -s : s;
+    const Quatf q(a.Rotation.x * (1 - s) + b.Rotation.x * sb, a.Rotation.y * (1 - s) + b.Rotation.y * sb,
+                  a.Rotation.z * (1 - s) + b.Rotation.z * sb, a.Rotation.w * (1 - s) + b.Rotation.w * sb);
+    return Posef(q.Normalized(), a.Translation * (1 - s) + b.Translation * s);
+}
+
+// Largest position (meters) and rotation (radians) error of world against composing
+// the blended bones one at a time.
+void Compare(const SkeletonDesc& desc, const Update& update, const SkeletalPoseSoA& world,
+             float* positionError, float* rotationError)
+{
+    for (int h = 0; h < pvrHand_Count; h++)
+    {
+        Posef reference[PVR_MAX_SKELETAL_BONE_COUNT];
+        for (uint32_t b = 0; b < desc.BoneCount; b++)
+        {
+            const Posef local = BlendPose(update.WithController[h].boneTransforms[b],
+                                          update.WithoutController[h].boneTransforms[b], update.Weight[h]);
+            reference[b] = (desc.Parent[b] < 0) ? local : reference[desc.Parent[b]] * local;
+        }
+        for (uint32_t b = 0; b < desc.BoneCount; b++)
+        {
+            const Posef expected = Posef(update.HandToWorld[h]) * reference[b];
+            const Posef actual = world.GetPose(h, b);
+            *positionError = PVRMath_Max(*positionError, (actual.Translation - expected.Translation).Length());
+            *rotationError = PVRMath_Max(*rotationError,
+                                         (actual.Rotation * expected.Rotation.Inverted()).ToRotationVector().Length());
+        }
+    }
+}
+
+volatile float Sink;
+
+void Run(const char* name, const SkeletonDesc& desc)
+{
+    const std::vector<Update> updates = MakeUpdates(desc.BoneCount);
+    const SkeletonEvaluator fk(desc);
+    SkeletalPoseSoA model, world;
+
+    // Full update: load both ranges, blend, model and world poses.
+    double start = Seconds();
+    for (int r = 0; r < Repeats; r++)
+    {
+        for (int u = 0; u < UpdateCount; u++)
+        {
+            const Update& update = updates[u];
+            fk.Evaluate(update.WithController, update.WithoutController, update.Weight, update.HandToWorld, &model,
+                        &world);
+            Sink = world.Tx[desc.BoneCount - 1];
+        }
+    }
+    const double fullSeconds = (Seconds() - start) / (Repeats * UpdateCount);
+
+    // Evaluation alone, from bones already blended into SoA.
+    SkeletalPoseSoA local;
+    for (int h = 0; h < pvrHand_Count; h++)
+        local.Load(h, updates[0].WithController[h]);
+    start = Seconds();
+    for (int r = 0; r < Repeats; r++)
+    {
+        for (int u = 0; u < UpdateCount; u++)
+        {
+            fk.Evaluate(local, updates[u].HandToWorld, &model, &world);
+            Sink = world.Tx[desc.BoneCount - 1];
+        }
+    }
+    const double evaluateSeconds = (Seconds() - start) / (Repeats * UpdateCount);
+
+    float positionError = 0.0f, rotationError = 0.0f;
+    for (int u = 0; u < UpdateCount; u++)
+    {
+        fk.Evaluate(updates[u].WithController, updates[u].WithoutController, updates[u].Weight, updates[u].HandToWorld,
+                    &model, &world);
+        Compare(desc, updates[u], world, &positionError, &rotationError);
+    }
+
+    int levels = 0;
+    for (uint32_t b = 0; b < desc.BoneCount; b++)
+        levels = PVRMath_Max(levels, desc.GetDepth(b) + 1);
+    printf("%-20s %6d %8.2f us %8.2f us %7.2f%% %9.4f mm %9.2f urad\n", name, levels, 1e6 * evaluateSeconds,
+           1e6 * fullSeconds, 100.0 * fullSeconds * 1000.0, 1000.0 * positionError, 1e6 * rotationError);
+}
+
+} // namespace
+
+int main()
+{
+    srand(1);
+    printf("%-20s %6s %11s %11s %8s %12s %14s\n", "Skeleton", "Levels", "Evaluate", "Update", "Budget",
+           "Position", "Rotation");
+
+    Run("Hand, 2 x 31 bones", SkeletonDesc::Hand());
+
+    int8_t chain[PVR_MAX_SKELETAL_BONE_COUNT];
+    for (int b = 0; b < PVR_MAX_SKELETAL_BONE_COUNT; b++)
+        chain[b] = int8_t(b - 1);
+    Run("Chain, 2 x 32 bones", SkeletonDesc(chain, PVR_MAX_SKELETAL_BONE_COUNT));
+    return 0;
+}
@@ -0,0 +1,234 @@
+/************************************************************************************
+
+Filename    :   SkinningBenchmark.cpp
+Content     :   Dual quaternion against matrix palette skinning on a hand mesh.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Skins a tube mesh of about 8000 vertices wrapped around the bones of one hand, with up
+// to three influences per vertex near the joints, by SkinDualQuat and SkinLinear. For a
+// few poses it prints the time per mesh of both kernels and of their scalar paths, the
+// largest error of the vertices bound to a single bone against a double precision rigid
+// transform, and the smallest tube radius relative to the bind pose. Linear blending
+// shrinks the tube at bent and twisted joints; dual quaternions should keep it close to 1.
+
+#include "../PVR_Skinning.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const int   RingsPerBone = 20;
+const int   RingVertices = 16;
+const float FingerRadius = 0.008f;
+const float WristRadius = 0.025f;
+const int   Repeats = 200;
+
+struct Mesh
+{
+    std::vector<Vector3f>      Positions, Normals;
+    std::vector<SkinInfluence> Influences;
+    std::vector<float>         RingRadius;      // Bind radius of each ring.
+    Posef                      InverseBind[HandBone_Count];
+};
+
+// Bind pose of the hand: fingers spread along X and pointing down -Z.
+SkeletalPoseSoA BindPose()
+{
+    SkeletalPoseSoA local;
+    local.SetIdentity();
+    local.SetPose(0, HandBone_Wrist, Posef(Quatf(), Vector3f(0.0f, 0.0f, -0.05f)));
+    static const struct { int First, Count; float X; } fingers[] =
+    {
+        { HandBone_Thumb0,        4,  0.03f },
+        { HandBone_IndexFinger0,  5,  0.015f },
+        { HandBone_MiddleFinger0, 5,  0.0f },
+        { HandBone_RingFinger0,   5, -0.015f },
+        { HandBone_PinkyFinger0,  5, -0.03f },
+    };
+    for (size_t f = 0; f < sizeof(fingers) / sizeof(fingers[0]); f++)
+    {
+        local.SetPose(0, fingers[f].First, Posef(Quatf(), Vector3f(fingers[f].X, 0.0f, -0.01f)));
+        for (int b = 1; b < fingers[f].Count; b++)
+            local.SetPose(0, fingers[f].First + b, Posef(Quatf(), Vector3f(0.0f, 0.0f, -0.045f + 0.007f * b)));
+    }
+    return local;
+}
+
+// The only child of bone, or -1.
+int OnlyChild(const SkeletonDesc& desc, int bone)
+{
+    int child = -1;
+    for (uint32_t b = 0; b < desc.BoneCount; b++)
+    {
+        if (desc.Parent[b] != bone)
+            continue;
+        if (child >= 0)
+            return -1;
+        child = int(b);
+    }
+    return child;
+}
+
+// Rings along the segment of each bone from the wrist to the fingertips. Rings in the first
+// quarter blend with the parent, so the wrist with the root as a forearm would, and rings in
+// the last quarter with the only child.
+Mesh MakeMesh(const SkeletonDesc& desc, const SkeletalPoseSoA& local, const SkeletalPoseSoA& bindModel)
+{
+    Mesh mesh;
+    for (int b = 0; b < HandBone_Count; b++)
+        mesh.InverseBind[b] = bindModel.GetPose(0, b).Inverted();
+
+    for (int b = HandBone_Wrist; b < HandBone_Count; b++)
+    {
+        if (b >= HandBone_Aux_Thumb)
+            continue;
+        const int child = OnlyChild(desc, b);
+        const float tipLength = (b == HandBone_Wrist) ? 0.04f : 0.015f;
+        const float length = (child >= 0) ? local.GetPose(0, child).Translation.Length() : tipLength;
+        const float radius = (b == HandBone_Wrist) ? WristRadius : FingerRadius;
+        const int parent = desc.Parent[b];
+        const Posef bind = bindModel.GetPose(0, b);
+
+        for (int r = 0; r < RingsPerBone; r++)
+        {
+            const float f = (r + 0.5f) / RingsPerBone;
+            SkinInfluence inf;
+            memset(&inf, 0, sizeof(inf));
+            const float parentWeight = (parent >= 0) ? PVRMath_Max(0.0f, 0.5f - 2.0f * f) : 0.0f;
+            const float childWeight = (child >= 0) ? PVRMath_Max(0.0f, 2.0f * f - 1.5f) : 0.0f;
+            inf.Bone[0] = uint16_t(b);
+            inf.Weight[0] = 1.0f - parentWeight - childWeight;
+            inf.Bone[1] = uint16_t(PVRMath_Max(parent, 0));
+            inf.Weight[1] = parentWeight;
+            inf.Bone[2] = uint16_t(PVRMath_Max(child, 0));
+            inf.Weight[2] = childWeight;
+
+            for (int v = 0; v < RingVertices; v++)
+            {
+                const float a = 2.0f * MATH_FLOAT_PI * v / RingVertices;
+                const Vector3f normal(cosf(a), sinf(a), 0.0f);
+                mesh.Positions.push_back(bind.Transform(normal * radius + Vector3f(0.0f, 0.0f, -f * length)));
+                mesh.Normals.push_back(bind.Rotate(normal));
+                mesh.Influences.push_back(inf);
+            }
+            mesh.RingRadius.push_back(radius);
+        }
+    }
+    return mesh;
+}
+
+struct Result
+{
+    double Seconds, ScalarSeconds;
+    float  RigidError;      // Meters.
+    float  MinRadius;       // Relative to the bind pose.
+};
+
+template <typename PaletteType, typename Skin, typename SkinScalar>
+Result Measure(const Mesh& mesh, const SkeletalPoseSoA& model, Skin skin, SkinScalar skinScalar)
+{
+    Result result;
+    PaletteType palette[HandBone_Count];
+    BuildSkinningPalette(model, 0, mesh.InverseBind, HandBone_Count, palette);
+
+    const int count = int(mesh.Positions.size());
+    std::vector<Vector3f> positions(count), normals(count);
+    double start = Seconds();
+    for (int r = 0; r < Repeats; r++)
+        skin(palette, mesh.Influences.data(), mesh.Positions.data(), mesh.Normals.data(), count, positions.data(),
+             normals.data());
+    result.Seconds = (Seconds() - start) / Repeats;
+
+    std::vector<Vector3f> scalarPositions(count), scalarNormals(count);
+    start = Seconds();
+    for (int r = 0; r < Repeats; r++)
+    {
+        for (int i = 0; i < count; i++)
+            skinScalar(palette, mesh.Influences[i], mesh.Positions[i], &mesh.Normals[i], &scalarPositions[i],
+                       &scalarNormals[i]);
+    }
+    result.ScalarSeconds = (Seconds() - start) / Repeats;
+
+    result.RigidError = 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        const SkinInfluence& inf = mesh.Influences[i];
+        if (inf.Weight[0] != 1.0f)
+            continue;
+        const Posed rigid = Posed(model.GetPose(0, inf.Bone[0])) * Posed(mesh.InverseBind[inf.Bone[0]]);
+        const Vector3d expected = rigid.Transform(Vector3d(mesh.Positions[i]));
+        result.RigidError = PVRMath_Max(result.RigidError, float((Vector3d(positions[i]) - expected).Length()));
+    }
+
+    result.MinRadius = MATH_FLOAT_MAXVALUE;
+    for (size_t ring = 0; ring < mesh.RingRadius.size(); ring++)
+    {
+        const Vector3f* p = &positions[ring * RingVertices];
+        Vector3f center;
+        for (int v = 0; v < RingVertices; v++)
+            center += p[v] / float(RingVertices);
+        float radius = 0.0f;
+        for (int v = 0; v < RingVertices; v++)
+            radius += (p[v] - center).Length() / float(RingVertices);
+        result.MinRadius = PVRMath_Min(result.MinRadius, radius / mesh.RingRadius[ring]);
+    }
+    return result;
+}
+
+void Run(const char* name, const SkeletonEvaluator& fk, const SkeletalPoseSoA& bindLocal, const Mesh& mesh,
+         float bend, float twist)
+{
+    // Curl every finger joint past the first about X and twist the wrist about its axis.
+    SkeletalPoseSoA local = bindLocal;
+    for (int b = HandBone_Thumb0; b < HandBone_Aux_Thumb; b++)
+    {
+        if (b != HandBone_Thumb0 && b != HandBone_IndexFinger0 && b != HandBone_MiddleFinger0 &&
+            b != HandBone_RingFinger0 && b != HandBone_PinkyFinger0)
+            local.SetPose(0, b, Posef(Quatf(Vector3f(1.0f, 0.0f, 0.0f), bend), local.GetPose(0, b).Translation));
+    }
+    const Vector3f wrist = local.GetPose(0, HandBone_Wrist).Translation;
+    local.SetPose(0, HandBone_Wrist, Posef(Quatf(Vector3f(0.0f, 0.0f, 1.0f), twist), wrist));
+
+    SkeletalPoseSoA model;
+    fk.EvaluateModel(local, &model);
+
+    const Result dq = Measure<DualQuatf>(mesh, model, SkinDualQuat, SkinningDetail::SkinDualQuatScalar);
+    const Result linear = Measure<Matrix4f>(mesh, model, SkinLinear, SkinningDetail::SkinLinearScalar);
+    printf("%-18s %7.1f us %7.1f us %7.1f us %7.1f us %7.2f um %6.2f um %7.3f %7.3f\n", name, 1e6 * dq.Seconds,
+           1e6 * dq.ScalarSeconds, 1e6 * linear.Seconds, 1e6 * linear.ScalarSeconds, 1e6 * dq.RigidError,
+           1e6 * linear.RigidError, dq.MinRadius, linear.MinRadius);
+}
+
+} // namespace
+
+int main()
+{
+    const SkeletonDesc desc = SkeletonDesc::Hand();
+    const SkeletonEvaluator fk(desc);
+    const SkeletalPoseSoA bindLocal = BindPose();
+    SkeletalPoseSoA bindModel;
+    fk.EvaluateModel(bindLocal, &bindModel);
+    const Mesh mesh = MakeMesh(desc, bindLocal, bindModel);
+
+    printf("%d vertices, times per mesh; dual quaternion (DQ) against linear blend (LB)\n",
+           int(mesh.Positions.size()));
+    printf("%-18s %10s %10s %10s %10s %10s %9s %7s %7s\n", "Pose", "DQ", "DQ scalar", "LB", "LB scalar",
+           "DQ rigid", "LB rigid", "DQ min", "LB min");
+    static const struct { const char* Name; float Bend, Twist; } poses[] =
+    {
+        { "Bind",              0.0f, 0.0f },
+        { "Curl 45 deg",       0.25f * MATH_FLOAT_PI, 0.0f },
+        { "Curl 90 deg",       0.5f * MATH_FLOAT_PI, 0.0f },
+        { "Twist 90 deg",      0.0f, 0.5f * MATH_FLOAT_PI },
+        { "Twist 150 deg",     0.0f, 0.8333f * MATH_FLOAT_PI },
+    };
+    for (size_t p = 0; p < sizeof(poses) / sizeof(poses[0]); p++)
+        Run(poses[p].Name, fk, bindLocal, mesh, poses[p].Bend, poses[p].Twist);
+    return 0;
+}
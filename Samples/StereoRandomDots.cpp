@@ -0,0 +1,210 @@
+/************************************************************************************
+
+Filename    :   StereoRandomDots.cpp
+Content     :   Disparity error of VSTStereoMatcher on a random-dot stereo pair.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Renders a rectified 640 x 480 random-dot pair with known disparity: a background
+// plane slanting from 6 to 16 pixels across the image, so that most disparities are
+// fractional, and a square in front at 30 pixels. The right image has gain and offset
+// differences and noise. For each matcher configuration it prints the fraction of the
+// visible pixels given a disparity, their mean error and the fraction off by more than
+// one pixel, and the time per pair. Pixels hidden from the right camera are left out;
+// the left-right check should reject them, and the rejected fraction is printed too.
+
+#include "../PVR_VSTStereo.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const int   Width = 640;
+const int   Height = 480;
+const float BackgroundNear = 6.0f;      // Disparity at x = 0.
+const float BackgroundFar = 16.0f;      // Disparity at x = Width.
+const float SquareDisparity = 30.0f;
+const int   SquareX0 = 220, SquareX1 = 420, SquareY0 = 140, SquareY1 = 340;
+
+// Random dots about two pixels wide: a random grid at half resolution, bilinearly
+// interpolated so that fractional shifts resample smoothly.
+struct Texture
+{
+    std::vector<float> Cells;
+
+    Texture()
+    {
+        Cells.resize((Width / 2 + 2) * (Height / 2 + 2));
+        for (size_t i = 0; i < Cells.size(); i++)
+            Cells[i] = Uniform(0.0f, 255.0f);
+    }
+
+    float Sample(float x, float y) const
+    {
+        const float u = PVRMath_Min(PVRMath_Max(x * 0.5f, 0.0f), float(Width / 2));
+        const float v = PVRMath_Min(PVRMath_Max(y * 0.5f, 0.0f), float(Height / 2));
+        const int iu = int(u), iv = int(v);
+        const float fu = u - iu, fv = v - iv;
+        const int stride = Width / 2 + 2;
+        const float* c = &Cells[iv * stride + iu];
+        return (c[0] * (1 - fu) + c[1] * fu) * (1 - fv) + (c[stride] * (1 - fu) + c[stride + 1] * fu) * fv;
+    }
+};
+
+bool InSquare(float x, int y)
+{
+    return x >= SquareX0 && x < SquareX1 && y >= SquareY0 && y < SquareY1;
+}
+
+float BackgroundDisparity(float x)
+{
+    return BackgroundNear + (BackgroundFar - BackgroundNear) * x / Width;
+}
+
+struct Scene
+{
+    std::vector<uint8_t> Left, Right;
+    std::vector<float>   Disparity;     // Of the left image, level 0.
+    std::vector<uint8_t> Visible;       // Left pixels seen by the right camera.
+};
+
+uint8_t ToPixel(float value)
+{
+    return uint8_t(PVRMath_Min(PVRMath_Max(value + 0.5f, 0.0f), 255.0f));
+}
+
+Scene MakeScene()
+{
+    const Texture background, square;
+    Scene scene;
+    const size_t pixels = size_t(Width) * Height;
+    scene.Left.resize(pixels);
+    scene.Right.resize(pixels);
+    scene.Disparity.resize(pixels);
+    scene.Visible.resize(pixels);
+
+    // Background x seen at right image xr solves x - BackgroundDisparity(x) = xr.
+    const float slope = (BackgroundFar - BackgroundNear) / Width;
+    for (int y = 0; y < Height; y++)
+    {
+        for (int x = 0; x < Width; x++)
+        {
+            const size_t i = size_t(y) * Width + x;
+            const bool inSquare = InSquare(float(x), y);
+            const float d = inSquare ? SquareDisparity : BackgroundDisparity(float(x));
+            scene.Left[i] = ToPixel((inSquare ? square : background).Sample(float(x), float(y)) + Gaussian() * 2.0f);
+            scene.Disparity[i] = d;
+            // Hidden if it falls off the right image or behind the square.
+            const float xr = x - d;
+            scene.Visible[i] = (xr >= 0.0f) && (inSquare || !InSquare(xr + SquareDisparity, y));
+
+            const float xs = float(x) + SquareDisparity;
+            const float value = InSquare(xs, y) ? square.Sample(xs, float(y))
+                                                : background.Sample((float(x) + BackgroundNear) / (1.0f - slope), float(y));
+            scene.Right[i] = ToPixel(value * 0.9f + 12.0f + Gaussian() * 2.0f);
+        }
+    }
+    return scene;
+}
+
+void Run(const char* name, const VSTStereoParams& params, const Scene& scene)
+{
+    VSTStereoRectification rect;
+    rect.Target.Width = Width;
+    rect.Target.Height = Height;
+    rect.Target.Focal = Vector2f(500.0f, 500.0f);
+    rect.Target.Center = Vector2f(Width * 0.5f - 0.5f, Height * 0.5f - 0.5f);
+    rect.RectifiedToHmd[0] = rect.RectifiedToHmd[1] = Posef::Identity();
+    rect.Baseline = 0.064f;
+
+    VSTStereoMatcher matcher(params);
+    VSTDepthMap depth;
+    const int runs = 5;
+    const double start = Seconds();
+    for (int r = 0; r < runs; r++)
+    {
+        if (matcher.Compute(scene.Left.data(), Width, scene.Right.data(), Width, rect, &depth) != pvr_success)
+        {
+            printf("%-26s failed\n", name);
+            return;
+        }
+    }
+    const double seconds = (Seconds() - start) / runs;
+
+    // A pixel at the matching level covers scale x scale pixels of the pair; only those
+    // covering one surface, all visible or all hidden, are counted.
+    const int scale = 1 << params.Level;
+    int visible = 0, valid = 0, bad = 0, hidden = 0, rejected = 0;
+    double errorSum = 0.0;
+    for (uint32_t y = 0; y < depth.Height; y++)
+    {
+        for (uint32_t x = 0; x < depth.Width; x++)
+        {
+            const size_t corner = size_t(y * scale) * Width + x * scale;
+            bool same = true;
+            float truth = 0.0f;
+            for (int v = 0; v < scale; v++)
+            {
+                for (int u = 0; u < scale; u++)
+                {
+                    const size_t i = corner + size_t(v) * Width + u;
+                    same = same && scene.Visible[i] == scene.Visible[corner] &&
+                           InSquare(float(x * scale + u), y * scale + v) == InSquare(float(x * scale), y * scale);
+                    truth += scene.Disparity[i];
+                }
+            }
+            if (!same)
+                continue;
+            truth /= float(scale * scale * scale);
+
+            const float measured = depth.Disparity[size_t(y) * depth.Width + x];
+            if (!scene.Visible[corner])
+            {
+                hidden++;
+                rejected += (measured < 0.0f) ? 1 : 0;
+                continue;
+            }
+            visible++;
+            if (measured < 0.0f)
+                continue;
+            valid++;
+            const float error = fabsf(measured - truth);
+            errorSum += error;
+            bad += (error > 1.0f) ? 1 : 0;
+        }
+    }
+    printf("%-26s %7.1f%% %8.3f px %7.1f%% %8.1f%% %8.1f ms\n", name, 100.0 * valid / PVRMath_Max(visible, 1),
+           errorSum / PVRMath_Max(valid, 1), 100.0 * bad / PVRMath_Max(valid, 1), 100.0 * rejected / PVRMath_Max(hidden, 1),
+           1000.0 * seconds);
+}
+
+} // namespace
+
+int main()
+{
+    srand(1);
+    const Scene scene = MakeScene();
+
+    printf("%-26s %8s %11s %8s %9s %11s\n", "Configuration", "Valid", "Error", "> 1 px", "Rejected", "Time");
+    static const struct { const char* Name; VSTStereoMethod Method; int Level; int MaxDisparity; } configs[] =
+    {
+        { "Block matching, level 0", VSTStereo_BlockMatching, 0, 48 },
+        { "Semi-global, level 0",    VSTStereo_SemiGlobal,    0, 48 },
+        { "Block matching, level 1", VSTStereo_BlockMatching, 1, 32 },
+        { "Semi-global, level 1",    VSTStereo_SemiGlobal,    1, 32 },
+    };
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+    {
+        VSTStereoParams params;
+        params.Method = configs[c].Method;
+        params.Level = configs[c].Level;
+        params.MaxDisparity = configs[c].MaxDisparity;
+        Run(configs[c].Name, params, scene);
+    }
+    return 0;
+}
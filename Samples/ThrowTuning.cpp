@@ -0,0 +1,161 @@
+/************************************************************************************
+
+Filename    :   ThrowTuning.cpp
+Content     :   Accuracy and cost of ThrowEstimator parameters on simulated throws.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Simulates overhand throws tracked at 1 kHz with 1 mm position and 2 mrad rotation
+// noise. The hand accelerates, flicks the wrist and brakes hard right at the release,
+// which is when reported velocities are least reliable. For a few Window / FitOrder
+// combinations it prints the mean error of the released linear and angular velocity,
+// the fit residual and the time per estimate, next to the velocities reported by the
+// tracker at the release.
+
+#include "../PVR_ThrowEstimator.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const double Rate = 1000.0;
+const double ThrowTime = 0.3;           // Seconds of motion before the release.
+const float  PositionNoise = 0.001f;
+const float  RotationNoise = 0.002f;
+const int    ThrowCount = 200;
+
+struct Throw
+{
+    std::vector<pvrPoseStatef> Samples;
+    Vector3f                   LinearVelocity;     // Of the object at the release.
+    Vector3f                   AngularVelocity;
+    Vector3f                   Offset;             // Object in controller space.
+};
+
+// Controller pose at time t of a throw whose release is at ThrowTime. The hand moves
+// forward (-Z) and up with a speed ramping to peak and braking in the last 20 ms; the
+// wrist pitches forward at an increasing rate.
+Posef ThrowPose(double t, float peak, float flick)
+{
+    const double brake = ThrowTime - 0.02;
+    const double tc = PVRMath_Min(t, brake);
+    // Speed peak * (tc / brake)^2, integrated; past brake the speed drops linearly to
+    // 60% of the peak at the release.
+    double distance = peak * tc * tc * tc / (3.0 * brake * brake);
+    if (t > brake)
+    {
+        const double dt = t - brake;
+        distance += peak * (dt - 0.4 * dt * dt / (2.0 * 0.02));
+    }
+    const double pitch = flick * t * t / (2.0 * ThrowTime);
+    return Posef(Quatf(Vector3f(1.0f, 0.0f, 0.0f), -float(pitch)),
+                 Vector3f(0.2f, 1.2f + float(0.3 * distance), -float(distance)));
+}
+
+Throw MakeThrow()
+{
+    Throw result;
+    const float peak = Uniform(4.0f, 10.0f);
+    const float flick = Uniform(10.0f, 25.0f);
+    result.Offset = Vector3f(0.0f, 0.0f, -Uniform(0.03f, 0.08f));
+
+    const int count = int(ThrowTime * Rate) + 1;
+    const double h = 1e-4;
+    for (int i = 0; i < count; i++)
+    {
+        const double t = i / Rate;
+        const Posef truth = ThrowPose(t, peak, flick);
+        const Posef before = ThrowPose(t - h, peak, flick);
+        const Vector3f linear = (truth.Translation - before.Translation) / float(h);
+        const Vector3f angular = (truth.Rotation * before.Rotation.Inverted()).ToRotationVector() / float(h);
+
+        pvrPoseStatef s = MeasuredPose(truth, t, PositionNoise, RotationNoise);
+        // The reported velocities lag and overshoot at the release; model them as the
+        // true ones 15 ms earlier plus noise.
+        const Posef earlier = ThrowPose(t - 0.015, peak, flick);
+        const Posef earlierBefore = ThrowPose(t - 0.015 - h, peak, flick);
+        s.LinearVelocity = (earlier.Translation - earlierBefore.Translation) / float(h) + GaussianVector(0.05f);
+        s.AngularVelocity = (earlier.Rotation * earlierBefore.Rotation.Inverted()).ToRotationVector() / float(h) +
+                            GaussianVector(0.2f);
+        result.Samples.push_back(s);
+
+        if (i == count - 1)
+        {
+            const Vector3f leverArm = truth.Rotation.Rotate(result.Offset);
+            result.LinearVelocity = linear + angular.Cross(leverArm);
+            result.AngularVelocity = angular;
+        }
+    }
+    return result;
+}
+
+void Run(const char* name, const ThrowParams& params, const std::vector<Throw>& throws)
+{
+    ThrowEstimator estimator(params);
+    double linearError = 0.0, angularError = 0.0, residual = 0.0;
+    int fitted = 0;
+    const double start = Seconds();
+    for (size_t i = 0; i < throws.size(); i++)
+    {
+        const Throw& t = throws[i];
+        ThrowEstimate estimate;
+        if (!estimator.Estimate(t.Samples.data(), int(t.Samples.size()), ThrowTime, t.Offset, &estimate))
+            continue;
+        linearError += (estimate.LinearVelocity - t.LinearVelocity).Length();
+        angularError += (estimate.AngularVelocity - t.AngularVelocity).Length();
+        residual += estimate.ResidualRms;
+        fitted += estimate.Fitted ? 1 : 0;
+    }
+    const double seconds = Seconds() - start;
+    const double n = double(throws.size());
+    printf("%-22s %8.2f m/s %8.2f rad/s %7.2f mm %7.2f us %5d\n", name, linearError / n, angularError / n,
+           1000.0 * residual / n, 1e6 * seconds / n, fitted);
+}
+
+} // namespace
+
+int main()
+{
+    srand(1);
+    std::vector<Throw> throws;
+    for (int i = 0; i < ThrowCount; i++)
+        throws.push_back(MakeThrow());
+
+    // Reported velocities at the release, for reference.
+    double linearError = 0.0, angularError = 0.0;
+    for (size_t i = 0; i < throws.size(); i++)
+    {
+        const pvrPoseStatef& last = throws[i].Samples.back();
+        const Vector3f leverArm = Quatf(last.ThePose.Orientation).Rotate(throws[i].Offset);
+        const Vector3f linear = Vector3f(last.LinearVelocity) + Vector3f(last.AngularVelocity).Cross(leverArm);
+        linearError += (linear - throws[i].LinearVelocity).Length();
+        angularError += (Vector3f(last.AngularVelocity) - throws[i].AngularVelocity).Length();
+    }
+
+    printf("%d throws; mean velocity errors at the release\n", ThrowCount);
+    printf("%-22s %12s %14s %10s %10s %5s\n", "Configuration", "Linear", "Angular", "Residual", "Time", "Fits");
+    printf("%-22s %8.2f m/s %8.2f rad/s\n", "Reported velocities", linearError / ThrowCount, angularError / ThrowCount);
+
+    static const struct { const char* Name; double Window; int FitOrder; } configs[] =
+    {
+        { "Linear, 40 ms", 0.04, 1 },
+        { "Linear, 80 ms", 0.08, 1 },
+        { "Quadratic, 40 ms", 0.04, 2 },
+        { "Quadratic, 80 ms", 0.08, 2 },
+        { "Quadratic, 120 ms", 0.12, 2 },
+    };
+    Run("Default", ThrowParams(), throws);
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+    {
+        ThrowParams params;
+        params.Window = configs[c].Window;
+        params.FitOrder = configs[c].FitOrder;
+        Run(configs[c].Name, params, throws);
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/************************************************************************************
+
+Filename    :   VSTConvertBenchmark.cpp
+Content     :   Cost of ConvertVSTFrame for a stereo camera stream at full rate.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Converts two seconds of a stereo 1280 x 1024 camera stream at 90 Hz, both cameras per
+// frame, for the NV12 and RAW8 conversions an application typically asks for. For each
+// it prints the mean and largest time to convert the pair of a frame, on one thread and
+// on WorkerPool::GetDefault(), and the share of one core the stream costs. Build with
+// -DPVR_SIMD_DISABLE to compare with the scalar paths, and with -mavx2 for the AVX2 ones.
+
+#include "../PVR_VSTConvert.h"
+#include "SampleCommon.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const uint32_t Width = 1280;
+const uint32_t Height = 1024;
+const uint32_t Stride = 1344;           // Rows padded as the runtime may return them.
+const double   Rate = 90.0;
+const int      FrameCount = 180;
+
+// NV12 or RAW8 buffer of one camera with smooth content and sensor noise.
+std::vector<uint8_t> MakeBuffer(pvrVSTStreamFormat format, float phase)
+{
+    const uint32_t rows = (format == pvrVST_FORMAT_NV12) ? Height * 3 / 2 : Height;
+    std::vector<uint8_t> buffer(size_t(Stride) * rows);
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        for (uint32_t x = 0; x < Width; x++)
+        {
+            const float value = 128.0f + 80.0f * sinf(x * 0.011f + phase) * cosf(y * 0.007f) + Gaussian() * 3.0f;
+            buffer[size_t(y) * Stride + x] = uint8_t(PVRMath_Min(PVRMath_Max(value, 0.0f), 255.0f));
+        }
+    }
+    return buffer;
+}
+
+struct Timing
+{
+    double Mean, Max;
+};
+
+Timing Measure(const pvrVSTStreamFrame frames[2], pvrVSTStreamFormat format, const VSTConvertParams& params,
+               const VSTImage images[2])
+{
+    Timing timing = { 0.0, 0.0 };
+    for (int f = 0; f < FrameCount; f++)
+    {
+        const double start = Seconds();
+        for (int camera = 0; camera < 2; camera++)
+        {
+            if (ConvertVSTFrame(frames[camera], format, params, images[camera]) != pvr_success)
+                printf("Conversion failed\n");
+        }
+        const double seconds = Seconds() - start;
+        timing.Mean += seconds / FrameCount;
+        timing.Max = PVRMath_Max(timing.Max, seconds);
+    }
+    return timing;
+}
+
+void Run(const char* name, pvrVSTStreamFormat format, VSTPixelFormat pixel, uint32_t downscale)
+{
+    std::vector<uint8_t> buffers[2];
+    pvrVSTStreamFrame frames[2];
+    for (int camera = 0; camera < 2; camera++)
+    {
+        buffers[camera] = MakeBuffer(format, camera * 0.3f);
+        frames[camera].frameIdx = 0;
+        frames[camera].exposureTime = 0.0;
+        frames[camera].width = Width;
+        frames[camera].height = Height;
+        frames[camera].stride = Stride;
+        frames[camera].buffer = buffers[camera].data();
+    }
+
+    VSTConvertParams params;
+    params.Format = pixel;
+    params.Downscale = downscale;
+    uint32_t width, height;
+    GetVSTConvertedSize(frames[0], params, &width, &height);
+    std::vector<uint8_t> outputs[2];
+    VSTImage images[2];
+    for (int camera = 0; camera < 2; camera++)
+    {
+        images[camera].Width = width;
+        images[camera].Height = height;
+        images[camera].Stride = width * GetVSTPixelSize(pixel);
+        outputs[camera].resize(size_t(images[camera].Stride) * height);
+        images[camera].Data = outputs[camera].data();
+    }
+
+    params.Multithreaded = false;
+    const Timing single = Measure(frames, format, params, images);
+    params.Multithreaded = true;
+    const Timing pool = Measure(frames, format, params, images);
+
+    printf("%-24s %9u x %-4u %6.2f ms %6.2f ms %6.2f ms %6.2f ms %6.1f%%\n", name, width, height, 1000.0 * single.Mean,
+           1000.0 * single.Max, 1000.0 * pool.Mean, 1000.0 * pool.Max, 100.0 * single.Mean * Rate);
+}
+
+} // namespace
+
+int main()
+{
+    srand(1);
+    printf("Stereo %u x %u at %.0f Hz, %d threads; times per stereo pair (budget %.1f ms)\n", Width, Height, Rate,
+           WorkerPool::GetDefault().GetThreadCount(), 1000.0 / Rate);
+    printf("%-24s %16s %9s %9s %9s %9s %7s\n", "Conversion", "Output", "1 thread", "max", "Pool", "max", "Core");
+
+    Run("NV12 to RGBA",          pvrVST_FORMAT_NV12, VSTPixel_RGBA8, 1);
+    Run("NV12 to RGB",           pvrVST_FORMAT_NV12, VSTPixel_RGB8,  1);
+    Run("NV12 to gray",          pvrVST_FORMAT_NV12, VSTPixel_Gray8, 1);
+    Run("NV12 to RGBA, 1/2",     pvrVST_FORMAT_NV12, VSTPixel_RGBA8, 2);
+    Run("NV12 to gray, 1/4",     pvrVST_FORMAT_NV12, VSTPixel_Gray8, 4);
+    Run("RAW8 to RGBA",          pvrVST_FORMAT_RAW8, VSTPixel_RGBA8, 1);
+    Run("RAW8 to RGBA, 1/2",     pvrVST_FORMAT_RAW8, VSTPixel_RGBA8, 2);
+    Run("RAW8 to gray, 1/4",     pvrVST_FORMAT_RAW8, VSTPixel_Gray8, 4);
+    return 0;
+}
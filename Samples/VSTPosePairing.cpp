@@ -0,0 +1,162 @@
+/************************************************************************************
+
+Filename    :   VSTPosePairing.cpp
+Content     :   Latency and accuracy of pairing VST frames with camera poses.
+
+Copyright   :   Copyright 2017 Pimax, Inc. All Rights reserved.
+************************************************************************************/
+
+// Feeds a PoseHistory with a head turning and nodding at up to 3 rad/s, tracked at
+// 1 kHz, and pairs stereo frames arriving at 90 Hz, 20 ms after their exposure, with
+// their camera poses through VSTFramePoseSync. It prints the time per pairing, median,
+// 99th percentile and largest, once with the history idle and once while another thread
+// adds samples at 1 kHz. It also prints the camera pose errors at the exposure time,
+// against the pose at the frame's arrival that a getTrackingState call would return.
+
+#include "../PVR_VSTFramePool.h"
+#include "../PVR_PoseHistory.h"
+#include "SampleCommon.h"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+using namespace PVR;
+using namespace PVRSamples;
+
+namespace {
+
+const double TrackerRate = 1000.0;
+const double FrameRate = 90.0;
+const double FrameLatency = 0.02;       // From exposure to the frame being available.
+const int    PairingCount = 20000;
+
+Posef HeadPose(double t)
+{
+    const float yaw = 0.8f * sinf(float(3.0 * t));
+    const float pitch = 0.3f * sinf(float(5.0 * t));
+    return Posef(Quatf(Vector3f(0.0f, 1.0f, 0.0f), yaw) * Quatf(Vector3f(1.0f, 0.0f, 0.0f), pitch),
+                 Vector3f(0.1f * sinf(float(2.0 * t)), 1.7f, 0.05f * sinf(float(3.0 * t))));
+}
+
+pvrPoseStatef TrackedState(double t)
+{
+    const double h = 1e-4;
+    const Posef pose = HeadPose(t);
+    const Posef before = HeadPose(t - h);
+    pvrPoseStatef state = MeasuredPose(pose, t, 0.0f, 0.0f);
+    state.LinearVelocity = (pose.Translation - before.Translation) / float(h);
+    state.AngularVelocity = (pose.Rotation * before.Rotation.Inverted()).ToRotationVector() / float(h);
+    return state;
+}
+
+struct Percentiles
+{
+    double Median, P99, Max;
+};
+
+Percentiles GetPercentiles(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    const Percentiles result = { values[values.size() / 2], values[values.size() * 99 / 100], values.back() };
+    return result;
+}
+
+// Pairs PairingCount frames with exposure times spread over the history, timing each call.
+std::vector<double> TimePairings(const VSTFramePoseSync& sync, const PoseHistory& history, double newest)
+{
+    std::vector<double> times;
+    times.reserve(PairingCount);
+    VSTFramePose pose;
+    for (int i = 0; i < PairingCount; i++)
+    {
+        const double exposure = newest - FrameLatency - Uniform(0.0, 0.5);
+        const double start = Seconds();
+        const bool paired = sync.GetPose(exposure, history, &pose);
+        times.push_back(Seconds() - start);
+        if (!paired)
+            printf("Pairing failed\n");
+    }
+    return times;
+}
+
+double PositionError(const Posef& pose, const Posef& truth)
+{
+    return (pose.Translation - truth.Translation).Length();
+}
+
+double RotationError(const Posef& pose, const Posef& truth)
+{
+    return (pose.Rotation * truth.Rotation.Inverted()).ToRotationVector().Length();
+}
+
+void Print(const char* name, const Percentiles& p)
+{
+    printf("%-34s %8.3f us %8.3f us %8.3f us\n", name, 1e6 * p.Median, 1e6 * p.P99, 1e6 * p.Max);
+}
+
+} // namespace
+
+int main()
+{
+    srand(1);
+    VSTFramePoseSync sync;
+    sync.SetCameraToHmd(0, Posef(Quatf(), Vector3f(-0.032f, 0.0f, -0.08f)));
+    sync.SetCameraToHmd(1, Posef(Quatf(), Vector3f(0.032f, 0.0f, -0.08f)));
+
+    // One second of tracking.
+    PoseHistory history(1024);
+    int sample = 0;
+    for (; sample < int(TrackerRate); sample++)
+        history.Add(TrackedState(sample / TrackerRate));
+    const double newest = (sample - 1) / TrackerRate;
+
+    printf("%-34s %11s %11s %11s\n", "Pairing time", "Median", "99%", "Max");
+    Print("Idle history", GetPercentiles(TimePairings(sync, history, newest)));
+
+    // A poller thread adding 1 kHz samples; exposure times stay within the second it keeps.
+    std::atomic<bool> exiting(false);
+    std::thread writer([&]()
+    {
+        int s = sample;
+        const double start = Seconds();
+        while (!exiting)
+        {
+            const double elapsed = Seconds() - start;
+            while (s < sample + int(elapsed * TrackerRate))
+            {
+                history.Add(TrackedState(s / TrackerRate));
+                s++;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    });
+    Print("While adding samples at 1 kHz", GetPercentiles(TimePairings(sync, history, newest)));
+    exiting = true;
+    writer.join();
+
+    // Camera pose errors for two seconds of 90 Hz frames, paired at exposure or taking the
+    // head pose at arrival.
+    PoseHistory replay(4096);
+    const double duration = 2.0;
+    for (int s = 0; s <= int(duration * TrackerRate); s++)
+        replay.Add(TrackedState(s / TrackerRate));
+    double pairedPosition = 0.0, pairedRotation = 0.0, arrivalPosition = 0.0, arrivalRotation = 0.0;
+    int frames = 0;
+    for (double exposure = 0.1; exposure + FrameLatency <= duration; exposure += 1.0 / FrameRate, frames++)
+    {
+        VSTFramePose paired, arrival;
+        sync.GetPose(exposure, replay, &paired);
+        sync.GetPose(exposure + FrameLatency, replay, &arrival);
+        const Posef truth = HeadPose(exposure) * Posef(Quatf(), Vector3f(-0.032f, 0.0f, -0.08f));
+        pairedPosition = PVRMath_Max(pairedPosition, PositionError(paired.CameraToWorld[0], truth));
+        pairedRotation = PVRMath_Max(pairedRotation, RotationError(paired.CameraToWorld[0], truth));
+        arrivalPosition = PVRMath_Max(arrivalPosition, PositionError(arrival.CameraToWorld[0], truth));
+        arrivalRotation = PVRMath_Max(arrivalRotation, RotationError(arrival.CameraToWorld[0], truth));
+    }
+    printf("\n%d frames; largest left camera pose error\n", frames);
+    printf("%-34s %8.4f mm %8.4f mrad\n", "Paired at exposure", 1000.0 * pairedPosition, 1000.0 * pairedRotation);
+    printf("%-34s %8.4f mm %8.4f mrad\n", "Head pose at arrival", 1000.0 * arrivalPosition, 1000.0 * arrivalRotation);
+    return 0;
+}